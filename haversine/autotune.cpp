@@ -0,0 +1,365 @@
+// NOTE(Lucas): --autotune. Picks the parser (tree, tape or stream) and the
+// distance precision for this machine by timing each combination with the
+// repetition tester's loop on a sample of the input, and keeps the fastest
+// one whose average is within the tolerance of the f64 tree's. The choice is
+// saved per CPU model, so later runs read it back instead of measuring
+// again, until --retune.
+//
+// The default tolerance is 0: bit for bit, which only the f64 variants can
+// meet. f32 gets considered once a relative error is allowed with
+// --tune-tolerance.
+
+#include <sys/utsname.h>
+#if __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+// NOTE(Lucas): Big enough to run past the caches, small enough that all six
+// variants are tuned in a couple of seconds.
+#define AUTOTUNE_SAMPLE_SIZE (8 * 1024 * 1024)
+#define AUTOTUNE_MAX_MILLISECONDS_PER_VARIANT 300
+
+struct autotune_variant {
+  const char *Name;
+  input_mode Mode;
+  bool UseF32;
+};
+
+static autotune_variant GlobalAutotuneVariants[] = {
+    {"tree", InputMode_Tree, false},   {"tape", InputMode_Tape, false},
+    {"stream", InputMode_Stream, false}, {"tree-f32", InputMode_Tree, true},
+    {"tape-f32", InputMode_Tape, true},  {"stream-f32", InputMode_Stream, true},
+};
+
+struct autotune_config {
+  char CPUModel[128];
+  f64 Tolerance;
+  u32 VariantIndex;
+};
+
+static void ReadCPUModel(char *Out, size_t OutSize) {
+  Out[0] = 0;
+
+#if __linux__
+  FILE *File = fopen("/proc/cpuinfo", "r");
+  if (File) {
+    char Line[256];
+    while (fgets(Line, sizeof(Line), File)) {
+      char *Value = strchr(Line, ':');
+      if (Value && strncmp(Line, "model name", 10) == 0) {
+        Value += 1 + strspn(Value + 1, " \t");
+        Value[strcspn(Value, "\n")] = 0;
+        snprintf(Out, OutSize, "%s", Value);
+        break;
+      }
+    }
+    fclose(File);
+  }
+#elif __APPLE__
+  size_t Size = OutSize;
+  if (sysctlbyname("machdep.cpu.brand_string", Out, &Size, NULL, 0) != 0) {
+    Out[0] = 0;
+  }
+#endif
+
+  // NOTE(Lucas): ARM linux has no model name, the architecture is better
+  // than nothing.
+  if (!Out[0]) {
+    struct utsname Name;
+    snprintf(Out, OutSize, "%s", (uname(&Name) == 0) ? Name.machine : "?");
+  }
+}
+
+// NOTE(Lucas): mkdir -p. Failures are left for the caller's open to report.
+static void MakeDirectories(char *Path) {
+  for (char *At = Path + 1; *At; ++At) {
+    if (*At == '/') {
+      *At = 0;
+      mkdir(Path, 0755);
+      *At = '/';
+    }
+  }
+  mkdir(Path, 0755);
+}
+
+// NOTE(Lucas): $XDG_CACHE_HOME/haversine or ~/.cache/haversine, one file per
+// CPU model so machines sharing a home directory don't overwrite each other.
+static bool MakeAutotuneConfigPath(char *Buffer, size_t BufferSize,
+                                   const char *CPUModel) {
+  const char *CacheHome = getenv("XDG_CACHE_HOME");
+  const char *Home = getenv("HOME");
+
+  char Directory[4096];
+  if (CacheHome && CacheHome[0]) {
+    snprintf(Directory, sizeof(Directory), "%s/haversine", CacheHome);
+  } else if (Home && Home[0]) {
+    snprintf(Directory, sizeof(Directory), "%s/.cache/haversine", Home);
+  } else {
+    return false;
+  }
+  MakeDirectories(Directory);
+
+  // NOTE(Lucas): FNV-1a of the model name.
+  u64 Hash = 0xcbf29ce484222325ull;
+  for (const char *At = CPUModel; *At; ++At) {
+    Hash = (Hash ^ (u8)*At) * 0x100000001b3ull;
+  }
+
+  return snprintf(Buffer, BufferSize, "%s/autotune_%016llx.txt", Directory,
+                  Hash) < (int)BufferSize;
+}
+
+// NOTE(Lucas): "cpu MODEL", "tolerance REL" and "variant NAME" lines, the
+// timings written after them are only there for people reading the file.
+static bool LoadAutotuneConfig(const char *Path, autotune_config *Config) {
+  FILE *File = fopen(Path, "r");
+  if (!File) {
+    return false;
+  }
+
+  bool HasCPU = false;
+  bool HasTolerance = false;
+  bool HasVariant = false;
+
+  char Line[256];
+  while (fgets(Line, sizeof(Line), File)) {
+    Line[strcspn(Line, "\n")] = 0;
+
+    if (strncmp(Line, "cpu ", 4) == 0) {
+      snprintf(Config->CPUModel, sizeof(Config->CPUModel), "%.*s",
+               (int)sizeof(Config->CPUModel) - 1, Line + 4);
+      HasCPU = true;
+    } else if (sscanf(Line, "tolerance %lf", &Config->Tolerance) == 1) {
+      HasTolerance = true;
+    } else if (strncmp(Line, "variant ", 8) == 0) {
+      for (u32 Index = 0; Index < ArrayCount(GlobalAutotuneVariants);
+           ++Index) {
+        if (strcmp(GlobalAutotuneVariants[Index].Name, Line + 8) == 0) {
+          Config->VariantIndex = Index;
+          HasVariant = true;
+        }
+      }
+    }
+  }
+
+  fclose(File);
+
+  return HasCPU && HasTolerance && HasVariant;
+}
+
+static bool SaveAutotuneConfig(const char *Path, autotune_config *Config,
+                               f64 *CyclesPerPair) {
+  char TemporaryPath[4096 + 8];
+  snprintf(TemporaryPath, sizeof(TemporaryPath), "%s.tmp", Path);
+
+  FILE *File = fopen(TemporaryPath, "w");
+  if (!File) {
+    return false;
+  }
+
+  fprintf(File, "cpu %s\ntolerance %.17g\nvariant %s\n", Config->CPUModel,
+          Config->Tolerance, GlobalAutotuneVariants[Config->VariantIndex].Name);
+  for (u32 Index = 0; Index < ArrayCount(GlobalAutotuneVariants); ++Index) {
+    if (CyclesPerPair[Index] > 0) {
+      fprintf(File, "# %s %.1f cycles/pair\n",
+              GlobalAutotuneVariants[Index].Name, CyclesPerPair[Index]);
+    }
+  }
+
+  // NOTE(Lucas): Renamed into place, so a run reading the config never sees
+  // half of one.
+  bool Result = (fclose(File) == 0) && rename(TemporaryPath, Path) == 0;
+  if (!Result) {
+    unlink(TemporaryPath);
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): The first AUTOTUNE_SAMPLE_SIZE bytes of InputPath, cut after
+// the last complete pair and closed again. Returns false if the input is
+// small enough to be its own sample.
+static bool WriteAutotuneSample(const char *InputPath, char *SamplePath,
+                                size_t SamplePathSize) {
+  memory_mapped_file File = OpenMemoryMappedFile(InputPath);
+  if (!File.IsValid) {
+    return false;
+  }
+
+  bool Result = false;
+
+  if (File.Contents.Size > AUTOTUNE_SAMPLE_SIZE) {
+    u8 *Data = File.Contents.Data;
+    u64 End = AUTOTUNE_SAMPLE_SIZE;
+    while (End > 0 && Data[End - 1] != '}') {
+      End--;
+    }
+
+    snprintf(SamplePath, SamplePathSize, "/tmp/haversine_autotune_XXXXXX");
+    int FileDescriptor = End ? mkstemp(SamplePath) : -1;
+
+    if (FileDescriptor != -1) {
+      const char Suffix[] = "\n]}\n";
+      Result = write(FileDescriptor, Data, End) == (ssize_t)End &&
+               write(FileDescriptor, Suffix, sizeof(Suffix) - 1) ==
+                   (ssize_t)(sizeof(Suffix) - 1);
+      close(FileDescriptor);
+
+      if (!Result) {
+        unlink(SamplePath);
+      }
+    }
+  }
+
+  CloseMemoryMappedFile(&File);
+
+  return Result;
+}
+
+static haversine_result RunAutotuneVariant(options *Options,
+                                           autotune_variant *Variant,
+                                           const char *SamplePath) {
+  options VariantOptions = *Options;
+  VariantOptions.Mode = Variant->Mode;
+
+  haversine_result Result = {};
+
+  if (Variant->UseF32) {
+    haversine_pairs_f32 Pairs = {};
+    if (LoadPairsF32(&VariantOptions, SamplePath, &Pairs)) {
+      Result = SumHaversineDistancesF32(&Pairs, Options->ThreadCount,
+                                        Options->IsCompensated);
+    }
+    FreePairsF32(&Pairs);
+  } else {
+    InitSummation(&Result.Summation, Options->IsCompensated);
+    Result.IsValid =
+        LoadPairs(&VariantOptions, SamplePath, AccumulatePair, &Result);
+    Result.Sum = SummationResult(&Result.Summation);
+  }
+
+  return Result;
+}
+
+static bool IsWithinTolerance(f64 Reference, f64 Average, f64 Tolerance) {
+  if (Tolerance == 0) {
+    return memcmp(&Reference, &Average, sizeof(f64)) == 0;
+  }
+  return fabs(Average - Reference) <= Tolerance * fabs(Reference);
+}
+
+// NOTE(Lucas): The tree with f64 distances is the reference every variant is
+// checked against, it is also timed like the others.
+static bool TuneVariants(options *Options, const char *SamplePath,
+                         autotune_config *Config, f64 *CyclesPerPair) {
+  haversine_result Reference =
+      RunAutotuneVariant(Options, GlobalAutotuneVariants, SamplePath);
+  if (!Reference.IsValid || !Reference.Count) {
+    return false;
+  }
+  f64 ReferenceAverage = Reference.Sum / (f64)Reference.Count;
+
+  bool HasWinner = false;
+  u64 SampleSize = 0;
+  {
+    struct stat Stat;
+    SampleSize = (stat(SamplePath, &Stat) == 0) ? (u64)Stat.st_size : 0;
+  }
+
+  for (u32 Index = 0; Index < ArrayCount(GlobalAutotuneVariants); ++Index) {
+    autotune_variant *Variant = GlobalAutotuneVariants + Index;
+
+    test_context *Context = (test_context *)calloc(1, sizeof(test_context));
+    Context->StopRule = StopRule_Converged;
+    Context->TargetTime = GlobalProfiler.CPUFrequency *
+                          AUTOTUNE_MAX_MILLISECONDS_PER_VARIANT / 1000;
+
+    haversine_result Result = {};
+    while (IsTesting(Context)) {
+      BeginTime(Context);
+      Result = RunAutotuneVariant(Options, Variant, SamplePath);
+      EndTime(Context);
+      CountBytes(Context, SampleSize);
+    }
+
+    u64 Cycles = Context->Results.Min.M[Metric_CPUTimer];
+    free(Context);
+
+    f64 Average = Result.Count ? Result.Sum / (f64)Result.Count : 0;
+    bool IsAccurate =
+        Result.IsValid && Result.Count == Reference.Count &&
+        IsWithinTolerance(ReferenceAverage, Average, Config->Tolerance);
+
+    CyclesPerPair[Index] = (f64)Cycles / (f64)Reference.Count;
+    printf("Autotune: %-10s %8.1f cycles/pair, %s\n", Variant->Name,
+           CyclesPerPair[Index],
+           IsAccurate ? "within tolerance" : "rejected, not accurate enough");
+
+    if (IsAccurate && (!HasWinner || CyclesPerPair[Index] <
+                                         CyclesPerPair[Config->VariantIndex])) {
+      Config->VariantIndex = Index;
+      HasWinner = true;
+    }
+  }
+
+  return HasWinner;
+}
+
+// NOTE(Lucas): Sets Options->Mode and Options->UseF32 from the saved config,
+// or from measuring when there is none (or it was made with another
+// tolerance, or ForceRetune). Leaves Options alone if neither works.
+static void Autotune(options *Options, f64 Tolerance, bool ForceRetune) {
+  if (IsGzipFile(Options->InputPath)) {
+    printf("Autotune: compressed input is always streamed, nothing to "
+           "tune\n");
+    return;
+  }
+
+  autotune_config Config = {.Tolerance = Tolerance};
+  ReadCPUModel(Config.CPUModel, sizeof(Config.CPUModel));
+
+  char ConfigPath[4096];
+  bool HasConfigPath =
+      MakeAutotuneConfigPath(ConfigPath, sizeof(ConfigPath), Config.CPUModel);
+
+  autotune_config Saved = {};
+  if (!ForceRetune && HasConfigPath &&
+      LoadAutotuneConfig(ConfigPath, &Saved) &&
+      strcmp(Saved.CPUModel, Config.CPUModel) == 0 &&
+      Saved.Tolerance == Tolerance) {
+    Config = Saved;
+    printf("Autotune: %s (from %s)\n",
+           GlobalAutotuneVariants[Config.VariantIndex].Name, ConfigPath);
+  } else {
+    char SamplePath[64];
+    bool HasSample =
+        WriteAutotuneSample(Options->InputPath, SamplePath, sizeof(SamplePath));
+
+    f64 CyclesPerPair[ArrayCount(GlobalAutotuneVariants)] = {};
+    bool IsTuned = TuneVariants(
+        Options, HasSample ? SamplePath : Options->InputPath, &Config,
+        CyclesPerPair);
+
+    if (HasSample) {
+      unlink(SamplePath);
+    }
+
+    if (!IsTuned) {
+      printf("Autotune: could not tune on %s, keeping the defaults\n",
+             Options->InputPath);
+      return;
+    }
+
+    printf("Autotune: picked %s for %s",
+           GlobalAutotuneVariants[Config.VariantIndex].Name, Config.CPUModel);
+    if (HasConfigPath && SaveAutotuneConfig(ConfigPath, &Config,
+                                            CyclesPerPair)) {
+      printf(", saved to %s\n", ConfigPath);
+    } else {
+      printf(", could not save it\n");
+    }
+  }
+
+  Options->Mode = GlobalAutotuneVariants[Config.VariantIndex].Mode;
+  Options->UseF32 = GlobalAutotuneVariants[Config.VariantIndex].UseF32;
+}
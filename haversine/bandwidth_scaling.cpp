@@ -0,0 +1,402 @@
+// NOTE(Lucas): Threaded versions of the repetition tests. They run on 1..N
+// threads, each on its own slice of the data, to find how many threads it
+// takes to saturate memory bandwidth, page faulting or the page cache.
+//
+// Every repetition the threads line up on a barrier so they start together.
+// A repetition lasts from the earliest start to the latest end. The
+// coordinating thread feeds that into a regular test_context, so the stop
+// rules are the same as for the single threaded tests.
+
+#define SCALING_MAX_THREADS 64
+#define SCALING_TARGET_SECONDS 2
+#define SCALING_PAGE_SIZE 4096
+
+enum scaling_test {
+  ScalingTest_Write,
+  // NOTE(Lucas): One byte per page, on fresh buffers that is all faulting.
+  // It counts pages rather than bytes and reports millions of pages per
+  // second, the bytes it skips over were never touched.
+  ScalingTest_TouchPages,
+  ScalingTest_Read,
+  ScalingTest_Fread,
+
+  ScalingTest_COUNT
+};
+
+enum scaling_buffer {
+  // NOTE(Lucas): Every thread maps its own slice each repetition and faults
+  // it in itself.
+  ScalingBuffer_Fresh,
+  // NOTE(Lucas): Slices of one buffer, faulted in before the first
+  // repetition.
+  ScalingBuffer_Shared,
+
+  ScalingBuffer_COUNT
+};
+
+struct thread_barrier {
+  pthread_mutex_t Mutex;
+  pthread_cond_t Released;
+  u32 ThreadCount;
+  u32 WaitingCount;
+  u64 Generation;
+};
+
+struct scaling_run {
+  thread_barrier Barrier;
+  scaling_test Test;
+  scaling_buffer BufferMode;
+  const char *Filepath;
+  buffer Shared;
+  bool IsQuitting;
+};
+
+struct scaling_worker {
+  pthread_t Thread;
+  scaling_run *Run;
+  int Core;
+  u64 Offset;
+  u64 Size;
+
+  // NOTE(Lucas): Written by the worker, read by the coordinator once the
+  // repetition's last barrier was passed.
+  u64 StartTime;
+  u64 EndTime;
+  // NOTE(Lucas): Bytes, or pages for ScalingTest_TouchPages.
+  u64 Count;
+};
+
+static void InitBarrier(thread_barrier *Barrier, u32 ThreadCount) {
+  pthread_mutex_init(&Barrier->Mutex, NULL);
+  pthread_cond_init(&Barrier->Released, NULL);
+  Barrier->ThreadCount = ThreadCount;
+  Barrier->WaitingCount = 0;
+  Barrier->Generation = 0;
+}
+
+static void DestroyBarrier(thread_barrier *Barrier) {
+  pthread_cond_destroy(&Barrier->Released);
+  pthread_mutex_destroy(&Barrier->Mutex);
+}
+
+// NOTE(Lucas): pthread_barrier_t does not exist on macos.
+static void WaitOnBarrier(thread_barrier *Barrier) {
+  pthread_mutex_lock(&Barrier->Mutex);
+
+  u64 Generation = Barrier->Generation;
+  if (++Barrier->WaitingCount == Barrier->ThreadCount) {
+    Barrier->WaitingCount = 0;
+    Barrier->Generation++;
+    pthread_cond_broadcast(&Barrier->Released);
+  } else {
+    while (Generation == Barrier->Generation) {
+      pthread_cond_wait(&Barrier->Released, &Barrier->Mutex);
+    }
+  }
+
+  pthread_mutex_unlock(&Barrier->Mutex);
+}
+
+// NOTE(Lucas): mmap instead of malloc, glibc raises its mmap threshold after
+// the first free and then hands out already faulted heap memory.
+static buffer MapFreshBuffer(u64 Size) {
+  buffer Result = {};
+
+  if (Size) {
+    void *Data = mmap(NULL, Size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Data != MAP_FAILED) {
+      Result.Data = (u8 *)Data;
+      Result.Size = Size;
+    }
+  }
+
+  return Result;
+}
+
+static void UnmapFreshBuffer(buffer *Buffer) {
+  if (Buffer->Data) {
+    munmap(Buffer->Data, Buffer->Size);
+  }
+  *Buffer = {};
+}
+
+static const char *DescribeScalingTest(scaling_test Test) {
+  switch (Test) {
+  case ScalingTest_Write:
+    return "WriteToAllBytes";
+  case ScalingTest_TouchPages:
+    return "TouchPages";
+  case ScalingTest_Read:
+    return "pread";
+  case ScalingTest_Fread:
+    return "fread";
+  default:
+    abort();
+    return "";
+  }
+}
+
+static u64 RunScalingSlice(scaling_run *Run, scaling_worker *Worker,
+                           buffer Buffer, int FileDescriptor, FILE *File) {
+  u64 Result = 0;
+
+  switch (Run->Test) {
+  case ScalingTest_Write: {
+    for (u64 Index = 0; Index < Buffer.Size; ++Index) {
+      Buffer.Data[Index] = (u8)Index;
+    }
+    Result = Buffer.Size;
+  } break;
+
+  case ScalingTest_TouchPages: {
+    for (u64 Index = 0; Index < Buffer.Size; Index += SCALING_PAGE_SIZE) {
+      Buffer.Data[Index] = (u8)Index;
+      ++Result;
+    }
+  } break;
+
+  case ScalingTest_Read: {
+    while (Result < Buffer.Size) {
+      ssize_t Count = pread(FileDescriptor, Buffer.Data + Result,
+                            Buffer.Size - Result, Worker->Offset + Result);
+      if (Count <= 0) {
+        break;
+      }
+      Result += Count;
+    }
+  } break;
+
+  case ScalingTest_Fread: {
+    if (File) {
+      Result = fread(Buffer.Data, sizeof(u8), Buffer.Size, File);
+    }
+  } break;
+
+  default:
+    abort();
+  }
+
+  return Result;
+}
+
+static void *ScalingWorkerThread(void *Data) {
+  scaling_worker *Worker = (scaling_worker *)Data;
+  scaling_run *Run = Worker->Run;
+
+  if (Worker->Core >= 0) {
+    PinCurrentThread(Worker->Core);
+  }
+
+  for (;;) {
+    WaitOnBarrier(&Run->Barrier);
+    if (Run->IsQuitting) {
+      break;
+    }
+
+    buffer Buffer = {Run->Shared.Data + Worker->Offset, Worker->Size};
+    if (Run->BufferMode == ScalingBuffer_Fresh) {
+      Buffer = MapFreshBuffer(Worker->Size);
+    }
+
+    int FileDescriptor = -1;
+    FILE *File = NULL;
+    if (Run->Test == ScalingTest_Read) {
+      FileDescriptor = open(Run->Filepath, O_RDONLY);
+    } else if (Run->Test == ScalingTest_Fread) {
+      File = fopen(Run->Filepath, "rb");
+      if (File && fseeko(File, Worker->Offset, SEEK_SET) != 0) {
+        fclose(File);
+        File = NULL;
+      }
+    }
+
+    WaitOnBarrier(&Run->Barrier);
+
+    Worker->StartTime = ReadCPUTimer();
+    Worker->Count =
+        RunScalingSlice(Run, Worker, Buffer, FileDescriptor, File);
+    Worker->EndTime = ReadCPUTimer();
+
+    if (FileDescriptor >= 0) {
+      close(FileDescriptor);
+    }
+    if (File) {
+      fclose(File);
+    }
+    if (Run->BufferMode == ScalingBuffer_Fresh) {
+      UnmapFreshBuffer(&Buffer);
+    }
+
+    WaitOnBarrier(&Run->Barrier);
+  }
+
+  return NULL;
+}
+
+struct scaling_result {
+  test_results Results;
+  // NOTE(Lucas): Per thread rate during the fastest repetition.
+  f64 ThreadRates[SCALING_MAX_THREADS];
+};
+
+static f64 GigabytesPerSecond(f64 ByteCount, f64 Seconds) {
+  return Seconds > 0 ? ByteCount / (1024.0 * 1024.0 * 1024.0 * Seconds) : 0;
+}
+
+// NOTE(Lucas): gb/s for the tests that move bytes, millions of pages per
+// second for TouchPages.
+static f64 ScalingRate(scaling_test Test, f64 Count, f64 Seconds) {
+  f64 Result = 0;
+
+  if (Test == ScalingTest_TouchPages) {
+    Result = Seconds > 0 ? Count / (1000000.0 * Seconds) : 0;
+  } else {
+    Result = GigabytesPerSecond(Count, Seconds);
+  }
+
+  return Result;
+}
+
+static const char *ScalingRateUnit(scaling_test Test) {
+  return (Test == ScalingTest_TouchPages) ? "mpages/s" : "gb/s";
+}
+
+static scaling_result RunScalingTest(scaling_run *Run, u32 ThreadCount,
+                                     u64 Size, int FirstCore,
+                                     stop_rule StopRule,
+                                     u64 CPUTimerFrequency) {
+  scaling_result Result = {};
+  scaling_worker Workers[SCALING_MAX_THREADS] = {};
+
+  // NOTE(Lucas): Page aligned slices, the last thread takes the remainder.
+  u64 SliceSize = (Size / ThreadCount) & ~(u64)(SCALING_PAGE_SIZE - 1);
+
+  Run->IsQuitting = false;
+  InitBarrier(&Run->Barrier, ThreadCount + 1);
+
+  int CoreCount = OnlineCoreCount();
+  for (u32 Index = 0; Index < ThreadCount; ++Index) {
+    scaling_worker *Worker = Workers + Index;
+    Worker->Run = Run;
+    Worker->Core = (FirstCore >= 0) ? (FirstCore + Index) % CoreCount : -1;
+    Worker->Offset = Index * SliceSize;
+    Worker->Size = (Index == ThreadCount - 1) ? Size - Worker->Offset
+                                               : SliceSize;
+    pthread_create(&Worker->Thread, NULL, ScalingWorkerThread, Worker);
+  }
+
+  static test_context Context;
+  Context = {};
+  Context.StopRule = StopRule;
+  Context.TargetTime = SCALING_TARGET_SECONDS * CPUTimerFrequency;
+
+  while (IsTesting(&Context)) {
+    WaitOnBarrier(&Run->Barrier);
+    u64 FaultsBefore = ReadOSPageFaultCount();
+    WaitOnBarrier(&Run->Barrier);
+    WaitOnBarrier(&Run->Barrier);
+    u64 FaultsAfter = ReadOSPageFaultCount();
+
+    u64 EarliestStart = ~0ull;
+    u64 LatestEnd = 0;
+    u64 Count = 0;
+    for (u32 Index = 0; Index < ThreadCount; ++Index) {
+      EarliestStart = Min(EarliestStart, Workers[Index].StartTime);
+      LatestEnd = Max(LatestEnd, Workers[Index].EndTime);
+      Count += Workers[Index].Count;
+    }
+
+    // NOTE(Lucas): For TouchPages Metric_ByteCount holds the page count, it
+    // only goes through ScalingRate.
+    test_metrics *Accum = &Context.AccumulatedOnThisTest;
+    Accum->M[Metric_CPUTimer] = LatestEnd - EarliestStart;
+    Accum->M[Metric_ByteCount] = Count;
+    Accum->M[Metric_MemPageFaults] = FaultsAfter - FaultsBefore;
+
+    if (Accum->M[Metric_CPUTimer] < Context.Results.Min.M[Metric_CPUTimer]) {
+      for (u32 Index = 0; Index < ThreadCount; ++Index) {
+        scaling_worker *Worker = Workers + Index;
+        f64 Seconds = (f64)(Worker->EndTime - Worker->StartTime) /
+                      (f64)CPUTimerFrequency;
+        Result.ThreadRates[Index] =
+            ScalingRate(Run->Test, (f64)Worker->Count, Seconds);
+      }
+    }
+  }
+
+  Run->IsQuitting = true;
+  WaitOnBarrier(&Run->Barrier);
+  for (u32 Index = 0; Index < ThreadCount; ++Index) {
+    pthread_join(Workers[Index].Thread, NULL);
+  }
+  DestroyBarrier(&Run->Barrier);
+
+  Result.Results = Context.Results;
+  return Result;
+}
+
+static f64 ScalingResultRate(scaling_test Test, scaling_result *Result,
+                             u64 CPUTimerFrequency) {
+  test_metrics Min = Result->Results.Min;
+  f64 Seconds = (f64)Min.M[Metric_CPUTimer] / (f64)CPUTimerFrequency;
+  return ScalingRate(Test, (f64)Min.M[Metric_ByteCount], Seconds);
+}
+
+static void PrintScalingResult(scaling_test Test, scaling_result *Result,
+                               u32 ThreadCount, f64 SingleThreadRate,
+                               u64 CPUTimerFrequency) {
+  test_metrics Min = Result->Results.Min;
+  f64 Seconds = (f64)Min.M[Metric_CPUTimer] / (f64)CPUTimerFrequency;
+  f64 Rate = ScalingResultRate(Test, Result, CPUTimerFrequency);
+  const char *Unit = ScalingRateUnit(Test);
+
+  printf("%2u threads: %fms %f%s (%.2fx) PF: %llu, per thread %s:",
+         ThreadCount, 1000.0 * Seconds, Rate, Unit,
+         SingleThreadRate > 0 ? Rate / SingleThreadRate : 0.0,
+         Min.M[Metric_MemPageFaults], Unit);
+  for (u32 Index = 0; Index < ThreadCount; ++Index) {
+    printf(" %.2f", Result->ThreadRates[Index]);
+  }
+  printf("\n");
+}
+
+static void RunScalingTests(const char *Filepath, buffer Shared,
+                            u32 MaxThreadCount, int FirstCore,
+                            stop_rule StopRule, u64 CPUTimerFrequency) {
+  MaxThreadCount = Min(MaxThreadCount, (u32)SCALING_MAX_THREADS);
+
+  // NOTE(Lucas): Faulted in once here, the shared mode never faults.
+  memset(Shared.Data, 0, Shared.Size);
+
+  scaling_run Run = {};
+  Run.Filepath = Filepath;
+  Run.Shared = Shared;
+
+  for (u32 Test = 0; Test < ScalingTest_COUNT; ++Test) {
+    for (u32 Mode = 0; Mode < ScalingBuffer_COUNT; ++Mode) {
+      Run.Test = (scaling_test)Test;
+      Run.BufferMode = (scaling_buffer)Mode;
+
+      printf("\n--- threaded %s, %s ---\n", DescribeScalingTest(Run.Test),
+             (Mode == ScalingBuffer_Fresh) ? "fresh buffer per thread"
+                                           : "shared pre-faulted buffer");
+
+      f64 SingleThreadRate = 0;
+      for (u32 ThreadCount = 1; ThreadCount <= MaxThreadCount;
+           ++ThreadCount) {
+        scaling_result Result =
+            RunScalingTest(&Run, ThreadCount, Shared.Size, FirstCore,
+                           StopRule, CPUTimerFrequency);
+
+        if (ThreadCount == 1) {
+          SingleThreadRate =
+              ScalingResultRate(Run.Test, &Result, CPUTimerFrequency);
+        }
+
+        PrintScalingResult(Run.Test, &Result, ThreadCount, SingleThreadRate,
+                           CPUTimerFrequency);
+      }
+    }
+  }
+}
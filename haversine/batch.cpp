@@ -0,0 +1,455 @@
+// NOTE(Lucas): --batch N. Sums every input file (directories are expanded to
+// the *.json and *.json.gz files in them) on N long lived worker processes,
+// instead of one ComputeHaversineAverage per file. The frequency estimate is
+// made once by the coordinator, and every worker keeps its read buffer and
+// its tape from one file to the next, so after its first few files a worker
+// doesn't allocate or fault in anything new.
+//
+// Files are handed out with work stealing: every worker starts with a
+// contiguous run of the file list and takes files from the front of it. A
+// worker that runs out takes the back half of the biggest run left, so a few
+// big files at the end of one run don't leave the others idle.
+//
+// Workers are processes like the shards, so the profiler stays single
+// threaded and their sections are merged into the coordinator's.
+
+#include <dirent.h>
+
+#define BATCH_MAX_WORKERS 256
+#define BATCH_MAX_SECTIONS 64
+
+struct batch_file {
+  // NOTE(Lucas): Filled in by the coordinator before the workers start.
+  const char *Path;
+  u64 ByteCount;
+
+  // NOTE(Lucas): Filled in by the worker that took the file.
+  bool IsValid;
+  u32 WorkerIndex;
+  u64 PairCount;
+  f64 Sum;
+  u64 Elapsed;
+};
+
+struct batch_worker {
+  // NOTE(Lucas): The files still to do, (Next << 32) | OnePastLast, so the
+  // owner and thieves can both claim files with a single compare and swap.
+  // Only the owner stores into an empty range.
+  u64 Range;
+
+  u64 FileCount;
+  u64 StolenCount;
+  u64 ByteCount;
+  u64 BusyElapsed;
+  u64 Elapsed;
+  // NOTE(Lucas): The worker's own, the coordinator's getrusage only covers
+  // the coordinator.
+  u64 PeakResidentBytes;
+  u32 SectionCount;
+  profiler_section Sections[BATCH_MAX_SECTIONS];
+};
+
+struct batch {
+  batch_file *Files;
+  u32 FileCount;
+  batch_worker *Workers;
+  u32 WorkerCount;
+  input_mode Mode;
+  bool IsCompensated;
+};
+
+static u64 PackBatchRange(u32 Next, u32 OnePastLast) {
+  return ((u64)Next << 32) | OnePastLast;
+}
+
+static bool TakeBatchFile(batch_worker *Worker, u32 *FileIndex) {
+  u64 Range = __atomic_load_n(&Worker->Range, __ATOMIC_ACQUIRE);
+
+  for (;;) {
+    u32 Next = (u32)(Range >> 32);
+    u32 OnePastLast = (u32)Range;
+    if (Next >= OnePastLast) {
+      return false;
+    }
+
+    if (__atomic_compare_exchange_n(&Worker->Range, &Range,
+                                    PackBatchRange(Next + 1, OnePastLast),
+                                    false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+      *FileIndex = Next;
+      return true;
+    }
+  }
+}
+
+// NOTE(Lucas): Takes the back half (rounded up, so a last file can be taken
+// too) of the biggest range left into the thief's own, empty one. Returns
+// false once no worker has anything left.
+static bool StealBatchFiles(batch *Batch, u32 ThiefIndex) {
+  for (;;) {
+    batch_worker *Victim = 0;
+    u64 VictimRange = 0;
+    u32 MostRemaining = 0;
+
+    for (u32 Index = 0; Index < Batch->WorkerCount; ++Index) {
+      u64 Range = __atomic_load_n(&Batch->Workers[Index].Range,
+                                  __ATOMIC_ACQUIRE);
+      u32 Next = (u32)(Range >> 32);
+      u32 OnePastLast = (u32)Range;
+
+      if (Index != ThiefIndex && Next < OnePastLast &&
+          OnePastLast - Next > MostRemaining) {
+        Victim = Batch->Workers + Index;
+        VictimRange = Range;
+        MostRemaining = OnePastLast - Next;
+      }
+    }
+
+    if (!Victim) {
+      return false;
+    }
+
+    u32 Next = (u32)(VictimRange >> 32);
+    u32 OnePastLast = (u32)VictimRange;
+    u32 Middle = OnePastLast - (MostRemaining + 1) / 2;
+
+    if (__atomic_compare_exchange_n(&Victim->Range, &VictimRange,
+                                    PackBatchRange(Next, Middle), false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      batch_worker *Thief = Batch->Workers + ThiefIndex;
+      __atomic_store_n(&Thief->Range, PackBatchRange(Middle, OnePastLast),
+                       __ATOMIC_RELEASE);
+      Thief->StolenCount += OnePastLast - Middle;
+      return true;
+    }
+  }
+}
+
+// NOTE(Lucas): Whole files go through the read buffer, with the tape unless
+// --stream. Tree mode parses with the tape too, a tree would have to be
+// allocated and freed node by node for every file.
+static void SumBatchFile(batch *Batch, batch_file *File, json_tape *Tape) {
+  haversine_result Result = {};
+  InitSummation(&Result.Summation, Batch->IsCompensated);
+
+  bool IsValid = false;
+
+  if (IsGzipFile(File->Path)) {
+    IsValid = StreamGzipPairs(File->Path, AccumulatePair, &Result);
+  } else {
+    buffer Contents = ReadEntireFileInto(&GlobalInputBuffer, File->Path);
+
+    if (Contents.Data) {
+      if (Batch->Mode == InputMode_Stream) {
+        pair_stream_decoder Decoder = {.Callback = AccumulatePair,
+                                       .UserData = &Result};
+        json_stream_parser Parser;
+        InitJSONStream(&Parser, DecodePairStreamEvent, &Decoder);
+
+        TimeBandwidth("FeedJSONStream", Contents.Size);
+        IsValid =
+            FeedJSONStream(&Parser, (char *)Contents.Data, Contents.Size) &&
+            FinishJSONStream(&Parser) && !Decoder.IsMissingField;
+      } else {
+        bool IsParsed;
+        {
+          TimeBandwidth("ParseJSON", Contents.Size);
+          IsParsed =
+              ParseJSONTapeInto(Tape, (char *)Contents.Data, Contents.Size);
+        }
+
+        json_tape_value PairsData =
+            IsParsed ? GetKey(JSONTapeRoot(Tape), STRING("pairs"))
+                     : json_tape_value{};
+        if (PairsData) {
+          ForEachPair(PairsData, AccumulatePair, &Result);
+          IsValid = true;
+        }
+      }
+    }
+  }
+
+  File->IsValid = IsValid;
+  File->PairCount = Result.Count;
+  File->Sum = SummationResult(&Result.Summation);
+}
+
+static void RunBatchWorker(batch *Batch, u32 WorkerIndex) {
+  ResetProfilerSections();
+
+  // NOTE(Lucas): The other workers keep the cores busy already.
+  GlobalInputBuffer.PrefaultThreadCount =
+      Min(GlobalInputBuffer.PrefaultThreadCount, 1);
+
+  batch_worker *Worker = Batch->Workers + WorkerIndex;
+
+  json_tape Tape = {};
+  u64 Start = ReadCPUTimer();
+
+  for (;;) {
+    u32 FileIndex;
+    if (!TakeBatchFile(Worker, &FileIndex)) {
+      if (StealBatchFiles(Batch, WorkerIndex)) {
+        continue;
+      }
+      break;
+    }
+
+    batch_file *File = Batch->Files + FileIndex;
+    File->WorkerIndex = WorkerIndex;
+
+    u64 FileStart = ReadCPUTimer();
+    SumBatchFile(Batch, File, &Tape);
+    File->Elapsed = ReadCPUTimer() - FileStart;
+
+    Worker->FileCount++;
+    Worker->ByteCount += File->ByteCount;
+    Worker->BusyElapsed += File->Elapsed;
+  }
+
+  Worker->Elapsed = ReadCPUTimer() - Start;
+  Worker->PeakResidentBytes = ReadOSPeakResidentBytes();
+  Worker->SectionCount =
+      CollectProfilerSections(Worker->Sections, BATCH_MAX_SECTIONS);
+}
+
+static bool IsBatchInputName(const char *Name) {
+  size_t Length = strlen(Name);
+  return (Length > 5 && strcmp(Name + Length - 5, ".json") == 0) ||
+         (Length > 8 && strcmp(Name + Length - 8, ".json.gz") == 0);
+}
+
+static int CompareBatchPaths(const void *A, const void *B) {
+  return strcmp(*(const char **)A, *(const char **)B);
+}
+
+// NOTE(Lucas): Files are taken as they are, directories are expanded one
+// level in name order. Returns the number of files, the paths are malloced.
+static u32 CollectBatchFiles(char **InputPaths, u32 InputCount,
+                             char ***OutPaths) {
+  u32 Count = 0;
+  u32 Capacity = 0;
+  char **Paths = 0;
+
+  for (u32 Input = 0; Input < InputCount; ++Input) {
+    const char *InputPath = InputPaths[Input];
+    u32 FirstOfInput = Count;
+
+    DIR *Directory = opendir(InputPath);
+    for (;;) {
+      const char *Name = InputPath;
+      if (Directory) {
+        struct dirent *Entry = readdir(Directory);
+        if (!Entry) {
+          break;
+        }
+        Name = Entry->d_name;
+        if (!IsBatchInputName(Name)) {
+          continue;
+        }
+      }
+
+      if (Count == Capacity) {
+        Capacity = Capacity ? 2 * Capacity : 64;
+        Paths = (char **)realloc(Paths, Capacity * sizeof(char *));
+      }
+
+      if (Directory) {
+        size_t Size = strlen(InputPath) + strlen(Name) + 2;
+        Paths[Count] = (char *)malloc(Size);
+        snprintf(Paths[Count], Size, "%s/%s", InputPath, Name);
+        Count++;
+      } else {
+        Paths[Count++] = strdup(Name);
+        break;
+      }
+    }
+
+    if (Directory) {
+      closedir(Directory);
+      qsort(Paths + FirstOfInput, Count - FirstOfInput, sizeof(char *),
+            CompareBatchPaths);
+    }
+  }
+
+  *OutPaths = Paths;
+  return Count;
+}
+
+// NOTE(Lucas): data_uniform_1000.json(.gz) -> data_uniform_1000.f64, the
+// answer the generator writes next to it.
+static bool MakeAnswerPath(char *Buffer, size_t BufferSize, const char *Path) {
+  size_t Length = strlen(Path);
+  if (Length > 3 && strcmp(Path + Length - 3, ".gz") == 0) {
+    Length -= 3;
+  }
+  if (Length <= 5 || strncmp(Path + Length - 5, ".json", 5) != 0) {
+    return false;
+  }
+
+  Length -= 5;
+  return snprintf(Buffer, BufferSize, "%.*s.f64", (int)Length, Path) <
+         (int)BufferSize;
+}
+
+// NOTE(Lucas): Every file is summed the same way a single file run sums it,
+// so files with an answer next to them are checked bit for bit.
+static bool ProcessBatch(char **InputPaths, u32 InputCount, u32 WorkerCount,
+                         input_mode Mode, bool IsCompensated) {
+  char **Paths;
+  u32 FileCount = CollectBatchFiles(InputPaths, InputCount, &Paths);
+  if (!FileCount) {
+    fprintf(stderr, "No input files found\n");
+    return false;
+  }
+
+  WorkerCount = Min(WorkerCount, FileCount);
+
+  size_t FilesSize = FileCount * sizeof(batch_file);
+  size_t WorkersSize = WorkerCount * sizeof(batch_worker);
+  batch Batch = {.FileCount = FileCount,
+                 .WorkerCount = WorkerCount,
+                 .Mode = Mode,
+                 .IsCompensated = IsCompensated};
+  Batch.Files = (batch_file *)MapSharedMemory(FilesSize);
+  Batch.Workers = (batch_worker *)MapSharedMemory(WorkersSize);
+
+  bool Result = Batch.Files && Batch.Workers;
+
+  if (Result) {
+    u64 TotalByteCount = 0;
+    for (u32 Index = 0; Index < FileCount; ++Index) {
+      struct stat Stat;
+      Batch.Files[Index].Path = Paths[Index];
+      Batch.Files[Index].ByteCount =
+          (stat(Paths[Index], &Stat) == 0) ? (u64)Stat.st_size : 0;
+      TotalByteCount += Batch.Files[Index].ByteCount;
+    }
+
+    for (u32 Index = 0; Index < WorkerCount; ++Index) {
+      Batch.Workers[Index].Range =
+          PackBatchRange((u32)((u64)FileCount * Index / WorkerCount),
+                         (u32)((u64)FileCount * (Index + 1) / WorkerCount));
+    }
+
+    pid_t Workers[BATCH_MAX_WORKERS];
+    u64 Start = ReadCPUTimer();
+
+    {
+      TimeBlock("RunBatch");
+
+      // NOTE(Lucas): Otherwise whatever is still buffered gets printed once
+      // more by every worker.
+      fflush(stdout);
+      fflush(stderr);
+
+      u32 StartedCount = 0;
+      for (; StartedCount < WorkerCount; ++StartedCount) {
+        pid_t Worker = fork();
+        if (Worker == 0) {
+          RunBatchWorker(&Batch, StartedCount);
+          _exit(0);
+        } else if (Worker < 0) {
+          fprintf(stderr, "Could not start batch worker %u: %s\n",
+                  StartedCount, strerror(errno));
+          Result = false;
+          break;
+        }
+        Workers[StartedCount] = Worker;
+      }
+
+      for (u32 Index = 0; Index < StartedCount; ++Index) {
+        int Status = 0;
+        if (waitpid(Workers[Index], &Status, 0) != Workers[Index] ||
+            !WIFEXITED(Status) || WEXITSTATUS(Status) != 0) {
+          fprintf(stderr, "Batch worker %u failed\n", Index);
+          Result = false;
+        } else {
+          MergeProfilerSections(Batch.Workers[Index].Sections,
+                                Batch.Workers[Index].SectionCount);
+        }
+      }
+    }
+
+    u64 Elapsed = ReadCPUTimer() - Start;
+    f64 Milliseconds = 1000.0 / (f64)GlobalProfiler.CPUFrequency;
+    f64 Megabyte = 1024.0 * 1024.0;
+    f64 Gigabyte = 1024.0 * Megabyte;
+
+    u64 PairCount = 0;
+    u32 FailedCount = 0;
+    u32 CheckedCount = 0;
+    u32 MismatchCount = 0;
+
+    for (u32 Index = 0; Index < FileCount; ++Index) {
+      batch_file *File = Batch.Files + Index;
+
+      if (!File->IsValid) {
+        printf("%s: FAILED\n", File->Path);
+        FailedCount++;
+        continue;
+      }
+
+      // NOTE(Lucas): '"pairs": []' is a valid input, like in a single file
+      // run it just has no average.
+      if (!File->PairCount) {
+        printf("%s: 0 pairs, %.3fms, worker %u\n", File->Path,
+               File->Elapsed * Milliseconds, File->WorkerIndex);
+        continue;
+      }
+
+      f64 Average = File->Sum / (f64)File->PairCount;
+      f64 Seconds = File->Elapsed * Milliseconds / 1000.0;
+      printf("%s: %llu pairs, average %f, %.3fms, %.2fgb/s, worker %u",
+             File->Path, File->PairCount, Average, File->Elapsed * Milliseconds,
+             (f64)File->ByteCount / Seconds / Gigabyte, File->WorkerIndex);
+
+      char AnswerPath[4096];
+      f64 Reference;
+      if (MakeAnswerPath(AnswerPath, sizeof(AnswerPath), File->Path) &&
+          ReadAnswer(AnswerPath, IsCompensated, &Reference)) {
+        bool IsExact = memcmp(&Reference, &Average, sizeof(f64)) == 0;
+        printf(IsExact ? ", exact" : ", MISMATCH");
+        CheckedCount++;
+        MismatchCount += !IsExact;
+      }
+      putchar('\n');
+
+      PairCount += File->PairCount;
+    }
+
+    f64 Seconds = Elapsed * Milliseconds / 1000.0;
+    printf("Batch: %u files (%u failed, %u checked, %u mismatched), %llu "
+           "pairs, %.3fmb in %.3fms: %.2fgb/s, %.0f pairs/s\n",
+           FileCount, FailedCount, CheckedCount, MismatchCount, PairCount,
+           TotalByteCount / Megabyte, Elapsed * Milliseconds,
+           (f64)TotalByteCount / Seconds / Gigabyte, (f64)PairCount / Seconds);
+
+    for (u32 Index = 0; Index < WorkerCount; ++Index) {
+      batch_worker *Worker = Batch.Workers + Index;
+      printf("Worker %u: %llu files (%llu stolen), %.3fmb, busy %.3fms of "
+             "%.3fms, peak RSS %.3fmb\n",
+             Index, Worker->FileCount, Worker->StolenCount,
+             Worker->ByteCount / Megabyte, Worker->BusyElapsed * Milliseconds,
+             Worker->Elapsed * Milliseconds,
+             Worker->PeakResidentBytes / Megabyte);
+    }
+    printf("Batch sections in the profile are summed over the %u workers.\n",
+           WorkerCount);
+
+    Result = Result && !FailedCount && !MismatchCount;
+  }
+
+  if (Batch.Files) {
+    munmap(Batch.Files, FilesSize);
+  }
+  if (Batch.Workers) {
+    munmap(Batch.Workers, WorkersSize);
+  }
+  for (u32 Index = 0; Index < FileCount; ++Index) {
+    free(Paths[Index]);
+  }
+  free(Paths);
+
+  return Result;
+}
@@ -7,7 +7,10 @@ mkdir -p build
 pushd build
 
 clang -std=c17 -O2 ../gen.c -o GenerateRandomHaversineData
-clang++ -g -O0 ../processor.cpp -o ComputeHaversineAverage
-clang++ -g -O2 ../repetition_tester.cpp -o Test
+clang++ -g -O2 -fno-math-errno -fno-omit-frame-pointer ../processor.cpp ../profiler_unit.cpp -o ComputeHaversineAverage -lz -pthread
+clang++ -g -O2 -fno-math-errno ../repetition_tester.cpp -o Test -lz -pthread
+clang++ -g -O2 ../load_generator.cpp -o HaversineLoadGenerator
+clang++ -g -O2 ../spatial_benchmark.cpp -o SpatialBenchmark -pthread
+clang++ -g -O2 ../pipeline_benchmark.cpp -o PipelineBenchmark
 
 popd
@@ -0,0 +1,137 @@
+// NOTE(Lucas): Puts the file or the destination buffer back into a cold state
+// between repetitions. Without it, every repetition after the first reads the
+// file from the page cache and writes into a buffer the CPU caches still hold.
+
+#if __x86_64__
+#include <immintrin.h>
+#endif
+
+enum cache_mode {
+  CacheMode_Warm = 0,
+  // NOTE(Lucas): The file's pages are dropped from the page cache, so the
+  // read goes to the disk.
+  CacheMode_ColdFile,
+  // NOTE(Lucas): The destination buffer is flushed out of the CPU caches, the
+  // file stays in the page cache.
+  CacheMode_ColdCPU,
+
+  CacheMode_COUNT
+};
+
+static const char *DescribeCacheMode(cache_mode Mode) {
+  switch (Mode) {
+  case CacheMode_Warm:
+    return "warm";
+  case CacheMode_ColdFile:
+    return "cold file";
+  case CacheMode_ColdCPU:
+    return "cold cpu caches";
+  default:
+    abort();
+    return "";
+  }
+}
+
+// NOTE(Lucas): Only clean pages can be dropped, files written by the
+// generator are flushed first.
+static bool EvictFileFromPageCache(const char *Filepath) {
+  bool Result = false;
+
+  int FileDescriptor = open(Filepath, O_RDONLY);
+  if (FileDescriptor >= 0) {
+#if __APPLE__
+    // NOTE(Lucas): No posix_fadvise on macos, invalidating a mapping of the
+    // whole file drops its pages from the unified buffer cache instead.
+    struct stat FileStats;
+    if (fstat(FileDescriptor, &FileStats) == 0 && FileStats.st_size > 0) {
+      void *Mapping = mmap(0, FileStats.st_size, PROT_READ, MAP_SHARED,
+                           FileDescriptor, 0);
+      if (Mapping != MAP_FAILED) {
+        Result = msync(Mapping, FileStats.st_size, MS_INVALIDATE) == 0;
+        munmap(Mapping, FileStats.st_size);
+      }
+    }
+#else
+    fdatasync(FileDescriptor);
+    Result = posix_fadvise(FileDescriptor, 0, 0, POSIX_FADV_DONTNEED) == 0;
+#endif
+    close(FileDescriptor);
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Fraction of the file's pages in the page cache, to check that
+// the eviction actually works on this file system.
+static f64 FileResidentFraction(const char *Filepath) {
+  f64 Result = -1.0;
+
+  int FileDescriptor = open(Filepath, O_RDONLY);
+  if (FileDescriptor >= 0) {
+    struct stat FileStats;
+    if (fstat(FileDescriptor, &FileStats) == 0 && FileStats.st_size > 0) {
+      size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+      size_t PageCount = (FileStats.st_size + PageSize - 1) / PageSize;
+
+      void *Mapping = mmap(0, FileStats.st_size, PROT_READ, MAP_SHARED,
+                           FileDescriptor, 0);
+#if __APPLE__
+      char *Residency = (char *)malloc(PageCount);
+#else
+      unsigned char *Residency = (unsigned char *)malloc(PageCount);
+#endif
+
+      if (Mapping != MAP_FAILED && Residency &&
+          mincore(Mapping, FileStats.st_size, Residency) == 0) {
+        size_t ResidentCount = 0;
+        for (size_t Page = 0; Page < PageCount; ++Page) {
+          ResidentCount += Residency[Page] & 1;
+        }
+        Result = (f64)ResidentCount / (f64)PageCount;
+      }
+
+      free(Residency);
+      if (Mapping != MAP_FAILED) {
+        munmap(Mapping, FileStats.st_size);
+      }
+    }
+    close(FileDescriptor);
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Writes back and invalidates every line of Buffer in all cache
+// levels. Touching a page that was never faulted in would fault it, so this
+// is only for buffers that are already resident.
+static void FlushFromCPUCaches(buffer Buffer) {
+  u8 *End = Buffer.Data + Buffer.Size;
+
+#if __aarch64__
+  u64 CacheType;
+  asm volatile("mrs %0, ctr_el0" : "=r"(CacheType));
+  // NOTE(Lucas): DminLine is log2 of the smallest data cache line in words.
+  u64 LineSize = 4ull << ((CacheType >> 16) & 0xf);
+
+  for (u8 *Line = Buffer.Data; Line < End; Line += LineSize) {
+    asm volatile("dc civac, %0" ::"r"(Line) : "memory");
+  }
+  asm volatile("dsb ish" ::: "memory");
+#elif __x86_64__
+  for (u8 *Line = Buffer.Data; Line < End; Line += 64) {
+    _mm_clflush(Line);
+  }
+  _mm_mfence();
+#else
+  // NOTE(Lucas): No flush instruction we know of, push the lines out by
+  // sweeping a buffer bigger than any last level cache instead.
+  static u8 *EvictionBuffer;
+  size_t EvictionSize = 256 * 1024 * 1024;
+  if (!EvictionBuffer) {
+    EvictionBuffer = (u8 *)calloc(EvictionSize, 1);
+  }
+  for (size_t Index = 0; Index < EvictionSize; Index += 64) {
+    EvictionBuffer[Index]++;
+  }
+#endif
+}
@@ -1,7 +1,11 @@
+#include <cstdint>
+
 typedef double f64;
+typedef float f32;
 typedef uint64_t u64;
 typedef uint32_t u32;
 typedef uint8_t u8;
+typedef int64_t s64;
 
 #define ArrayCount(A) (sizeof(A) / sizeof(A[0]))
 
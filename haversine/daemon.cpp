@@ -0,0 +1,432 @@
+// NOTE(Lucas): Resident server mode. The datasets are loaded once and kept in
+// memory as structure of arrays, then requests (see haversine_protocol.hpp)
+// are answered over a unix socket until a client asks for a shutdown.
+//
+// One thread serves every connection with poll(). Everything a client has
+// pipelined is read in one go, all complete requests in it are answered as a
+// batch and the responses go out in a single write. A client that keeps
+// sending without reading stops being read once its unsent responses pass
+// DAEMON_OUTPUT_HIGH_WATER, until they drain.
+
+#define DAEMON_MAX_CONNECTIONS 64
+#define DAEMON_READ_SIZE (256 * 1024)
+#define DAEMON_OUTPUT_HIGH_WATER (4 * 1024 * 1024)
+
+typedef bool load_dataset_fn(void *UserData, const char *Path,
+                             haversine_pairs *Pairs);
+
+struct resident_dataset {
+  const char *Path;
+  haversine_pairs Pairs;
+};
+
+struct byte_queue {
+  u8 *Data;
+  size_t Size;
+  size_t Capacity;
+  size_t Offset;
+};
+
+struct daemon_connection {
+  int FileDescriptor;
+  byte_queue Input;
+  byte_queue Output;
+};
+
+struct haversine_daemon {
+  resident_dataset *Datasets;
+  u32 DatasetCount;
+  load_dataset_fn *LoadDataset;
+  void *LoadUserData;
+
+  daemon_connection Connections[DAEMON_MAX_CONNECTIONS];
+  u32 ConnectionCount;
+
+  bool IsShuttingDown;
+
+  u64 RequestCount;
+  u64 BatchCount;
+};
+
+static u8 *ReserveBytes(byte_queue *Queue, size_t Size) {
+  if (Queue->Size + Size > Queue->Capacity) {
+    // NOTE(Lucas): Drop what was already consumed before growing.
+    if (Queue->Offset) {
+      memmove(Queue->Data, Queue->Data + Queue->Offset,
+              Queue->Size - Queue->Offset);
+      Queue->Size -= Queue->Offset;
+      Queue->Offset = 0;
+    }
+
+    while (Queue->Size + Size > Queue->Capacity) {
+      Queue->Capacity = Queue->Capacity ? 2 * Queue->Capacity : 64 * 1024;
+    }
+    Queue->Data = (u8 *)realloc(Queue->Data, Queue->Capacity);
+  }
+
+  return Queue->Data + Queue->Size;
+}
+
+static void AppendBytes(byte_queue *Queue, const void *Data, size_t Size) {
+  memcpy(ReserveBytes(Queue, Size), Data, Size);
+  Queue->Size += Size;
+}
+
+static size_t PendingBytes(byte_queue *Queue) {
+  return Queue->Size - Queue->Offset;
+}
+
+static void ConsumeBytes(byte_queue *Queue, size_t Size) {
+  Queue->Offset += Size;
+  if (Queue->Offset == Queue->Size) {
+    Queue->Offset = 0;
+    Queue->Size = 0;
+  }
+}
+
+static void FreeByteQueue(byte_queue *Queue) {
+  free(Queue->Data);
+  *Queue = {};
+}
+
+static void Respond(daemon_connection *Connection, request_header *Request,
+                    response_status Status, u64 Count, f64 Sum) {
+  response_header Response = {
+      .Status = Status, .Type = Request->Type, .Count = Count, .Sum = Sum};
+  AppendBytes(&Connection->Output, &Response, sizeof(Response));
+}
+
+static void HandleRangeSum(haversine_daemon *Daemon, daemon_connection *Connection,
+                           request_header *Request) {
+  TimeFunction;
+
+  if (Request->Dataset >= Daemon->DatasetCount) {
+    Respond(Connection, Request, Response_BadDataset, 0, 0);
+    return;
+  }
+
+  haversine_pairs *Pairs = &Daemon->Datasets[Request->Dataset].Pairs;
+
+  u64 First = Request->First;
+  u64 Count = Request->Count;
+  if (!Count && First <= Pairs->Count) {
+    Count = Pairs->Count - First;
+  }
+
+  if (First > Pairs->Count || Count > Pairs->Count - First) {
+    Respond(Connection, Request, Response_BadRange, 0, 0);
+    return;
+  }
+
+  summation Sum;
+  InitSummation(&Sum, false);
+  for (u64 Index = First; Index < First + Count; ++Index) {
+    AddToSummation(&Sum, ReferenceHaversine(Pairs->X0[Index], Pairs->Y0[Index],
+                                            Pairs->X1[Index], Pairs->Y1[Index],
+                                            EARTH_RADIUS));
+  }
+
+  Respond(Connection, Request, Response_OK, Count, SummationResult(&Sum));
+}
+
+static void HandleDistances(daemon_connection *Connection,
+                            request_header *Request, u8 *Payload) {
+  TimeFunction;
+
+  u64 Count = Request->Count;
+
+  // NOTE(Lucas): Reserve the response and its distances up front so the
+  // distances can be written in place.
+  size_t ResponseSize = sizeof(response_header) + Count * sizeof(f64);
+  u8 *Response = ReserveBytes(&Connection->Output, ResponseSize);
+  f64 *Distances = (f64 *)(Response + sizeof(response_header));
+
+  summation Sum;
+  InitSummation(&Sum, false);
+  for (u64 Index = 0; Index < Count; ++Index) {
+    request_pair Pair;
+    memcpy(&Pair, Payload + Index * sizeof(request_pair), sizeof(Pair));
+
+    f64 Distance =
+        ReferenceHaversine(Pair.X0, Pair.Y0, Pair.X1, Pair.Y1, EARTH_RADIUS);
+    memcpy(Distances + Index, &Distance, sizeof(f64));
+    AddToSummation(&Sum, Distance);
+  }
+
+  response_header Header = {.Status = Response_OK,
+                            .Type = Request->Type,
+                            .Count = Count,
+                            .Sum = SummationResult(&Sum)};
+  memcpy(Response, &Header, sizeof(Header));
+  Connection->Output.Size += ResponseSize;
+}
+
+static void HandleReload(haversine_daemon *Daemon, daemon_connection *Connection,
+                         request_header *Request) {
+  TimeFunction;
+
+  if (Request->Dataset >= Daemon->DatasetCount) {
+    Respond(Connection, Request, Response_BadDataset, 0, 0);
+    return;
+  }
+
+  resident_dataset *Dataset = &Daemon->Datasets[Request->Dataset];
+
+  // NOTE(Lucas): Keep serving the old data if the new load fails.
+  haversine_pairs Pairs = {};
+  if (Daemon->LoadDataset(Daemon->LoadUserData, Dataset->Path, &Pairs)) {
+    FreePairs(&Dataset->Pairs);
+    Dataset->Pairs = Pairs;
+    Respond(Connection, Request, Response_OK, Pairs.Count, 0);
+  } else {
+    FreePairs(&Pairs);
+    Respond(Connection, Request, Response_LoadFailed, 0, 0);
+  }
+}
+
+// NOTE(Lucas): Answers every complete request in the input queue. Returns
+// false if the connection has to be dropped after flushing its output.
+static bool HandleRequests(haversine_daemon *Daemon, daemon_connection *Connection) {
+  TimeFunction;
+  bool Result = true;
+
+  byte_queue *Input = &Connection->Input;
+
+  while (PendingBytes(Input) >= sizeof(request_header)) {
+    request_header Request;
+    memcpy(&Request, Input->Data + Input->Offset, sizeof(Request));
+
+    size_t PayloadSize = 0;
+    if (Request.Type == Request_Distances) {
+      if (Request.Count > HAVERSINE_MAX_DISTANCES_PER_REQUEST) {
+        // NOTE(Lucas): We can't skip a payload we refuse to buffer, so there
+        // is no way to find the next request.
+        Respond(Connection, &Request, Response_BadRequest, 0, 0);
+        Result = false;
+        break;
+      }
+      PayloadSize = Request.Count * sizeof(request_pair);
+    }
+
+    if (PendingBytes(Input) < sizeof(request_header) + PayloadSize) {
+      break;
+    }
+
+    u8 *Payload = Input->Data + Input->Offset + sizeof(request_header);
+
+    switch (Request.Type) {
+    case Request_RangeSum: {
+      HandleRangeSum(Daemon, Connection, &Request);
+    } break;
+    case Request_Distances: {
+      HandleDistances(Connection, &Request, Payload);
+    } break;
+    case Request_Info: {
+      if (Request.Dataset < Daemon->DatasetCount) {
+        Respond(Connection, &Request, Response_OK,
+                Daemon->Datasets[Request.Dataset].Pairs.Count, 0);
+      } else {
+        Respond(Connection, &Request, Response_BadDataset, 0, 0);
+      }
+    } break;
+    case Request_Reload: {
+      HandleReload(Daemon, Connection, &Request);
+    } break;
+    case Request_Shutdown: {
+      Respond(Connection, &Request, Response_OK, 0, 0);
+      Daemon->IsShuttingDown = true;
+    } break;
+    default: {
+      Respond(Connection, &Request, Response_BadRequest, 0, 0);
+    } break;
+    }
+
+    ConsumeBytes(Input, sizeof(request_header) + PayloadSize);
+    Daemon->RequestCount++;
+  }
+
+  Daemon->BatchCount++;
+
+  return Result;
+}
+
+// NOTE(Lucas): Returns false if the peer is gone.
+static bool FlushOutput(daemon_connection *Connection) {
+  byte_queue *Output = &Connection->Output;
+
+  while (PendingBytes(Output)) {
+    ssize_t Written = write(Connection->FileDescriptor,
+                            Output->Data + Output->Offset, PendingBytes(Output));
+    if (Written > 0) {
+      ConsumeBytes(Output, Written);
+    } else if (Written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void CloseConnection(haversine_daemon *Daemon, u32 Index) {
+  daemon_connection *Connection = Daemon->Connections + Index;
+
+  close(Connection->FileDescriptor);
+  FreeByteQueue(&Connection->Input);
+  FreeByteQueue(&Connection->Output);
+
+  *Connection = Daemon->Connections[--Daemon->ConnectionCount];
+  Daemon->Connections[Daemon->ConnectionCount] = {};
+}
+
+static int OpenListeningSocket(const char *SocketPath) {
+  struct sockaddr_un Address = {};
+  Address.sun_family = AF_UNIX;
+
+  if (strlen(SocketPath) >= sizeof(Address.sun_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", SocketPath);
+    return -1;
+  }
+  strcpy(Address.sun_path, SocketPath);
+
+  int FileDescriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FileDescriptor == -1) {
+    return -1;
+  }
+
+  // NOTE(Lucas): A previous run that crashed leaves the socket file behind.
+  unlink(SocketPath);
+
+  if (bind(FileDescriptor, (struct sockaddr *)&Address, sizeof(Address)) !=
+          0 ||
+      listen(FileDescriptor, DAEMON_MAX_CONNECTIONS) != 0) {
+    perror("bind/listen");
+    close(FileDescriptor);
+    return -1;
+  }
+
+  fcntl(FileDescriptor, F_SETFL, fcntl(FileDescriptor, F_GETFL) | O_NONBLOCK);
+
+  return FileDescriptor;
+}
+
+static bool RunDaemon(const char *SocketPath, resident_dataset *Datasets,
+                      u32 DatasetCount, load_dataset_fn *LoadDataset,
+                      void *LoadUserData) {
+  static haversine_daemon Daemon;
+  Daemon.Datasets = Datasets;
+  Daemon.DatasetCount = DatasetCount;
+  Daemon.LoadDataset = LoadDataset;
+  Daemon.LoadUserData = LoadUserData;
+
+  int ListenDescriptor = OpenListeningSocket(SocketPath);
+  if (ListenDescriptor == -1) {
+    return false;
+  }
+
+  // NOTE(Lucas): A client hanging up must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("Serving %u dataset(s) on %s\n", DatasetCount, SocketPath);
+  fflush(stdout);
+
+  struct pollfd PollDescriptors[DAEMON_MAX_CONNECTIONS + 1];
+
+  while (!Daemon.IsShuttingDown) {
+    PollDescriptors[0] = {.fd = ListenDescriptor, .events = POLLIN};
+    for (u32 Index = 0; Index < Daemon.ConnectionCount; ++Index) {
+      daemon_connection *Connection = Daemon.Connections + Index;
+      short Events = 0;
+      if (PendingBytes(&Connection->Output) < DAEMON_OUTPUT_HIGH_WATER) {
+        Events |= POLLIN;
+      }
+      if (PendingBytes(&Connection->Output)) {
+        Events |= POLLOUT;
+      }
+      PollDescriptors[Index + 1] = {.fd = Connection->FileDescriptor,
+                                    .events = Events};
+    }
+
+    if (poll(PollDescriptors, Daemon.ConnectionCount + 1, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    // NOTE(Lucas): Walk backwards, CloseConnection moves the last connection
+    // into the closed slot.
+    for (u32 Index = Daemon.ConnectionCount; Index > 0; --Index) {
+      daemon_connection *Connection = Daemon.Connections + Index - 1;
+      short Events = PollDescriptors[Index].revents;
+      bool KeepOpen = true;
+
+      // NOTE(Lucas): POLLHUP and POLLERR come even when POLLIN was not asked
+      // for, the flush below finds out about those.
+      bool IsReading =
+          PendingBytes(&Connection->Output) < DAEMON_OUTPUT_HIGH_WATER;
+      if (IsReading && (Events & (POLLIN | POLLHUP | POLLERR))) {
+        ssize_t ReadByteCount;
+        {
+          TimeBlock("ReadRequests");
+          u8 *Destination = ReserveBytes(&Connection->Input, DAEMON_READ_SIZE);
+          ReadByteCount =
+              read(Connection->FileDescriptor, Destination, DAEMON_READ_SIZE);
+        }
+
+        if (ReadByteCount > 0) {
+          Connection->Input.Size += ReadByteCount;
+          KeepOpen = HandleRequests(&Daemon, Connection);
+        } else if (ReadByteCount == 0 ||
+                   (errno != EAGAIN && errno != EINTR)) {
+          KeepOpen = false;
+        }
+      }
+
+      {
+        TimeBlock("WriteResponses");
+        if (!FlushOutput(Connection)) {
+          KeepOpen = false;
+        }
+      }
+
+      if (!KeepOpen) {
+        CloseConnection(&Daemon, Index - 1);
+      }
+    }
+
+    if (PollDescriptors[0].revents & POLLIN) {
+      int ClientDescriptor;
+      while ((ClientDescriptor = accept(ListenDescriptor, NULL, NULL)) >= 0) {
+        if (Daemon.ConnectionCount == DAEMON_MAX_CONNECTIONS) {
+          close(ClientDescriptor);
+          continue;
+        }
+
+        fcntl(ClientDescriptor, F_SETFL,
+              fcntl(ClientDescriptor, F_GETFL) | O_NONBLOCK);
+        Daemon.Connections[Daemon.ConnectionCount++] = {.FileDescriptor =
+                                                            ClientDescriptor};
+      }
+    }
+  }
+
+  // NOTE(Lucas): Best effort to get the last responses (the shutdown
+  // acknowledgement) out before closing.
+  while (Daemon.ConnectionCount) {
+    daemon_connection *Connection = Daemon.Connections;
+    fcntl(Connection->FileDescriptor, F_SETFL,
+          fcntl(Connection->FileDescriptor, F_GETFL) & ~O_NONBLOCK);
+    FlushOutput(Connection);
+    CloseConnection(&Daemon, 0);
+  }
+
+  close(ListenDescriptor);
+  unlink(SocketPath);
+
+  printf("Answered %llu requests in %llu batches\n", Daemon.RequestCount,
+         Daemon.BatchCount);
+
+  return true;
+}
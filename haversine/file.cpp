@@ -0,0 +1,268 @@
+struct buffer {
+  u8 *Data;
+  size_t Size;
+};
+
+struct memory_mapped_file {
+  buffer Contents;
+  bool IsValid;
+};
+
+buffer ReadEntireFile(const char *FileName) {
+  buffer Result = {0};
+
+  FILE *File = fopen(FileName, "rb");
+
+  if (File) {
+    fseek(File, 0, SEEK_END);
+    size_t Size = ftell(File);
+    fseek(File, 0, SEEK_SET);
+
+    TimeBandwidth(__func__, Size);
+    u8 *Data = (u8 *)ProfiledMalloc(Size + 1);
+    Data[Size] = 0;
+    fread(Data, sizeof(u8), Size, File);
+
+    Result.Size = Size;
+    Result.Data = Data;
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Destination for whole file reads that is kept between files.
+// The pages are faulted in up front, on several threads when the buffer is
+// big, so the read itself never faults. Once a buffer is big enough, later
+// (smaller) files reuse it without faulting at all.
+//
+// The prefault threads do not touch the profiler, they time themselves and
+// the totals are kept here for PrintReadBufferStats.
+
+#define READ_BUFFER_GRANULARITY (2 * 1024 * 1024)
+#define READ_BUFFER_PARALLEL_THRESHOLD (16 * 1024 * 1024)
+#define READ_BUFFER_MAX_THREADS 16
+
+struct read_buffer {
+  u8 *Data;
+  size_t Capacity;
+
+  // NOTE(Lucas): 0 leaves the faulting to the read, like ReadEntireFile.
+  u32 PrefaultThreadCount;
+
+  u64 FileCount;
+  u64 ReuseCount;
+  u64 PrefaultedByteCount;
+  u64 PrefaultPageFaultCount;
+  u64 PrefaultElapsed;
+  // NOTE(Lucas): Summed over the prefault threads, about what faulting on
+  // one thread would have cost.
+  u64 PrefaultThreadElapsed;
+  u32 MaxThreadsUsed;
+};
+
+struct prefault_slice {
+  pthread_t Thread;
+  u8 *Data;
+  size_t Size;
+  size_t PageSize;
+  u64 Elapsed;
+};
+
+static u32 DefaultPrefaultThreadCount() {
+  long CoreCount = sysconf(_SC_NPROCESSORS_ONLN);
+  return (u32)Min(Max(CoreCount, 1), READ_BUFFER_MAX_THREADS);
+}
+
+static void *PrefaultSliceThread(void *Data) {
+  prefault_slice *Slice = (prefault_slice *)Data;
+
+  u64 Start = ReadCPUTimer();
+  for (size_t Offset = 0; Offset < Slice->Size; Offset += Slice->PageSize) {
+    ((volatile u8 *)Slice->Data)[Offset] = 0;
+  }
+  Slice->Elapsed = ReadCPUTimer() - Start;
+
+  return NULL;
+}
+
+static void PrefaultReadBuffer(read_buffer *Buffer) {
+  TimeBandwidth(__func__, Buffer->Capacity);
+
+  size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+  u32 ThreadCount = Buffer->PrefaultThreadCount;
+  if (Buffer->Capacity < READ_BUFFER_PARALLEL_THRESHOLD) {
+    ThreadCount = 1;
+  }
+
+  // NOTE(Lucas): Page aligned slices, the last thread takes the remainder.
+  prefault_slice Slices[READ_BUFFER_MAX_THREADS] = {};
+  size_t SliceSize = (Buffer->Capacity / ThreadCount) & ~(PageSize - 1);
+
+  u64 FaultsBefore = ReadOSPageFaultCount();
+  u64 Start = ReadCPUTimer();
+
+  for (u32 Index = 0; Index < ThreadCount; ++Index) {
+    prefault_slice *Slice = Slices + Index;
+    Slice->Data = Buffer->Data + Index * SliceSize;
+    Slice->Size = (Index == ThreadCount - 1)
+                      ? Buffer->Capacity - Index * SliceSize
+                      : SliceSize;
+    Slice->PageSize = PageSize;
+
+    if (Index > 0) {
+      pthread_create(&Slice->Thread, NULL, PrefaultSliceThread, Slice);
+    }
+  }
+
+  // NOTE(Lucas): The calling thread takes the first slice itself.
+  PrefaultSliceThread(Slices);
+
+  for (u32 Index = 1; Index < ThreadCount; ++Index) {
+    pthread_join(Slices[Index].Thread, NULL);
+  }
+
+  Buffer->PrefaultElapsed += ReadCPUTimer() - Start;
+  Buffer->PrefaultPageFaultCount += ReadOSPageFaultCount() - FaultsBefore;
+  Buffer->PrefaultedByteCount += Buffer->Capacity;
+  Buffer->MaxThreadsUsed = Max(Buffer->MaxThreadsUsed, ThreadCount);
+  for (u32 Index = 0; Index < ThreadCount; ++Index) {
+    Buffer->PrefaultThreadElapsed += Slices[Index].Elapsed;
+  }
+}
+
+// NOTE(Lucas): Grows the buffer when Size does not fit. Anonymous memory
+// instead of malloc, so it is page aligned and can ask for huge pages.
+static bool ReserveReadBuffer(read_buffer *Buffer, size_t Size) {
+  if (Size <= Buffer->Capacity) {
+    Buffer->ReuseCount++;
+    return true;
+  }
+
+  if (Buffer->Data) {
+    munmap(Buffer->Data, Buffer->Capacity);
+    Buffer->Data = NULL;
+    Buffer->Capacity = 0;
+  }
+
+  size_t Capacity = (Size + READ_BUFFER_GRANULARITY - 1) &
+                    ~(size_t)(READ_BUFFER_GRANULARITY - 1);
+  void *Data = mmap(NULL, Capacity, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Data == MAP_FAILED) {
+    return false;
+  }
+
+#if defined(MADV_HUGEPAGE)
+  // NOTE(Lucas): Only a hint, with THP in madvise mode it cuts the fault count
+  // by 512.
+  madvise(Data, Capacity, MADV_HUGEPAGE);
+#endif
+
+  Buffer->Data = (u8 *)Data;
+  Buffer->Capacity = Capacity;
+
+  if (Buffer->PrefaultThreadCount) {
+    PrefaultReadBuffer(Buffer);
+  }
+
+  return true;
+}
+
+// NOTE(Lucas): Like ReadEntireFile, but the result lives in Buffer and is
+// only valid until the next read into it.
+buffer ReadEntireFileInto(read_buffer *Buffer, const char *FileName) {
+  buffer Result = {0};
+
+  FILE *File = fopen(FileName, "rb");
+
+  if (File) {
+    fseek(File, 0, SEEK_END);
+    size_t Size = ftell(File);
+    fseek(File, 0, SEEK_SET);
+
+    if (ReserveReadBuffer(Buffer, Size + 1)) {
+      TimeBandwidth(__func__, Size);
+      Buffer->Data[Size] = 0;
+      fread(Buffer->Data, sizeof(u8), Size, File);
+
+      Buffer->FileCount++;
+      Result.Size = Size;
+      Result.Data = Buffer->Data;
+    }
+
+    fclose(File);
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Zeroes the counters but keeps the memory and its faulted in
+// pages.
+static void ResetReadBufferStats(read_buffer *Buffer) {
+  read_buffer Kept = {.Data = Buffer->Data,
+                      .Capacity = Buffer->Capacity,
+                      .PrefaultThreadCount = Buffer->PrefaultThreadCount};
+  *Buffer = Kept;
+}
+
+static void PrintReadBufferStats(read_buffer *Buffer, u64 CPUFrequency) {
+  f64 Megabyte = 1024.0 * 1024.0;
+  f64 Milliseconds = 1000.0 / (f64)CPUFrequency;
+
+  printf("Read buffer: %llu files, %llu reused, %.3fmb capacity\n",
+         Buffer->FileCount, Buffer->ReuseCount, Buffer->Capacity / Megabyte);
+
+  if (Buffer->PrefaultedByteCount) {
+    f64 Wall = Buffer->PrefaultElapsed * Milliseconds;
+    f64 Serial = Buffer->PrefaultThreadElapsed * Milliseconds;
+    printf("Prefault: %.3fmb on up to %u threads, %llu faults, %.3fms "
+           "(%.3fms summed over threads, ~%.3fms saved)\n",
+           Buffer->PrefaultedByteCount / Megabyte, Buffer->MaxThreadsUsed,
+           Buffer->PrefaultPageFaultCount, Wall, Serial,
+           Max(Serial - Wall, 0.0));
+  }
+}
+
+memory_mapped_file OpenMemoryMappedFile(const char *FileName) {
+  memory_mapped_file Result = {0};
+
+  int FileDescriptor = open(FileName, O_RDONLY);
+  if (FileDescriptor != -1) {
+    struct stat FileStats = {0};
+    if (fstat(FileDescriptor, &FileStats) == 0) {
+
+      size_t FileSize = FileStats.st_size;
+      // NOTE(Lucas): On macos the flags parameter has to either have
+      // MAP_PRIVATE or MAP_SHARED set. without having one of those set, mmap
+      // will fail.
+      //
+      // This bit of information was hiding at the 'compatibility' section of
+      // the man page (man 2 mmap).
+      void *Mapping = mmap(0, FileSize, PROT_READ, MAP_PRIVATE | MAP_FILE,
+                           FileDescriptor, 0);
+
+      if (Mapping != MAP_FAILED) {
+        Result.Contents = (buffer){.Data = (u8 *)Mapping, .Size = FileSize};
+
+        Result.IsValid = true;
+      }
+    }
+
+    close(FileDescriptor);
+  }
+
+  return Result;
+}
+
+bool CloseMemoryMappedFile(memory_mapped_file *File) {
+  if (File->IsValid) {
+    if (munmap(File->Contents.Data, File->Contents.Size) == 0) {
+      File->IsValid = false;
+      File->Contents.Data = NULL;
+      File->Contents.Size = 0;
+      return true;
+    }
+  }
+
+  return false;
+}
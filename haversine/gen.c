@@ -3,11 +3,18 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdarg.h>
 
 #define NUMBER_OF_CLUSTERS 64
 #define EARTH_RADIUS 6372.8
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
 
 typedef double f64;
+typedef uint64_t u64;
+typedef uint32_t u32;
+
+#include "summation.h"
 
 typedef struct {
 	f64 X0;
@@ -24,7 +31,7 @@ static f64 Square(f64 A)
 
 static f64 RadiansFromDegrees(f64 Degrees)
 {
-    f64 Result = 0.01745329251994329577f * Degrees;
+    f64 Result = 0.01745329251994329577 * Degrees;
     return Result;
 }
 
@@ -50,6 +57,32 @@ static f64 ReferenceHaversine(coordinates_pair* Pair, f64 EarthRadius)
     return Result;
 }
 
+// NOTE(Lucas): The processor only sees the coordinates as printed with %f, so
+// the reference answer has to be computed from those same values.
+static f64 RoundToPrintedPrecision(f64 Value) {
+	char Buffer[64];
+	snprintf(Buffer, sizeof(Buffer), "%f", Value);
+	return atof(Buffer);
+}
+
+static void RoundPairToPrintedPrecision(coordinates_pair* Pair) {
+	Pair->X0 = RoundToPrintedPrecision(Pair->X0);
+	Pair->Y0 = RoundToPrintedPrecision(Pair->Y0);
+	Pair->X1 = RoundToPrintedPrecision(Pair->X1);
+	Pair->Y1 = RoundToPrintedPrecision(Pair->Y1);
+}
+
+typedef struct {
+	summation Plain;
+	summation Compensated;
+} reference_sums;
+
+static void AddReferenceDistance(reference_sums* Sums, coordinates_pair* Pair) {
+	f64 Distance = ReferenceHaversine(Pair, EARTH_RADIUS);
+	AddToSummation(&Sums->Plain, Distance);
+	AddToSummation(&Sums->Compensated, Distance);
+}
+
 static coordinates_pair GenerateRandomPair() {
 	return (coordinates_pair) {
 		.X0 = ((f64)rand() / RAND_MAX - 0.5) * 2 * 180,
@@ -59,9 +92,7 @@ static coordinates_pair GenerateRandomPair() {
 	};
 }
 
-static f64 GenerateClusterPairs(coordinates_pair* ArrayOfPairs, int NumberOfPairs) {
-	f64 HaversineSum = 0;
-
+static void GenerateClusterPairs(coordinates_pair* ArrayOfPairs, int NumberOfPairs) {
 	// Pick a random center
 	f64 CenterX = ((f64)rand() / RAND_MAX - 0.5) * 2 * 180;
 	f64 CenterY = ((f64)rand() / RAND_MAX - 0.5) * 2 * 90;
@@ -76,19 +107,76 @@ static f64 GenerateClusterPairs(coordinates_pair* ArrayOfPairs, int NumberOfPair
 		ArrayOfPairs[i].X1 = ((f64)rand() / RAND_MAX - 0.5) * 2 * Radius + CenterX;
 		ArrayOfPairs[i].Y1 = ((f64)rand() / RAND_MAX - 0.5) * 2 * Radius + CenterY;
 
-		HaversineSum += ReferenceHaversine(&ArrayOfPairs[i], EARTH_RADIUS);
 	}
+}
 
-	return HaversineSum;
+// NOTE(Lucas): Output is formatted into a 1mb buffer that goes to the file in
+// one call per fill, on an unbuffered stream so stdio does not copy it again.
+// In the repetition tester's write tests that is the 1mb chunk write() path,
+// about 6x faster than fwrite per record through a 4kb stdio buffer.
+typedef struct {
+	FILE* File;
+	char* Data;
+	size_t Used;
+	bool IsValid;
+} output_file;
+
+static output_file OpenOutputFile(const char* FileName) {
+	output_file Result = {0};
+
+	Result.File = fopen(FileName, "wt");
+	Result.Data = (char*) malloc(OUTPUT_BUFFER_SIZE);
+	if (Result.File && Result.Data) {
+		setvbuf(Result.File, NULL, _IONBF, 0);
+		Result.IsValid = true;
+	}
+
+	return Result;
 }
 
-static void PrintPair(FILE* OutputFile, coordinates_pair Pair, bool ShouldPrintCommaAtTheEnd) {
-	fprintf(OutputFile, "{\"x0\": %f, \"y0\": %f, \"x1\": %f, \"y1\": %f}", Pair.X0, Pair.Y0, Pair.X1, Pair.Y1);
-	if (ShouldPrintCommaAtTheEnd) {
-		fprintf(OutputFile, ",");
+static void FlushOutputFile(output_file* Output) {
+	if (Output->Used && fwrite(Output->Data, 1, Output->Used, Output->File) != Output->Used) {
+		Output->IsValid = false;
 	}
+	Output->Used = 0;
+}
+
+static void OutputPrintf(output_file* Output, const char* Format, ...) {
+	for (int Attempt = 0; Attempt < 2; ++Attempt) {
+		size_t Remaining = OUTPUT_BUFFER_SIZE - Output->Used;
+
+		va_list Arguments;
+		va_start(Arguments, Format);
+		int Length = vsnprintf(Output->Data + Output->Used, Remaining, Format, Arguments);
+		va_end(Arguments);
 
-	fprintf(OutputFile, "\n");
+		if (Length >= 0 && (size_t)Length < Remaining) {
+			Output->Used += Length;
+			return;
+		}
+
+		// NOTE(Lucas): Did not fit, retry once on an empty buffer.
+		FlushOutputFile(Output);
+	}
+
+	Output->IsValid = false;
+}
+
+static bool CloseOutputFile(output_file* Output) {
+	bool Result = false;
+
+	if (Output->File) {
+		FlushOutputFile(Output);
+		Result = Output->IsValid && (fclose(Output->File) == 0);
+	}
+	free(Output->Data);
+
+	return Result;
+}
+
+static void PrintPair(output_file* OutputFile, coordinates_pair Pair, bool ShouldPrintCommaAtTheEnd) {
+	OutputPrintf(OutputFile, "{\"x0\": %f, \"y0\": %f, \"x1\": %f, \"y1\": %f}%s\n", Pair.X0, Pair.Y0, Pair.X1, Pair.Y1,
+			ShouldPrintCommaAtTheEnd ? "," : "");
 }
 
 static void PrintUsage(const char*  ProgramName) {
@@ -155,16 +243,25 @@ int main(int CommandLineArgumentsCount, char* CommandLineArguments[]) {
 
 	MakeOutputFileName(TempBuf, sizeof(TempBuf), Options.Mode, Options.NumberOfCoordinatePairs);
 
-	f64 HaversineSum = 0;
+	reference_sums Sums;
+	InitSummation(&Sums.Plain, false);
+	InitSummation(&Sums.Compensated, true);
 
 	{
-		FILE* OutputFile = fopen(TempBuf, "wt");
-		fprintf(OutputFile, "{\"pairs\": [\n");
+		output_file Output = OpenOutputFile(TempBuf);
+		output_file* OutputFile = &Output;
+		if (!Output.IsValid) {
+			fprintf(stderr, "Could not open %s\n", TempBuf);
+			return 1;
+		}
+
+		OutputPrintf(OutputFile, "{\"pairs\": [\n");
 
 		if (Options.Mode == mode_uniform) {
 			for (int i = 1; i <= Options.NumberOfCoordinatePairs; i++) {
 				coordinates_pair Pair = GenerateRandomPair();
-				HaversineSum += ReferenceHaversine(&Pair, EARTH_RADIUS);
+				RoundPairToPrintedPrecision(&Pair);
+				AddReferenceDistance(&Sums, &Pair);
 				PrintPair(OutputFile, Pair, i != Options.NumberOfCoordinatePairs);
 			}
 		} else {
@@ -175,25 +272,40 @@ int main(int CommandLineArgumentsCount, char* CommandLineArguments[]) {
 
 			for (int  i = 1; i <= NUMBER_OF_CLUSTERS; i++) {
 				int NumberOfPairsInCluster = PairsPerCluster + ((i == NUMBER_OF_CLUSTERS) ? RemainderPairs : 0);
-				HaversineSum += GenerateClusterPairs(Pairs, NumberOfPairsInCluster);
+				GenerateClusterPairs(Pairs, NumberOfPairsInCluster);
 
 				for (int j = 1; j <= NumberOfPairsInCluster; j++) {
-					PrintPair(OutputFile, Pairs[j-1], (i != NUMBER_OF_CLUSTERS) && (j != NumberOfPairsInCluster));
+					RoundPairToPrintedPrecision(&Pairs[j-1]);
+					AddReferenceDistance(&Sums, &Pairs[j-1]);
+					PrintPair(OutputFile, Pairs[j-1], !((i == NUMBER_OF_CLUSTERS) && (j == NumberOfPairsInCluster)));
 				}
 			}
 		}
 
-		fprintf(OutputFile, "]}\n");
-		fclose(OutputFile);
+		OutputPrintf(OutputFile, "]}\n");
+		if (!CloseOutputFile(OutputFile)) {
+			fprintf(stderr, "Could not write %s\n", TempBuf);
+			return 1;
+		}
 	}
 
 
-	f64 HaversineAverage = HaversineSum / (f64) Options.NumberOfCoordinatePairs;
+	f64 HaversineAverage = SummationResult(&Sums.Plain) / (f64) Options.NumberOfCoordinatePairs;
+	f64 CompensatedHaversineAverage = SummationResult(&Sums.Compensated) / (f64) Options.NumberOfCoordinatePairs;
 	MakeHaversineResultFileName(TempBuf, sizeof(TempBuf), Options.Mode, Options.NumberOfCoordinatePairs);
 
-	FILE *HaversineResultFile = fopen(TempBuf, "wt");
-	fprintf(HaversineResultFile, "%f\n", HaversineAverage);
-	fclose(HaversineResultFile);
+	output_file HaversineResultFile = OpenOutputFile(TempBuf);
+	if (!HaversineResultFile.IsValid) {
+		fprintf(stderr, "Could not open %s\n", TempBuf);
+		return 1;
+	}
+
+	// NOTE(Lucas): %.17g round trips, the processor's --check compares bit for bit.
+	OutputPrintf(&HaversineResultFile, "%.17g\n%.17g\n", HaversineAverage, CompensatedHaversineAverage);
+	if (!CloseOutputFile(&HaversineResultFile)) {
+		fprintf(stderr, "Could not write %s\n", TempBuf);
+		return 1;
+	}
 
 	fprintf(stderr, "DONE\n");
 
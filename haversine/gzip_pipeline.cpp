@@ -0,0 +1,243 @@
+// NOTE(Lucas): Inflates a gzip file on a helper thread into a small ring of
+// buffers while the calling thread consumes them, so decompression and
+// parsing overlap.
+//
+// The helper thread does not touch the profiler (it is not thread safe), it
+// keeps its own counters instead and the caller reports them.
+
+#define GZIP_PIPELINE_BUFFER_COUNT 4
+#define GZIP_PIPELINE_BUFFER_SIZE (1024 * 1024)
+#define GZIP_PIPELINE_INPUT_SIZE (256 * 1024)
+
+struct gzip_pipeline {
+  pthread_t Thread;
+  pthread_mutex_t Mutex;
+  pthread_cond_t BufferFilled;
+  pthread_cond_t BufferConsumed;
+
+  char *Buffers[GZIP_PIPELINE_BUFFER_COUNT];
+  size_t BufferSizes[GZIP_PIPELINE_BUFFER_COUNT];
+
+  // NOTE(Lucas): Only ever incremented, the slot is the value modulo
+  // GZIP_PIPELINE_BUFFER_COUNT.
+  u64 FilledCount;
+  u64 ConsumedCount;
+
+  bool IsFinished;
+  bool IsValid;
+
+  int FileDescriptor;
+
+  // NOTE(Lucas): Written by the inflate thread, read after it finished.
+  // InflateElapsed excludes the time spent waiting for a free buffer.
+  u64 CompressedByteCount;
+  u64 UncompressedByteCount;
+  u64 InflateElapsed;
+  u64 WaitElapsed;
+};
+
+static bool IsGzipFile(const char *FileName) {
+  bool Result = false;
+
+  int FileDescriptor = open(FileName, O_RDONLY);
+
+  if (FileDescriptor != -1) {
+    u8 Magic[2];
+    Result = read(FileDescriptor, Magic, sizeof(Magic)) == sizeof(Magic) &&
+             Magic[0] == 0x1f && Magic[1] == 0x8b;
+    close(FileDescriptor);
+  }
+
+  return Result;
+}
+
+static void PublishGzipBuffer(gzip_pipeline *Pipeline, size_t Size) {
+  pthread_mutex_lock(&Pipeline->Mutex);
+  Pipeline->BufferSizes[Pipeline->FilledCount % GZIP_PIPELINE_BUFFER_COUNT] =
+      Size;
+  Pipeline->FilledCount++;
+  pthread_cond_signal(&Pipeline->BufferFilled);
+  pthread_mutex_unlock(&Pipeline->Mutex);
+}
+
+static char *WaitForEmptyGzipBuffer(gzip_pipeline *Pipeline) {
+  u64 StartCounter = ReadCPUTimer();
+
+  pthread_mutex_lock(&Pipeline->Mutex);
+  while (Pipeline->FilledCount - Pipeline->ConsumedCount ==
+         GZIP_PIPELINE_BUFFER_COUNT) {
+    pthread_cond_wait(&Pipeline->BufferConsumed, &Pipeline->Mutex);
+  }
+  char *Result =
+      Pipeline->Buffers[Pipeline->FilledCount % GZIP_PIPELINE_BUFFER_COUNT];
+  pthread_mutex_unlock(&Pipeline->Mutex);
+
+  Pipeline->WaitElapsed += ReadCPUTimer() - StartCounter;
+
+  return Result;
+}
+
+static void *InflateGzipThread(void *UserData) {
+  gzip_pipeline *Pipeline = (gzip_pipeline *)UserData;
+
+  u64 StartCounter = ReadCPUTimer();
+
+  u8 *Input = (u8 *)malloc(GZIP_PIPELINE_INPUT_SIZE);
+
+  z_stream Stream = {};
+  // NOTE(Lucas): 16 + MAX_WBITS makes zlib expect a gzip header and trailer.
+  bool IsValid = (inflateInit2(&Stream, 16 + MAX_WBITS) == Z_OK);
+
+  char *Output = WaitForEmptyGzipBuffer(Pipeline);
+  Stream.next_out = (Bytef *)Output;
+  Stream.avail_out = GZIP_PIPELINE_BUFFER_SIZE;
+
+  while (IsValid) {
+    if (Stream.avail_in == 0) {
+      ssize_t ReadByteCount =
+          read(Pipeline->FileDescriptor, Input, GZIP_PIPELINE_INPUT_SIZE);
+
+      if (ReadByteCount <= 0) {
+        // NOTE(Lucas): A clean end of file is only valid between members.
+        IsValid = (ReadByteCount == 0) && (Stream.total_in == 0);
+        break;
+      }
+
+      Pipeline->CompressedByteCount += ReadByteCount;
+      Stream.next_in = Input;
+      Stream.avail_in = (uInt)ReadByteCount;
+    }
+
+    int Status = inflate(&Stream, Z_NO_FLUSH);
+
+    if (Status == Z_STREAM_END) {
+      // NOTE(Lucas): gzip files can hold several concatenated members.
+      inflateReset(&Stream);
+    } else if (Status != Z_OK && Status != Z_BUF_ERROR) {
+      IsValid = false;
+    }
+
+    if (Stream.avail_out == 0) {
+      Pipeline->UncompressedByteCount += GZIP_PIPELINE_BUFFER_SIZE;
+      PublishGzipBuffer(Pipeline, GZIP_PIPELINE_BUFFER_SIZE);
+
+      Output = WaitForEmptyGzipBuffer(Pipeline);
+      Stream.next_out = (Bytef *)Output;
+      Stream.avail_out = GZIP_PIPELINE_BUFFER_SIZE;
+    }
+  }
+
+  size_t Remaining = GZIP_PIPELINE_BUFFER_SIZE - Stream.avail_out;
+  if (IsValid && Remaining) {
+    Pipeline->UncompressedByteCount += Remaining;
+    PublishGzipBuffer(Pipeline, Remaining);
+  }
+
+  inflateEnd(&Stream);
+  free(Input);
+
+  Pipeline->InflateElapsed =
+      ReadCPUTimer() - StartCounter - Pipeline->WaitElapsed;
+
+  pthread_mutex_lock(&Pipeline->Mutex);
+  Pipeline->IsValid = IsValid;
+  Pipeline->IsFinished = true;
+  pthread_cond_signal(&Pipeline->BufferFilled);
+  pthread_mutex_unlock(&Pipeline->Mutex);
+
+  return NULL;
+}
+
+static bool StartGzipPipeline(gzip_pipeline *Pipeline, const char *FileName) {
+  *Pipeline = {};
+
+  Pipeline->FileDescriptor = open(FileName, O_RDONLY);
+  if (Pipeline->FileDescriptor == -1) {
+    return false;
+  }
+
+  for (u32 Index = 0; Index < GZIP_PIPELINE_BUFFER_COUNT; ++Index) {
+    Pipeline->Buffers[Index] = (char *)malloc(GZIP_PIPELINE_BUFFER_SIZE);
+  }
+
+  pthread_mutex_init(&Pipeline->Mutex, NULL);
+  pthread_cond_init(&Pipeline->BufferFilled, NULL);
+  pthread_cond_init(&Pipeline->BufferConsumed, NULL);
+
+  return pthread_create(&Pipeline->Thread, NULL, InflateGzipThread,
+                        Pipeline) == 0;
+}
+
+// NOTE(Lucas): Blocks until the next inflated buffer is ready. Returns false
+// once everything has been consumed. The buffer stays valid until it is
+// handed back with ReleaseGzipBuffer.
+static bool NextGzipBuffer(gzip_pipeline *Pipeline, char **OutData,
+                           size_t *OutSize) {
+  TimeBlock("WaitForInflate");
+  bool Result = false;
+
+  pthread_mutex_lock(&Pipeline->Mutex);
+
+  while (Pipeline->FilledCount == Pipeline->ConsumedCount &&
+         !Pipeline->IsFinished) {
+    pthread_cond_wait(&Pipeline->BufferFilled, &Pipeline->Mutex);
+  }
+
+  if (Pipeline->FilledCount != Pipeline->ConsumedCount) {
+    u32 Slot = Pipeline->ConsumedCount % GZIP_PIPELINE_BUFFER_COUNT;
+    *OutData = Pipeline->Buffers[Slot];
+    *OutSize = Pipeline->BufferSizes[Slot];
+    Result = true;
+  }
+
+  pthread_mutex_unlock(&Pipeline->Mutex);
+
+  return Result;
+}
+
+static void ReleaseGzipBuffer(gzip_pipeline *Pipeline) {
+  pthread_mutex_lock(&Pipeline->Mutex);
+  Pipeline->ConsumedCount++;
+  pthread_cond_signal(&Pipeline->BufferConsumed);
+  pthread_mutex_unlock(&Pipeline->Mutex);
+}
+
+// NOTE(Lucas): Stops the inflate thread even if not everything was consumed.
+// Returns whether the whole file inflated without errors.
+static bool FinishGzipPipeline(gzip_pipeline *Pipeline) {
+  pthread_mutex_lock(&Pipeline->Mutex);
+  while (!Pipeline->IsFinished) {
+    Pipeline->ConsumedCount = Pipeline->FilledCount;
+    pthread_cond_signal(&Pipeline->BufferConsumed);
+    pthread_cond_wait(&Pipeline->BufferFilled, &Pipeline->Mutex);
+  }
+  pthread_mutex_unlock(&Pipeline->Mutex);
+
+  pthread_join(Pipeline->Thread, NULL);
+
+  for (u32 Index = 0; Index < GZIP_PIPELINE_BUFFER_COUNT; ++Index) {
+    free(Pipeline->Buffers[Index]);
+  }
+
+  pthread_mutex_destroy(&Pipeline->Mutex);
+  pthread_cond_destroy(&Pipeline->BufferFilled);
+  pthread_cond_destroy(&Pipeline->BufferConsumed);
+  close(Pipeline->FileDescriptor);
+
+  return Pipeline->IsValid;
+}
+
+static void PrintGzipPipelineStats(gzip_pipeline *Pipeline, u64 CPUFrequency) {
+  f64 Megabyte = 1024.0 * 1024.0;
+  f64 Gigabyte = 1024.0 * Megabyte;
+  f64 Seconds = (f64)Pipeline->InflateElapsed / (f64)CPUFrequency;
+
+  printf("Inflate: %.3fmb compressed at %.2fgb/s, %.3fmb uncompressed at "
+         "%.2fgb/s (%.2fx)\n",
+         Pipeline->CompressedByteCount / Megabyte,
+         Pipeline->CompressedByteCount / (Gigabyte * Seconds),
+         Pipeline->UncompressedByteCount / Megabyte,
+         Pipeline->UncompressedByteCount / (Gigabyte * Seconds),
+         (f64)Pipeline->UncompressedByteCount /
+             (f64)Max(Pipeline->CompressedByteCount, 1));
+}
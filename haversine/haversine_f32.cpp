@@ -0,0 +1,111 @@
+// NOTE(Lucas): f32 haversine for when about a meter of accuracy is enough.
+// Lanes are twice as wide as with f64 and the coordinates take half the
+// memory.
+//
+// libm's sinf/cosf/asinf calls keep the loop from vectorizing (unless a
+// vector math library is linked), so the trigonometry is done with
+// polynomials and selects instead of branches. The kernel needs
+// -fno-math-errno for sqrtf to vectorize (and -fno-trapping-math on gcc,
+// clang assumes it already).
+
+#define HAVERSINE_F32_PI 3.14159265358979323846f
+#define HAVERSINE_F32_HALF_PI 1.57079632679489661923f
+#define HAVERSINE_F32_DEGREES_TO_RADIANS 0.01745329251994329577f
+
+// NOTE(Lucas): Brings X into [-pi, pi]. 2 pi is split in two constants so the
+// subtraction stays exact for the small turn counts we see. Rounding goes
+// through an int conversion, rintf only vectorizes with SSE4.1 and up.
+static inline f32 ReduceAngleF32(f32 X) {
+  f32 Scaled = X * 0.15915494309189533577f;
+  f32 Turns = (f32)(int)(Scaled + copysignf(0.5f, Scaled));
+  X = X - Turns * 6.28125f;
+  X = X - Turns * 0.0019353071795864769253f;
+  return X;
+}
+
+// NOTE(Lucas): Taylor series up to x^13, the truncation error on
+// [-pi/2, pi/2] is below 1e-9, well under f32 precision.
+static inline f32 SinePolynomialF32(f32 X) {
+  f32 X2 = X * X;
+  f32 P = 1.0f / 6227020800.0f;
+  P = P * X2 - 1.0f / 39916800.0f;
+  P = P * X2 + 1.0f / 362880.0f;
+  P = P * X2 - 1.0f / 5040.0f;
+  P = P * X2 + 1.0f / 120.0f;
+  P = P * X2 - 1.0f / 6.0f;
+  return X + X * X2 * P;
+}
+
+static inline f32 SineF32(f32 X) {
+  X = ReduceAngleF32(X);
+  // NOTE(Lucas): sin(x) = sin(pi - x) folds [pi/2, pi] onto [0, pi/2].
+  f32 Folded = copysignf(HAVERSINE_F32_PI, X) - X;
+  X = (fabsf(X) > HAVERSINE_F32_HALF_PI) ? Folded : X;
+  return SinePolynomialF32(X);
+}
+
+static inline f32 CosineF32(f32 X) {
+  X = ReduceAngleF32(X);
+  return SinePolynomialF32(HAVERSINE_F32_HALF_PI - fabsf(X));
+}
+
+// NOTE(Lucas): X in [0, 1]. The polynomial is the Cephes asinf one for
+// [0, 0.5], above that asin(x) = pi/2 - 2 asin(sqrt((1 - x) / 2)).
+static inline f32 ArcsineF32(f32 X) {
+  bool IsLarge = X > 0.5f;
+  f32 Z = IsLarge ? 0.5f * (1.0f - X) : X * X;
+  f32 Root = sqrtf(Z);
+  f32 S = IsLarge ? Root : X;
+
+  f32 P = 4.2163199048e-2f;
+  P = P * Z + 2.4181311049e-2f;
+  P = P * Z + 4.5470025998e-2f;
+  P = P * Z + 7.4953002686e-2f;
+  P = P * Z + 1.6666752422e-1f;
+  f32 R = S + S * Z * P;
+
+  return IsLarge ? HAVERSINE_F32_HALF_PI - 2.0f * R : R;
+}
+
+static inline f32 HaversineF32(f32 X0, f32 Y0, f32 X1, f32 Y1,
+                               f32 EarthRadius) {
+  f32 dLat = (Y1 - Y0) * HAVERSINE_F32_DEGREES_TO_RADIANS;
+  f32 dLon = (X1 - X0) * HAVERSINE_F32_DEGREES_TO_RADIANS;
+  f32 Lat0 = Y0 * HAVERSINE_F32_DEGREES_TO_RADIANS;
+  f32 Lat1 = Y1 * HAVERSINE_F32_DEGREES_TO_RADIANS;
+
+  f32 SinHalfLat = SineF32(0.5f * dLat);
+  f32 SinHalfLon = SineF32(0.5f * dLon);
+  f32 SinHalfLatSum = SineF32(0.5f * (Lat0 + Lat1));
+  f32 CosHalfLon = CosineF32(0.5f * dLon);
+  f32 CosLats = CosineF32(Lat0) * CosineF32(Lat1);
+
+  // NOTE(Lucas): A is the usual haversine term. In f32, 1 - A loses
+  // everything for nearly antipodal points, so B = 1 - A is computed on its
+  // own as the haversine term between P0 and the antipode of P1. Both are
+  // sums of non negative terms, and whichever is smaller goes into asin.
+  f32 A = SinHalfLat * SinHalfLat + CosLats * SinHalfLon * SinHalfLon;
+  f32 B = SinHalfLatSum * SinHalfLatSum + CosLats * CosHalfLon * CosHalfLon;
+  A = Min(Max(A, 0.0f), 1.0f);
+  B = Min(Max(B, 0.0f), 1.0f);
+
+  bool IsFar = A > B;
+  f32 HalfAngle = ArcsineF32(sqrtf(IsFar ? B : A));
+  f32 Angle = IsFar ? HAVERSINE_F32_PI - 2.0f * HalfAngle : 2.0f * HalfAngle;
+
+  return EarthRadius * Angle;
+}
+
+// NOTE(Lucas): Distances of pairs [First, First + Count) into Out.
+static void HaversineF32Kernel(haversine_pairs_f32 *Pairs, u64 First,
+                               u64 Count, f32 EarthRadius, f32 *Out) {
+  f32 *X0 = Pairs->X0 + First;
+  f32 *Y0 = Pairs->Y0 + First;
+  f32 *X1 = Pairs->X1 + First;
+  f32 *Y1 = Pairs->Y1 + First;
+
+  for (u64 Index = 0; Index < Count; ++Index) {
+    Out[Index] =
+        HaversineF32(X0[Index], Y0[Index], X1[Index], Y1[Index], EarthRadius);
+  }
+}
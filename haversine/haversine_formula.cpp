@@ -1,5 +1,7 @@
 #include <math.h>
 
+#define EARTH_RADIUS 6372.8
+
 static f64 Square(f64 A) {
   f64 Result = (A * A);
   return Result;
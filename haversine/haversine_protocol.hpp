@@ -0,0 +1,53 @@
+// NOTE(Lucas): Wire format between the resident processor (--serve) and its
+// clients over a local unix socket. Both sides run on the same machine, so
+// everything is sent in native byte order.
+//
+// A client may write any number of requests before reading the responses;
+// they are answered in order. Every request gets exactly one response.
+//
+//   Request_RangeSum   Sum of the distances of pairs [First, First + Count)
+//                      of Dataset. Count = 0 means up to the end.
+//   Request_Distances  Followed by Count request_pairs. The response is
+//                      followed by Count f64 distances.
+//   Request_Info       Response Count is the number of pairs in Dataset.
+//   Request_Reload     Reloads Dataset from its file.
+//   Request_Shutdown   Stops the server once the response was sent.
+
+#define HAVERSINE_MAX_DISTANCES_PER_REQUEST (1024 * 1024)
+
+enum request_type : u32 {
+  Request_RangeSum = 1,
+  Request_Distances,
+  Request_Info,
+  Request_Reload,
+  Request_Shutdown,
+};
+
+enum response_status : u32 {
+  Response_OK = 0,
+  Response_BadRequest,
+  Response_BadDataset,
+  Response_BadRange,
+  Response_LoadFailed,
+};
+
+struct request_header {
+  u32 Type;
+  u32 Dataset;
+  u64 First;
+  u64 Count;
+};
+
+struct request_pair {
+  f64 X0;
+  f64 Y0;
+  f64 X1;
+  f64 Y1;
+};
+
+struct response_header {
+  u32 Status;
+  u32 Type;
+  u64 Count;
+  f64 Sum;
+};
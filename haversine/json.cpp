@@ -1,40 +1,74 @@
 #define __JSON_IS_DIGIT(CH) ('0' <= (CH) && (CH) <= '9')
 
+// NOTE(Lucas): Objects with at most this many keys are searched linearly
+// (comparing hashes first), bigger ones get an open addressing index.
+#define __JSON_INLINE_KEY_COUNT 8
+
 enum json_element_type { json_object, json_array, json_value };
 
 struct json_element;
-
-struct json_key_value_pair {
-  json_key_value_pair *Next;
-  string Key;
-  json_element *Value;
+struct json_key_value_pair;
+
+struct json_object_data {
+  json_key_value_pair *Pairs;
+  u32 *Index;
+  u32 Count;
+  u32 Capacity;
+  u32 IndexMask;
 };
 
-struct json_array_item {
-  json_array_item *Next;
-  json_element *Value;
+struct json_array_data {
+  json_element *Items;
+  u64 Count;
+  u64 Capacity;
 };
 
 struct json_element {
   json_element_type Type;
 
   union {
-    json_key_value_pair *Object;
-    json_array_item *Array;
+    json_object_data Object;
+    json_array_data Array;
     string Value;
   };
 };
 
+struct json_key_value_pair {
+  string Key;
+  u64 Hash;
+  json_element Value;
+};
+
+// NOTE(Lucas): A precomputed key. Build it once with MakeJSONKey outside of
+// the hot loop and pass it to GetKey for every object you look it up in.
+struct json_key {
+  string Key;
+  u64 Hash;
+};
+
 struct __json_parse_context {
   const char *Content;
   size_t ContentSize;
   size_t Offset;
 };
 
-static json_element *ParseValue(__json_parse_context *Context);
-static json_element *ParseArray(__json_parse_context *Context);
-static json_element *ParseObject(__json_parse_context *Context);
-static void FreeJSON(json_element *Json);
+static bool ParseValue(__json_parse_context *Context, json_element *Out);
+static bool ParseArray(__json_parse_context *Context, json_element *Out);
+static bool ParseObject(__json_parse_context *Context, json_element *Out);
+static void FreeJSONContents(json_element *Json);
+
+static u64 HashJSONKey(string Key) {
+  // FNV-1a
+  u64 Hash = 0xcbf29ce484222325ull;
+  for (size_t Index = 0; Index < Key.Size; ++Index) {
+    Hash = (Hash ^ (u8)Key.Data[Index]) * 0x100000001b3ull;
+  }
+  return Hash;
+}
+
+json_key MakeJSONKey(string Key) {
+  return {.Key = Key, .Hash = HashJSONKey(Key)};
+}
 
 static void Advance(__json_parse_context *Context) {
   if (Context->Offset != Context->ContentSize) {
@@ -87,35 +121,36 @@ static bool ParseKey(__json_parse_context *Context, string *OutKey) {
 }
 
 static void InsertArrayItem(json_element *Json, json_element *Item) {
-  json_array_item *ArrayItem =
-      (json_array_item *)malloc(sizeof(json_array_item));
+  json_array_data *Array = &Json->Array;
 
-  ArrayItem->Next = Json->Array;
-  ArrayItem->Value = Item;
+  if (Array->Count == Array->Capacity) {
+    Array->Capacity = Array->Capacity ? 2 * Array->Capacity : 4;
+    Array->Items = (json_element *)ProfiledRealloc(
+        Array->Items, Array->Capacity * sizeof(json_element));
+  }
 
-  Json->Array = ArrayItem;
+  Array->Items[Array->Count++] = *Item;
 }
 
-static json_element *ParseArray(__json_parse_context *Context) {
+static bool ParseArray(__json_parse_context *Context, json_element *Out) {
   if (!Expect(Context, '[')) {
-    return NULL;
+    return false;
   }
 
-  json_element *Json = (json_element *)malloc(sizeof(json_element));
-  Json->Type = json_array;
-  Json->Array = NULL;
+  json_element Json = {.Type = json_array};
+  Json.Array = {};
 
   bool IsValid = true;
   char Peeked = 0;
   while ((Peeked = Peek(Context)) && Peeked != ']') {
-    json_element *Item = ParseValue(Context);
+    json_element Item;
 
-    if (!Item) {
+    if (!ParseValue(Context, &Item)) {
       IsValid = false;
       break;
     }
 
-    InsertArrayItem(Json, Item);
+    InsertArrayItem(&Json, &Item);
 
     EatWhitespace(Context);
     if (Peek(Context) == ',') {
@@ -130,25 +165,26 @@ static json_element *ParseArray(__json_parse_context *Context) {
   }
 
   if (IsValid) {
-    return Json;
+    *Out = Json;
   } else {
-    FreeJSON(Json);
-    return NULL;
+    FreeJSONContents(&Json);
   }
+
+  return IsValid;
 }
 
-static json_element *ParseValue(__json_parse_context *Context) {
+static bool ParseValue(__json_parse_context *Context, json_element *Out) {
   TimeFunction;
   EatWhitespace(Context);
 
-  json_element *Result = NULL;
+  bool Result = false;
 
   char PeekedCharacter = Peek(Context);
 
   if (PeekedCharacter == '[') {
-    Result = ParseArray(Context);
+    Result = ParseArray(Context, Out);
   } else if (PeekedCharacter == '{') {
-    Result = ParseObject(Context);
+    Result = ParseObject(Context, Out);
   } else {
     size_t StartOffset = Context->Offset;
 
@@ -169,12 +205,11 @@ static json_element *ParseValue(__json_parse_context *Context) {
       }
     }
 
-    json_element *Json = (json_element *)malloc(sizeof(json_element));
-    Json->Type = json_value;
-    Json->Value = CopyString(Context->Content, StartOffset,
-                             Context->Offset - StartOffset);
+    Out->Type = json_value;
+    Out->Value = CopyString(Context->Content, StartOffset,
+                            Context->Offset - StartOffset);
 
-    Result = Json;
+    Result = true;
   }
 
   return Result;
@@ -182,26 +217,50 @@ static json_element *ParseValue(__json_parse_context *Context) {
 
 static inline void InsertKeyValue(json_element *Json, string Key,
                                   json_element *Value) {
-  json_key_value_pair *Pair =
-      (json_key_value_pair *)malloc(sizeof(json_key_value_pair));
+  json_object_data *Object = &Json->Object;
 
+  if (Object->Count == Object->Capacity) {
+    Object->Capacity = Object->Capacity ? 2 * Object->Capacity : 4;
+    Object->Pairs = (json_key_value_pair *)ProfiledRealloc(
+        Object->Pairs, Object->Capacity * sizeof(json_key_value_pair));
+  }
+
+  json_key_value_pair *Pair = Object->Pairs + Object->Count++;
   Pair->Key = Key;
-  Pair->Value = Value;
+  Pair->Hash = HashJSONKey(Key);
+  Pair->Value = *Value;
+}
+
+static void BuildObjectIndex(json_element *Json) {
+  json_object_data *Object = &Json->Object;
+
+  u32 SlotCount = 2 * __JSON_INLINE_KEY_COUNT;
+  while (SlotCount < 2 * Object->Count) {
+    SlotCount *= 2;
+  }
+
+  Object->IndexMask = SlotCount - 1;
+  Object->Index = (u32 *)ProfiledCalloc(SlotCount, sizeof(u32));
 
-  Pair->Next = Json->Object;
-  Json->Object = Pair;
+  // NOTE(Lucas): Slots store the pair index plus one so zero means empty.
+  for (u32 PairIndex = 0; PairIndex < Object->Count; ++PairIndex) {
+    u32 Slot = Object->Pairs[PairIndex].Hash & Object->IndexMask;
+    while (Object->Index[Slot]) {
+      Slot = (Slot + 1) & Object->IndexMask;
+    }
+    Object->Index[Slot] = PairIndex + 1;
+  }
 }
 
-static json_element *ParseObject(__json_parse_context *Context) {
+static bool ParseObject(__json_parse_context *Context, json_element *Out) {
   TimeFunction;
   EatWhitespace(Context);
 
   if (!Expect(Context, '{'))
-    return NULL;
+    return false;
 
-  json_element *Json = (json_element *)malloc(sizeof(json_element));
-  Json->Type = json_object;
-  Json->Object = NULL;
+  json_element Json = {.Type = json_object};
+  Json.Object = {};
 
   bool IsValid = true;
 
@@ -215,19 +274,14 @@ static json_element *ParseObject(__json_parse_context *Context) {
     }
 
     EatWhitespace(Context);
-    if (!Expect(Context, ':')) {
+    json_element Value;
+    if (!Expect(Context, ':') || !ParseValue(Context, &Value)) {
+      free((void *)Key.Data);
       IsValid = false;
       break;
     }
 
-    json_element *Value = ParseValue(Context);
-
-    if (!Value) {
-      IsValid = false;
-      break;
-    }
-
-    InsertKeyValue(Json, Key, Value);
+    InsertKeyValue(&Json, Key, &Value);
 
     EatWhitespace(Context);
 
@@ -246,61 +300,82 @@ static json_element *ParseObject(__json_parse_context *Context) {
   }
 
   if (IsValid) {
-    return Json;
+    if (Json.Object.Count > __JSON_INLINE_KEY_COUNT) {
+      BuildObjectIndex(&Json);
+    }
+    *Out = Json;
   } else {
-    FreeJSON(Json);
-    return NULL;
+    FreeJSONContents(&Json);
   }
+
+  return IsValid;
 };
 
 static json_element *ParseJSON(const char *Content, size_t Size) {
   __json_parse_context Context = {.Content = Content, .ContentSize = Size};
 
-  return ParseObject(&Context);
-}
+  json_element *Result = (json_element *)ProfiledMalloc(sizeof(json_element));
+  if (!ParseObject(&Context, Result)) {
+    free(Result);
+    Result = NULL;
+  }
 
-static void FreeJSON(json_element *Json) {
-  assert(Json != NULL);
+  return Result;
+}
 
+static void FreeJSONContents(json_element *Json) {
   switch (Json->Type) {
   case json_value: {
     free((void *)(Json->Value.Data));
   } break;
   case json_array: {
-    for (json_array_item *Item = Json->Array; Item;) {
-      FreeJSON(Item->Value);
-
-      json_array_item *Next = Item->Next;
-      free(Item);
-
-      Item = Next;
+    for (u64 Index = 0; Index < Json->Array.Count; ++Index) {
+      FreeJSONContents(Json->Array.Items + Index);
     }
+    free(Json->Array.Items);
   } break;
   case json_object: {
-    for (json_key_value_pair *Pair = Json->Object; Pair;) {
+    for (u32 Index = 0; Index < Json->Object.Count; ++Index) {
+      json_key_value_pair *Pair = Json->Object.Pairs + Index;
       free((void *)Pair->Key.Data);
-      FreeJSON(Pair->Value);
-
-      json_key_value_pair *Next = Pair->Next;
-      free(Pair);
-
-      Pair = Next;
+      FreeJSONContents(&Pair->Value);
     }
+    free(Json->Object.Pairs);
+    free(Json->Object.Index);
   } break;
   }
+}
+
+static void FreeJSON(json_element *Json) {
+  assert(Json != NULL);
 
+  FreeJSONContents(Json);
   free(Json);
 }
 
-json_element *GetKey(json_element *Json, string Key) {
+json_element *GetKey(json_element *Json, const json_key *Key) {
   TimeFunction;
   json_element *Result = NULL;
 
   if (Json->Type == json_object) {
-    for (json_key_value_pair *Pair = Json->Object; Pair; Pair = Pair->Next) {
-      if (StringEqual(Pair->Key, Key)) {
-        Result = Pair->Value;
-        break;
+    json_object_data *Object = &Json->Object;
+
+    if (Object->Index) {
+      for (u32 Slot = Key->Hash & Object->IndexMask; Object->Index[Slot];
+           Slot = (Slot + 1) & Object->IndexMask) {
+        json_key_value_pair *Pair = Object->Pairs + Object->Index[Slot] - 1;
+        if (Pair->Hash == Key->Hash && StringEqual(Pair->Key, Key->Key)) {
+          Result = &Pair->Value;
+          break;
+        }
+      }
+    } else {
+      for (u32 Index = 0; Index < Object->Count; ++Index) {
+        json_key_value_pair *Pair = Object->Pairs + Index;
+        if (Pair->Hash == Key->Hash && StringEqual(Pair->Key, Key->Key)) {
+          Result = &Pair->Value;
+          break;
+        }
       }
     }
   }
@@ -308,26 +383,70 @@ json_element *GetKey(json_element *Json, string Key) {
   return Result;
 }
 
+json_element *GetKey(json_element *Json, string Key) {
+  json_key Handle = MakeJSONKey(Key);
+  return GetKey(Json, &Handle);
+}
+
+u64 JSONArrayCount(json_element *Json) {
+  return (Json->Type == json_array) ? Json->Array.Count : 0;
+}
+
+json_element *JSONArrayAt(json_element *Json, u64 Index) {
+  json_element *Result = NULL;
+
+  if (Index < JSONArrayCount(Json)) {
+    Result = Json->Array.Items + Index;
+  }
+
+  return Result;
+}
+
 typedef struct {
-  json_array_item *CurrentItem;
+  json_element *At;
+  json_element *End;
 } json_array_iterator;
 
-json_array_iterator MakeJSONArrayIterator(json_element *Json) {
+json_array_iterator MakeJSONArrayIterator(json_element *Json, u64 First,
+                                          u64 OnePastLast) {
   json_array_iterator Result = {0};
 
-  if (Json->Type == json_array) {
-    Result.CurrentItem = Json->Array;
+  u64 Count = JSONArrayCount(Json);
+  OnePastLast = Min(OnePastLast, Count);
+  First = Min(First, OnePastLast);
+
+  if (Count) {
+    Result.At = Json->Array.Items + First;
+    Result.End = Json->Array.Items + OnePastLast;
   }
 
   return Result;
 }
 
+json_array_iterator MakeJSONArrayIterator(json_element *Json) {
+  return MakeJSONArrayIterator(Json, 0, JSONArrayCount(Json));
+}
+
+// NOTE(Lucas): Returns the PartIndex-th of PartCount contiguous, (almost)
+// equally sized pieces of Iter. Useful for handing ranges to threads.
+json_array_iterator SplitJSONArrayIterator(json_array_iterator Iter,
+                                           u64 PartCount, u64 PartIndex) {
+  assert(PartIndex < PartCount);
+
+  u64 Count = Iter.End - Iter.At;
+
+  json_array_iterator Result;
+  Result.At = Iter.At + (Count * PartIndex) / PartCount;
+  Result.End = Iter.At + (Count * (PartIndex + 1)) / PartCount;
+
+  return Result;
+}
+
 json_element *Next(json_array_iterator *Iter) {
   json_element *Result = NULL;
 
-  if (Iter->CurrentItem) {
-    Result = Iter->CurrentItem->Value;
-    Iter->CurrentItem = Iter->CurrentItem->Next;
+  if (Iter->At != Iter->End) {
+    Result = Iter->At++;
   }
 
   return Result;
@@ -338,3 +457,9 @@ f64 ConvertJSONValueToF64(json_element *Json) {
 
   return atof(Json->Value.Data);
 }
+
+f32 ConvertJSONValueToF32(json_element *Json) {
+  assert(Json->Type == json_value);
+
+  return strtof(Json->Value.Data, NULL);
+}
@@ -0,0 +1,272 @@
+// NOTE(Lucas): A resumable push parser. Feed it the input in pieces of any
+// size and it calls back with one event per token. Nothing but the container
+// stack and the token being assembled is kept between calls, so memory only
+// grows with the nesting depth, never with the input size.
+//
+// Strings are reported raw: escape sequences are kept as they appear in the
+// input.
+
+#define JSON_STREAM_MAX_DEPTH 64
+#define JSON_STREAM_MAX_TOKEN 256
+
+enum json_stream_event_type {
+  JSONEvent_ObjectBegin,
+  JSONEvent_ObjectEnd,
+  JSONEvent_ArrayBegin,
+  JSONEvent_ArrayEnd,
+  JSONEvent_Key,
+  JSONEvent_String,
+  JSONEvent_Number,
+  JSONEvent_Literal,
+};
+
+struct json_stream_event {
+  json_stream_event_type Type;
+  // NOTE(Lucas): Depth of the container that begins/ends, or that holds the
+  // key or value. The root container has depth 1.
+  u32 Depth;
+  // NOTE(Lucas): Zero terminated, only valid during the callback.
+  string Text;
+};
+
+typedef void json_stream_event_fn(void *UserData, json_stream_event *Event);
+
+enum json_stream_state {
+  JSONStream_Value = 0,
+  JSONStream_FirstValueOrEnd,
+  JSONStream_FirstKeyOrEnd,
+  JSONStream_Key,
+  JSONStream_Colon,
+  JSONStream_CommaOrEnd,
+  JSONStream_String,
+  JSONStream_StringEscape,
+  JSONStream_Scalar,
+  JSONStream_Done,
+  JSONStream_Error,
+};
+
+struct json_stream_parser {
+  json_stream_state State;
+  bool IsKey;
+
+  u32 Depth;
+  char Stack[JSON_STREAM_MAX_DEPTH];
+
+  u32 TokenSize;
+  char Token[JSON_STREAM_MAX_TOKEN + 1];
+
+  u64 ConsumedByteCount;
+
+  json_stream_event_fn *Callback;
+  void *UserData;
+};
+
+static void InitJSONStream(json_stream_parser *Parser,
+                           json_stream_event_fn *Callback, void *UserData) {
+  *Parser = {};
+  Parser->Callback = Callback;
+  Parser->UserData = UserData;
+}
+
+static inline bool IsJSONWhitespace(char Character) {
+  return Character == ' ' || Character == '\n' || Character == '\r' ||
+         Character == '\t';
+}
+
+static void EmitJSONStreamEvent(json_stream_parser *Parser,
+                                json_stream_event_type Type, u32 Depth) {
+  Parser->Token[Parser->TokenSize] = 0;
+
+  json_stream_event Event = {
+      .Type = Type,
+      .Depth = Depth,
+      .Text = {.Data = Parser->Token, .Size = Parser->TokenSize}};
+  Parser->Callback(Parser->UserData, &Event);
+
+  Parser->TokenSize = 0;
+}
+
+static void FinishJSONStreamValue(json_stream_parser *Parser) {
+  Parser->State = Parser->Depth ? JSONStream_CommaOrEnd : JSONStream_Done;
+}
+
+static void PushJSONStreamContainer(json_stream_parser *Parser, char Open) {
+  if (Parser->Depth == JSON_STREAM_MAX_DEPTH) {
+    Parser->State = JSONStream_Error;
+    return;
+  }
+
+  Parser->Stack[Parser->Depth++] = Open;
+
+  if (Open == '{') {
+    EmitJSONStreamEvent(Parser, JSONEvent_ObjectBegin, Parser->Depth);
+    Parser->State = JSONStream_FirstKeyOrEnd;
+  } else {
+    EmitJSONStreamEvent(Parser, JSONEvent_ArrayBegin, Parser->Depth);
+    Parser->State = JSONStream_FirstValueOrEnd;
+  }
+}
+
+static void PopJSONStreamContainer(json_stream_parser *Parser, char Close) {
+  char Open = Parser->Depth ? Parser->Stack[Parser->Depth - 1] : 0;
+
+  if ((Close == '}' && Open != '{') || (Close == ']' && Open != '[')) {
+    Parser->State = JSONStream_Error;
+    return;
+  }
+
+  EmitJSONStreamEvent(Parser,
+                      (Close == '}') ? JSONEvent_ObjectEnd : JSONEvent_ArrayEnd,
+                      Parser->Depth);
+  Parser->Depth--;
+  FinishJSONStreamValue(Parser);
+}
+
+static void EmitJSONStreamScalar(json_stream_parser *Parser) {
+  char First = Parser->Token[0];
+  if (First == '-' || __JSON_IS_DIGIT(First)) {
+    EmitJSONStreamEvent(Parser, JSONEvent_Number, Parser->Depth);
+  } else {
+    EmitJSONStreamEvent(Parser, JSONEvent_Literal, Parser->Depth);
+  }
+  FinishJSONStreamValue(Parser);
+}
+
+static inline bool AppendJSONStreamToken(json_stream_parser *Parser,
+                                         char Character) {
+  if (Parser->TokenSize == JSON_STREAM_MAX_TOKEN) {
+    Parser->State = JSONStream_Error;
+    return false;
+  }
+
+  Parser->Token[Parser->TokenSize++] = Character;
+  return true;
+}
+
+// NOTE(Lucas): Returns false when Character ended a scalar and has to be
+// looked at again in the new state.
+static bool StepJSONStream(json_stream_parser *Parser, char Character) {
+  switch (Parser->State) {
+  case JSONStream_String: {
+    if (Character == '"') {
+      if (Parser->IsKey) {
+        EmitJSONStreamEvent(Parser, JSONEvent_Key, Parser->Depth);
+        Parser->State = JSONStream_Colon;
+      } else {
+        EmitJSONStreamEvent(Parser, JSONEvent_String, Parser->Depth);
+        FinishJSONStreamValue(Parser);
+      }
+    } else if (AppendJSONStreamToken(Parser, Character) && Character == '\\') {
+      Parser->State = JSONStream_StringEscape;
+    }
+  } break;
+
+  case JSONStream_StringEscape: {
+    if (AppendJSONStreamToken(Parser, Character)) {
+      Parser->State = JSONStream_String;
+    }
+  } break;
+
+  case JSONStream_Scalar: {
+    if (IsJSONWhitespace(Character) || Character == ',' || Character == '}' ||
+        Character == ']') {
+      EmitJSONStreamScalar(Parser);
+      return false;
+    }
+    AppendJSONStreamToken(Parser, Character);
+  } break;
+
+  default: {
+    if (IsJSONWhitespace(Character)) {
+      break;
+    }
+
+    switch (Parser->State) {
+    case JSONStream_FirstValueOrEnd:
+      if (Character == ']') {
+        PopJSONStreamContainer(Parser, Character);
+        break;
+      }
+      // fallthrough
+    case JSONStream_Value:
+      if (Character == '{' || Character == '[') {
+        PushJSONStreamContainer(Parser, Character);
+      } else if (Character == '"') {
+        Parser->IsKey = false;
+        Parser->State = JSONStream_String;
+      } else if (Character == ',' || Character == ':' || Character == '}' ||
+                 Character == ']') {
+        Parser->State = JSONStream_Error;
+      } else {
+        Parser->State = JSONStream_Scalar;
+        AppendJSONStreamToken(Parser, Character);
+      }
+      break;
+
+    case JSONStream_FirstKeyOrEnd:
+      if (Character == '}') {
+        PopJSONStreamContainer(Parser, Character);
+        break;
+      }
+      // fallthrough
+    case JSONStream_Key:
+      if (Character == '"') {
+        Parser->IsKey = true;
+        Parser->State = JSONStream_String;
+      } else {
+        Parser->State = JSONStream_Error;
+      }
+      break;
+
+    case JSONStream_Colon:
+      Parser->State =
+          (Character == ':') ? JSONStream_Value : JSONStream_Error;
+      break;
+
+    case JSONStream_CommaOrEnd:
+      if (Character == ',') {
+        Parser->State = (Parser->Stack[Parser->Depth - 1] == '{')
+                            ? JSONStream_Key
+                            : JSONStream_Value;
+      } else if (Character == '}' || Character == ']') {
+        PopJSONStreamContainer(Parser, Character);
+      } else {
+        Parser->State = JSONStream_Error;
+      }
+      break;
+
+    default:
+      Parser->State = JSONStream_Error;
+      break;
+    }
+  } break;
+  }
+
+  return true;
+}
+
+// NOTE(Lucas): Returns false once the input is known to be malformed.
+static bool FeedJSONStream(json_stream_parser *Parser, const char *Data,
+                           size_t Size) {
+  size_t Index = 0;
+
+  while (Index < Size && Parser->State != JSONStream_Error) {
+    if (StepJSONStream(Parser, Data[Index])) {
+      Index++;
+    }
+  }
+
+  Parser->ConsumedByteCount += Index;
+
+  return Parser->State != JSONStream_Error;
+}
+
+// NOTE(Lucas): Call after the last piece. Returns true if the input was one
+// complete JSON value.
+static bool FinishJSONStream(json_stream_parser *Parser) {
+  if (Parser->State == JSONStream_Scalar) {
+    EmitJSONStreamScalar(Parser);
+  }
+
+  return Parser->State == JSONStream_Done;
+}
@@ -0,0 +1,342 @@
+// NOTE(Lucas): A flat, lazily decoded alternative to the json_element tree.
+//
+// Parsing only records one 64 bit entry per token into the tape. Strings and
+// numbers keep an offset and a length into the source buffer and are
+// converted when they are read, while the begin entry of every object and
+// array stores the tape index of its matching end entry so a whole container
+// can be skipped in one step.
+//
+// Entry layout: [ type:8 | length:16 | payload:40 ]
+//
+//   '{' '['  payload = tape index of the matching end entry
+//   '}' ']'  payload = number of members/items in the container
+//   '"'      payload = source offset of the first character, length = size
+//   'n'      payload = source offset of the first character, length = size
+//
+// The source buffer has to outlive the tape.
+
+#define __JSON_TAPE_PAYLOAD_BITS 40
+#define __JSON_TAPE_LENGTH_BITS 16
+#define __JSON_TAPE_PAYLOAD_MASK ((1ull << __JSON_TAPE_PAYLOAD_BITS) - 1)
+#define __JSON_TAPE_LENGTH_MASK ((1ull << __JSON_TAPE_LENGTH_BITS) - 1)
+
+enum json_tape_type : u8 {
+  JSONTape_ObjectBegin = '{',
+  JSONTape_ObjectEnd = '}',
+  JSONTape_ArrayBegin = '[',
+  JSONTape_ArrayEnd = ']',
+  JSONTape_String = '"',
+  JSONTape_Number = 'n',
+};
+
+struct json_tape {
+  const char *Source;
+  u64 *Entries;
+  u64 Count;
+  u64 Capacity;
+};
+
+struct json_tape_value {
+  json_tape *Tape;
+  u64 Index;
+
+  explicit operator bool() const { return Tape != NULL; }
+};
+
+struct json_tape_array_iterator {
+  json_tape *Tape;
+  u64 At;
+  u64 End;
+};
+
+static inline json_tape_type JSONTapeType(u64 Entry) {
+  return (json_tape_type)(Entry >> (__JSON_TAPE_PAYLOAD_BITS +
+                                    __JSON_TAPE_LENGTH_BITS));
+}
+
+static inline u64 JSONTapeLength(u64 Entry) {
+  return (Entry >> __JSON_TAPE_PAYLOAD_BITS) & __JSON_TAPE_LENGTH_MASK;
+}
+
+static inline u64 JSONTapePayload(u64 Entry) {
+  return Entry & __JSON_TAPE_PAYLOAD_MASK;
+}
+
+static u64 AppendTapeEntry(json_tape *Tape, json_tape_type Type, u64 Length,
+                           u64 Payload) {
+  if (Tape->Count == Tape->Capacity) {
+    Tape->Capacity = Tape->Capacity ? 2 * Tape->Capacity : 1024;
+    Tape->Entries =
+        (u64 *)ProfiledRealloc(Tape->Entries, Tape->Capacity * sizeof(u64));
+  }
+
+  u64 Index = Tape->Count++;
+  Tape->Entries[Index] =
+      ((u64)Type << (__JSON_TAPE_PAYLOAD_BITS + __JSON_TAPE_LENGTH_BITS)) |
+      (Length << __JSON_TAPE_PAYLOAD_BITS) | Payload;
+
+  return Index;
+}
+
+static inline void PatchTapePayload(json_tape *Tape, u64 Index, u64 Payload) {
+  Tape->Entries[Index] =
+      (Tape->Entries[Index] & ~__JSON_TAPE_PAYLOAD_MASK) | Payload;
+}
+
+static bool TapeValue(__json_parse_context *Context, json_tape *Tape);
+
+static bool TapeString(__json_parse_context *Context, json_tape *Tape) {
+  if (!Expect(Context, '"'))
+    return false;
+
+  size_t StartOffset = Context->Offset;
+
+  char Peeked = 0;
+  while ((Peeked = Peek(Context)) && Peeked != '"') {
+    Advance(Context);
+  }
+
+  size_t Length = Context->Offset - StartOffset;
+  if (!Expect(Context, '"') || Length > __JSON_TAPE_LENGTH_MASK)
+    return false;
+
+  AppendTapeEntry(Tape, JSONTape_String, Length, StartOffset);
+
+  return true;
+}
+
+static bool TapeContainer(__json_parse_context *Context, json_tape *Tape,
+                          bool IsObject) {
+  char Open = IsObject ? '{' : '[';
+  char Close = IsObject ? '}' : ']';
+
+  if (!Expect(Context, Open))
+    return false;
+
+  u64 BeginIndex = AppendTapeEntry(
+      Tape, IsObject ? JSONTape_ObjectBegin : JSONTape_ArrayBegin, 0, 0);
+  u64 MemberCount = 0;
+
+  EatWhitespace(Context);
+  if (Peek(Context) != Close) {
+    do {
+      EatWhitespace(Context);
+
+      if (IsObject) {
+        if (!TapeString(Context, Tape))
+          return false;
+
+        EatWhitespace(Context);
+        if (!Expect(Context, ':'))
+          return false;
+      }
+
+      if (!TapeValue(Context, Tape))
+        return false;
+
+      MemberCount++;
+      EatWhitespace(Context);
+    } while (Expect(Context, ','));
+  }
+
+  EatWhitespace(Context);
+  if (!Expect(Context, Close))
+    return false;
+
+  u64 EndIndex = AppendTapeEntry(
+      Tape, IsObject ? JSONTape_ObjectEnd : JSONTape_ArrayEnd, 0, MemberCount);
+  PatchTapePayload(Tape, BeginIndex, EndIndex);
+
+  return true;
+}
+
+static bool TapeValue(__json_parse_context *Context, json_tape *Tape) {
+  EatWhitespace(Context);
+
+  bool Result = false;
+
+  char PeekedCharacter = Peek(Context);
+
+  if (PeekedCharacter == '[') {
+    Result = TapeContainer(Context, Tape, false);
+  } else if (PeekedCharacter == '{') {
+    Result = TapeContainer(Context, Tape, true);
+  } else if (PeekedCharacter == '"') {
+    Result = TapeString(Context, Tape);
+  } else {
+    size_t StartOffset = Context->Offset;
+
+    char Character = 0;
+
+    if (Peek(Context) == '-') {
+      Advance(Context);
+    }
+
+    while ((Character = Peek(Context)) && __JSON_IS_DIGIT(Character)) {
+      Advance(Context);
+    }
+
+    if (Character == '.') {
+      Advance(Context);
+      while ((Character = Peek(Context)) && __JSON_IS_DIGIT(Character)) {
+        Advance(Context);
+      }
+    }
+
+    size_t Length = Context->Offset - StartOffset;
+    if (Length && Length <= __JSON_TAPE_LENGTH_MASK) {
+      AppendTapeEntry(Tape, JSONTape_Number, Length, StartOffset);
+      Result = true;
+    }
+  }
+
+  return Result;
+}
+
+static void FreeJSONTape(json_tape *Tape) {
+  assert(Tape != NULL);
+
+  free(Tape->Entries);
+  free(Tape);
+}
+
+// NOTE(Lucas): Parses into Tape, keeping the entries of an earlier parse
+// when they are big enough. Lets a loop over many files parse without
+// allocating once the tape has grown to the biggest of them.
+static bool ParseJSONTapeInto(json_tape *Tape, const char *Content,
+                              size_t Size) {
+  __json_parse_context Context = {.Content = Content, .ContentSize = Size};
+
+  Tape->Source = Content;
+  Tape->Count = 0;
+
+  // NOTE(Lucas): Offsets have to fit in the payload bits.
+  bool IsValid = (Size <= __JSON_TAPE_PAYLOAD_MASK);
+
+  if (IsValid) {
+    // NOTE(Lucas): A generated pair takes ~70 bytes of text and 10 entries.
+    u64 Capacity = Size / 7 + 16;
+    if (Tape->Capacity < Capacity) {
+      free(Tape->Entries);
+      Tape->Capacity = Capacity;
+      Tape->Entries = (u64 *)ProfiledMalloc(Tape->Capacity * sizeof(u64));
+    }
+
+    EatWhitespace(&Context);
+    IsValid = TapeContainer(&Context, Tape, true);
+  }
+
+  return IsValid;
+}
+
+static json_tape *ParseJSONTape(const char *Content, size_t Size) {
+  json_tape *Tape = (json_tape *)ProfiledCalloc(1, sizeof(json_tape));
+
+  if (!ParseJSONTapeInto(Tape, Content, Size)) {
+    FreeJSONTape(Tape);
+    Tape = NULL;
+  }
+
+  return Tape;
+}
+
+json_tape_value JSONTapeRoot(json_tape *Tape) {
+  return {.Tape = Tape, .Index = 0};
+}
+
+static inline json_tape_type JSONTapeType(json_tape_value Json) {
+  return JSONTapeType(Json.Tape->Entries[Json.Index]);
+}
+
+// NOTE(Lucas): Index of the entry right after the value at Index, skipping
+// nested containers in one step.
+static inline u64 SkipTapeValue(json_tape *Tape, u64 Index) {
+  u64 Entry = Tape->Entries[Index];
+  json_tape_type Type = JSONTapeType(Entry);
+
+  if (Type == JSONTape_ObjectBegin || Type == JSONTape_ArrayBegin) {
+    return JSONTapePayload(Entry) + 1;
+  }
+
+  return Index + 1;
+}
+
+static inline bool TapeStringEqual(json_tape *Tape, u64 Index, string Key) {
+  u64 Entry = Tape->Entries[Index];
+
+  return JSONTapeLength(Entry) == Key.Size &&
+         memcmp(Tape->Source + JSONTapePayload(Entry), Key.Data, Key.Size) ==
+             0;
+}
+
+json_tape_value GetKey(json_tape_value Json, string Key) {
+  TimeFunction;
+  json_tape_value Result = {0};
+
+  if (Json.Tape && JSONTapeType(Json) == JSONTape_ObjectBegin) {
+    json_tape *Tape = Json.Tape;
+    u64 End = JSONTapePayload(Tape->Entries[Json.Index]);
+
+    for (u64 Index = Json.Index + 1; Index < End;
+         Index = SkipTapeValue(Tape, Index + 1)) {
+      if (TapeStringEqual(Tape, Index, Key)) {
+        Result = {.Tape = Tape, .Index = Index + 1};
+        break;
+      }
+    }
+  }
+
+  return Result;
+}
+
+json_tape_value GetKey(json_tape_value Json, const json_key *Key) {
+  return GetKey(Json, Key->Key);
+}
+
+u64 JSONArrayCount(json_tape_value Json) {
+  u64 Result = 0;
+
+  if (Json.Tape && JSONTapeType(Json) == JSONTape_ArrayBegin) {
+    u64 End = JSONTapePayload(Json.Tape->Entries[Json.Index]);
+    Result = JSONTapePayload(Json.Tape->Entries[End]);
+  }
+
+  return Result;
+}
+
+json_tape_array_iterator MakeJSONArrayIterator(json_tape_value Json) {
+  json_tape_array_iterator Result = {0};
+
+  if (Json.Tape && JSONTapeType(Json) == JSONTape_ArrayBegin) {
+    Result.Tape = Json.Tape;
+    Result.At = Json.Index + 1;
+    Result.End = JSONTapePayload(Json.Tape->Entries[Json.Index]);
+  }
+
+  return Result;
+}
+
+json_tape_value Next(json_tape_array_iterator *Iter) {
+  json_tape_value Result = {0};
+
+  if (Iter->At != Iter->End) {
+    Result = {.Tape = Iter->Tape, .Index = Iter->At};
+    Iter->At = SkipTapeValue(Iter->Tape, Iter->At);
+  }
+
+  return Result;
+}
+
+f64 ConvertJSONValueToF64(json_tape_value Json) {
+  assert(JSONTapeType(Json) == JSONTape_Number);
+
+  u64 Entry = Json.Tape->Entries[Json.Index];
+  return atof(Json.Tape->Source + JSONTapePayload(Entry));
+}
+
+f32 ConvertJSONValueToF32(json_tape_value Json) {
+  assert(JSONTapeType(Json) == JSONTape_Number);
+
+  u64 Entry = Json.Tape->Entries[Json.Index];
+  return strtof(Json.Tape->Source + JSONTapePayload(Entry), NULL);
+}
@@ -0,0 +1,316 @@
+// NOTE(Lucas): Repetition tests for the pair layouts in pair_layouts.cpp,
+// to pick the one to keep in memory and on disk. Three groups:
+//
+//   parse      the whole way from the JSON bytes (already in memory) through
+//              the tape parser into a layout, then the f64 sum. Either
+//              appending straight into the layout or collecting AoS and
+//              transposing afterwards.
+//   sum        the sum alone over a layout that is already built, with the
+//              f64 reference haversine and with the f32 polynomial one.
+//   convert    each conversion on its own, with every transpose kernel the
+//              CPU runs.
+//
+// Bandwidth is the size of the JSON for parse and of the pairs (32 bytes
+// each) for sum and convert.
+
+#define LAYOUT_TARGET_SECONDS 5
+
+struct layout_test_data {
+  buffer Contents;
+  json_tape Tape;
+  pair_transpose_kernels Kernels;
+
+  // NOTE(Lucas): Built once up front, the sum and convert tests read them.
+  haversine_pairs_aos AoS;
+  haversine_pairs SoA;
+  haversine_pairs_aosoa AoSoA;
+
+  // NOTE(Lucas): Written by the parse and convert tests, reused between
+  // repetitions so only the first one allocates.
+  haversine_pairs_aos ScratchAoS;
+  haversine_pairs ScratchSoA;
+  haversine_pairs_aosoa ScratchAoSoA;
+
+  // NOTE(Lucas): Where the tests leave their sum, so it can't be dropped.
+  f64 Sum;
+};
+
+typedef u64 layout_test_fn(layout_test_data *Data);
+
+struct layout_test {
+  const char *Group;
+  const char *Name;
+  layout_test_fn *Function;
+
+  // NOTE(Lucas): Only the convert tests depend on the kernels, the others
+  // run once with whatever Data->Kernels is.
+  bool UsesKernels;
+};
+
+static bool ParseLayoutFile(layout_test_data *Data, haversine_pair_fn *Append,
+                            void *Pairs) {
+  bool IsParsed = ParseJSONTapeInto(&Data->Tape, (char *)Data->Contents.Data,
+                                    Data->Contents.Size);
+  json_tape_value PairsData =
+      IsParsed ? GetKey(JSONTapeRoot(&Data->Tape), STRING("pairs"))
+               : json_tape_value{};
+  if (PairsData) {
+    ForEachPair(PairsData, Append, Pairs);
+  }
+
+  return (bool)PairsData;
+}
+
+template <typename pairs_type>
+static f64 SumLayoutF64(pairs_type *Pairs) {
+  return SumHaversineLayout<pairs_type, false>(Pairs, EARTH_RADIUS,
+                                               false);
+}
+
+template <typename pairs_type>
+static f64 SumLayoutF32(pairs_type *Pairs) {
+  return SumHaversineLayout<pairs_type, true>(Pairs, EARTH_RADIUS,
+                                              false);
+}
+
+static u64 ParseIntoAoS(layout_test_data *Data) {
+  Data->ScratchAoS.Count = 0;
+  ParseLayoutFile(Data, AppendPairAoS, &Data->ScratchAoS);
+  Data->Sum = SumLayoutF64(&Data->ScratchAoS);
+  return Data->Contents.Size;
+}
+
+static u64 ParseIntoSoA(layout_test_data *Data) {
+  Data->ScratchSoA.Count = 0;
+  ParseLayoutFile(Data, AppendPair, &Data->ScratchSoA);
+  Data->Sum = SumLayoutF64(&Data->ScratchSoA);
+  return Data->Contents.Size;
+}
+
+static u64 ParseIntoAoSoA(layout_test_data *Data) {
+  Data->ScratchAoSoA.Count = 0;
+  ParseLayoutFile(Data, AppendPairAoSoA, &Data->ScratchAoSoA);
+  Data->Sum = SumLayoutF64(&Data->ScratchAoSoA);
+  return Data->Contents.Size;
+}
+
+static u64 ParseAoSThenSoA(layout_test_data *Data) {
+  Data->ScratchAoS.Count = 0;
+  ParseLayoutFile(Data, AppendPairAoS, &Data->ScratchAoS);
+  ConvertAoSToSoA(&Data->ScratchAoS, &Data->ScratchSoA, &Data->Kernels);
+  Data->Sum = SumLayoutF64(&Data->ScratchSoA);
+  return Data->Contents.Size;
+}
+
+static u64 ParseAoSThenAoSoA(layout_test_data *Data) {
+  Data->ScratchAoS.Count = 0;
+  ParseLayoutFile(Data, AppendPairAoS, &Data->ScratchAoS);
+  ConvertAoSToAoSoA(&Data->ScratchAoS, &Data->ScratchAoSoA, &Data->Kernels);
+  Data->Sum = SumLayoutF64(&Data->ScratchAoSoA);
+  return Data->Contents.Size;
+}
+
+static u64 SumAoSF64(layout_test_data *Data) {
+  Data->Sum = SumLayoutF64(&Data->AoS);
+  return Data->AoS.Count * sizeof(haversine_pair);
+}
+
+static u64 SumSoAF64(layout_test_data *Data) {
+  Data->Sum = SumLayoutF64(&Data->SoA);
+  return Data->SoA.Count * sizeof(haversine_pair);
+}
+
+static u64 SumAoSoAF64(layout_test_data *Data) {
+  Data->Sum = SumLayoutF64(&Data->AoSoA);
+  return Data->AoSoA.Count * sizeof(haversine_pair);
+}
+
+static u64 SumAoSF32(layout_test_data *Data) {
+  Data->Sum = SumLayoutF32(&Data->AoS);
+  return Data->AoS.Count * sizeof(haversine_pair);
+}
+
+static u64 SumSoAF32(layout_test_data *Data) {
+  Data->Sum = SumLayoutF32(&Data->SoA);
+  return Data->SoA.Count * sizeof(haversine_pair);
+}
+
+static u64 SumAoSoAF32(layout_test_data *Data) {
+  Data->Sum = SumLayoutF32(&Data->AoSoA);
+  return Data->AoSoA.Count * sizeof(haversine_pair);
+}
+
+static u64 ConvertAoSToSoATest(layout_test_data *Data) {
+  ConvertAoSToSoA(&Data->AoS, &Data->ScratchSoA, &Data->Kernels);
+  return Data->AoS.Count * sizeof(haversine_pair);
+}
+
+static u64 ConvertSoAToAoSTest(layout_test_data *Data) {
+  ConvertSoAToAoS(&Data->SoA, &Data->ScratchAoS, &Data->Kernels);
+  return Data->SoA.Count * sizeof(haversine_pair);
+}
+
+static u64 ConvertAoSToAoSoATest(layout_test_data *Data) {
+  ConvertAoSToAoSoA(&Data->AoS, &Data->ScratchAoSoA, &Data->Kernels);
+  return Data->AoS.Count * sizeof(haversine_pair);
+}
+
+static u64 ConvertAoSoAToAoSTest(layout_test_data *Data) {
+  ConvertAoSoAToAoS(&Data->AoSoA, &Data->ScratchAoS, &Data->Kernels);
+  return Data->AoSoA.Count * sizeof(haversine_pair);
+}
+
+static u64 ConvertSoAToAoSoATest(layout_test_data *Data) {
+  ConvertSoAToAoSoA(&Data->SoA, &Data->ScratchAoSoA);
+  return Data->SoA.Count * sizeof(haversine_pair);
+}
+
+static u64 ConvertAoSoAToSoATest(layout_test_data *Data) {
+  ConvertAoSoAToSoA(&Data->AoSoA, &Data->ScratchSoA);
+  return Data->AoSoA.Count * sizeof(haversine_pair);
+}
+
+static bool PairsMatchAoS(haversine_pairs_aos *A, haversine_pairs_aos *B) {
+  return A->Count == B->Count &&
+         memcmp(A->Pairs, B->Pairs, A->Count * sizeof(haversine_pair)) == 0;
+}
+
+// NOTE(Lucas): Every layout has to give the exact same sums, and every
+// conversion has to come back to the parsed pairs bit for bit, before any
+// of the timings mean anything.
+static bool CheckPairLayouts(layout_test_data *Data) {
+  bool IsValid = true;
+
+  f64 F64Sums[] = {SumLayoutF64(&Data->AoS), SumLayoutF64(&Data->SoA),
+                   SumLayoutF64(&Data->AoSoA)};
+  f64 F32Sums[] = {SumLayoutF32(&Data->AoS), SumLayoutF32(&Data->SoA),
+                   SumLayoutF32(&Data->AoSoA)};
+  for (u32 Index = 1; Index < ArrayCount(F64Sums); ++Index) {
+    IsValid &= memcmp(F64Sums + Index, F64Sums, sizeof(f64)) == 0;
+    IsValid &= memcmp(F32Sums + Index, F32Sums, sizeof(f64)) == 0;
+  }
+  printf("Sums: f64 %.16f, f32 %.16f (%s across layouts)\n",
+         F64Sums[0] / (f64)Max(Data->AoS.Count, 1),
+         F32Sums[0] / (f64)Max(Data->AoS.Count, 1),
+         IsValid ? "identical" : "DIFFERENT");
+
+  for (u32 ISA = 0; ISA < PairTranspose_COUNT; ++ISA) {
+    if (!PairTransposeIsSupported((pair_transpose_isa)ISA)) {
+      continue;
+    }
+
+    pair_transpose_kernels Kernels =
+        GetPairTransposeKernels((pair_transpose_isa)ISA);
+    haversine_pairs SoA = {};
+    haversine_pairs_aos AoS = {};
+    haversine_pairs_aosoa AoSoA = {};
+
+    ConvertAoSToSoA(&Data->AoS, &SoA, &Kernels);
+    ConvertSoAToAoS(&SoA, &AoS, &Kernels);
+    bool RoundTrips = PairsMatchAoS(&AoS, &Data->AoS);
+
+    ConvertAoSToAoSoA(&Data->AoS, &AoSoA, &Kernels);
+    ConvertAoSoAToSoA(&AoSoA, &SoA);
+    ConvertSoAToAoSoA(&SoA, &AoSoA);
+    ConvertAoSoAToAoS(&AoSoA, &AoS, &Kernels);
+    RoundTrips &= PairsMatchAoS(&AoS, &Data->AoS);
+
+    printf("Transpose %s: %s\n", Kernels.Name,
+           RoundTrips ? "round trips" : "MISMATCH");
+    IsValid &= RoundTrips;
+
+    FreePairs(&SoA);
+    FreePairsAoS(&AoS);
+    FreePairsAoSoA(&AoSoA);
+  }
+
+  return IsValid;
+}
+
+static void RunLayoutTest(layout_test *Test, layout_test_data *Data,
+                          stop_rule StopRule, u64 CPUTimerFrequency) {
+  // NOTE(Lucas): Too big for the stack with the sample ring.
+  static test_context Context;
+  Context = {};
+  Context.StopRule = StopRule;
+  Context.TargetTime = LAYOUT_TARGET_SECONDS * CPUTimerFrequency;
+
+  while (IsTesting(&Context)) {
+    BeginTime(&Context);
+    u64 ByteCount = Test->Function(Data);
+    EndTime(&Context);
+    CountBytes(&Context, ByteCount);
+  }
+
+  printf("\n--- %s: %s%s%s ---\n", Test->Group, Test->Name,
+         Test->UsesKernels ? ", " : "",
+         Test->UsesKernels ? Data->Kernels.Name : "");
+  PrintTestResults(Context.Results, CPUTimerFrequency);
+  PrintSampleStatistics(&Context, CPUTimerFrequency);
+}
+
+static bool PrepareLayoutTests(layout_test_data *Data, const char *Filepath,
+                               u64 FileSize) {
+  *Data = {};
+  Data->Contents = LoadAlignedCopy(Filepath, FileSize);
+  Data->Kernels = GetBestPairTransposeKernels();
+
+  bool IsValid = Data->Contents.Data &&
+                 ParseLayoutFile(Data, AppendPairAoS, &Data->AoS);
+  if (IsValid) {
+    ConvertAoSToSoA(&Data->AoS, &Data->SoA, &Data->Kernels);
+    ConvertAoSToAoSoA(&Data->AoS, &Data->AoSoA, &Data->Kernels);
+
+    printf("Layouts: %llu pairs, %llu bytes of JSON, %s transposes\n",
+           Data->AoS.Count, (u64)Data->Contents.Size, Data->Kernels.Name);
+    IsValid = CheckPairLayouts(Data);
+  } else {
+    fprintf(stderr, "ERROR: %s is not a haversine pairs file.\n", Filepath);
+  }
+
+  return IsValid;
+}
+
+static void RunLayoutTests(layout_test_data *Data, stop_rule StopRule,
+                           u64 CPUTimerFrequency) {
+  layout_test Tests[] = {
+      {"parse", "AoS", ParseIntoAoS},
+      {"parse", "SoA", ParseIntoSoA},
+      {"parse", "AoSoA", ParseIntoAoSoA},
+      {"parse", "AoS then transpose to SoA", ParseAoSThenSoA},
+      {"parse", "AoS then transpose to AoSoA", ParseAoSThenAoSoA},
+      {"sum", "AoS f64", SumAoSF64},
+      {"sum", "SoA f64", SumSoAF64},
+      {"sum", "AoSoA f64", SumAoSoAF64},
+      {"sum", "AoS f32", SumAoSF32},
+      {"sum", "SoA f32", SumSoAF32},
+      {"sum", "AoSoA f32", SumAoSoAF32},
+      {"convert", "AoS to SoA", ConvertAoSToSoATest, true},
+      {"convert", "SoA to AoS", ConvertSoAToAoSTest, true},
+      {"convert", "AoS to AoSoA", ConvertAoSToAoSoATest, true},
+      {"convert", "AoSoA to AoS", ConvertAoSoAToAoSTest, true},
+      {"convert", "SoA to AoSoA", ConvertSoAToAoSoATest},
+      {"convert", "AoSoA to SoA", ConvertAoSoAToSoATest},
+  };
+
+  pair_transpose_kernels Best = Data->Kernels;
+
+  for (u32 Index = 0; Index < ArrayCount(Tests); ++Index) {
+    layout_test *Test = Tests + Index;
+
+    if (!Test->UsesKernels) {
+      Data->Kernels = Best;
+      RunLayoutTest(Test, Data, StopRule, CPUTimerFrequency);
+      continue;
+    }
+
+    for (u32 ISA = 0; ISA < PairTranspose_COUNT; ++ISA) {
+      if (PairTransposeIsSupported((pair_transpose_isa)ISA)) {
+        Data->Kernels = GetPairTransposeKernels((pair_transpose_isa)ISA);
+        RunLayoutTest(Test, Data, StopRule, CPUTimerFrequency);
+      }
+    }
+  }
+
+  Data->Kernels = Best;
+}
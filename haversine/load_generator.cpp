@@ -0,0 +1,253 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "haversine_protocol.hpp"
+#include "os.cpp"
+
+enum load_mode {
+  LoadMode_Invalid = 0,
+  LoadMode_Range,
+  LoadMode_Distances,
+  LoadMode_Shutdown
+};
+
+struct options {
+  const char *SocketPath;
+  load_mode Mode;
+  u64 RequestCount;
+  u64 Depth;
+  u64 BatchSize;
+  bool IsValid;
+};
+
+static void PrintUsage(const char *ProgramName) {
+  fprintf(stderr, "Usage: %s SOCKET MODE [REQUESTS [DEPTH [BATCH]]]\n\n",
+          ProgramName);
+  fprintf(stderr, "SOCKET\tUnix socket of a ComputeHaversineAverage --serve.\n");
+  fprintf(stderr, "MODE\t'range' (sum BATCH pairs of dataset 0 at a random "
+                  "offset), 'distances' (send BATCH random pairs) or "
+                  "'shutdown'.\n");
+  fprintf(stderr, "REQUESTS\tNumber of requests to send (default 100000).\n");
+  fprintf(stderr, "DEPTH\tRequests kept in flight (default 16).\n");
+  fprintf(stderr, "BATCH\tPairs per request (default 64).\n");
+}
+
+static options ParseCommandLineOptions(int ArgCount, char *Args[]) {
+  options Result = {.RequestCount = 100000, .Depth = 16, .BatchSize = 64};
+
+  if (ArgCount >= 3 && ArgCount <= 6) {
+    Result.SocketPath = Args[1];
+
+    if (strcmp(Args[2], "range") == 0) {
+      Result.Mode = LoadMode_Range;
+    } else if (strcmp(Args[2], "distances") == 0) {
+      Result.Mode = LoadMode_Distances;
+    } else if (strcmp(Args[2], "shutdown") == 0) {
+      Result.Mode = LoadMode_Shutdown;
+    }
+
+    if (ArgCount > 3) {
+      Result.RequestCount = strtoull(Args[3], NULL, 10);
+    }
+    if (ArgCount > 4) {
+      Result.Depth = strtoull(Args[4], NULL, 10);
+    }
+    if (ArgCount > 5) {
+      Result.BatchSize = strtoull(Args[5], NULL, 10);
+    }
+
+    Result.IsValid = Result.Mode != LoadMode_Invalid && Result.RequestCount &&
+                     Result.Depth && Result.BatchSize &&
+                     Result.BatchSize <= HAVERSINE_MAX_DISTANCES_PER_REQUEST;
+  }
+
+  return Result;
+}
+
+static bool WriteAll(int FileDescriptor, const void *Data, size_t Size) {
+  const u8 *At = (const u8 *)Data;
+
+  while (Size) {
+    ssize_t Written = write(FileDescriptor, At, Size);
+    if (Written <= 0) {
+      return false;
+    }
+    At += Written;
+    Size -= Written;
+  }
+
+  return true;
+}
+
+static bool ReadAll(int FileDescriptor, void *Data, size_t Size) {
+  u8 *At = (u8 *)Data;
+
+  while (Size) {
+    ssize_t ReadByteCount = read(FileDescriptor, At, Size);
+    if (ReadByteCount <= 0) {
+      return false;
+    }
+    At += ReadByteCount;
+    Size -= ReadByteCount;
+  }
+
+  return true;
+}
+
+static int ConnectToServer(const char *SocketPath) {
+  struct sockaddr_un Address = {};
+  Address.sun_family = AF_UNIX;
+  strncpy(Address.sun_path, SocketPath, sizeof(Address.sun_path) - 1);
+
+  int FileDescriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FileDescriptor != -1 &&
+      connect(FileDescriptor, (struct sockaddr *)&Address, sizeof(Address)) !=
+          0) {
+    close(FileDescriptor);
+    FileDescriptor = -1;
+  }
+
+  return FileDescriptor;
+}
+
+static f64 RandomDegrees(f64 Range) {
+  return ((f64)rand() / RAND_MAX - 0.5) * 2 * Range;
+}
+
+static int CompareU64(const void *A, const void *B) {
+  u64 X = *(const u64 *)A;
+  u64 Y = *(const u64 *)B;
+  return (X > Y) - (X < Y);
+}
+
+static f64 Percentile(u64 *Sorted, u64 Count, f64 Fraction) {
+  u64 Index = (u64)(Fraction * (f64)(Count - 1) + 0.5);
+  return (f64)Sorted[Index];
+}
+
+int main(int ArgCount, char *Args[]) {
+  options Options = ParseCommandLineOptions(ArgCount, Args);
+
+  if (!Options.IsValid) {
+    PrintUsage(Args[0]);
+    return 1;
+  }
+
+  int Server = ConnectToServer(Options.SocketPath);
+  if (Server == -1) {
+    fprintf(stderr, "Could not connect to %s\n", Options.SocketPath);
+    return 1;
+  }
+
+  response_header Response;
+
+  if (Options.Mode == LoadMode_Shutdown) {
+    request_header Request = {.Type = Request_Shutdown};
+    bool Result = WriteAll(Server, &Request, sizeof(Request)) &&
+                  ReadAll(Server, &Response, sizeof(Response));
+    close(Server);
+    return Result ? 0 : 1;
+  }
+
+  u64 CPUTimerFrequency = EstimateCPUFrequency();
+
+  u64 PairCount = 0;
+  {
+    request_header Request = {.Type = Request_Info};
+    if (!WriteAll(Server, &Request, sizeof(Request)) ||
+        !ReadAll(Server, &Response, sizeof(Response)) ||
+        Response.Status != Response_OK) {
+      fprintf(stderr, "Server did not answer the info request\n");
+      return 1;
+    }
+    PairCount = Response.Count;
+  }
+
+  if (Options.Mode == LoadMode_Range && PairCount < Options.BatchSize) {
+    fprintf(stderr, "Dataset 0 only has %llu pairs\n", PairCount);
+    return 1;
+  }
+
+  srand(1234);
+
+  // NOTE(Lucas): Responses come back in order, so the send time of request N
+  // is all we need to know its latency.
+  u64 *SendTimes = (u64 *)malloc(Options.RequestCount * sizeof(u64));
+  u64 *Latencies = (u64 *)malloc(Options.RequestCount * sizeof(u64));
+
+  size_t PayloadSize = (Options.Mode == LoadMode_Distances)
+                           ? Options.BatchSize * sizeof(request_pair)
+                           : 0;
+  u8 *RequestBuffer = (u8 *)malloc(sizeof(request_header) + PayloadSize);
+  f64 *Distances = (f64 *)malloc(Options.BatchSize * sizeof(f64));
+
+  u64 SentCount = 0;
+  u64 ReceivedCount = 0;
+  u64 FailedCount = 0;
+
+  u64 StartCounter = ReadCPUTimer();
+
+  while (ReceivedCount < Options.RequestCount) {
+    while (SentCount < Options.RequestCount &&
+           SentCount - ReceivedCount < Options.Depth) {
+      request_header Request = {.Count = Options.BatchSize};
+
+      if (Options.Mode == LoadMode_Range) {
+        Request.Type = Request_RangeSum;
+        Request.First = (u64)rand() % (PairCount - Options.BatchSize + 1);
+      } else {
+        Request.Type = Request_Distances;
+        request_pair *Pairs = (request_pair *)(RequestBuffer + sizeof(Request));
+        for (u64 Index = 0; Index < Options.BatchSize; ++Index) {
+          Pairs[Index] = {RandomDegrees(180), RandomDegrees(90),
+                          RandomDegrees(180), RandomDegrees(90)};
+        }
+      }
+      memcpy(RequestBuffer, &Request, sizeof(Request));
+
+      SendTimes[SentCount++] = ReadCPUTimer();
+      if (!WriteAll(Server, RequestBuffer, sizeof(Request) + PayloadSize)) {
+        fprintf(stderr, "Lost the connection while sending\n");
+        return 1;
+      }
+    }
+
+    if (!ReadAll(Server, &Response, sizeof(Response)) ||
+        (Response.Type == Request_Distances && Response.Status == Response_OK &&
+         !ReadAll(Server, Distances, Response.Count * sizeof(f64)))) {
+      fprintf(stderr, "Lost the connection while receiving\n");
+      return 1;
+    }
+
+    Latencies[ReceivedCount] = ReadCPUTimer() - SendTimes[ReceivedCount];
+    FailedCount += (Response.Status != Response_OK);
+    ReceivedCount++;
+  }
+
+  u64 Elapsed = ReadCPUTimer() - StartCounter;
+
+  close(Server);
+
+  qsort(Latencies, Options.RequestCount, sizeof(u64), CompareU64);
+
+  f64 Seconds = (f64)Elapsed / (f64)CPUTimerFrequency;
+  f64 Microseconds = 1000000.0 / (f64)CPUTimerFrequency;
+
+  printf("%llu requests (%llu failed), depth %llu, %llu pairs each\n",
+         Options.RequestCount, FailedCount, Options.Depth, Options.BatchSize);
+  printf("Throughput: %.0f requests/s, %.0f pairs/s\n",
+         Options.RequestCount / Seconds,
+         Options.RequestCount * Options.BatchSize / Seconds);
+  printf("Latency: p50 %.2fus, p99 %.2fus, p99.9 %.2fus, max %.2fus\n",
+         Percentile(Latencies, Options.RequestCount, 0.50) * Microseconds,
+         Percentile(Latencies, Options.RequestCount, 0.99) * Microseconds,
+         Percentile(Latencies, Options.RequestCount, 0.999) * Microseconds,
+         Latencies[Options.RequestCount - 1] * Microseconds);
+
+  return FailedCount ? 1 : 0;
+}
@@ -0,0 +1,393 @@
+// NOTE(Lucas): Small inline assembly kernels that measure the machine's basic
+// limits: loads and stores per cycle at each width, dependent versus
+// independent chains, branch patterns and loop alignment. They are the ground
+// truth for tuning the parser's byte loop and the haversine kernels.
+//
+// The CPU timer is not the core clock (the TSC runs at a fixed rate), so the
+// results are converted with a dependent add chain: one add per core cycle on
+// every x86 we care about. Run with --warmup so the clock is settled first.
+//
+// x86-64 only, the kernels are written in AT&T syntax for gcc and clang.
+
+#if __x86_64__
+
+#include <cpuid.h>
+
+#define PROBE_ITERATION_COUNT (1024 * 1024)
+#define PROBE_TARGET_SECONDS 1
+#define PROBE_DATA_SIZE (PROBE_ITERATION_COUNT + 4096)
+
+typedef void probe_fn(u64 Count, u8 *Data);
+
+// NOTE(Lucas): Every kernel runs Body Count times. The loop is 64 byte
+// aligned, so only the alignment probes see different code placement.
+#define PROBE_KERNEL(Name, Prologue, Body, Epilogue)                           \
+  static void Name(u64 Count, u8 *Data) {                                      \
+    asm volatile(Prologue ".p2align 6\n"                                       \
+                          "1:\n\t" Body "sub $1, %[Count]\n\t"                 \
+                          "jnz 1b\n\t" Epilogue                                \
+                 : [Count] "+r"(Count)                                         \
+                 : [Data] "r"(Data)                                            \
+                 : "rax", "rcx", "rdx", "rsi", "rdi", "xmm0", "xmm1", "xmm2",  \
+                   "xmm3", "xmm4", "memory", "cc");                            \
+  }
+
+#define PROBE_REPEAT1(X) X
+#define PROBE_REPEAT2(X) X X
+#define PROBE_REPEAT3(X) X X X
+#define PROBE_REPEAT4(X) X X X X
+
+#define PROBE_WIDTH(Name, Instruction, Epilogue)                               \
+  PROBE_KERNEL(Name##x1, "", PROBE_REPEAT1(Instruction), Epilogue)             \
+  PROBE_KERNEL(Name##x2, "", PROBE_REPEAT2(Instruction), Epilogue)             \
+  PROBE_KERNEL(Name##x3, "", PROBE_REPEAT3(Instruction), Epilogue)             \
+  PROBE_KERNEL(Name##x4, "", PROBE_REPEAT4(Instruction), Epilogue)
+
+// NOTE(Lucas): Same address every time, so everything hits L1 and only the
+// ports are measured. vzeroupper after the 256/512 bit loops avoids the SSE
+// transition penalty in whatever runs next.
+PROBE_WIDTH(Load8, "mov (%[Data]), %%rax\n\t", "")
+PROBE_WIDTH(Load16, "movdqu (%[Data]), %%xmm0\n\t", "")
+PROBE_WIDTH(Load32, "vmovdqu (%[Data]), %%ymm0\n\t", "vzeroupper\n\t")
+PROBE_WIDTH(Load64, "vmovdqu64 (%[Data]), %%zmm0\n\t", "vzeroupper\n\t")
+PROBE_WIDTH(Store8, "mov %%rax, (%[Data])\n\t", "")
+PROBE_WIDTH(Store16, "movdqu %%xmm0, (%[Data])\n\t", "")
+PROBE_WIDTH(Store32, "vmovdqu %%ymm0, (%[Data])\n\t", "vzeroupper\n\t")
+PROBE_WIDTH(Store64, "vmovdqu64 %%zmm0, (%[Data])\n\t", "vzeroupper\n\t")
+
+// NOTE(Lucas): Four operations per iteration, either all feeding each other
+// or on four separate registers. The adds take a register operand, newer
+// cores fold chains of add-immediate at rename and run them in no time. The
+// pointer chase needs the first 8 bytes of Data to hold Data itself. Every
+// register a chain reads is set in the prologue, leftover denormals or NaNs
+// from the caller would add microcode assists that change run to run.
+PROBE_KERNEL(AddDependent, "xor %%eax, %%eax\n\tmov $1, %%edi\n\t",
+             PROBE_REPEAT4("add %%rdi, %%rax\n\t"), "")
+PROBE_KERNEL(AddIndependent,
+             "xor %%eax, %%eax\n\txor %%ecx, %%ecx\n\t"
+             "xor %%edx, %%edx\n\txor %%esi, %%esi\n\tmov $1, %%edi\n\t",
+             "add %%rdi, %%rax\n\t"
+             "add %%rdi, %%rcx\n\t"
+             "add %%rdi, %%rdx\n\t"
+             "add %%rdi, %%rsi\n\t",
+             "")
+PROBE_KERNEL(MulDependent, "mov $1, %%eax\n\t",
+             PROBE_REPEAT4("imul %%rax, %%rax\n\t"), "")
+PROBE_KERNEL(MulIndependent,
+             "mov $1, %%eax\n\tmov $1, %%ecx\n\t"
+             "mov $1, %%edx\n\tmov $1, %%esi\n\t",
+             "imul %%rax, %%rax\n\t"
+             "imul %%rcx, %%rcx\n\t"
+             "imul %%rdx, %%rdx\n\t"
+             "imul %%rsi, %%rsi\n\t",
+             "")
+PROBE_KERNEL(FAddDependent, "xorpd %%xmm0, %%xmm0\n\txorpd %%xmm1, %%xmm1\n\t",
+             PROBE_REPEAT4("addsd %%xmm1, %%xmm0\n\t"), "")
+PROBE_KERNEL(FAddIndependent,
+             "xorpd %%xmm0, %%xmm0\n\txorpd %%xmm1, %%xmm1\n\t"
+             "xorpd %%xmm2, %%xmm2\n\txorpd %%xmm3, %%xmm3\n\t"
+             "xorpd %%xmm4, %%xmm4\n\t",
+             "addsd %%xmm1, %%xmm0\n\t"
+             "addsd %%xmm1, %%xmm2\n\t"
+             "addsd %%xmm1, %%xmm3\n\t"
+             "addsd %%xmm1, %%xmm4\n\t",
+             "")
+PROBE_KERNEL(FMulDependent, "xorpd %%xmm0, %%xmm0\n\txorpd %%xmm1, %%xmm1\n\t",
+             PROBE_REPEAT4("mulsd %%xmm1, %%xmm0\n\t"), "")
+PROBE_KERNEL(FMulIndependent,
+             "xorpd %%xmm0, %%xmm0\n\txorpd %%xmm1, %%xmm1\n\t"
+             "xorpd %%xmm2, %%xmm2\n\txorpd %%xmm3, %%xmm3\n\t"
+             "xorpd %%xmm4, %%xmm4\n\t",
+             "mulsd %%xmm1, %%xmm0\n\t"
+             "mulsd %%xmm1, %%xmm2\n\t"
+             "mulsd %%xmm1, %%xmm3\n\t"
+             "mulsd %%xmm1, %%xmm4\n\t",
+             "")
+PROBE_KERNEL(LoadDependent, "mov %[Data], %%rax\n\t",
+             PROBE_REPEAT4("mov (%%rax), %%rax\n\t"), "")
+
+// NOTE(Lucas): One conditional jump per iteration, taken when bit 0 of
+// Data[Index] is set. The same shape as a Peek/compare/branch in the parser.
+static void BranchPattern(u64 Count, u8 *Data) {
+  asm volatile("xor %%eax, %%eax\n\t"
+               ".p2align 6\n"
+               "1:\n\t"
+               "movzbl (%[Data], %%rax), %%ecx\n\t"
+               "test $1, %%cl\n\t"
+               "jnz 2f\n\t"
+               "nop\n"
+               "2:\n\t"
+               "add $1, %%rax\n\t"
+               "cmp %[Count], %%rax\n\t"
+               "jb 1b\n\t"
+               :
+               : [Count] "r"(Count), [Data] "r"(Data)
+               : "rax", "rcx", "memory", "cc");
+}
+
+// NOTE(Lucas): The same 18 byte loop starting Padding bytes after a 64 byte
+// boundary. The nops in front run once and do not matter.
+template <int Padding> static void AlignedLoop(u64 Count, u8 *Data) {
+  asm volatile("xor %%eax, %%eax\n\txor %%ecx, %%ecx\n\t"
+               "xor %%edx, %%edx\n\txor %%esi, %%esi\n\t"
+               "mov $1, %%edi\n\t"
+               ".p2align 6\n\t"
+               ".rept %c[Padding]\n\t"
+               "nop\n\t"
+               ".endr\n"
+               "1:\n\t"
+               "add %%rdi, %%rax\n\t"
+               "add %%rdi, %%rcx\n\t"
+               "add %%rdi, %%rdx\n\t"
+               "add %%rdi, %%rsi\n\t"
+               "sub $1, %[Count]\n\t"
+               "jnz 1b\n\t"
+               : [Count] "+r"(Count)
+               : [Padding] "i"(Padding)
+               : "rax", "rcx", "rdx", "rsi", "rdi", "cc");
+}
+
+enum probe_requirement {
+  ProbeRequires_Nothing = 0,
+  ProbeRequires_AVX,
+  ProbeRequires_AVX512
+};
+
+enum branch_pattern {
+  BranchPattern_None = 0,
+  BranchPattern_NeverTaken,
+  BranchPattern_AlwaysTaken,
+  BranchPattern_EveryOther,
+  BranchPattern_EveryThird,
+  BranchPattern_EveryFourth,
+  BranchPattern_RandomEighth,
+  BranchPattern_RandomHalf
+};
+
+struct probe {
+  const char *Group;
+  const char *Name;
+  probe_fn *Function;
+  u32 OperationsPerIteration;
+  probe_requirement Requirement;
+  branch_pattern Pattern;
+};
+
+static u64 ReadXCR0() {
+  u32 Low, High;
+  asm volatile("xgetbv" : "=a"(Low), "=d"(High) : "c"(0));
+  return ((u64)High << 32) | Low;
+}
+
+static bool HasProbeRequirement(probe_requirement Requirement) {
+  u32 A, B, C, D;
+  bool HasAVX = false;
+  bool HasAVX512 = false;
+
+  // NOTE(Lucas): The CPU has to support it and the OS has to save the
+  // registers (OSXSAVE and the XCR0 state bits).
+  if (__get_cpuid(1, &A, &B, &C, &D) && (C & (1u << 27)) &&
+      (C & (1u << 28))) {
+    u64 XCR0 = ReadXCR0();
+    HasAVX = (XCR0 & 0x6) == 0x6;
+
+    if (HasAVX && __get_cpuid_count(7, 0, &A, &B, &C, &D) &&
+        (B & (1u << 16))) {
+      HasAVX512 = (XCR0 & 0xe6) == 0xe6;
+    }
+  }
+
+  switch (Requirement) {
+  case ProbeRequires_Nothing:
+    return true;
+  case ProbeRequires_AVX:
+    return HasAVX;
+  case ProbeRequires_AVX512:
+    return HasAVX512;
+  default:
+    return false;
+  }
+}
+
+static void FillBranchPattern(u8 *Data, u64 Count, branch_pattern Pattern) {
+  u64 Random = 0x9e3779b97f4a7c15ull;
+
+  for (u64 Index = 0; Index < Count; ++Index) {
+    Random ^= Random << 13;
+    Random ^= Random >> 7;
+    Random ^= Random << 17;
+
+    bool IsTaken = false;
+    switch (Pattern) {
+    case BranchPattern_NeverTaken:
+      IsTaken = false;
+      break;
+    case BranchPattern_AlwaysTaken:
+      IsTaken = true;
+      break;
+    case BranchPattern_EveryOther:
+      IsTaken = (Index % 2) == 0;
+      break;
+    case BranchPattern_EveryThird:
+      IsTaken = (Index % 3) == 0;
+      break;
+    case BranchPattern_EveryFourth:
+      IsTaken = (Index % 4) == 0;
+      break;
+    case BranchPattern_RandomEighth:
+      IsTaken = (Random & 7) == 0;
+      break;
+    case BranchPattern_RandomHalf:
+      IsTaken = (Random & 1) == 0;
+      break;
+    default:
+      break;
+    }
+
+    Data[Index] = IsTaken ? 1 : 0;
+  }
+}
+
+// NOTE(Lucas): Minimum CPU timer ticks per iteration, over repetitions until
+// the stop rule says it settled.
+static f64 MeasureProbe(probe_fn *Function, u8 *Data, stop_rule StopRule,
+                        u64 CPUTimerFrequency) {
+  static test_context Context;
+  Context = {};
+  Context.StopRule = StopRule;
+  Context.TargetTime = PROBE_TARGET_SECONDS * CPUTimerFrequency;
+
+  while (IsTesting(&Context)) {
+    test_metrics *Accum = &Context.AccumulatedOnThisTest;
+
+    u64 Start = ReadCPUTimer();
+    Function(PROBE_ITERATION_COUNT, Data);
+    u64 End = ReadCPUTimer();
+
+    Accum->M[Metric_CPUTimer] += End - Start;
+    Accum->M[Metric_ByteCount] += PROBE_ITERATION_COUNT;
+  }
+
+  return (f64)Context.Results.Min.M[Metric_CPUTimer] / PROBE_ITERATION_COUNT;
+}
+
+static void RunMicroarchitectureProbes(stop_rule StopRule,
+                                       u64 CPUTimerFrequency) {
+  probe Probes[] = {
+      {"load", "8 bytes x1", Load8x1, 1},
+      {"load", "8 bytes x2", Load8x2, 2},
+      {"load", "8 bytes x3", Load8x3, 3},
+      {"load", "8 bytes x4", Load8x4, 4},
+      {"load", "16 bytes x1", Load16x1, 1},
+      {"load", "16 bytes x2", Load16x2, 2},
+      {"load", "16 bytes x3", Load16x3, 3},
+      {"load", "16 bytes x4", Load16x4, 4},
+      {"load", "32 bytes x1", Load32x1, 1, ProbeRequires_AVX},
+      {"load", "32 bytes x2", Load32x2, 2, ProbeRequires_AVX},
+      {"load", "32 bytes x3", Load32x3, 3, ProbeRequires_AVX},
+      {"load", "32 bytes x4", Load32x4, 4, ProbeRequires_AVX},
+      {"load", "64 bytes x1", Load64x1, 1, ProbeRequires_AVX512},
+      {"load", "64 bytes x2", Load64x2, 2, ProbeRequires_AVX512},
+      {"load", "64 bytes x3", Load64x3, 3, ProbeRequires_AVX512},
+      {"load", "64 bytes x4", Load64x4, 4, ProbeRequires_AVX512},
+      {"store", "8 bytes x1", Store8x1, 1},
+      {"store", "8 bytes x2", Store8x2, 2},
+      {"store", "8 bytes x3", Store8x3, 3},
+      {"store", "8 bytes x4", Store8x4, 4},
+      {"store", "16 bytes x1", Store16x1, 1},
+      {"store", "16 bytes x2", Store16x2, 2},
+      {"store", "16 bytes x3", Store16x3, 3},
+      {"store", "16 bytes x4", Store16x4, 4},
+      {"store", "32 bytes x1", Store32x1, 1, ProbeRequires_AVX},
+      {"store", "32 bytes x2", Store32x2, 2, ProbeRequires_AVX},
+      {"store", "32 bytes x3", Store32x3, 3, ProbeRequires_AVX},
+      {"store", "32 bytes x4", Store32x4, 4, ProbeRequires_AVX},
+      {"store", "64 bytes x1", Store64x1, 1, ProbeRequires_AVX512},
+      {"store", "64 bytes x2", Store64x2, 2, ProbeRequires_AVX512},
+      {"store", "64 bytes x3", Store64x3, 3, ProbeRequires_AVX512},
+      {"store", "64 bytes x4", Store64x4, 4, ProbeRequires_AVX512},
+      {"chain", "add dependent", AddDependent, 4},
+      {"chain", "add independent", AddIndependent, 4},
+      {"chain", "imul dependent", MulDependent, 4},
+      {"chain", "imul independent", MulIndependent, 4},
+      {"chain", "addsd dependent", FAddDependent, 4},
+      {"chain", "addsd independent", FAddIndependent, 4},
+      {"chain", "mulsd dependent", FMulDependent, 4},
+      {"chain", "mulsd independent", FMulIndependent, 4},
+      {"chain", "load dependent", LoadDependent, 4},
+      {"chain", "load independent", Load8x4, 4},
+      {"branch", "never taken", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_NeverTaken},
+      {"branch", "always taken", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_AlwaysTaken},
+      {"branch", "every other", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_EveryOther},
+      {"branch", "every third", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_EveryThird},
+      {"branch", "every fourth", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_EveryFourth},
+      {"branch", "random 1/8", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_RandomEighth},
+      {"branch", "random 1/2", BranchPattern, 1, ProbeRequires_Nothing,
+       BranchPattern_RandomHalf},
+      {"align", "+0 bytes", AlignedLoop<0>, 4},
+      {"align", "+16 bytes", AlignedLoop<16>, 4},
+      {"align", "+32 bytes", AlignedLoop<32>, 4},
+      {"align", "+44 bytes", AlignedLoop<44>, 4},
+      {"align", "+48 bytes", AlignedLoop<48>, 4},
+      {"align", "+52 bytes", AlignedLoop<52>, 4},
+      {"align", "+56 bytes", AlignedLoop<56>, 4},
+      {"align", "+60 bytes", AlignedLoop<60>, 4},
+      {"align", "+63 bytes", AlignedLoop<63>, 4},
+  };
+
+  u8 *Data = (u8 *)calloc(PROBE_DATA_SIZE, 1);
+
+  // NOTE(Lucas): The dependent add chain runs at one add per core cycle.
+  *(u8 **)Data = Data;
+  f64 TicksPerAdd = MeasureProbe(AddDependent, Data, StopRule,
+                                 CPUTimerFrequency) /
+                    4.0;
+  f64 CyclesPerTick = 1.0 / TicksPerAdd;
+  printf("Core clock: ~%.3fghz (%.4f timer ticks per dependent add)\n",
+         CyclesPerTick * (f64)CPUTimerFrequency / 1e9, TicksPerAdd);
+
+  const char *Group = "";
+  for (u32 Index = 0; Index < ArrayCount(Probes); ++Index) {
+    probe *Probe = Probes + Index;
+
+    if (strcmp(Group, Probe->Group) != 0) {
+      Group = Probe->Group;
+      printf("\n%-8s %-20s %12s %12s %12s\n", Group, "", "cycles/iter",
+             "cycles/op", "ticks/iter");
+    }
+
+    if (!HasProbeRequirement(Probe->Requirement)) {
+      printf("%-8s %-20s %12s\n", "", Probe->Name, "unsupported");
+      continue;
+    }
+
+    memset(Data, 0, PROBE_DATA_SIZE);
+    *(u8 **)Data = Data;
+    if (Probe->Pattern != BranchPattern_None) {
+      FillBranchPattern(Data, PROBE_ITERATION_COUNT, Probe->Pattern);
+    }
+
+    f64 Ticks = MeasureProbe(Probe->Function, Data, StopRule,
+                             CPUTimerFrequency);
+    f64 Cycles = Ticks * CyclesPerTick;
+    printf("%-8s %-20s %12.3f %12.3f %12.3f\n", "", Probe->Name, Cycles,
+           Cycles / Probe->OperationsPerIteration, Ticks);
+  }
+
+  free(Data);
+}
+
+#else
+
+static void RunMicroarchitectureProbes(stop_rule StopRule,
+                                       u64 CPUTimerFrequency) {
+  printf("The microarchitecture probes are x86-64 only.\n");
+}
+
+#endif
@@ -1,5 +1,41 @@
-#if __arm__ || __aarch64__
+#if (__arm__ || __aarch64__ || __x86_64__) && !_WIN64
 #include <sys/resource.h>
+#if __APPLE__
+#include <mach/mach.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if __x86_64__
+#include <time.h>
+#include <x86intrin.h>
+
+static u64 ReadCPUTimer() { return __rdtsc(); }
+
+static u64 ReadOSTimerNanoseconds() {
+  struct timespec Value;
+  clock_gettime(CLOCK_MONOTONIC, &Value);
+  return (u64)Value.tv_sec * 1000000000ull + (u64)Value.tv_nsec;
+}
+
+// NOTE(Lucas): The TSC has no architectural way to ask for its frequency,
+// so it is measured against the OS clock like on windows.
+static u64 EstimateCPUFrequency() {
+  u64 MillisecondsToWait = 100;
+  u64 OSWaitTime = MillisecondsToWait * 1000000ull;
+
+  u64 CPUStart = ReadCPUTimer();
+  u64 OSStart = ReadOSTimerNanoseconds();
+  u64 OSElapsed = 0;
+  while (OSElapsed < OSWaitTime) {
+    OSElapsed = ReadOSTimerNanoseconds() - OSStart;
+  }
+  u64 CPUElapsed = ReadCPUTimer() - CPUStart;
+
+  return 1000000000ull * CPUElapsed / OSElapsed;
+}
+#else
 static u64 ReadCPUTimer() {
   u64 Result;
 
@@ -15,6 +51,7 @@ static u64 EstimateCPUFrequency() {
 
   return Result;
 }
+#endif
 
 static u64 ReadOSPageFaultCount() {
   u64 Result = 0;
@@ -27,6 +64,65 @@ static u64 ReadOSPageFaultCount() {
   return Result;
 }
 
+static u64 ReadOSPeakResidentBytes() {
+  u64 Result = 0;
+
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) == 0) {
+    // NOTE(Lucas): ru_maxrss is in bytes on macos but in kilobytes on linux.
+#if __APPLE__
+    Result = Usage.ru_maxrss;
+#else
+    Result = (u64)Usage.ru_maxrss * 1024;
+#endif
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): The current resident set size, not the peak.
+static u64 ReadOSResidentBytes() {
+  u64 Result = 0;
+
+#if __APPLE__
+  mach_task_basic_info_data_t Info;
+  mach_msg_type_number_t Count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&Info,
+                &Count) == KERN_SUCCESS) {
+    Result = Info.resident_size;
+  }
+#else
+  // NOTE(Lucas): Kept open, reading from offset 0 regenerates the contents.
+  // /proc/self is resolved at open, so a forked child (--shards, --batch)
+  // that inherited the descriptor would read its parent's numbers. Reopened
+  // whenever the pid changed.
+  static int StatmFile = -1;
+  static pid_t StatmPid = 0;
+  pid_t Pid = getpid();
+  if (StatmFile == -1 || StatmPid != Pid) {
+    if (StatmFile != -1) {
+      close(StatmFile);
+    }
+    StatmFile = open("/proc/self/statm", O_RDONLY);
+    StatmPid = Pid;
+  }
+
+  char Buffer[128];
+  ssize_t Size = pread(StatmFile, Buffer, sizeof(Buffer) - 1, 0);
+  if (Size > 0) {
+    Buffer[Size] = 0;
+
+    u64 TotalPages = 0;
+    u64 ResidentPages = 0;
+    if (sscanf(Buffer, "%llu %llu", &TotalPages, &ResidentPages) == 2) {
+      Result = ResidentPages * (u64)sysconf(_SC_PAGESIZE);
+    }
+  }
+#endif
+
+  return Result;
+}
+
 #elif _WIN64
 
 #include <intrin.h>
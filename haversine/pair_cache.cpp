@@ -0,0 +1,253 @@
+// NOTE(Lucas): A binary sidecar next to the input JSON holding the parsed
+// pairs as structure of arrays, so repeated runs on the same file can map it
+// instead of parsing again.
+//
+// Layout: pair_cache_header, then PairCount f64s of X0, Y0, X1 and Y1.
+//
+// The header records the size, modification time and a content hash of the
+// source. Size and modification time are checked on every open. Only when
+// the size matches but the time does not (a copy, a touch) is the source
+// hashed again to decide, and on a match the new time is written into the
+// header so that happens only once.
+
+#define PAIR_CACHE_MAGIC 0x52494150 // "PAIR"
+#define PAIR_CACHE_VERSION 1
+#define PAIR_CACHE_HASH_CHUNK_SIZE (1024 * 1024)
+
+struct pair_cache_header {
+  u32 Magic;
+  u32 Version;
+  u64 PairCount;
+  u64 SourceSize;
+  u64 SourceModifiedSeconds;
+  u64 SourceModifiedNanoseconds;
+  u64 SourceHash;
+  // NOTE(Lucas): Pads the header to 64 bytes so the arrays stay aligned.
+  u64 Reserved[2];
+};
+
+struct pair_cache {
+  memory_mapped_file File;
+  // NOTE(Lucas): Points into the mapping, do not append to or free it.
+  haversine_pairs Pairs;
+  bool IsValid;
+};
+
+struct source_identity {
+  u64 Size;
+  u64 ModifiedSeconds;
+  u64 ModifiedNanoseconds;
+  bool IsValid;
+};
+
+static source_identity GetSourceIdentity(const char *FileName) {
+  source_identity Result = {};
+
+  struct stat FileStats;
+  if (stat(FileName, &FileStats) == 0) {
+    Result.Size = FileStats.st_size;
+#if __APPLE__
+    Result.ModifiedSeconds = FileStats.st_mtimespec.tv_sec;
+    Result.ModifiedNanoseconds = FileStats.st_mtimespec.tv_nsec;
+#else
+    Result.ModifiedSeconds = FileStats.st_mtim.tv_sec;
+    Result.ModifiedNanoseconds = FileStats.st_mtim.tv_nsec;
+#endif
+    Result.IsValid = true;
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Not cryptographic, just a fast 8 bytes at a time mix. Callers
+// hashing in pieces have to pass pieces whose size is a multiple of 8,
+// except for the last one.
+static u64 HashBytes(u64 Hash, const u8 *Data, size_t Size) {
+  size_t Index = 0;
+
+  for (; Index + 8 <= Size; Index += 8) {
+    u64 Word;
+    memcpy(&Word, Data + Index, sizeof(Word));
+    Hash = (Hash ^ Word) * 0xff51afd7ed558ccdull;
+    Hash ^= Hash >> 32;
+  }
+
+  for (; Index < Size; ++Index) {
+    Hash = (Hash ^ Data[Index]) * 0x100000001b3ull;
+  }
+
+  return Hash;
+}
+
+static bool HashFile(const char *FileName, u64 *OutHash) {
+  TimeFunction;
+  bool Result = false;
+
+  int FileDescriptor = open(FileName, O_RDONLY);
+
+  if (FileDescriptor != -1) {
+    u8 *Chunk = (u8 *)malloc(PAIR_CACHE_HASH_CHUNK_SIZE);
+    u64 Hash = 0x9e3779b97f4a7c15ull;
+
+    // NOTE(Lucas): Every chunk is filled up before it is hashed, a short
+    // read must not change where the pieces split and with it the hash.
+    bool IsDone = false;
+    bool IsFailed = false;
+    while (!IsDone && !IsFailed) {
+      size_t ChunkSize = 0;
+      while (ChunkSize < PAIR_CACHE_HASH_CHUNK_SIZE) {
+        ssize_t ReadByteCount =
+            read(FileDescriptor, Chunk + ChunkSize,
+                 PAIR_CACHE_HASH_CHUNK_SIZE - ChunkSize);
+        if (ReadByteCount > 0) {
+          ChunkSize += ReadByteCount;
+        } else if (ReadByteCount == 0) {
+          IsDone = true;
+          break;
+        } else if (errno != EINTR) {
+          IsFailed = true;
+          break;
+        }
+      }
+      Hash = HashBytes(Hash, Chunk, ChunkSize);
+    }
+
+    Result = !IsFailed;
+    *OutHash = Hash;
+
+    free(Chunk);
+    close(FileDescriptor);
+  }
+
+  return Result;
+}
+
+static void MakePairCachePath(char *Buffer, size_t BufferSize,
+                              const char *SourcePath) {
+  snprintf(Buffer, BufferSize, "%s.pairs", SourcePath);
+}
+
+static void ClosePairCache(pair_cache *Cache) {
+  CloseMemoryMappedFile(&Cache->File);
+  *Cache = {};
+}
+
+// NOTE(Lucas): After the hash vouched for a source with a new modification
+// time, records that time so the next open doesn't hash again. Only the two
+// time fields are written in place. A reader that catches them half written
+// sees a mismatch and hashes, nothing worse. Failing is fine too, it just
+// costs the hash again next time.
+static void UpdatePairCacheSourceTime(const char *CachePath,
+                                      source_identity *Source) {
+  int FileDescriptor = open(CachePath, O_WRONLY);
+  if (FileDescriptor != -1) {
+    u64 Times[2] = {Source->ModifiedSeconds, Source->ModifiedNanoseconds};
+    pwrite(FileDescriptor, Times, sizeof(Times),
+           offsetof(pair_cache_header, SourceModifiedSeconds));
+    close(FileDescriptor);
+  }
+}
+
+static pair_cache OpenPairCache(const char *SourcePath) {
+  TimeFunction;
+  pair_cache Result = {};
+
+  char CachePath[4096];
+  MakePairCachePath(CachePath, sizeof(CachePath), SourcePath);
+
+  source_identity Source = GetSourceIdentity(SourcePath);
+  if (!Source.IsValid) {
+    return Result;
+  }
+
+  Result.File = OpenMemoryMappedFile(CachePath);
+  if (!Result.File.IsValid) {
+    return Result;
+  }
+
+  buffer Contents = Result.File.Contents;
+  pair_cache_header *Header = (pair_cache_header *)Contents.Data;
+
+  bool IsValid = Contents.Size >= sizeof(pair_cache_header) &&
+                 Header->Magic == PAIR_CACHE_MAGIC &&
+                 Header->Version == PAIR_CACHE_VERSION &&
+                 Contents.Size == sizeof(pair_cache_header) +
+                                      4 * sizeof(f64) * Header->PairCount &&
+                 Header->SourceSize == Source.Size;
+
+  if (IsValid && (Header->SourceModifiedSeconds != Source.ModifiedSeconds ||
+                  Header->SourceModifiedNanoseconds !=
+                      Source.ModifiedNanoseconds)) {
+    u64 SourceHash = 0;
+    IsValid = HashFile(SourcePath, &SourceHash) &&
+              (SourceHash == Header->SourceHash);
+    if (IsValid) {
+      UpdatePairCacheSourceTime(CachePath, &Source);
+    }
+  }
+
+  if (IsValid) {
+    f64 *Arrays = (f64 *)(Header + 1);
+    u64 Count = Header->PairCount;
+
+    Result.Pairs.Count = Count;
+    Result.Pairs.X0 = Arrays;
+    Result.Pairs.Y0 = Arrays + Count;
+    Result.Pairs.X1 = Arrays + 2 * Count;
+    Result.Pairs.Y1 = Arrays + 3 * Count;
+    Result.IsValid = true;
+  } else {
+    ClosePairCache(&Result);
+  }
+
+  return Result;
+}
+
+static bool WritePairCache(const char *SourcePath, haversine_pairs *Pairs) {
+  TimeFunction;
+
+  source_identity Source = GetSourceIdentity(SourcePath);
+
+  pair_cache_header Header = {};
+  Header.Magic = PAIR_CACHE_MAGIC;
+  Header.Version = PAIR_CACHE_VERSION;
+  Header.PairCount = Pairs->Count;
+  Header.SourceSize = Source.Size;
+  Header.SourceModifiedSeconds = Source.ModifiedSeconds;
+  Header.SourceModifiedNanoseconds = Source.ModifiedNanoseconds;
+
+  if (!Source.IsValid || !HashFile(SourcePath, &Header.SourceHash)) {
+    return false;
+  }
+
+  char CachePath[4096];
+  char TemporaryPath[4096 + 8];
+  MakePairCachePath(CachePath, sizeof(CachePath), SourcePath);
+  snprintf(TemporaryPath, sizeof(TemporaryPath), "%s.tmp", CachePath);
+
+  // NOTE(Lucas): Write to the side and rename, so a concurrent or interrupted
+  // run never sees a half written cache.
+  FILE *File = fopen(TemporaryPath, "wb");
+  if (!File) {
+    return false;
+  }
+
+  u64 Count = Pairs->Count;
+  bool Result = fwrite(&Header, sizeof(Header), 1, File) == 1 &&
+                fwrite(Pairs->X0, sizeof(f64), Count, File) == Count &&
+                fwrite(Pairs->Y0, sizeof(f64), Count, File) == Count &&
+                fwrite(Pairs->X1, sizeof(f64), Count, File) == Count &&
+                fwrite(Pairs->Y1, sizeof(f64), Count, File) == Count;
+
+  Result = (fclose(File) == 0) && Result;
+
+  if (Result) {
+    Result = (rename(TemporaryPath, CachePath) == 0);
+  }
+
+  if (!Result) {
+    unlink(TemporaryPath);
+  }
+
+  return Result;
+}
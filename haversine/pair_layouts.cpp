@@ -0,0 +1,505 @@
+// NOTE(Lucas): The three ways to lay the coordinates out in memory:
+//
+//   AoS    haversine_pair[], one pair after the other, the way the JSON and
+//          the generator's coordinates_pair have them.
+//   SoA    haversine_pairs, each coordinate in its own array, what the
+//          processor sums from.
+//   AoSoA  haversine_pair_block[], PAIR_BLOCK_LANES pairs per block stored
+//          as four short arrays, so a block is a handful of vector loads and
+//          the four streams stay in one place in memory.
+//
+// The conversions between them, and one haversine loop templated on the
+// layout that gives bit for bit the same sum whichever layout it reads.
+// Expects pairs.cpp, haversine_formula.cpp, haversine_f32.cpp and
+// summation.h before it.
+
+#if __x86_64__
+#include <immintrin.h>
+#endif
+
+#define PAIR_BLOCK_LANES 8
+
+struct haversine_pairs_aos {
+  u64 Count;
+  u64 Capacity;
+  haversine_pair *Pairs;
+};
+
+struct haversine_pair_block {
+  f64 X0[PAIR_BLOCK_LANES];
+  f64 Y0[PAIR_BLOCK_LANES];
+  f64 X1[PAIR_BLOCK_LANES];
+  f64 Y1[PAIR_BLOCK_LANES];
+};
+
+// NOTE(Lucas): The lanes of the last block past Count are zero, kernels can
+// read a whole block without checking.
+struct haversine_pairs_aosoa {
+  u64 Count;
+  u64 BlockCapacity;
+  haversine_pair_block *Blocks;
+};
+
+static inline u64 PairBlockCount(u64 PairCount) {
+  return (PairCount + PAIR_BLOCK_LANES - 1) / PAIR_BLOCK_LANES;
+}
+
+static void ReservePairsAoS(haversine_pairs_aos *Pairs, u64 Capacity) {
+  if (Capacity > Pairs->Capacity) {
+    Pairs->Capacity = Capacity;
+    Pairs->Pairs = (haversine_pair *)ProfiledRealloc(
+        Pairs->Pairs, Capacity * sizeof(haversine_pair));
+  }
+}
+
+static void ReservePairsSoA(haversine_pairs *Pairs, u64 Capacity) {
+  if (Capacity > Pairs->Capacity) {
+    Pairs->Capacity = Capacity;
+
+    size_t Size = Capacity * sizeof(f64);
+    Pairs->X0 = (f64 *)ProfiledRealloc(Pairs->X0, Size);
+    Pairs->Y0 = (f64 *)ProfiledRealloc(Pairs->Y0, Size);
+    Pairs->X1 = (f64 *)ProfiledRealloc(Pairs->X1, Size);
+    Pairs->Y1 = (f64 *)ProfiledRealloc(Pairs->Y1, Size);
+  }
+}
+
+static void ReservePairsAoSoA(haversine_pairs_aosoa *Pairs, u64 Capacity) {
+  u64 BlockCapacity = PairBlockCount(Capacity);
+  if (BlockCapacity > Pairs->BlockCapacity) {
+    Pairs->BlockCapacity = BlockCapacity;
+    Pairs->Blocks = (haversine_pair_block *)ProfiledRealloc(
+        Pairs->Blocks, BlockCapacity * sizeof(haversine_pair_block));
+  }
+}
+
+static void AppendPairAoS(void *UserData, haversine_pair *Pair) {
+  haversine_pairs_aos *Pairs = (haversine_pairs_aos *)UserData;
+
+  if (Pairs->Count == Pairs->Capacity) {
+    ReservePairsAoS(Pairs, Pairs->Capacity ? 2 * Pairs->Capacity : 4096);
+  }
+
+  Pairs->Pairs[Pairs->Count++] = *Pair;
+}
+
+static void AppendPairAoSoA(void *UserData, haversine_pair *Pair) {
+  haversine_pairs_aosoa *Pairs = (haversine_pairs_aosoa *)UserData;
+
+  u64 Block = Pairs->Count / PAIR_BLOCK_LANES;
+  u32 Lane = Pairs->Count % PAIR_BLOCK_LANES;
+  if (!Lane) {
+    if (Block == Pairs->BlockCapacity) {
+      u64 Capacity = Pairs->BlockCapacity ? 2 * Pairs->BlockCapacity : 512;
+      ReservePairsAoSoA(Pairs, Capacity * PAIR_BLOCK_LANES);
+    }
+    memset(Pairs->Blocks + Block, 0, sizeof(haversine_pair_block));
+  }
+
+  haversine_pair_block *Dest = Pairs->Blocks + Block;
+  Dest->X0[Lane] = Pair->X0;
+  Dest->Y0[Lane] = Pair->Y0;
+  Dest->X1[Lane] = Pair->X1;
+  Dest->Y1[Lane] = Pair->Y1;
+  Pairs->Count++;
+}
+
+static void FreePairsAoS(haversine_pairs_aos *Pairs) {
+  free(Pairs->Pairs);
+  *Pairs = {};
+}
+
+static void FreePairsAoSoA(haversine_pairs_aosoa *Pairs) {
+  free(Pairs->Blocks);
+  *Pairs = {};
+}
+
+//
+// NOTE(Lucas): Transpose kernels. Gather turns Count AoS pairs into the four
+// coordinate streams, Scatter does the opposite. Every conversion is built
+// from these two (or plain copies between SoA and AoSoA, where the streams
+// are already split).
+//
+
+typedef void pair_gather_fn(const haversine_pair *Source, u64 Count, f64 *X0,
+                            f64 *Y0, f64 *X1, f64 *Y1);
+typedef void pair_scatter_fn(const f64 *X0, const f64 *Y0, const f64 *X1,
+                             const f64 *Y1, u64 Count, haversine_pair *Dest);
+
+static void GatherPairsScalar(const haversine_pair *Source, u64 Count, f64 *X0,
+                              f64 *Y0, f64 *X1, f64 *Y1) {
+  for (u64 Index = 0; Index < Count; ++Index) {
+    X0[Index] = Source[Index].X0;
+    Y0[Index] = Source[Index].Y0;
+    X1[Index] = Source[Index].X1;
+    Y1[Index] = Source[Index].Y1;
+  }
+}
+
+static void ScatterPairsScalar(const f64 *X0, const f64 *Y0, const f64 *X1,
+                               const f64 *Y1, u64 Count, haversine_pair *Dest) {
+  for (u64 Index = 0; Index < Count; ++Index) {
+    Dest[Index].X0 = X0[Index];
+    Dest[Index].Y0 = Y0[Index];
+    Dest[Index].X1 = X1[Index];
+    Dest[Index].Y1 = Y1[Index];
+  }
+}
+
+#if __x86_64__
+
+// NOTE(Lucas): SSE2 is part of x86-64, so this one needs no check. Two pairs
+// at a time: each half of a pair is a 2x2 transpose with one unpacklo and one
+// unpackhi.
+static void GatherPairsSSE2(const haversine_pair *Source, u64 Count, f64 *X0,
+                            f64 *Y0, f64 *X1, f64 *Y1) {
+  u64 Index = 0;
+  for (; Index + 2 <= Count; Index += 2) {
+    const f64 *A = &Source[Index].X0;
+    const f64 *B = &Source[Index + 1].X0;
+
+    __m128d A0 = _mm_loadu_pd(A);
+    __m128d A1 = _mm_loadu_pd(A + 2);
+    __m128d B0 = _mm_loadu_pd(B);
+    __m128d B1 = _mm_loadu_pd(B + 2);
+
+    _mm_storeu_pd(X0 + Index, _mm_unpacklo_pd(A0, B0));
+    _mm_storeu_pd(Y0 + Index, _mm_unpackhi_pd(A0, B0));
+    _mm_storeu_pd(X1 + Index, _mm_unpacklo_pd(A1, B1));
+    _mm_storeu_pd(Y1 + Index, _mm_unpackhi_pd(A1, B1));
+  }
+
+  GatherPairsScalar(Source + Index, Count - Index, X0 + Index, Y0 + Index,
+                    X1 + Index, Y1 + Index);
+}
+
+static void ScatterPairsSSE2(const f64 *X0, const f64 *Y0, const f64 *X1,
+                             const f64 *Y1, u64 Count, haversine_pair *Dest) {
+  u64 Index = 0;
+  for (; Index + 2 <= Count; Index += 2) {
+    __m128d VX0 = _mm_loadu_pd(X0 + Index);
+    __m128d VY0 = _mm_loadu_pd(Y0 + Index);
+    __m128d VX1 = _mm_loadu_pd(X1 + Index);
+    __m128d VY1 = _mm_loadu_pd(Y1 + Index);
+
+    f64 *A = &Dest[Index].X0;
+    f64 *B = &Dest[Index + 1].X0;
+    _mm_storeu_pd(A, _mm_unpacklo_pd(VX0, VY0));
+    _mm_storeu_pd(A + 2, _mm_unpacklo_pd(VX1, VY1));
+    _mm_storeu_pd(B, _mm_unpackhi_pd(VX0, VY0));
+    _mm_storeu_pd(B + 2, _mm_unpackhi_pd(VX1, VY1));
+  }
+
+  ScatterPairsScalar(X0 + Index, Y0 + Index, X1 + Index, Y1 + Index,
+                     Count - Index, Dest + Index);
+}
+
+// NOTE(Lucas): Four pairs are a 4x4 matrix of f64, one pair per row going
+// in and one coordinate per row coming out. A 4x4 transpose is its own
+// inverse, so Gather and Scatter share it. Compiled for AVX with a target
+// attribute, only call these when PairTransposeIsSupported says so.
+#define PAIR_AVX __attribute__((target("avx")))
+
+PAIR_AVX static inline void Transpose4x4(__m256d *R0, __m256d *R1,
+                                         __m256d *R2, __m256d *R3) {
+  __m256d T0 = _mm256_unpacklo_pd(*R0, *R1);
+  __m256d T1 = _mm256_unpackhi_pd(*R0, *R1);
+  __m256d T2 = _mm256_unpacklo_pd(*R2, *R3);
+  __m256d T3 = _mm256_unpackhi_pd(*R2, *R3);
+
+  *R0 = _mm256_permute2f128_pd(T0, T2, 0x20);
+  *R1 = _mm256_permute2f128_pd(T1, T3, 0x20);
+  *R2 = _mm256_permute2f128_pd(T0, T2, 0x31);
+  *R3 = _mm256_permute2f128_pd(T1, T3, 0x31);
+}
+
+PAIR_AVX static void GatherPairsAVX(const haversine_pair *Source, u64 Count,
+                                    f64 *X0, f64 *Y0, f64 *X1, f64 *Y1) {
+  u64 Index = 0;
+  for (; Index + 4 <= Count; Index += 4) {
+    const f64 *Row = &Source[Index].X0;
+    __m256d R0 = _mm256_loadu_pd(Row);
+    __m256d R1 = _mm256_loadu_pd(Row + 4);
+    __m256d R2 = _mm256_loadu_pd(Row + 8);
+    __m256d R3 = _mm256_loadu_pd(Row + 12);
+
+    Transpose4x4(&R0, &R1, &R2, &R3);
+
+    _mm256_storeu_pd(X0 + Index, R0);
+    _mm256_storeu_pd(Y0 + Index, R1);
+    _mm256_storeu_pd(X1 + Index, R2);
+    _mm256_storeu_pd(Y1 + Index, R3);
+  }
+  _mm256_zeroupper();
+
+  GatherPairsScalar(Source + Index, Count - Index, X0 + Index, Y0 + Index,
+                    X1 + Index, Y1 + Index);
+}
+
+PAIR_AVX static void ScatterPairsAVX(const f64 *X0, const f64 *Y0,
+                                     const f64 *X1, const f64 *Y1, u64 Count,
+                                     haversine_pair *Dest) {
+  u64 Index = 0;
+  for (; Index + 4 <= Count; Index += 4) {
+    __m256d R0 = _mm256_loadu_pd(X0 + Index);
+    __m256d R1 = _mm256_loadu_pd(Y0 + Index);
+    __m256d R2 = _mm256_loadu_pd(X1 + Index);
+    __m256d R3 = _mm256_loadu_pd(Y1 + Index);
+
+    Transpose4x4(&R0, &R1, &R2, &R3);
+
+    f64 *Row = &Dest[Index].X0;
+    _mm256_storeu_pd(Row, R0);
+    _mm256_storeu_pd(Row + 4, R1);
+    _mm256_storeu_pd(Row + 8, R2);
+    _mm256_storeu_pd(Row + 12, R3);
+  }
+  _mm256_zeroupper();
+
+  ScatterPairsScalar(X0 + Index, Y0 + Index, X1 + Index, Y1 + Index,
+                     Count - Index, Dest + Index);
+}
+
+#endif
+
+enum pair_transpose_isa {
+  PairTranspose_Scalar,
+  PairTranspose_SSE2,
+  PairTranspose_AVX,
+
+  PairTranspose_COUNT
+};
+
+struct pair_transpose_kernels {
+  const char *Name;
+  pair_gather_fn *Gather;
+  pair_scatter_fn *Scatter;
+};
+
+static pair_transpose_kernels GetPairTransposeKernels(pair_transpose_isa ISA) {
+  switch (ISA) {
+#if __x86_64__
+  case PairTranspose_SSE2:
+    return {"sse2", GatherPairsSSE2, ScatterPairsSSE2};
+  case PairTranspose_AVX:
+    return {"avx", GatherPairsAVX, ScatterPairsAVX};
+#endif
+  default:
+    return {"scalar", GatherPairsScalar, ScatterPairsScalar};
+  }
+}
+
+static bool PairTransposeIsSupported(pair_transpose_isa ISA) {
+  switch (ISA) {
+  case PairTranspose_Scalar:
+    return true;
+#if __x86_64__
+  case PairTranspose_SSE2:
+    return true;
+  case PairTranspose_AVX:
+    return __builtin_cpu_supports("avx");
+#endif
+  default:
+    return false;
+  }
+}
+
+// NOTE(Lucas): The widest kernels this CPU runs.
+static pair_transpose_kernels GetBestPairTransposeKernels() {
+  u32 Best = PairTranspose_Scalar;
+  for (u32 ISA = 0; ISA < PairTranspose_COUNT; ++ISA) {
+    if (PairTransposeIsSupported((pair_transpose_isa)ISA)) {
+      Best = ISA;
+    }
+  }
+  return GetPairTransposeKernels((pair_transpose_isa)Best);
+}
+
+//
+// NOTE(Lucas): Conversions. Dest is grown as needed and reused across calls,
+// its old contents are overwritten.
+//
+
+static void ConvertAoSToSoA(haversine_pairs_aos *Source, haversine_pairs *Dest,
+                            pair_transpose_kernels *Kernels) {
+  ReservePairsSoA(Dest, Source->Count);
+  Kernels->Gather(Source->Pairs, Source->Count, Dest->X0, Dest->Y0, Dest->X1,
+                  Dest->Y1);
+  Dest->Count = Source->Count;
+}
+
+static void ConvertSoAToAoS(haversine_pairs *Source, haversine_pairs_aos *Dest,
+                            pair_transpose_kernels *Kernels) {
+  ReservePairsAoS(Dest, Source->Count);
+  Kernels->Scatter(Source->X0, Source->Y0, Source->X1, Source->Y1,
+                   Source->Count, Dest->Pairs);
+  Dest->Count = Source->Count;
+}
+
+static void ConvertAoSToAoSoA(haversine_pairs_aos *Source,
+                              haversine_pairs_aosoa *Dest,
+                              pair_transpose_kernels *Kernels) {
+  ReservePairsAoSoA(Dest, Source->Count);
+
+  u64 BlockCount = PairBlockCount(Source->Count);
+  for (u64 Block = 0; Block < BlockCount; ++Block) {
+    u64 First = Block * PAIR_BLOCK_LANES;
+    u64 Count = Min(Source->Count - First, (u64)PAIR_BLOCK_LANES);
+    haversine_pair_block *To = Dest->Blocks + Block;
+
+    if (Count < PAIR_BLOCK_LANES) {
+      memset(To, 0, sizeof(*To));
+    }
+    Kernels->Gather(Source->Pairs + First, Count, To->X0, To->Y0, To->X1,
+                    To->Y1);
+  }
+  Dest->Count = Source->Count;
+}
+
+static void ConvertAoSoAToAoS(haversine_pairs_aosoa *Source,
+                              haversine_pairs_aos *Dest,
+                              pair_transpose_kernels *Kernels) {
+  ReservePairsAoS(Dest, Source->Count);
+
+  u64 BlockCount = PairBlockCount(Source->Count);
+  for (u64 Block = 0; Block < BlockCount; ++Block) {
+    u64 First = Block * PAIR_BLOCK_LANES;
+    u64 Count = Min(Source->Count - First, (u64)PAIR_BLOCK_LANES);
+    haversine_pair_block *From = Source->Blocks + Block;
+
+    Kernels->Scatter(From->X0, From->Y0, From->X1, From->Y1, Count,
+                     Dest->Pairs + First);
+  }
+  Dest->Count = Source->Count;
+}
+
+// NOTE(Lucas): SoA and AoSoA both keep the streams apart, going between them
+// is four copies per block and needs no transpose.
+static void ConvertSoAToAoSoA(haversine_pairs *Source,
+                              haversine_pairs_aosoa *Dest) {
+  ReservePairsAoSoA(Dest, Source->Count);
+
+  u64 BlockCount = PairBlockCount(Source->Count);
+  for (u64 Block = 0; Block < BlockCount; ++Block) {
+    u64 First = Block * PAIR_BLOCK_LANES;
+    u64 Count = Min(Source->Count - First, (u64)PAIR_BLOCK_LANES);
+    haversine_pair_block *To = Dest->Blocks + Block;
+
+    if (Count < PAIR_BLOCK_LANES) {
+      memset(To, 0, sizeof(*To));
+    }
+    memcpy(To->X0, Source->X0 + First, Count * sizeof(f64));
+    memcpy(To->Y0, Source->Y0 + First, Count * sizeof(f64));
+    memcpy(To->X1, Source->X1 + First, Count * sizeof(f64));
+    memcpy(To->Y1, Source->Y1 + First, Count * sizeof(f64));
+  }
+  Dest->Count = Source->Count;
+}
+
+static void ConvertAoSoAToSoA(haversine_pairs_aosoa *Source,
+                              haversine_pairs *Dest) {
+  ReservePairsSoA(Dest, Source->Count);
+
+  u64 BlockCount = PairBlockCount(Source->Count);
+  for (u64 Block = 0; Block < BlockCount; ++Block) {
+    u64 First = Block * PAIR_BLOCK_LANES;
+    u64 Count = Min(Source->Count - First, (u64)PAIR_BLOCK_LANES);
+    haversine_pair_block *From = Source->Blocks + Block;
+
+    memcpy(Dest->X0 + First, From->X0, Count * sizeof(f64));
+    memcpy(Dest->Y0 + First, From->Y0, Count * sizeof(f64));
+    memcpy(Dest->X1 + First, From->X1, Count * sizeof(f64));
+    memcpy(Dest->Y1 + First, From->Y1, Count * sizeof(f64));
+  }
+  Dest->Count = Source->Count;
+}
+
+//
+// NOTE(Lucas): The haversine loop. Each layout hands out PAIR_BLOCK_LANES
+// pairs at a time as four pointers and a constant stride between lanes, so
+// after inlining the lane loop is plain strided loads: unit stride for SoA
+// and AoSoA, four f64 apart for AoS.
+//
+
+struct pair_lanes {
+  const f64 *X0;
+  const f64 *Y0;
+  const f64 *X1;
+  const f64 *Y1;
+};
+
+static inline u32 PairLaneStride(haversine_pairs_aos *) { return 4; }
+static inline u32 PairLaneStride(haversine_pairs *) { return 1; }
+static inline u32 PairLaneStride(haversine_pairs_aosoa *) { return 1; }
+
+// NOTE(Lucas): First is a multiple of PAIR_BLOCK_LANES. The AoS lanes walk
+// the array storage as f64s from the first pair's base, not from a member of
+// a single pair, haversine_pair is four f64s with no padding.
+static inline pair_lanes GetPairLanes(haversine_pairs_aos *Pairs, u64 First) {
+  const f64 *Base = (const f64 *)&Pairs->Pairs[First];
+  return {Base, Base + 1, Base + 2, Base + 3};
+}
+
+static inline pair_lanes GetPairLanes(haversine_pairs *Pairs, u64 First) {
+  return {Pairs->X0 + First, Pairs->Y0 + First, Pairs->X1 + First,
+          Pairs->Y1 + First};
+}
+
+static inline pair_lanes GetPairLanes(haversine_pairs_aosoa *Pairs,
+                                      u64 First) {
+  const haversine_pair_block *Block = Pairs->Blocks + First / PAIR_BLOCK_LANES;
+  return {Block->X0, Block->Y0, Block->X1, Block->Y1};
+}
+
+// NOTE(Lucas): With IsF32 the distances come from the polynomial f32
+// haversine on narrowed coordinates, otherwise from ReferenceHaversine.
+// Called with a constant LaneCount for whole blocks so the lane loop gets a
+// fixed trip count, only the tail of the last block runs a shorter one.
+template <bool IsF32>
+static inline void PairLaneDistances(pair_lanes Lanes, u32 Stride,
+                                     u32 LaneCount, f64 EarthRadius,
+                                     f64 *Out) {
+  for (u32 Lane = 0; Lane < LaneCount; ++Lane) {
+    u32 Offset = Lane * Stride;
+    if (IsF32) {
+      Out[Lane] = HaversineF32((f32)Lanes.X0[Offset], (f32)Lanes.Y0[Offset],
+                               (f32)Lanes.X1[Offset], (f32)Lanes.Y1[Offset],
+                               (f32)EarthRadius);
+    } else {
+      Out[Lane] = ReferenceHaversine(Lanes.X0[Offset], Lanes.Y0[Offset],
+                                     Lanes.X1[Offset], Lanes.Y1[Offset],
+                                     EarthRadius);
+    }
+  }
+}
+
+// NOTE(Lucas): The sum is f64 either way, accumulated like
+// SumDistanceBlocks does, so SoA gives the processor's result.
+template <typename pairs_type, bool IsF32>
+static f64 SumHaversineLayout(pairs_type *Pairs, f64 EarthRadius,
+                              bool IsCompensated) {
+  u32 Stride = PairLaneStride(Pairs);
+  f64 Distances[SUMMATION_BLOCK_SIZE];
+
+  summation Summation;
+  InitSummation(&Summation, IsCompensated);
+
+  for (u64 First = 0; First < Pairs->Count; First += SUMMATION_BLOCK_SIZE) {
+    u32 Count = (u32)Min(Pairs->Count - First, (u64)SUMMATION_BLOCK_SIZE);
+
+    u32 Index = 0;
+    for (; Index + PAIR_BLOCK_LANES <= Count; Index += PAIR_BLOCK_LANES) {
+      PairLaneDistances<IsF32>(GetPairLanes(Pairs, First + Index), Stride,
+                               PAIR_BLOCK_LANES, EarthRadius,
+                               Distances + Index);
+    }
+    if (Index < Count) {
+      PairLaneDistances<IsF32>(GetPairLanes(Pairs, First + Index), Stride,
+                               Count - Index, EarthRadius, Distances + Index);
+    }
+
+    AddBlockSum(&Summation, SumBlock(Distances, Count, IsCompensated));
+  }
+
+  return SummationResult(&Summation);
+}
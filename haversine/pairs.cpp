@@ -0,0 +1,224 @@
+struct haversine_pair {
+  f64 X0;
+  f64 Y0;
+  f64 X1;
+  f64 Y1;
+};
+
+typedef void haversine_pair_fn(void *UserData, haversine_pair *Pair);
+
+struct haversine_pair_f32 {
+  f32 X0;
+  f32 Y0;
+  f32 X1;
+  f32 Y1;
+};
+
+typedef void haversine_pair_f32_fn(void *UserData, haversine_pair_f32 *Pair);
+
+// NOTE(Lucas): Structure of arrays, each coordinate gets its own array.
+struct haversine_pairs {
+  u64 Count;
+  u64 Capacity;
+  f64 *X0;
+  f64 *Y0;
+  f64 *X1;
+  f64 *Y1;
+};
+
+static void AppendPair(void *UserData, haversine_pair *Pair) {
+  haversine_pairs *Pairs = (haversine_pairs *)UserData;
+
+  if (Pairs->Count == Pairs->Capacity) {
+    Pairs->Capacity = Pairs->Capacity ? 2 * Pairs->Capacity : 4096;
+
+    size_t Size = Pairs->Capacity * sizeof(f64);
+    Pairs->X0 = (f64 *)ProfiledRealloc(Pairs->X0, Size);
+    Pairs->Y0 = (f64 *)ProfiledRealloc(Pairs->Y0, Size);
+    Pairs->X1 = (f64 *)ProfiledRealloc(Pairs->X1, Size);
+    Pairs->Y1 = (f64 *)ProfiledRealloc(Pairs->Y1, Size);
+  }
+
+  u64 Index = Pairs->Count++;
+  Pairs->X0[Index] = Pair->X0;
+  Pairs->Y0[Index] = Pair->Y0;
+  Pairs->X1[Index] = Pair->X1;
+  Pairs->Y1[Index] = Pair->Y1;
+}
+
+static void FreePairs(haversine_pairs *Pairs) {
+  free(Pairs->X0);
+  free(Pairs->Y0);
+  free(Pairs->X1);
+  free(Pairs->Y1);
+  *Pairs = {};
+}
+
+// NOTE(Lucas): Half the footprint of haversine_pairs, for the f32 pipeline.
+struct haversine_pairs_f32 {
+  u64 Count;
+  u64 Capacity;
+  f32 *X0;
+  f32 *Y0;
+  f32 *X1;
+  f32 *Y1;
+};
+
+static void AppendPairF32(void *UserData, haversine_pair_f32 *Pair) {
+  haversine_pairs_f32 *Pairs = (haversine_pairs_f32 *)UserData;
+
+  if (Pairs->Count == Pairs->Capacity) {
+    Pairs->Capacity = Pairs->Capacity ? 2 * Pairs->Capacity : 4096;
+
+    size_t Size = Pairs->Capacity * sizeof(f32);
+    Pairs->X0 = (f32 *)ProfiledRealloc(Pairs->X0, Size);
+    Pairs->Y0 = (f32 *)ProfiledRealloc(Pairs->Y0, Size);
+    Pairs->X1 = (f32 *)ProfiledRealloc(Pairs->X1, Size);
+    Pairs->Y1 = (f32 *)ProfiledRealloc(Pairs->Y1, Size);
+  }
+
+  u64 Index = Pairs->Count++;
+  Pairs->X0[Index] = Pair->X0;
+  Pairs->Y0[Index] = Pair->Y0;
+  Pairs->X1[Index] = Pair->X1;
+  Pairs->Y1[Index] = Pair->Y1;
+}
+
+// NOTE(Lucas): For the stream parser, which only decodes f64. Rounding twice
+// can be one f32 ulp off from parsing straight to f32.
+static void AppendPairAsF32(void *UserData, haversine_pair *Pair) {
+  haversine_pair_f32 Narrow = {(f32)Pair->X0, (f32)Pair->Y0, (f32)Pair->X1,
+                               (f32)Pair->Y1};
+  AppendPairF32(UserData, &Narrow);
+}
+
+static void FreePairsF32(haversine_pairs_f32 *Pairs) {
+  free(Pairs->X0);
+  free(Pairs->Y0);
+  free(Pairs->X1);
+  free(Pairs->Y1);
+  *Pairs = {};
+}
+
+template <typename json_value_type>
+static void DecodeJSONNumber(json_value_type Value, f64 *Out) {
+  *Out = ConvertJSONValueToF64(Value);
+}
+
+template <typename json_value_type>
+static void DecodeJSONNumber(json_value_type Value, f32 *Out) {
+  *Out = ConvertJSONValueToF32(Value);
+}
+
+// NOTE(Lucas): Works on both the json_element tree and the json_tape, their
+// accessors share the same names. The pair type picks the precision the
+// numbers are parsed to.
+template <typename json_value_type, typename pair_type>
+static void ForEachPair(json_value_type PairsData,
+                        void (*Callback)(void *, pair_type *), void *UserData) {
+  TimeFunction;
+
+  json_key X0Key = MakeJSONKey(STRING("x0"));
+  json_key Y0Key = MakeJSONKey(STRING("y0"));
+  json_key X1Key = MakeJSONKey(STRING("x1"));
+  json_key Y1Key = MakeJSONKey(STRING("y1"));
+
+  auto Iter = MakeJSONArrayIterator(PairsData);
+
+  for (json_value_type Item = Next(&Iter); Item; Item = Next(&Iter)) {
+    pair_type Pair;
+
+    json_value_type X0Value = GetKey(Item, &X0Key);
+    DecodeJSONNumber(X0Value, &Pair.X0);
+
+    json_value_type Y0Value = GetKey(Item, &Y0Key);
+    DecodeJSONNumber(Y0Value, &Pair.Y0);
+
+    json_value_type X1Value = GetKey(Item, &X1Key);
+    DecodeJSONNumber(X1Value, &Pair.X1);
+
+    json_value_type Y1Value = GetKey(Item, &Y1Key);
+    DecodeJSONNumber(Y1Value, &Pair.Y1);
+
+    Callback(UserData, &Pair);
+  }
+}
+
+// NOTE(Lucas): Turns the event stream of a '{"pairs": [{...}, ...]}' document
+// into complete pair records. A pair object without all four coordinates
+// sets IsMissingField, callers treat that like a parse error, the same as
+// the tree and tape paths do.
+struct pair_stream_decoder {
+  haversine_pair Pair;
+  f64 *PendingField;
+  u32 FieldMask;
+  bool IsMissingField;
+
+  bool AtPairsKey;
+  bool InPairs;
+
+  haversine_pair_fn *Callback;
+  void *UserData;
+};
+
+static void DecodePairStreamEvent(void *UserData, json_stream_event *Event) {
+  pair_stream_decoder *Decoder = (pair_stream_decoder *)UserData;
+
+  switch (Event->Type) {
+  case JSONEvent_Key: {
+    if (Event->Depth == 1) {
+      Decoder->AtPairsKey = StringEqual(Event->Text, STRING("pairs"));
+    } else if (Event->Depth == 3 && Decoder->InPairs) {
+      haversine_pair *Pair = &Decoder->Pair;
+
+      Decoder->PendingField = NULL;
+      if (StringEqual(Event->Text, STRING("x0"))) {
+        Decoder->PendingField = &Pair->X0;
+      } else if (StringEqual(Event->Text, STRING("y0"))) {
+        Decoder->PendingField = &Pair->Y0;
+      } else if (StringEqual(Event->Text, STRING("x1"))) {
+        Decoder->PendingField = &Pair->X1;
+      } else if (StringEqual(Event->Text, STRING("y1"))) {
+        Decoder->PendingField = &Pair->Y1;
+      }
+    }
+  } break;
+
+  case JSONEvent_Number: {
+    if (Event->Depth == 3 && Decoder->PendingField) {
+      *Decoder->PendingField = atof(Event->Text.Data);
+      Decoder->FieldMask |= 1 << (Decoder->PendingField - &Decoder->Pair.X0);
+      Decoder->PendingField = NULL;
+    }
+  } break;
+
+  case JSONEvent_ArrayBegin: {
+    if (Event->Depth == 2) {
+      Decoder->InPairs = Decoder->AtPairsKey;
+    }
+  } break;
+
+  case JSONEvent_ArrayEnd: {
+    if (Event->Depth == 2) {
+      Decoder->InPairs = false;
+    }
+  } break;
+
+  case JSONEvent_ObjectBegin: {
+    Decoder->FieldMask = 0;
+  } break;
+
+  case JSONEvent_ObjectEnd: {
+    if (Event->Depth == 3 && Decoder->InPairs) {
+      if (Decoder->FieldMask == 0xF) {
+        Decoder->Callback(Decoder->UserData, &Decoder->Pair);
+      } else {
+        Decoder->IsMissingField = true;
+      }
+    }
+  } break;
+
+  default:
+    break;
+  }
+}
@@ -0,0 +1,712 @@
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "os.cpp"
+#include "profiler.h"
+
+#include "string.cpp"
+#include "json.cpp"
+
+// NOTE(Lucas): Runs ComputeHaversineAverage end to end over a grid of data
+// sets and modes and splits each run into the phases every mode has in some
+// form, using the section lines the processor's profiler prints. The
+// numbers come from the processor's own timer, so they don't include
+// process start up.
+
+#define PIPELINE_MAX_SIZES 16
+#define PIPELINE_DEFAULT_RUN_COUNT 3
+#define PIPELINE_DEFAULT_THRESHOLD 10.0
+
+// NOTE(Lucas): Phases below this share of the run's total are too small to
+// compare between runs, their cycles per pair are mostly noise.
+#define PIPELINE_MIN_COMPARED_SHARE 0.05
+
+enum phase {
+  Phase_Read = 0,
+  Phase_Parse,
+  Phase_Lookup,
+  Phase_Compute,
+
+  Phase_COUNT
+};
+
+static const char *GlobalPhaseNames[Phase_COUNT] = {"read", "parse", "lookup",
+                                                    "compute"};
+
+struct phase_section {
+  const char *Name;
+  phase Phase;
+};
+
+// NOTE(Lucas): Exclusive time of these sections is summed into their phase,
+// every other section (cache writes, the shard wrappers in the parent, the
+// f32 error report itself) only counts towards the total. The stream parser
+// and the shards decode and sum every pair as they go, so in those modes
+// compute shows up under parse. ForEachPair includes decoding the numbers,
+// which for the tape is where they actually get parsed. The shard workers'
+// sections are summed over the workers, so their phases can add up to more
+// than the total.
+static phase_section GlobalPhaseSections[] = {
+    {"PrefaultReadBuffer", Phase_Read},
+    {"ReadEntireFileInto", Phase_Read},
+    {"ReadChunk", Phase_Read},
+    {"OpenPairCache", Phase_Read},
+    {"HashFile", Phase_Read},
+    {"ParseJSON", Phase_Parse},
+    {"ParseObject", Phase_Parse},
+    {"ParseValue", Phase_Parse},
+    {"FeedJSONStream", Phase_Parse},
+    {"CountShardPairs", Phase_Parse},
+    {"SumShard", Phase_Parse},
+    {"GetKey", Phase_Lookup},
+    {"ForEachPair", Phase_Compute},
+    {"SumHaversineDistances", Phase_Compute},
+    {"SumHaversineDistancesF32", Phase_Compute},
+};
+
+// NOTE(Lucas): Arguments may contain one %u, replaced by the shard count.
+// The f32 run also parses the input a second time as f64 for its error
+// report, that pass is part of its phases. Its average can't match the f64
+// answer bit for bit, so it isn't checked.
+struct pipeline_mode {
+  const char *Name;
+  const char *Arguments;
+  bool RemovesCache;
+  bool IsApproximate;
+};
+
+static pipeline_mode GlobalModes[] = {
+    {"tree", ""},
+    {"tape", "--tape"},
+    {"stream", "--stream"},
+    {"cache-cold", "--cache", true},
+    {"cache-hot", "--cache"},
+    {"f32", "--f32", false, true},
+    {"shards", "--shards %u"},
+};
+
+static const char *GlobalDatasetNames[] = {"uniform", "cluster"};
+
+enum run_status { RunStatus_OK = 0, RunStatus_Failed, RunStatus_Mismatch };
+
+static const char *GlobalStatusNames[] = {"ok", "failed", "MISMATCH"};
+
+struct pipeline_result {
+  u32 DatasetIndex;
+  u32 ModeIndex;
+  u64 PairCount;
+  u64 ByteCount;
+  run_status Status;
+
+  // NOTE(Lucas): CPU timer ticks, the minimum over the runs for each one
+  // independently.
+  u64 Total;
+  u64 Phases[Phase_COUNT];
+};
+
+struct options {
+  const char *GeneratorPath;
+  const char *ProcessorPath;
+  const char *DataDirectory;
+  const char *ReportPath;
+  const char *ComparePath;
+  u64 Sizes[PIPELINE_MAX_SIZES];
+  u32 SizeCount;
+  u32 RunCount;
+  u32 ShardCount;
+  f64 Threshold;
+  bool IsValid;
+};
+
+static void PrintUsage(const char *ProgramName) {
+  fprintf(stderr,
+          "Usage: %s [--sizes N,N,...] [--runs N] [--shards N] [--data DIR] "
+          "[--generator PATH] [--processor PATH] [--report FILE] "
+          "[--compare OLD] [--threshold PERCENT]\n\n",
+          ProgramName);
+  fprintf(stderr, "--sizes\tPairs per data set (default "
+                  "1000,100000,10000000,100000000), each one generated as "
+                  "uniform and cluster.\n");
+  fprintf(stderr, "--runs\tRuns per data set and mode, the fastest is kept "
+                  "per phase (default %d).\n",
+          PIPELINE_DEFAULT_RUN_COUNT);
+  fprintf(stderr, "--shards\tWorker processes of the shards mode (default: "
+                  "one per core, at least 2).\n");
+  fprintf(stderr, "--data\tWhere data sets are generated, and reused from "
+                  "on later runs (default pipeline_data).\n");
+  fprintf(stderr, "--generator\tGenerateRandomHaversineData to use (default "
+                  "./GenerateRandomHaversineData).\n");
+  fprintf(stderr, "--processor\tComputeHaversineAverage to benchmark "
+                  "(default ./ComputeHaversineAverage).\n");
+  fprintf(stderr, "--report\tWhere to save the results as JSON (default "
+                  "pipeline_report.json).\n");
+  fprintf(stderr, "--compare\tA report saved by an earlier run, phases that "
+                  "got slower by more than the threshold are flagged and the "
+                  "exit code is 1.\n");
+  fprintf(stderr, "--threshold\tPercent of cycles per pair a phase may grow "
+                  "by before it counts as a regression (default %.0f).\n",
+          PIPELINE_DEFAULT_THRESHOLD);
+}
+
+static bool ParseSizes(options *Options, const char *List) {
+  Options->SizeCount = 0;
+
+  const char *At = List;
+  while (*At) {
+    char *End;
+    u64 Size = strtoull(At, &End, 10);
+    if (End == At || Size == 0 || Size > INT_MAX ||
+        Options->SizeCount == PIPELINE_MAX_SIZES) {
+      return false;
+    }
+    Options->Sizes[Options->SizeCount++] = Size;
+
+    At = End;
+    if (*At == ',') {
+      At++;
+    } else if (*At) {
+      return false;
+    }
+  }
+
+  return Options->SizeCount > 0;
+}
+
+static options ParseCommandLineOptions(int ArgCount, char *Args[]) {
+  options Result = {.GeneratorPath = "./GenerateRandomHaversineData",
+                    .ProcessorPath = "./ComputeHaversineAverage",
+                    .DataDirectory = "pipeline_data",
+                    .ReportPath = "pipeline_report.json",
+                    .Sizes = {1000, 100000, 10000000, 100000000},
+                    .SizeCount = 4,
+                    .RunCount = PIPELINE_DEFAULT_RUN_COUNT,
+                    .Threshold = PIPELINE_DEFAULT_THRESHOLD};
+
+  long CoreCount = sysconf(_SC_NPROCESSORS_ONLN);
+  Result.ShardCount = (u32)Max(CoreCount, 2);
+
+  for (int Index = 1; Index < ArgCount; ++Index) {
+    const char *Argument = Args[Index];
+    bool HasValue = Index + 1 < ArgCount;
+
+    if (strcmp(Argument, "--sizes") == 0 && HasValue) {
+      if (!ParseSizes(&Result, Args[++Index])) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--runs") == 0 && HasValue) {
+      Result.RunCount = (u32)atoi(Args[++Index]);
+      if (Result.RunCount == 0) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--shards") == 0 && HasValue) {
+      Result.ShardCount = (u32)atoi(Args[++Index]);
+      if (Result.ShardCount == 0) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--data") == 0 && HasValue) {
+      Result.DataDirectory = Args[++Index];
+    } else if (strcmp(Argument, "--generator") == 0 && HasValue) {
+      Result.GeneratorPath = Args[++Index];
+    } else if (strcmp(Argument, "--processor") == 0 && HasValue) {
+      Result.ProcessorPath = Args[++Index];
+    } else if (strcmp(Argument, "--report") == 0 && HasValue) {
+      Result.ReportPath = Args[++Index];
+    } else if (strcmp(Argument, "--compare") == 0 && HasValue) {
+      Result.ComparePath = Args[++Index];
+    } else if (strcmp(Argument, "--threshold") == 0 && HasValue) {
+      Result.Threshold = atof(Args[++Index]);
+      if (Result.Threshold <= 0) {
+        return {};
+      }
+    } else {
+      return {};
+    }
+  }
+
+  Result.IsValid = true;
+  return Result;
+}
+
+static bool FileExists(const char *Path) {
+  struct stat Stat;
+  return stat(Path, &Stat) == 0;
+}
+
+static u64 FileSize(const char *Path) {
+  struct stat Stat;
+  return (stat(Path, &Stat) == 0) ? (u64)Stat.st_size : 0;
+}
+
+// NOTE(Lucas): The generator always writes data_MODE_COUNT.json and .f64
+// into its working directory.
+static void MakeDatasetPath(char *Buffer, size_t BufferSize,
+                            const char *Directory, u32 DatasetIndex,
+                            u64 PairCount, const char *Extension) {
+  snprintf(Buffer, BufferSize, "%s/data_%s_%llu.%s", Directory,
+           GlobalDatasetNames[DatasetIndex], PairCount, Extension);
+}
+
+static bool EnsureDataset(options *Options, u32 DatasetIndex, u64 PairCount) {
+  char JSONPath[PATH_MAX];
+  char AnswerPath[PATH_MAX];
+  MakeDatasetPath(JSONPath, sizeof(JSONPath), Options->DataDirectory,
+                  DatasetIndex, PairCount, "json");
+  MakeDatasetPath(AnswerPath, sizeof(AnswerPath), Options->DataDirectory,
+                  DatasetIndex, PairCount, "f64");
+
+  if (FileExists(JSONPath) && FileExists(AnswerPath)) {
+    return true;
+  }
+
+  // NOTE(Lucas): Fixed seeds, so a data set that had to be generated again
+  // is the same one an older report was measured on.
+  char Command[3 * PATH_MAX];
+  snprintf(Command, sizeof(Command), "cd '%s' && '%s' %s %u %llu >&2",
+           Options->DataDirectory, Options->GeneratorPath,
+           GlobalDatasetNames[DatasetIndex], 1234 + DatasetIndex, PairCount);
+
+  fprintf(stderr, "Generating %s\n", JSONPath);
+  int Status = system(Command);
+
+  return Status == 0 && FileExists(JSONPath) && FileExists(AnswerPath);
+}
+
+static void AddSectionLine(pipeline_result *Run, const char *Line) {
+  char Name[128];
+  u64 Hits, Inclusive, Exclusive;
+
+  // NOTE(Lucas): "\tName[hits]: inclusive, exclusive(...", histogram lines
+  // start with two tabs and are skipped.
+  if (Line[0] != '\t' || Line[1] == '\t' ||
+      sscanf(Line + 1, "%127[^[][%llu]: %llu, %llu", Name, &Hits, &Inclusive,
+             &Exclusive) != 4) {
+    return;
+  }
+
+  for (u32 Index = 0; Index < ArrayCount(GlobalPhaseSections); ++Index) {
+    if (strcmp(GlobalPhaseSections[Index].Name, Name) == 0) {
+      Run->Phases[GlobalPhaseSections[Index].Phase] += Exclusive;
+      break;
+    }
+  }
+}
+
+static pipeline_result RunProcessor(options *Options, u32 DatasetIndex,
+                                    u64 PairCount, u32 ModeIndex,
+                                    u64 CPUTimerFrequency) {
+  pipeline_mode *Mode = GlobalModes + ModeIndex;
+  pipeline_result Result = {.DatasetIndex = DatasetIndex,
+                            .ModeIndex = ModeIndex,
+                            .PairCount = PairCount,
+                            .Status = RunStatus_Failed};
+
+  char JSONPath[PATH_MAX];
+  char AnswerPath[PATH_MAX];
+  MakeDatasetPath(JSONPath, sizeof(JSONPath), Options->DataDirectory,
+                  DatasetIndex, PairCount, "json");
+  MakeDatasetPath(AnswerPath, sizeof(AnswerPath), Options->DataDirectory,
+                  DatasetIndex, PairCount, "f64");
+  Result.ByteCount = FileSize(JSONPath);
+
+  if (Mode->RemovesCache) {
+    char CachePath[PATH_MAX + 8];
+    snprintf(CachePath, sizeof(CachePath), "%s.pairs", JSONPath);
+    unlink(CachePath);
+  }
+
+  char Arguments[64];
+  snprintf(Arguments, sizeof(Arguments), Mode->Arguments,
+           Options->ShardCount);
+
+  char Check[PATH_MAX + 16] = "";
+  if (!Mode->IsApproximate) {
+    snprintf(Check, sizeof(Check), "--check '%s'", AnswerPath);
+  }
+
+  char Command[4 * PATH_MAX];
+  snprintf(Command, sizeof(Command), "'%s' %s %s '%s' 2>/dev/null",
+           Options->ProcessorPath, Arguments, Check, JSONPath);
+
+  FILE *Output = popen(Command, "r");
+  if (!Output) {
+    return Result;
+  }
+
+  bool HasResult = false;
+  bool IsExact = false;
+  f64 TotalMilliseconds = 0;
+
+  char Line[1024];
+  while (fgets(Line, sizeof(Line), Output)) {
+    u64 Count;
+    if (sscanf(Line, "Number of Coordinate Pairs: %llu", &Count) == 1) {
+      HasResult = (Count == PairCount);
+    } else if (strncmp(Line, "Reference check: exact match", 28) == 0) {
+      IsExact = true;
+    } else if (sscanf(Line, "== Profiling results (Total time: %lfms)",
+                      &TotalMilliseconds) == 1) {
+    } else {
+      AddSectionLine(&Result, Line);
+    }
+  }
+
+  int Status = pclose(Output);
+  bool Exited = Status != -1 && WIFEXITED(Status);
+
+  Result.Total =
+      (u64)(TotalMilliseconds / 1000.0 * (f64)CPUTimerFrequency + 0.5);
+
+  if (Exited && HasResult && TotalMilliseconds > 0) {
+    Result.Status = (IsExact || Mode->IsApproximate) ? RunStatus_OK
+                                                     : RunStatus_Mismatch;
+  }
+
+  return Result;
+}
+
+static pipeline_result MeasureMode(options *Options, u32 DatasetIndex,
+                                   u64 PairCount, u32 ModeIndex,
+                                   u64 CPUTimerFrequency) {
+  pipeline_result Result = {};
+
+  for (u32 Run = 0; Run < Options->RunCount; ++Run) {
+    pipeline_result This = RunProcessor(Options, DatasetIndex, PairCount,
+                                        ModeIndex, CPUTimerFrequency);
+
+    if (Run == 0 || This.Status != RunStatus_OK) {
+      Result = This;
+      if (This.Status != RunStatus_OK) {
+        break;
+      }
+    } else {
+      Result.Total = Min(Result.Total, This.Total);
+      for (u32 Phase = 0; Phase < Phase_COUNT; ++Phase) {
+        Result.Phases[Phase] = Min(Result.Phases[Phase], This.Phases[Phase]);
+      }
+    }
+  }
+
+  return Result;
+}
+
+static f64 CyclesPerPair(u64 Cycles, u64 PairCount) {
+  return (f64)Cycles / (f64)Max(PairCount, 1);
+}
+
+static void PrintCell(u64 Cycles, pipeline_result *Result,
+                      u64 CPUTimerFrequency) {
+  if (Cycles) {
+    f64 Seconds = (f64)Cycles / (f64)CPUTimerFrequency;
+    f64 GigabytesPerSecond =
+        (f64)Result->ByteCount / Seconds / (1024.0 * 1024.0 * 1024.0);
+    printf(" %9.1f %6.2f", CyclesPerPair(Cycles, Result->PairCount),
+           GigabytesPerSecond);
+  } else {
+    printf(" %9s %6s", "-", "-");
+  }
+}
+
+static void PrintTableHeader() {
+  printf("%-18s %-10s  %-16s", "Data set", "Mode", "total");
+  for (u32 Phase = 0; Phase < Phase_COUNT; ++Phase) {
+    printf(" %-16s", GlobalPhaseNames[Phase]);
+  }
+  printf("\n%-18s %-10s ", "", "");
+  for (u32 Column = 0; Column <= Phase_COUNT; ++Column) {
+    printf(" %9s %6s", "cyc/pair", "GB/s");
+  }
+  putchar('\n');
+}
+
+static void PrintTableRow(pipeline_result *Result, u64 CPUTimerFrequency) {
+  char Dataset[64];
+  snprintf(Dataset, sizeof(Dataset), "%s %llu",
+           GlobalDatasetNames[Result->DatasetIndex], Result->PairCount);
+  printf("%-18s %-10s ", Dataset, GlobalModes[Result->ModeIndex].Name);
+
+  if (Result->Status == RunStatus_Failed) {
+    printf(" failed\n");
+    return;
+  }
+
+  PrintCell(Result->Total, Result, CPUTimerFrequency);
+  for (u32 Phase = 0; Phase < Phase_COUNT; ++Phase) {
+    PrintCell(Result->Phases[Phase], Result, CPUTimerFrequency);
+  }
+
+  if (Result->Status == RunStatus_Mismatch) {
+    printf("  MISMATCH");
+  }
+  putchar('\n');
+}
+
+// NOTE(Lucas): Numbers and keys only, so json.cpp can read it back:
+// {"cpu_frequency": F, "runs": N, "DATASET": {"PAIRS": {"MODE": {...}}}}
+static bool WriteReport(const char *Path, pipeline_result *Results,
+                        u32 ResultCount, u64 CPUTimerFrequency,
+                        u32 RunCount) {
+  FILE *File = fopen(Path, "w");
+  if (!File) {
+    return false;
+  }
+
+  fprintf(File, "{\"cpu_frequency\": %llu, \"runs\": %u", CPUTimerFrequency,
+          RunCount);
+
+  for (u32 DatasetIndex = 0; DatasetIndex < ArrayCount(GlobalDatasetNames);
+       ++DatasetIndex) {
+    fprintf(File, ",\n\"%s\": {", GlobalDatasetNames[DatasetIndex]);
+
+    u64 PreviousPairCount = 0;
+    for (u32 Index = 0; Index < ResultCount; ++Index) {
+      pipeline_result *Result = Results + Index;
+      if (Result->DatasetIndex != DatasetIndex) {
+        continue;
+      }
+
+      bool IsNewSize = Result->PairCount != PreviousPairCount;
+      if (IsNewSize) {
+        fprintf(File, "%s\n  \"%llu\": {", PreviousPairCount ? "}," : "",
+                Result->PairCount);
+      }
+
+      fprintf(File,
+              "%s\n    \"%s\": {\"status\": %d, \"bytes\": %llu, "
+              "\"total\": %llu",
+              IsNewSize ? "" : ",", GlobalModes[Result->ModeIndex].Name,
+              Result->Status, Result->ByteCount, Result->Total);
+      for (u32 Phase = 0; Phase < Phase_COUNT; ++Phase) {
+        fprintf(File, ", \"%s\": %llu", GlobalPhaseNames[Phase],
+                Result->Phases[Phase]);
+      }
+      fprintf(File, "}");
+
+      PreviousPairCount = Result->PairCount;
+    }
+
+    fprintf(File, "%s}", PreviousPairCount ? "}" : "");
+  }
+
+  fprintf(File, "}\n");
+
+  return fclose(File) == 0;
+}
+
+static json_element *LoadReport(const char *Path) {
+  json_element *Result = NULL;
+
+  FILE *File = fopen(Path, "rb");
+  if (File) {
+    fseek(File, 0, SEEK_END);
+    long Size = ftell(File);
+    fseek(File, 0, SEEK_SET);
+
+    char *Content = (char *)malloc(Size + 1);
+    if (fread(Content, 1, Size, File) == (size_t)Size) {
+      Content[Size] = 0;
+      Result = ParseJSON(Content, Size);
+    }
+
+    free(Content);
+    fclose(File);
+  }
+
+  return Result;
+}
+
+static u64 ReportNumber(json_element *Object, const char *Key) {
+  json_element *Value =
+      Object ? GetKey(Object, (string){Key, strlen(Key)}) : NULL;
+  return (Value && Value->Type == json_value) ? (u64)atof(Value->Value.Data)
+                                              : 0;
+}
+
+static bool CompareCycles(pipeline_result *Result, const char *Name,
+                          u64 OldCycles, u64 NewCycles, u64 OldTotal,
+                          f64 Threshold) {
+  if (!OldCycles || !NewCycles ||
+      (f64)OldCycles < PIPELINE_MIN_COMPARED_SHARE * (f64)OldTotal) {
+    return false;
+  }
+
+  f64 Old = CyclesPerPair(OldCycles, Result->PairCount);
+  f64 New = CyclesPerPair(NewCycles, Result->PairCount);
+  f64 Change = 100.0 * (New / Old - 1.0);
+
+  bool IsRegression = Change > Threshold;
+  if (IsRegression || Change < -Threshold) {
+    printf("%-10s %s %llu %s %s: %.1f -> %.1f cycles/pair (%+.1f%%)\n",
+           IsRegression ? "REGRESSION" : "improved",
+           GlobalDatasetNames[Result->DatasetIndex], Result->PairCount,
+           GlobalModes[Result->ModeIndex].Name, Name, Old, New, Change);
+  }
+
+  return IsRegression;
+}
+
+// NOTE(Lucas): Results missing from the old report are skipped, so a report
+// over fewer sizes can still be compared with.
+static u32 CompareWithReport(json_element *Report, pipeline_result *Results,
+                             u32 ResultCount, u64 CPUTimerFrequency,
+                             f64 Threshold) {
+  u32 RegressionCount = 0;
+
+  u64 OldFrequency = ReportNumber(Report, "cpu_frequency");
+  if (OldFrequency &&
+      fabs((f64)OldFrequency / (f64)CPUTimerFrequency - 1.0) > 0.05) {
+    printf("The old report was measured with a %.2fGHz timer, this run with "
+           "%.2fGHz: cycles are not comparable across machines.\n",
+           (f64)OldFrequency / 1e9, (f64)CPUTimerFrequency / 1e9);
+  }
+
+  for (u32 Index = 0; Index < ResultCount; ++Index) {
+    pipeline_result *Result = Results + Index;
+
+    char PairCount[32];
+    snprintf(PairCount, sizeof(PairCount), "%llu", Result->PairCount);
+    const char *ModeName = GlobalModes[Result->ModeIndex].Name;
+    const char *DatasetName = GlobalDatasetNames[Result->DatasetIndex];
+
+    json_element *Dataset =
+        GetKey(Report, (string){DatasetName, strlen(DatasetName)});
+    json_element *Size =
+        Dataset ? GetKey(Dataset, (string){PairCount, strlen(PairCount)})
+                : NULL;
+    json_element *Old =
+        Size ? GetKey(Size, (string){ModeName, strlen(ModeName)}) : NULL;
+    if (!Old) {
+      continue;
+    }
+
+    u64 OldStatus = ReportNumber(Old, "status");
+    if (OldStatus == RunStatus_OK && Result->Status != RunStatus_OK) {
+      printf("%-10s %s %llu %s: was ok, now %s\n", "REGRESSION", DatasetName,
+             Result->PairCount, ModeName, GlobalStatusNames[Result->Status]);
+      RegressionCount++;
+      continue;
+    }
+    if (OldStatus != RunStatus_OK || Result->Status != RunStatus_OK) {
+      continue;
+    }
+
+    u64 OldTotal = ReportNumber(Old, "total");
+    RegressionCount += CompareCycles(Result, "total", OldTotal, Result->Total,
+                                     OldTotal, Threshold);
+    for (u32 Phase = 0; Phase < Phase_COUNT; ++Phase) {
+      RegressionCount += CompareCycles(
+          Result, GlobalPhaseNames[Phase],
+          ReportNumber(Old, GlobalPhaseNames[Phase]), Result->Phases[Phase],
+          OldTotal, Threshold);
+    }
+  }
+
+  return RegressionCount;
+}
+
+int main(int ArgCount, char *Args[]) {
+  options Options = ParseCommandLineOptions(ArgCount, Args);
+
+  if (!Options.IsValid) {
+    PrintUsage(Args[0]);
+    return 1;
+  }
+
+  // NOTE(Lucas): The generator runs inside the data directory, relative
+  // tool paths have to be resolved before that.
+  char GeneratorPath[PATH_MAX];
+  char ProcessorPath[PATH_MAX];
+  if (!realpath(Options.GeneratorPath, GeneratorPath) ||
+      !realpath(Options.ProcessorPath, ProcessorPath)) {
+    fprintf(stderr, "Could not find %s or %s, see --generator and "
+                    "--processor\n",
+            Options.GeneratorPath, Options.ProcessorPath);
+    return 1;
+  }
+  Options.GeneratorPath = GeneratorPath;
+  Options.ProcessorPath = ProcessorPath;
+
+  if (mkdir(Options.DataDirectory, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Could not create %s: %s\n", Options.DataDirectory,
+            strerror(errno));
+    return 1;
+  }
+
+  json_element *OldReport = NULL;
+  if (Options.ComparePath) {
+    OldReport = LoadReport(Options.ComparePath);
+    if (!OldReport) {
+      fprintf(stderr, "Could not read the report %s\n", Options.ComparePath);
+      return 1;
+    }
+  }
+
+  u64 CPUTimerFrequency = EstimateCPUFrequency();
+
+  u32 ResultCapacity = ArrayCount(GlobalDatasetNames) * Options.SizeCount *
+                       ArrayCount(GlobalModes);
+  pipeline_result *Results =
+      (pipeline_result *)calloc(ResultCapacity, sizeof(pipeline_result));
+  u32 ResultCount = 0;
+
+  printf("%u runs per mode, fastest kept, shards mode with %u workers, "
+         "%.2fGHz timer\n\n",
+         Options.RunCount, Options.ShardCount,
+         (f64)CPUTimerFrequency / 1e9);
+  PrintTableHeader();
+  fflush(stdout);
+
+  for (u32 DatasetIndex = 0; DatasetIndex < ArrayCount(GlobalDatasetNames);
+       ++DatasetIndex) {
+    for (u32 SizeIndex = 0; SizeIndex < Options.SizeCount; ++SizeIndex) {
+      u64 PairCount = Options.Sizes[SizeIndex];
+
+      if (!EnsureDataset(&Options, DatasetIndex, PairCount)) {
+        fprintf(stderr, "Could not generate %s %llu, skipped\n",
+                GlobalDatasetNames[DatasetIndex], PairCount);
+        continue;
+      }
+
+      for (u32 ModeIndex = 0; ModeIndex < ArrayCount(GlobalModes);
+           ++ModeIndex) {
+        pipeline_result *Result = Results + ResultCount++;
+        *Result = MeasureMode(&Options, DatasetIndex, PairCount, ModeIndex,
+                              CPUTimerFrequency);
+        PrintTableRow(Result, CPUTimerFrequency);
+        fflush(stdout);
+      }
+    }
+  }
+
+  int ExitCode = 0;
+
+  if (WriteReport(Options.ReportPath, Results, ResultCount, CPUTimerFrequency,
+                  Options.RunCount)) {
+    printf("\nReport written to %s\n", Options.ReportPath);
+  } else {
+    fprintf(stderr, "Could not write %s\n", Options.ReportPath);
+    ExitCode = 1;
+  }
+
+  if (OldReport) {
+    printf("\nCompared with %s (threshold %.0f%%):\n", Options.ComparePath,
+           Options.Threshold);
+    u32 RegressionCount = CompareWithReport(
+        OldReport, Results, ResultCount, CPUTimerFrequency, Options.Threshold);
+    printf("%u regressions\n", RegressionCount);
+
+    if (RegressionCount) {
+      ExitCode = 1;
+    }
+  }
+
+  return ExitCode;
+}
@@ -1,149 +1,788 @@
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "common.hpp"
+#include "haversine_protocol.hpp"
 #include "haversine_formula.cpp"
+#include "summation.h"
 #include "os.cpp"
 
+// NOTE(Lucas): The profiler is linked in from profiler_unit.cpp.
 #define PROFILER_ENABLED 1
-#include "profiler.cpp"
+#include "profiler.h"
 
 #include "string.cpp"
 #include "json.cpp"
+#include "json_tape.cpp"
+#include "json_stream.cpp"
 
-#define EARTH_RADIUS 6372.8
+#include "file.cpp"
+#include "pairs.cpp"
+#include "haversine_f32.cpp"
+#include "pair_cache.cpp"
+#include "gzip_pipeline.cpp"
 
-struct buffer {
-  u8 *Data;
-  size_t Size;
-};
+#include "daemon.cpp"
+
+#define STREAM_CHUNK_SIZE (1024 * 1024)
 
-struct memory_mapped_file {
-  buffer Contents;
+// NOTE(Lucas): Every whole file read goes here, so with several inputs (or
+// reloads in serve mode) the pages are only faulted in once.
+static read_buffer GlobalInputBuffer;
+
+struct haversine_result {
+  u64 Count;
+  summation Summation;
+  f64 Sum;
   bool IsValid;
 };
 
-buffer ReadEntireFile(const char *FileName) {
-  buffer Result = {0};
+static void AccumulatePair(void *UserData, haversine_pair *Pair) {
+  haversine_result *Result = (haversine_result *)UserData;
+
+  AddToSummation(&Result->Summation, ReferenceHaversine(Pair->X0, Pair->Y0,
+                                                        Pair->X1, Pair->Y1,
+                                                        EARTH_RADIUS));
+  Result->Count++;
+}
+
+// NOTE(Lucas): Each thread owns a contiguous run of summation blocks and
+// writes one sum per block. The block sums are combined on the calling
+// thread, in order, so the result does not depend on the thread count.
+struct sum_blocks_work {
+  pthread_t Thread;
+  haversine_pairs *Pairs;
+  haversine_pairs_f32 *PairsF32;
+  u64 PairCount;
+  u64 FirstBlock;
+  u64 OnePastLastBlock;
+  bool IsCompensated;
+  f64 *BlockSums;
+};
+
+static void *SumBlocksThread(void *UserData) {
+  sum_blocks_work *Work = (sum_blocks_work *)UserData;
+  haversine_pairs *Pairs = Work->Pairs;
 
-  FILE *File = fopen(FileName, "rb");
+  f64 Distances[SUMMATION_BLOCK_SIZE];
+  f32 NarrowDistances[SUMMATION_BLOCK_SIZE];
 
-  if (File) {
-    fseek(File, 0, SEEK_END);
-    size_t Size = ftell(File);
-    fseek(File, 0, SEEK_SET);
+  for (u64 Block = Work->FirstBlock; Block < Work->OnePastLastBlock; ++Block) {
+    u64 First = Block * SUMMATION_BLOCK_SIZE;
+    u32 Count = (u32)Min(Work->PairCount - First, (u64)SUMMATION_BLOCK_SIZE);
+
+    if (Work->PairsF32) {
+      // NOTE(Lucas): f32 distances, but the sum is still accumulated in f64.
+      HaversineF32Kernel(Work->PairsF32, First, Count, (f32)EARTH_RADIUS,
+                         NarrowDistances);
+      for (u32 Index = 0; Index < Count; ++Index) {
+        Distances[Index] = NarrowDistances[Index];
+      }
+    } else {
+      for (u32 Index = 0; Index < Count; ++Index) {
+        Distances[Index] = ReferenceHaversine(
+            Pairs->X0[First + Index], Pairs->Y0[First + Index],
+            Pairs->X1[First + Index], Pairs->Y1[First + Index], EARTH_RADIUS);
+      }
+    }
+
+    Work->BlockSums[Block] = SumBlock(Distances, Count, Work->IsCompensated);
+  }
+
+  return NULL;
+}
+
+// NOTE(Lucas): Sums either Pairs or PairsF32, whichever is not NULL.
+static haversine_result SumDistanceBlocks(haversine_pairs *Pairs,
+                                          haversine_pairs_f32 *PairsF32,
+                                          u64 PairCount, u32 ThreadCount,
+                                          bool IsCompensated) {
+  haversine_result Result = {.Count = PairCount, .IsValid = true};
+
+  u64 BlockCount =
+      (PairCount + SUMMATION_BLOCK_SIZE - 1) / SUMMATION_BLOCK_SIZE;
+  if (ThreadCount > BlockCount) {
+    ThreadCount = (u32)Max(BlockCount, 1);
+  }
 
-    TimeBandwidth(__func__, Size);
-    u8 *Data = (u8 *)malloc(Size + 1);
-    Data[Size] = 0;
-    fread(Data, sizeof(u8), Size, File);
+  f64 *BlockSums = (f64 *)malloc(Max(BlockCount, 1) * sizeof(f64));
+  sum_blocks_work *Work =
+      (sum_blocks_work *)calloc(ThreadCount, sizeof(sum_blocks_work));
+
+  for (u32 Index = 0; Index < ThreadCount; ++Index) {
+    Work[Index].Pairs = Pairs;
+    Work[Index].PairsF32 = PairsF32;
+    Work[Index].PairCount = PairCount;
+    Work[Index].FirstBlock = BlockCount * Index / ThreadCount;
+    Work[Index].OnePastLastBlock = BlockCount * (Index + 1) / ThreadCount;
+    Work[Index].IsCompensated = IsCompensated;
+    Work[Index].BlockSums = BlockSums;
+  }
 
-    Result.Size = Size;
-    Result.Data = Data;
+  // NOTE(Lucas): The calling thread takes the first run itself.
+  for (u32 Index = 1; Index < ThreadCount; ++Index) {
+    pthread_create(&Work[Index].Thread, NULL, SumBlocksThread, Work + Index);
+  }
+  SumBlocksThread(Work);
+  for (u32 Index = 1; Index < ThreadCount; ++Index) {
+    pthread_join(Work[Index].Thread, NULL);
   }
 
+  InitSummation(&Result.Summation, IsCompensated);
+  for (u64 Block = 0; Block < BlockCount; ++Block) {
+    AddBlockSum(&Result.Summation, BlockSums[Block]);
+  }
+  Result.Sum = SummationResult(&Result.Summation);
+
+  free(Work);
+  free(BlockSums);
+
   return Result;
 }
 
-memory_mapped_file OpenMemoryMappedFile(const char *FileName) {
-  memory_mapped_file Result = {0};
+static haversine_result SumHaversineDistances(haversine_pairs *Pairs,
+                                              u32 ThreadCount,
+                                              bool IsCompensated) {
+  TimeBlock("SumHaversineDistances");
+  return SumDistanceBlocks(Pairs, NULL, Pairs->Count, ThreadCount,
+                           IsCompensated);
+}
+
+static haversine_result SumHaversineDistancesF32(haversine_pairs_f32 *Pairs,
+                                                 u32 ThreadCount,
+                                                 bool IsCompensated) {
+  TimeBlock("SumHaversineDistancesF32");
+  return SumDistanceBlocks(NULL, Pairs, Pairs->Count, ThreadCount,
+                           IsCompensated);
+}
+
+// NOTE(Lucas): Reads the file STREAM_CHUNK_SIZE bytes at a time, memory use
+// does not depend on the file size.
+static bool StreamPairs(const char *FileName, haversine_pair_fn *Callback,
+                        void *UserData) {
+  bool Result = false;
 
   int FileDescriptor = open(FileName, O_RDONLY);
-  if (FileDescriptor != -1) {
-    struct stat FileStats = {0};
-    if (fstat(FileDescriptor, &FileStats) == 0) {
 
-      size_t FileSize = FileStats.st_size;
-      // NOTE(Lucas): On macos the flags parameter has to either have
-      // MAP_PRIVATE or MAP_SHARED set. without having one of those set, mmap
-      // will fail.
-      //
-      // This bit of information was hiding at the 'compatibility' section of
-      // the man page (man 2 mmap).
-      void *Mapping = mmap(0, FileSize, PROT_READ, MAP_PRIVATE | MAP_FILE,
-                           FileDescriptor, 0);
+  if (FileDescriptor != -1) {
+    pair_stream_decoder Decoder = {.Callback = Callback,
+                                   .UserData = UserData};
+    json_stream_parser Parser;
+    InitJSONStream(&Parser, DecodePairStreamEvent, &Decoder);
+
+    char *Chunk = (char *)malloc(STREAM_CHUNK_SIZE);
+
+    bool IsValid = true;
+    for (;;) {
+      ssize_t ReadByteCount;
+      {
+        TimeBlock("ReadChunk");
+        ReadByteCount = read(FileDescriptor, Chunk, STREAM_CHUNK_SIZE);
+      }
 
-      if (Mapping != MAP_FAILED) {
-        Result.Contents = (buffer){.Data = (u8 *)Mapping, .Size = FileSize};
+      if (ReadByteCount <= 0) {
+        IsValid = (ReadByteCount == 0);
+        break;
+      }
 
-        Result.IsValid = true;
+      TimeBandwidth("FeedJSONStream", ReadByteCount);
+      if (!FeedJSONStream(&Parser, Chunk, ReadByteCount)) {
+        IsValid = false;
+        break;
       }
     }
 
+    Result = IsValid && FinishJSONStream(&Parser) && !Decoder.IsMissingField;
+
+    free(Chunk);
     close(FileDescriptor);
   }
 
   return Result;
 }
 
-bool CloseMemoryMappedFile(memory_mapped_file *File) {
-  if (File->IsValid) {
-    if (munmap(File->Contents.Data, File->Contents.Size) == 0) {
-      File->IsValid = false;
-      File->Contents.Data = NULL;
-      File->Contents.Size = 0;
-      return true;
+// NOTE(Lucas): Same as StreamPairs, but the file is gzip compressed and gets
+// inflated on a second thread while this one parses.
+static bool StreamGzipPairs(const char *FileName, haversine_pair_fn *Callback,
+                            void *UserData) {
+  gzip_pipeline Pipeline;
+  if (!StartGzipPipeline(&Pipeline, FileName)) {
+    return false;
+  }
+
+  pair_stream_decoder Decoder = {.Callback = Callback, .UserData = UserData};
+  json_stream_parser Parser;
+  InitJSONStream(&Parser, DecodePairStreamEvent, &Decoder);
+
+  bool IsValid = true;
+  char *Data;
+  size_t Size;
+  while (IsValid && NextGzipBuffer(&Pipeline, &Data, &Size)) {
+    {
+      TimeBandwidth("FeedJSONStream", Size);
+      IsValid = FeedJSONStream(&Parser, Data, Size);
+    }
+    ReleaseGzipBuffer(&Pipeline);
+  }
+
+  IsValid = FinishGzipPipeline(&Pipeline) && IsValid;
+  IsValid = IsValid && FinishJSONStream(&Parser) && !Decoder.IsMissingField;
+
+  PrintGzipPipelineStats(&Pipeline, GlobalProfiler.CPUFrequency);
+
+  return IsValid;
+}
+
+enum input_mode { InputMode_Tree = 0, InputMode_Tape, InputMode_Stream };
+
+struct options {
+  const char *InputPath;
+  char **InputPaths;
+  u32 InputCount;
+  input_mode Mode;
+  bool UseCache;
+  const char *ServePath;
+  u32 ThreadCount;
+  bool IsCompensated;
+  bool UseF32;
+  const char *CheckPath;
+  u32 PrefaultThreadCount;
+  u32 SampleFrequency;
+  const char *CollapsedStacksPath;
+  u32 ShardCount;
+  u32 BatchWorkerCount;
+  bool UseAutotune;
+  bool ForceRetune;
+  f64 TuneTolerance;
+  bool IsValid;
+};
+
+// NOTE(Lucas): Tree or tape, depending on Options. The callback's pair type
+// picks whether numbers are parsed as f64 or f32.
+template <typename pair_type>
+static bool ParseDocumentPairs(options *Options, const char *InputPath,
+                               void (*Callback)(void *, pair_type *),
+                               void *UserData) {
+  bool Result = false;
+
+  if (Options->Mode == InputMode_Tape) {
+    buffer File = ReadEntireFileInto(&GlobalInputBuffer, InputPath);
+    json_tape *Tape;
+
+    {
+      TimeBandwidth("ParseJSON", File.Size);
+      Tape = ParseJSONTape((char *)File.Data, File.Size);
+    }
+
+    if (Tape) {
+      json_tape_value PairsData = GetKey(JSONTapeRoot(Tape), STRING("pairs"));
+
+      if (PairsData) {
+        ForEachPair(PairsData, Callback, UserData);
+        Result = true;
+      }
+
+      FreeJSONTape(Tape);
+    }
+  } else {
+    buffer File = ReadEntireFileInto(&GlobalInputBuffer, InputPath);
+    json_element *JsonData;
+
+    {
+      TimeBandwidth("ParseJSON", File.Size);
+      JsonData = ParseJSON((char *)File.Data, File.Size);
+    }
+
+    if (JsonData) {
+      json_element *PairsData = GetKey(JsonData, STRING("pairs"));
+
+      if (PairsData) {
+        ForEachPair(PairsData, Callback, UserData);
+        Result = true;
+      }
+
+      FreeJSON(JsonData);
+    }
+  }
+
+  return Result;
+}
+
+static bool LoadPairs(options *Options, const char *InputPath,
+                      haversine_pair_fn *Callback, void *UserData) {
+  bool Result = false;
+
+  if (IsGzipFile(InputPath)) {
+    // NOTE(Lucas): The tree and the tape need the whole document in memory,
+    // compressed input always goes through the stream parser.
+    Result = StreamGzipPairs(InputPath, Callback, UserData);
+  } else if (Options->Mode == InputMode_Stream) {
+    Result = StreamPairs(InputPath, Callback, UserData);
+  } else {
+    Result = ParseDocumentPairs(Options, InputPath, Callback, UserData);
+  }
+
+  return Result;
+}
+
+static bool LoadPairsF32(options *Options, const char *InputPath,
+                         haversine_pairs_f32 *Pairs) {
+  bool Result = false;
+
+  if (IsGzipFile(InputPath) || Options->Mode == InputMode_Stream) {
+    Result = LoadPairs(Options, InputPath, AppendPairAsF32, Pairs);
+  } else {
+    Result = ParseDocumentPairs(Options, InputPath, AppendPairF32, Pairs);
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Loads the input again as f64 and compares every f32 distance
+// with ReferenceHaversine, so the cost of the narrower lanes is measured on
+// the actual data.
+static void ReportF32Error(options *Options, haversine_pairs_f32 *PairsF32,
+                           haversine_result *F32Result) {
+  TimeFunction;
+
+  haversine_pairs Pairs = {};
+  if (!LoadPairs(Options, Options->InputPath, AppendPair, &Pairs) ||
+      Pairs.Count != PairsF32->Count) {
+    printf("F32 error: could not load the f64 reference\n");
+    FreePairs(&Pairs);
+    return;
+  }
+
+  f64 MaxError = 0;
+  f64 MaxRelativeError = 0;
+  summation ErrorSum;
+  InitSummation(&ErrorSum, false);
+
+  f32 Distances[SUMMATION_BLOCK_SIZE];
+
+  for (u64 First = 0; First < Pairs.Count; First += SUMMATION_BLOCK_SIZE) {
+    u64 Count = Min(Pairs.Count - First, (u64)SUMMATION_BLOCK_SIZE);
+    HaversineF32Kernel(PairsF32, First, Count, (f32)EARTH_RADIUS, Distances);
+
+    for (u64 Index = 0; Index < Count; ++Index) {
+      u64 Pair = First + Index;
+      f64 Reference =
+          ReferenceHaversine(Pairs.X0[Pair], Pairs.Y0[Pair], Pairs.X1[Pair],
+                             Pairs.Y1[Pair], EARTH_RADIUS);
+      f64 Error = fabs((f64)Distances[Index] - Reference);
+
+      MaxError = Max(MaxError, Error);
+      if (Reference > 0) {
+        MaxRelativeError = Max(MaxRelativeError, Error / Reference);
+      }
+      AddToSummation(&ErrorSum, Error);
+    }
+  }
+
+  haversine_result Reference = SumHaversineDistances(
+      &Pairs, Options->ThreadCount, Options->IsCompensated);
+
+  f64 Meters = 1000.0;
+  f64 AverageError =
+      fabs(F32Result->Sum - Reference.Sum) / (f64)Max(Pairs.Count, 1);
+
+  printf("F32 error vs f64: max %.3fm, mean %.3fm, max relative %.3g, "
+         "average off by %.3fm\n",
+         MaxError * Meters,
+         SummationResult(&ErrorSum) / (f64)Max(Pairs.Count, 1) * Meters,
+         MaxRelativeError, AverageError * Meters);
+  printf("Coordinates: %.3fmb as f32, %.3fmb as f64\n",
+         (f64)(Pairs.Count * 4 * sizeof(f32)) / (1024.0 * 1024.0),
+         (f64)(Pairs.Count * 4 * sizeof(f64)) / (1024.0 * 1024.0));
+
+  FreePairs(&Pairs);
+}
+
+static bool LoadDataset(void *UserData, const char *Path,
+                        haversine_pairs *Pairs) {
+  TimeFunction;
+  return LoadPairs((options *)UserData, Path, AppendPair, Pairs);
+}
+
+static bool Serve(options *Options) {
+  resident_dataset *Datasets =
+      (resident_dataset *)calloc(Options->InputCount, sizeof(resident_dataset));
+
+  for (u32 Index = 0; Index < Options->InputCount; ++Index) {
+    resident_dataset *Dataset = Datasets + Index;
+    Dataset->Path = Options->InputPaths[Index];
+
+    if (!LoadDataset(Options, Dataset->Path, &Dataset->Pairs)) {
+      fprintf(stderr, "Could not load %s\n", Dataset->Path);
+      return false;
+    }
+
+    printf("Dataset %u: %s (%llu pairs)\n", Index, Dataset->Path,
+           Dataset->Pairs.Count);
+  }
+
+  return RunDaemon(Options->ServePath, Datasets, Options->InputCount,
+                   LoadDataset, Options);
+}
+
+#include "shards.cpp"
+
+// NOTE(Lucas): The answer file holds the plain and the compensated average,
+// one per line, printed with enough digits to round trip.
+static bool ReadAnswer(const char *AnswerPath, bool IsCompensated,
+                       f64 *Reference) {
+  f64 Expected[2];
+  bool Result = false;
+
+  FILE *File = fopen(AnswerPath, "r");
+  if (File) {
+    if (fscanf(File, "%lf %lf", Expected, Expected + 1) == 2) {
+      *Reference = Expected[IsCompensated ? 1 : 0];
+      Result = true;
+    }
+    fclose(File);
+  }
+
+  return Result;
+}
+
+static bool CheckAgainstAnswer(const char *AnswerPath, bool IsCompensated,
+                               f64 Average) {
+  f64 Reference;
+  bool Result = false;
+
+  if (ReadAnswer(AnswerPath, IsCompensated, &Reference)) {
+    Result = memcmp(&Reference, &Average, sizeof(f64)) == 0;
+
+    if (Result) {
+      printf("Reference check: exact match\n");
+    } else {
+      printf("Reference check: MISMATCH, expected %.17g, got %.17g\n",
+             Reference, Average);
     }
+  } else {
+    printf("Reference check: could not read %s\n", AnswerPath);
   }
 
-  return false;
+  return Result;
+}
+
+#include "batch.cpp"
+#include "repetition_test.cpp"
+#include "autotune.cpp"
+
+static void PrintUsage(const char *ProgramName) {
+  fprintf(stderr,
+          "Usage: %s [--tape | --stream] [--cache | --f32] [--threads N] "
+          "[--compensated] [--check ANSWER] [--prefault N] [--sample HZ] "
+          "[--collapsed FILE] [--autotune | --retune] [--tune-tolerance REL] "
+          "INPUT\n",
+          ProgramName);
+  fprintf(stderr, "       %s [--tape | --stream] --serve SOCKET INPUT...\n",
+          ProgramName);
+  fprintf(stderr, "       %s --shards N [--compensated] [--check ANSWER] "
+                  "INPUT\n",
+          ProgramName);
+  fprintf(stderr, "       %s --batch N [--stream] [--compensated] "
+                  "INPUT...\n\n",
+          ProgramName);
+  fprintf(stderr, "INPUT\tJSON file produced by GenerateRandomHaversineData, "
+                  "optionally gzip compressed.\n");
+  fprintf(stderr, "--tape\tParse into a flat tape and decode values lazily "
+                  "instead of building a tree.\n");
+  fprintf(stderr, "--stream\tParse the file in fixed size chunks without "
+                  "loading it whole.\n");
+  fprintf(stderr, "--cache\tUse INPUT.pairs if it matches INPUT, otherwise "
+                  "parse and (re)write it.\n");
+  fprintf(stderr, "--serve\tKeep the inputs loaded and answer queries on the "
+                  "unix socket SOCKET.\n");
+  fprintf(stderr, "--threads\tThreads summing the distances with --cache or "
+                  "--f32 (default 1), the result does not depend on it.\n");
+  fprintf(stderr, "--compensated\tKeep a Neumaier correction per summation "
+                  "lane.\n");
+  fprintf(stderr, "--f32\tStore coordinates and compute distances in f32 "
+                  "(sum still in f64) and report the error against f64.\n");
+  fprintf(stderr, "--check\tCompare the average bit for bit with the "
+                  "data_*.f64 answer written by the generator.\n");
+  fprintf(stderr, "--prefault\tThreads faulting in the read buffer before "
+                  "the file is read into it (default: one per core, up to "
+                  "16), 0 leaves it to the read.\n");
+  fprintf(stderr, "--shards\tSplit INPUT into N ranges and parse and sum "
+                  "them in N worker processes. Uncompressed input only.\n");
+  fprintf(stderr, "--batch\tSum every INPUT (directories: the *.json and "
+                  "*.json.gz files in them) on N worker processes that "
+                  "reuse their buffers from file to file, and print a result "
+                  "per file. Parses with the tape unless --stream, checks "
+                  "files that have a data_*.f64 answer next to them.\n");
+  fprintf(stderr, "--autotune\tUse the parser and precision measured fastest "
+                  "on this CPU, measuring them on INPUT first if that hasn't "
+                  "been done yet.\n");
+  fprintf(stderr, "--retune\tLike --autotune, but always measure again.\n");
+  fprintf(stderr, "--tune-tolerance\tRelative error of the average the "
+                  "autotuner accepts (default 0, bit for bit with the f64 "
+                  "tree), f32 needs more than 0. Implies --autotune.\n");
+  fprintf(stderr, "--sample\tAlso run the sampling profiler at HZ samples "
+                  "per second of CPU time and print the hottest functions. "
+                  "Build with -fno-omit-frame-pointer for call stacks.\n");
+  fprintf(stderr, "--collapsed\tWrite the sampled call stacks to FILE in the "
+                  "collapsed format flame graph tools read (implies --sample "
+                  "%d).\n",
+          PROFILER_DEFAULT_SAMPLE_FREQUENCY);
+}
+
+static options ParseCommandLineOptions(int CommandLineArgumentsCount,
+                                       char *CommandLineArguments[]) {
+  options Result = {.ThreadCount = 1};
+  Result.PrefaultThreadCount = DefaultPrefaultThreadCount();
+
+  for (int Index = 1; Index < CommandLineArgumentsCount; ++Index) {
+    const char *Argument = CommandLineArguments[Index];
+
+    if (strcmp(Argument, "--tape") == 0) {
+      Result.Mode = InputMode_Tape;
+    } else if (strcmp(Argument, "--stream") == 0) {
+      Result.Mode = InputMode_Stream;
+    } else if (strcmp(Argument, "--cache") == 0) {
+      Result.UseCache = true;
+    } else if (strcmp(Argument, "--serve") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.ServePath = CommandLineArguments[++Index];
+    } else if (strcmp(Argument, "--threads") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.ThreadCount = (u32)atoi(CommandLineArguments[++Index]);
+      if (Result.ThreadCount == 0) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--prefault") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      u32 ThreadCount = (u32)atoi(CommandLineArguments[++Index]);
+      Result.PrefaultThreadCount = Min(ThreadCount, READ_BUFFER_MAX_THREADS);
+    } else if (strcmp(Argument, "--shards") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.ShardCount = (u32)atoi(CommandLineArguments[++Index]);
+      if (Result.ShardCount == 0 || Result.ShardCount > SHARD_MAX_COUNT) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--batch") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.BatchWorkerCount = (u32)atoi(CommandLineArguments[++Index]);
+      if (Result.BatchWorkerCount == 0 ||
+          Result.BatchWorkerCount > BATCH_MAX_WORKERS) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--autotune") == 0) {
+      Result.UseAutotune = true;
+    } else if (strcmp(Argument, "--retune") == 0) {
+      Result.UseAutotune = true;
+      Result.ForceRetune = true;
+    } else if (strcmp(Argument, "--tune-tolerance") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.UseAutotune = true;
+      Result.TuneTolerance = atof(CommandLineArguments[++Index]);
+      if (!(Result.TuneTolerance >= 0)) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--sample") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.SampleFrequency = (u32)atoi(CommandLineArguments[++Index]);
+      if (Result.SampleFrequency == 0) {
+        return {};
+      }
+    } else if (strcmp(Argument, "--collapsed") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.CollapsedStacksPath = CommandLineArguments[++Index];
+    } else if (strcmp(Argument, "--f32") == 0) {
+      Result.UseF32 = true;
+    } else if (strcmp(Argument, "--compensated") == 0) {
+      Result.IsCompensated = true;
+    } else if (strcmp(Argument, "--check") == 0 &&
+               Index + 1 < CommandLineArgumentsCount) {
+      Result.CheckPath = CommandLineArguments[++Index];
+    } else if (Argument[0] != '-') {
+      if (!Result.InputPaths) {
+        Result.InputPaths = CommandLineArguments + Index;
+      }
+      // NOTE(Lucas): Inputs have to be given one after the other.
+      if (Result.InputPaths + Result.InputCount !=
+          CommandLineArguments + Index) {
+        return {};
+      }
+      Result.InputCount++;
+    } else {
+      return {};
+    }
+  }
+
+  if (Result.InputCount) {
+    Result.InputPath = Result.InputPaths[0];
+  }
+
+  if (Result.CollapsedStacksPath && !Result.SampleFrequency) {
+    Result.SampleFrequency = PROFILER_DEFAULT_SAMPLE_FREQUENCY;
+  }
+
+  Result.IsValid =
+      (Result.InputCount == 1) ||
+      ((Result.ServePath || Result.BatchWorkerCount) && Result.InputCount >= 1);
+
+  // NOTE(Lucas): The pair cache and the server only hold f64 pairs.
+  if (Result.UseF32 && (Result.UseCache || Result.ServePath)) {
+    Result.IsValid = false;
+  }
+
+  // NOTE(Lucas): Shards always parse with the stream parser and sum in f64.
+  if (Result.ShardCount &&
+      (Result.UseF32 || Result.UseCache || Result.ServePath ||
+       Result.Mode != InputMode_Tree)) {
+    Result.IsValid = false;
+  }
+
+  // NOTE(Lucas): Batches check every file against its own answer.
+  if (Result.BatchWorkerCount &&
+      (Result.UseF32 || Result.UseCache || Result.ServePath ||
+       Result.ShardCount || Result.CheckPath)) {
+    Result.IsValid = false;
+  }
+
+  // NOTE(Lucas): The autotuner picks the parser and precision of a plain
+  // single file run, it can't be combined with picking them by hand.
+  if (Result.UseAutotune &&
+      (Result.Mode != InputMode_Tree || Result.UseF32 || Result.UseCache ||
+       Result.ServePath || Result.ShardCount || Result.BatchWorkerCount)) {
+    Result.IsValid = false;
+  }
+
+  return Result;
 }
 
 int main(int CommandLineArgumentsCount, char *CommandLineArguments[]) {
+  options Options =
+      ParseCommandLineOptions(CommandLineArgumentsCount, CommandLineArguments);
 
-  BeginProfile();
+  if (!Options.IsValid) {
+    PrintUsage(CommandLineArguments[0]);
+    return 1;
+  }
 
-  buffer File = ReadEntireFile(CommandLineArguments[1]);
+  GlobalInputBuffer.PrefaultThreadCount = Options.PrefaultThreadCount;
+  GlobalProfiler.SampleFrequency = Options.SampleFrequency;
+  GlobalProfiler.CollapsedStacksPath = Options.CollapsedStacksPath;
 
-  json_element *JsonData;
+  BeginProfile();
 
-  {
-    TimeBandwidth("ParseJSON", File.Size);
-    JsonData = ParseJSON((char *)File.Data, File.Size);
+  if (Options.ServePath) {
+    bool Served = Serve(&Options);
+    EndProfileAndPrint();
+    return Served ? 0 : 1;
   }
 
-  if (JsonData) {
-    json_element *PairsData = GetKey(JsonData, STRING("pairs"));
+  if (Options.BatchWorkerCount) {
+    bool Processed =
+        ProcessBatch(Options.InputPaths, Options.InputCount,
+                     Options.BatchWorkerCount, Options.Mode,
+                     Options.IsCompensated);
+    printf("Coordinator peak RSS: %.3fmb\n",
+           (f64)ReadOSPeakResidentBytes() / (1024.0 * 1024.0));
+    EndProfileAndPrint();
+    return Processed ? 0 : 1;
+  }
 
-    if (PairsData) {
-      int Count = 0;
-      f64 HaversineDistanceSum = 0;
-      json_array_iterator Iter = MakeJSONArrayIterator(PairsData);
+  if (Options.UseAutotune) {
+    Autotune(&Options, Options.TuneTolerance, Options.ForceRetune);
 
-      for (json_element *Item = Next(&Iter); Item; Item = Next(&Iter)) {
-        json_element *X0Value = GetKey(Item, STRING("x0"));
-        f64 X0 = ConvertJSONValueToF64(X0Value);
+    // NOTE(Lucas): Tuning is not part of the run being profiled.
+    ResetReadBufferStats(&GlobalInputBuffer);
+    RestartProfile();
+  }
 
-        json_element *Y0Value = GetKey(Item, STRING("y0"));
-        f64 Y0 = ConvertJSONValueToF64(Y0Value);
+  haversine_result Result = {};
 
-        json_element *X1Value = GetKey(Item, STRING("x1"));
-        f64 X1 = ConvertJSONValueToF64(X1Value);
+  if (Options.ShardCount) {
+    if (IsGzipFile(Options.InputPath)) {
+      fprintf(stderr, "--shards needs an uncompressed input\n");
+    } else {
+      Result = ProcessShards(Options.InputPath, Options.ShardCount,
+                             Options.IsCompensated);
+    }
+  } else if (Options.UseF32) {
+    haversine_pairs_f32 Pairs = {};
 
-        json_element *Y1Value = GetKey(Item, STRING("y1"));
-        f64 Y1 = ConvertJSONValueToF64(Y1Value);
+    if (LoadPairsF32(&Options, Options.InputPath, &Pairs)) {
+      Result = SumHaversineDistancesF32(&Pairs, Options.ThreadCount,
+                                        Options.IsCompensated);
+      ReportF32Error(&Options, &Pairs, &Result);
+    }
 
-        HaversineDistanceSum +=
-            ReferenceHaversine(X0, Y0, X1, Y1, EARTH_RADIUS);
-        Count++;
+    FreePairsF32(&Pairs);
+  } else if (Options.UseCache) {
+    pair_cache Cache = OpenPairCache(Options.InputPath);
+
+    if (Cache.IsValid) {
+      printf("Pair cache: hit\n");
+      Result = SumHaversineDistances(&Cache.Pairs, Options.ThreadCount,
+                                     Options.IsCompensated);
+      ClosePairCache(&Cache);
+    } else {
+      haversine_pairs Pairs = {};
+      bool IsValid;
+
+      {
+        TimeBlock("ColdParse");
+        IsValid = LoadPairs(&Options, Options.InputPath, AppendPair, &Pairs);
       }
 
-      f64 AverageHaversineDistance = HaversineDistanceSum / (f64)Count;
+      if (IsValid) {
+        bool Written = WritePairCache(Options.InputPath, &Pairs);
+        printf("Pair cache: miss (%s)\n",
+               Written ? "rebuilt" : "could not write the cache");
+        Result = SumHaversineDistances(&Pairs, Options.ThreadCount,
+                                       Options.IsCompensated);
+      }
+
+      FreePairs(&Pairs);
+    }
+  } else {
+    InitSummation(&Result.Summation, Options.IsCompensated);
+    Result.IsValid =
+        LoadPairs(&Options, Options.InputPath, AccumulatePair, &Result);
+    Result.Sum = SummationResult(&Result.Summation);
+  }
+
+  bool IsCorrect = Result.IsValid;
 
-      f64 ExpectedAverageHaversineDistance = 0;
+  if (Result.IsValid) {
+    f64 AverageHaversineDistance = Result.Sum / (f64)Result.Count;
 
-      printf("Number of Coordinate Pairs: %d\nAverage Haversine Distance: %f\n",
-             Count, AverageHaversineDistance);
+    printf("Number of Coordinate Pairs: %llu\nAverage Haversine Distance: %f\n",
+           Result.Count, AverageHaversineDistance);
+
+    if (Options.CheckPath) {
+      IsCorrect = CheckAgainstAnswer(Options.CheckPath, Options.IsCompensated,
+                                     AverageHaversineDistance);
     }
   }
 
+  if (GlobalInputBuffer.FileCount) {
+    PrintReadBufferStats(&GlobalInputBuffer, GlobalProfiler.CPUFrequency);
+  }
+
+  printf("Peak RSS: %.3fmb\n",
+         (f64)ReadOSPeakResidentBytes() / (1024.0 * 1024.0));
+
   EndProfileAndPrint();
 
-  return 0;
+  return IsCorrect ? 0 : 1;
 }
@@ -1,67 +1,161 @@
-#ifndef PROFILER_ENABLED
-#define PROFILER_ENABLED 0
+// NOTE(Lucas): The profiler's cold side: registration, the tables and the
+// report. Included directly by the unity builds, or compiled once through
+// profiler_unit.cpp when the program is split into several translation units.
+
+#include "profiler.h"
+
+#if PROFILER_SAMPLING
+#include "sampling_profiler.cpp"
 #endif
 
+profiler GlobalProfiler;
+
 #if PROFILER_ENABLED
 
-struct profiler_section {
-  const char *Name;
-  u64 ElapsedInclusive;
-  u64 ElapsedExclusive;
-  u64 Hits;
-  u64 ProcessedByteCount;
-};
-
-static profiler_section GlobalProfilerSections[4096];
-static u32 GlobalActiveSectionIndex;
-
-class profiler_trace {
-private:
-  u64 mStartCounter;
-  u64 mPreviousElapsedInclusive;
-  const char *mSectionName;
-  u32 mSectionIndex;
-  u32 mParentSectionIndex;
-
-public:
-  profiler_trace(const char *SectionName, u32 SectionIndex, u64 ByteCount);
-  ~profiler_trace();
-};
-
-profiler_trace::profiler_trace(const char *SectionName, u32 SectionIndex,
-                               u64 ByteCount) {
-  mSectionName = SectionName;
-  mSectionIndex = SectionIndex;
-  mParentSectionIndex = GlobalActiveSectionIndex;
-  mPreviousElapsedInclusive =
-      GlobalProfilerSections[mSectionIndex].ElapsedInclusive;
-  GlobalProfilerSections[mSectionIndex].ProcessedByteCount += ByteCount;
-  GlobalActiveSectionIndex = SectionIndex;
-
-  mStartCounter = ReadCPUTimer();
+u64 GlobalAllocationCount;
+u64 GlobalAllocatedByteCount;
+
+profiler_section GlobalProfilerSections[PROFILER_MAX_SECTIONS];
+u32 GlobalActiveSectionIndex;
+
+// NOTE(Lucas): Slots 0 and PROFILER_OVERFLOW_SECTION are never handed out.
+static u32 GlobalProfilerSectionCount = 1;
+
+#if PROFILER_HISTOGRAMS
+
+profiler_histogram GlobalProfilerHistograms[PROFILER_MAX_SECTIONS];
+
+// NOTE(Lucas): The middle of the range of values that land in Bucket.
+static u64 HistogramBucketValue(u32 Bucket) {
+  if (Bucket < PROFILER_HISTOGRAM_SUB_COUNT) {
+    return Bucket;
+  }
+
+  u32 Shift = Bucket / PROFILER_HISTOGRAM_SUB_COUNT - 1;
+  u64 Sub = Bucket % PROFILER_HISTOGRAM_SUB_COUNT;
+  u64 Low = (PROFILER_HISTOGRAM_SUB_COUNT + Sub) << Shift;
+  return Low + ((1ull << Shift) >> 1);
 }
 
-profiler_trace::~profiler_trace() {
-  u64 EndCounter = ReadCPUTimer();
-  u64 Elapsed = EndCounter - mStartCounter;
-  GlobalActiveSectionIndex = mParentSectionIndex;
-
-  profiler_section *Parent = GlobalProfilerSections + mParentSectionIndex;
-  profiler_section *Section = GlobalProfilerSections + mSectionIndex;
-
-  // Pop the active section
-  Parent->ElapsedExclusive -= Elapsed;
-  Section->ElapsedExclusive += Elapsed;
-  Section->ElapsedInclusive = mPreviousElapsedInclusive + Elapsed;
-  Section->Name = mSectionName;
-  Section->Hits++;
+static u64 HistogramPercentile(profiler_histogram *Histogram, u64 Count,
+                               f64 Fraction) {
+  u64 Rank = (u64)ceil(Fraction * (f64)Count);
+  Rank = Max(Rank, 1);
+
+  u64 Result = Histogram->Max;
+  u64 Seen = 0;
+  for (u32 Bucket = 0; Bucket < PROFILER_HISTOGRAM_BUCKET_COUNT; ++Bucket) {
+    Seen += Histogram->Buckets[Bucket];
+    if (Seen >= Rank) {
+      Result = HistogramBucketValue(Bucket);
+      break;
+    }
+  }
+
+  Result = Max(Result, Histogram->Min);
+  Result = Min(Result, Histogram->Max);
+  return Result;
+}
+
+#endif
+
+// NOTE(Lucas): Slots are handed out in the order sites first run. Sites past
+// the capacity all share the overflow slot, so their time still shows up
+// instead of being mixed into some other section. The counters themselves
+// are not thread safe, but two threads reaching a new site at once only
+// waste a slot.
+u32 RegisterProfilerSite(profiler_site *Site) {
+  u32 Index = __atomic_fetch_add(&GlobalProfilerSectionCount, 1,
+                                 __ATOMIC_RELAXED);
+
+  if (Index >= PROFILER_OVERFLOW_SECTION) {
+    Index = PROFILER_OVERFLOW_SECTION;
+    if (!GlobalProfilerSections[Index].Name) {
+      fprintf(stderr,
+              "Profiler: more than %d sections, \"%s\" and every section "
+              "after it are counted as \"[overflow]\". Raise "
+              "PROFILER_MAX_SECTIONS.\n",
+              PROFILER_MAX_SECTIONS - 2, Site->Name);
+      GlobalProfilerSections[Index].Name = "[overflow]";
+    }
+  } else {
+    GlobalProfilerSections[Index].Name = Site->Name;
+  }
+
+  u32 Expected = 0;
+  if (!__atomic_compare_exchange_n(&Site->Index, &Expected, Index, false,
+                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    Index = Expected;
+  }
+
+  return Index;
+}
+
+void ResetProfilerSections() {
+  for (u32 Index = 0; Index < PROFILER_MAX_SECTIONS; ++Index) {
+    const char *Name = GlobalProfilerSections[Index].Name;
+    GlobalProfilerSections[Index] = {};
+    GlobalProfilerSections[Index].Name = Name;
+  }
+  GlobalAllocationCount = 0;
+  GlobalAllocatedByteCount = 0;
+
+#if PROFILER_HISTOGRAMS
+  memset(GlobalProfilerHistograms, 0, sizeof(GlobalProfilerHistograms));
+#endif
+}
+
+// NOTE(Lucas): Sections without hits are skipped, that includes the ones
+// still open (whatever the parent was in when it forked).
+u32 CollectProfilerSections(profiler_section *Sections, u32 MaxCount) {
+  u32 Count = 0;
+
+  for (u32 Index = 1; Index < PROFILER_MAX_SECTIONS && Count < MaxCount;
+       ++Index) {
+    if (GlobalProfilerSections[Index].Hits) {
+      Sections[Count++] = GlobalProfilerSections[Index];
+    }
+  }
+
+  return Count;
+}
+
+// NOTE(Lucas): Name pointers are only comparable within one binary, the names
+// themselves are compared.
+void MergeProfilerSections(profiler_section *Sections, u32 Count) {
+  for (u32 SectionIndex = 0; SectionIndex < Count; ++SectionIndex) {
+    profiler_section *Source = Sections + SectionIndex;
+
+    u32 Index = 1;
+    u32 RegisteredCount = Min(GlobalProfilerSectionCount,
+                              (u32)PROFILER_OVERFLOW_SECTION);
+    while (Index < RegisteredCount &&
+           strcmp(GlobalProfilerSections[Index].Name, Source->Name) != 0) {
+      Index++;
+    }
+    if (Index == RegisteredCount) {
+      profiler_site Site = {Source->Name};
+      Index = RegisterProfilerSite(&Site);
+    }
+
+    profiler_section *Dest = GlobalProfilerSections + Index;
+    Dest->ElapsedInclusive += Source->ElapsedInclusive;
+    Dest->ElapsedExclusive += Source->ElapsedExclusive;
+    Dest->Hits += Source->Hits;
+    Dest->ProcessedByteCount += Source->ProcessedByteCount;
+    Dest->AllocationCount += Source->AllocationCount;
+    Dest->AllocatedByteCount += Source->AllocatedByteCount;
+    Dest->HasOSCounters |= Source->HasOSCounters;
+    Dest->PageFaultCount += Source->PageFaultCount;
+    Dest->ResidentGrowth += Source->ResidentGrowth;
+  }
 }
 
-void PrintSectionData(u64 TotalElapsed, u64 CPUFrequency) {
+static void PrintSectionData(u64 TotalElapsed, u64 CPUFrequency) {
   for (u32 Index = 1; Index < ArrayCount(GlobalProfilerSections); Index++) {
     profiler_section *Section = &GlobalProfilerSections[Index];
 
-    if (Section->Name) {
+    if (Section->Name && Section->Hits) {
       printf("\t%s[%llu]: %llu, %llu(%.2f%%, %.2f%%)", Section->Name,
              Section->Hits, Section->ElapsedInclusive,
              Section->ElapsedExclusive,
@@ -80,36 +174,63 @@ void PrintSectionData(u64 TotalElapsed, u64 CPUFrequency) {
         printf(" %.3fmb at %.2fgb/s", Megabytes, GigabytesPerSecond);
       }
 
+      if (Section->AllocationCount) {
+        printf(" %llu allocs %.3fmb", Section->AllocationCount,
+               (f64)Section->AllocatedByteCount / (1024.0 * 1024.0));
+      }
+
+      if (Section->HasOSCounters) {
+        printf(" %llu faults rss %+.3fmb", Section->PageFaultCount,
+               (f64)Section->ResidentGrowth / (1024.0 * 1024.0));
+      }
+
       putchar('\n');
+
+#if PROFILER_HISTOGRAMS
+      profiler_histogram *Histogram = GlobalProfilerHistograms + Index;
+      printf("\t\tcycles per call: min %llu, p50 %llu, p90 %llu, p99 %llu, "
+             "p99.9 %llu, max %llu\n",
+             Histogram->Min,
+             HistogramPercentile(Histogram, Section->Hits, 0.50),
+             HistogramPercentile(Histogram, Section->Hits, 0.90),
+             HistogramPercentile(Histogram, Section->Hits, 0.99),
+             HistogramPercentile(Histogram, Section->Hits, 0.999),
+             Histogram->Max);
+#endif
     }
   }
 }
 
-#define NameConcat2(A, B) A##B
-#define NameConcat(A, B) NameConcat2(A, B)
-#define TimeBandwidth(NAME, BYTE_COUNT)                                        \
-  profiler_trace NameConcat(Trace, __LINE__)(NAME, __COUNTER__ + 1, BYTE_COUNT)
-#define TimeBlock(NAME) TimeBandwidth(NAME, 0)
-#define TimeFunction TimeBlock(__func__)
-
 #else
 
-#define TimeBlock(...)
-#define TimeBandwidth(...)
-#define TimeFunction
-
 #define PrintSectionData(...)
 
 #endif
 
-struct profiler {
-  u64 CPUFrequency;
-  u64 StartCounter;
-};
-static profiler GlobalProfiler;
-
 void BeginProfile() {
   GlobalProfiler.CPUFrequency = EstimateCPUFrequency();
+
+#if PROFILER_SAMPLING
+  if (GlobalProfiler.SampleFrequency &&
+      !StartSampling(GlobalProfiler.SampleFrequency)) {
+    fprintf(stderr, "Could not start the sampling profiler: %s\n",
+            strerror(errno));
+  }
+#endif
+
+  GlobalProfiler.StartCounter = ReadCPUTimer();
+}
+
+void RestartProfile() {
+#if PROFILER_ENABLED
+  ResetProfilerSections();
+#endif
+
+#if PROFILER_SAMPLING
+  __atomic_store_n(&GlobalSampler.SampleCount, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&GlobalSampler.DroppedCount, 0, __ATOMIC_RELAXED);
+#endif
+
   GlobalProfiler.StartCounter = ReadCPUTimer();
 }
 
@@ -121,4 +242,14 @@ void EndProfileAndPrint() {
          1000.0 * (f64)TotalElapsed / (f64)GlobalProfiler.CPUFrequency);
 
   PrintSectionData(TotalElapsed, GlobalProfiler.CPUFrequency);
+
+#if PROFILER_SAMPLING
+  if (GlobalSampler.IsRunning) {
+    StopSampling();
+    PrintSamplingReport(GlobalProfiler.SampleTopCount
+                            ? GlobalProfiler.SampleTopCount
+                            : PROFILER_DEFAULT_SAMPLE_TOP_COUNT,
+                        GlobalProfiler.CollapsedStacksPath);
+  }
+#endif
 }
@@ -0,0 +1,276 @@
+// NOTE(Lucas): The profiler's interface and its hot path. Every translation
+// unit that uses TimeFunction/TimeBlock/TimeBandwidth includes this, exactly
+// one of them also compiles profiler.cpp (directly in a unity build, or
+// profiler_unit.cpp linked in).
+//
+// Sections are identified by a static anchor at each call site that takes a
+// slot in GlobalProfilerSections the first time it runs, so call sites in
+// separately compiled files can't end up sharing a slot. After that first
+// run the cost is one load and a predictable branch.
+//
+// PROFILER_ENABLED and PROFILER_HISTOGRAMS have to be the same in every
+// translation unit. Expects common.hpp and os.cpp before it.
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 0
+#endif
+
+// NOTE(Lucas): Build with -DPROFILER_HISTOGRAMS=1 to also keep a histogram
+// of the cycles of every single call per section.
+#ifndef PROFILER_HISTOGRAMS
+#define PROFILER_HISTOGRAMS 0
+#endif
+
+// NOTE(Lucas): The sampling profiler is compiled in on posix but only runs
+// when GlobalProfiler.SampleFrequency is set before BeginProfile. It works
+// with PROFILER_ENABLED 0 too.
+#ifndef PROFILER_SAMPLING
+#define PROFILER_SAMPLING !_WIN64
+#endif
+
+#define PROFILER_DEFAULT_SAMPLE_FREQUENCY 1000
+#define PROFILER_DEFAULT_SAMPLE_TOP_COUNT 20
+
+// NOTE(Lucas): Slot 0 is the root every top level section is nested in, the
+// last slot collects every call site registered after the table filled up.
+#ifndef PROFILER_MAX_SECTIONS
+#define PROFILER_MAX_SECTIONS 4096
+#endif
+#define PROFILER_OVERFLOW_SECTION (PROFILER_MAX_SECTIONS - 1)
+
+struct profiler {
+  u64 CPUFrequency;
+  u64 StartCounter;
+
+  // NOTE(Lucas): Samples per second of CPU time, 0 leaves the sampler off.
+  // The top SampleTopCount functions are printed, and the collapsed stacks
+  // written to CollapsedStacksPath when it is set.
+  u32 SampleFrequency;
+  u32 SampleTopCount;
+  const char *CollapsedStacksPath;
+};
+extern profiler GlobalProfiler;
+
+void BeginProfile();
+void EndProfileAndPrint();
+
+// NOTE(Lucas): Drops everything measured so far (sections, histograms,
+// samples) and starts the total time over, for work done after BeginProfile
+// that isn't part of the run, like --autotune's measurements.
+void RestartProfile();
+
+#if PROFILER_ENABLED
+
+// NOTE(Lucas): Allocations made through these are counted against every
+// active section. realloc counts as an allocation of its new size. The
+// counters are not atomic, only call these from the profiled thread.
+extern u64 GlobalAllocationCount;
+extern u64 GlobalAllocatedByteCount;
+
+static inline void *ProfiledMalloc(size_t Size) {
+  GlobalAllocationCount++;
+  GlobalAllocatedByteCount += Size;
+  return malloc(Size);
+}
+
+static inline void *ProfiledCalloc(size_t Count, size_t Size) {
+  GlobalAllocationCount++;
+  GlobalAllocatedByteCount += Count * Size;
+  return calloc(Count, Size);
+}
+
+static inline void *ProfiledRealloc(void *Memory, size_t Size) {
+  GlobalAllocationCount++;
+  GlobalAllocatedByteCount += Size;
+  return realloc(Memory, Size);
+}
+
+// NOTE(Lucas): Everything but Hits is inclusive of nested sections.
+// PageFaultCount and ResidentGrowth are only measured for TimeBlock and
+// TimeBandwidth sections: each costs a couple of system calls per hit, too
+// much for the per node functions that use TimeFunction.
+struct profiler_section {
+  const char *Name;
+  u64 ElapsedInclusive;
+  u64 ElapsedExclusive;
+  u64 Hits;
+  u64 ProcessedByteCount;
+
+  u64 AllocationCount;
+  u64 AllocatedByteCount;
+
+  bool HasOSCounters;
+  u64 PageFaultCount;
+  s64 ResidentGrowth;
+};
+
+// NOTE(Lucas): One per call site, constant initialized so it costs nothing
+// until the site first runs. Index 0 means not registered yet.
+struct profiler_site {
+  const char *Name;
+  u32 Index;
+};
+
+extern profiler_section GlobalProfilerSections[PROFILER_MAX_SECTIONS];
+extern u32 GlobalActiveSectionIndex;
+
+u32 RegisterProfilerSite(profiler_site *Site);
+
+// NOTE(Lucas): For processes forked off a profiled one (--shards). The child
+// resets the counters it inherited, collects its sections once done, and the
+// parent adds them into its own table by name. Histograms are cleared with
+// the sections but not carried over.
+void ResetProfilerSections();
+u32 CollectProfilerSections(profiler_section *Sections, u32 MaxCount);
+void MergeProfilerSections(profiler_section *Sections, u32 Count);
+
+#if PROFILER_HISTOGRAMS
+
+// NOTE(Lucas): Log-linear buckets like HDR histograms: values below 16 get
+// a bucket each, above that every power of two is split into 16 buckets,
+// so a bucket is at most 1/16 wider than its values. Fixed size, recording
+// is a clz, a shift and an increment.
+#define PROFILER_HISTOGRAM_SUB_BITS 4
+#define PROFILER_HISTOGRAM_SUB_COUNT (1 << PROFILER_HISTOGRAM_SUB_BITS)
+#define PROFILER_HISTOGRAM_BUCKET_COUNT                                        \
+  ((64 - PROFILER_HISTOGRAM_SUB_BITS + 1) * PROFILER_HISTOGRAM_SUB_COUNT)
+
+struct profiler_histogram {
+  u64 Min;
+  u64 Max;
+  u32 Buckets[PROFILER_HISTOGRAM_BUCKET_COUNT];
+};
+
+extern profiler_histogram GlobalProfilerHistograms[PROFILER_MAX_SECTIONS];
+
+static inline u32 HistogramBucketFor(u64 Cycles) {
+  if (Cycles < PROFILER_HISTOGRAM_SUB_COUNT) {
+    return (u32)Cycles;
+  }
+
+  u32 Exponent = 63 - __builtin_clzll(Cycles);
+  u32 Shift = Exponent - PROFILER_HISTOGRAM_SUB_BITS;
+  u32 Sub = (u32)(Cycles >> Shift) & (PROFILER_HISTOGRAM_SUB_COUNT - 1);
+  return (Shift + 1) * PROFILER_HISTOGRAM_SUB_COUNT + Sub;
+}
+
+static inline void RecordHistogram(u32 SectionIndex, u64 Cycles) {
+  profiler_histogram *Histogram = GlobalProfilerHistograms + SectionIndex;
+
+  if (!Histogram->Min || Cycles < Histogram->Min) {
+    Histogram->Min = Cycles;
+  }
+  Histogram->Max = Max(Histogram->Max, Cycles);
+  Histogram->Buckets[HistogramBucketFor(Cycles)]++;
+}
+
+#endif
+
+class profiler_trace {
+private:
+  u64 mStartCounter;
+  u64 mPreviousElapsedInclusive;
+  u32 mSectionIndex;
+  u32 mParentSectionIndex;
+
+  u64 mStartAllocationCount;
+  u64 mStartAllocatedByteCount;
+  u64 mPreviousAllocationCount;
+  u64 mPreviousAllocatedByteCount;
+
+  bool mHasOSCounters;
+  u64 mStartPageFaultCount;
+  u64 mStartResidentBytes;
+  u64 mPreviousPageFaultCount;
+  s64 mPreviousResidentGrowth;
+
+public:
+  inline profiler_trace(profiler_site *Site, u64 ByteCount,
+                        bool HasOSCounters);
+  inline ~profiler_trace();
+};
+
+inline profiler_trace::profiler_trace(profiler_site *Site, u64 ByteCount,
+                                      bool HasOSCounters) {
+  mSectionIndex = Site->Index;
+  if (!mSectionIndex) {
+    mSectionIndex = RegisterProfilerSite(Site);
+  }
+  mParentSectionIndex = GlobalActiveSectionIndex;
+
+  profiler_section *Section = GlobalProfilerSections + mSectionIndex;
+  mPreviousElapsedInclusive = Section->ElapsedInclusive;
+  mPreviousAllocationCount = Section->AllocationCount;
+  mPreviousAllocatedByteCount = Section->AllocatedByteCount;
+  mPreviousPageFaultCount = Section->PageFaultCount;
+  mPreviousResidentGrowth = Section->ResidentGrowth;
+  Section->ProcessedByteCount += ByteCount;
+  GlobalActiveSectionIndex = mSectionIndex;
+
+  mHasOSCounters = HasOSCounters;
+  if (mHasOSCounters) {
+    mStartPageFaultCount = ReadOSPageFaultCount();
+    mStartResidentBytes = ReadOSResidentBytes();
+  }
+
+  mStartAllocationCount = GlobalAllocationCount;
+  mStartAllocatedByteCount = GlobalAllocatedByteCount;
+  mStartCounter = ReadCPUTimer();
+}
+
+inline profiler_trace::~profiler_trace() {
+  u64 EndCounter = ReadCPUTimer();
+  u64 Elapsed = EndCounter - mStartCounter;
+  GlobalActiveSectionIndex = mParentSectionIndex;
+
+  profiler_section *Parent = GlobalProfilerSections + mParentSectionIndex;
+  profiler_section *Section = GlobalProfilerSections + mSectionIndex;
+
+  // Pop the active section
+  Parent->ElapsedExclusive -= Elapsed;
+  Section->ElapsedExclusive += Elapsed;
+  Section->ElapsedInclusive = mPreviousElapsedInclusive + Elapsed;
+  Section->Hits++;
+
+#if PROFILER_HISTOGRAMS
+  RecordHistogram(mSectionIndex, Elapsed);
+#endif
+
+  Section->AllocationCount = mPreviousAllocationCount +
+                             (GlobalAllocationCount - mStartAllocationCount);
+  Section->AllocatedByteCount =
+      mPreviousAllocatedByteCount +
+      (GlobalAllocatedByteCount - mStartAllocatedByteCount);
+
+  if (mHasOSCounters) {
+    Section->HasOSCounters = true;
+    Section->PageFaultCount =
+        mPreviousPageFaultCount +
+        (ReadOSPageFaultCount() - mStartPageFaultCount);
+    Section->ResidentGrowth =
+        mPreviousResidentGrowth +
+        ((s64)ReadOSResidentBytes() - (s64)mStartResidentBytes);
+  }
+}
+
+#define NameConcat2(A, B) A##B
+#define NameConcat(A, B) NameConcat2(A, B)
+#define ProfilerTrace(NAME, BYTE_COUNT, HAS_OS_COUNTERS)                       \
+  static profiler_site NameConcat(Site, __LINE__) = {NAME};                    \
+  profiler_trace NameConcat(Trace, __LINE__)(&NameConcat(Site, __LINE__),      \
+                                             BYTE_COUNT, HAS_OS_COUNTERS)
+#define TimeBandwidth(NAME, BYTE_COUNT) ProfilerTrace(NAME, BYTE_COUNT, true)
+#define TimeBlock(NAME) TimeBandwidth(NAME, 0)
+#define TimeFunction ProfilerTrace(__func__, 0, false)
+
+#else
+
+#define TimeBlock(...)
+#define TimeBandwidth(...)
+#define TimeFunction
+
+#define ProfiledMalloc malloc
+#define ProfiledCalloc calloc
+#define ProfiledRealloc realloc
+
+#endif
@@ -0,0 +1,22 @@
+// NOTE(Lucas): The profiler as its own translation unit, for programs split
+// into several files. Compile and link this once, and include profiler.h
+// (with the same PROFILER_* defines) everywhere else:
+//
+//   clang++ -O2 program.cpp module.cpp profiler_unit.cpp
+//
+// Defaults to PROFILER_ENABLED 1, define it to 0 here too when the rest of
+// the program is built without the instrumentation.
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "common.hpp"
+#include "os.cpp"
+
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+#include "profiler.cpp"
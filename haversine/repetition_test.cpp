@@ -0,0 +1,181 @@
+// NOTE(Lucas): The repetition testing loop: call IsTesting until it says
+// stop, bracket the code under test with BeginTime/EndTime and report the
+// bytes it touched with CountBytes. Used by the repetition tester and by the
+// processor's autotuner. Expects common.hpp and os.cpp before it.
+
+enum metric {
+  Metric_TestCount = 0,
+  Metric_ByteCount,
+  Metric_CPUTimer,
+  Metric_MemPageFaults,
+
+  Metric_COUNT
+};
+
+struct test_metrics {
+  u64 M[Metric_COUNT];
+};
+
+struct test_results {
+  test_metrics Min;
+  test_metrics Max;
+  test_metrics Total;
+};
+
+enum test_mode {
+  TestMode_Uninitialized = 0,
+  TestMode_Running,
+  TestMode_Completed
+};
+
+// NOTE(Lucas): StopRule_NoNewMin runs until no new minimum showed up for
+// TargetTime. StopRule_Converged stops as soon as the minimum has settled and
+// the 95% confidence interval of the median is within
+// TEST_CONVERGENCE_TOLERANCE of it, TargetTime is then only a cap on the
+// whole test.
+enum stop_rule { StopRule_NoNewMin = 0, StopRule_Converged };
+
+#define TEST_SAMPLE_RING_SIZE 4096
+#define TEST_CONVERGENCE_MIN_SAMPLES 32
+#define TEST_CONVERGENCE_CHECK_INTERVAL 8
+#define TEST_CONVERGENCE_TOLERANCE 0.005
+#define TEST_HISTOGRAM_BIN_COUNT 12
+
+struct test_context {
+  test_mode Mode;
+  stop_rule StopRule;
+
+  u64 TargetTime;
+
+  u64 TotalBytesProcessed;
+  u64 TestsStartTime;
+  u64 FirstTestTime;
+
+  test_metrics AccumulatedOnThisTest;
+  test_results Results;
+
+  // NOTE(Lucas): The metrics of the last TEST_SAMPLE_RING_SIZE iterations,
+  // iteration N is at N % TEST_SAMPLE_RING_SIZE. Sorted is scratch space for
+  // the statistics.
+  u64 SampleCount;
+  u64 MinSettledSince;
+  bool HasConverged;
+  test_metrics Samples[TEST_SAMPLE_RING_SIZE];
+  u64 Sorted[TEST_SAMPLE_RING_SIZE];
+};
+
+static void CountBytes(test_context *Context, u64 Count) {
+  test_metrics *Accum = &Context->AccumulatedOnThisTest;
+  Accum->M[Metric_ByteCount] += Count;
+}
+
+static void BeginTime(test_context *Context) {
+  test_metrics *Accum = &Context->AccumulatedOnThisTest;
+
+  Accum->M[Metric_CPUTimer] -= ReadCPUTimer();
+  Accum->M[Metric_MemPageFaults] -= ReadOSPageFaultCount();
+}
+
+static void EndTime(test_context *Context) {
+  test_metrics *Accum = &Context->AccumulatedOnThisTest;
+
+  Accum->M[Metric_CPUTimer] += ReadCPUTimer();
+  Accum->M[Metric_MemPageFaults] += ReadOSPageFaultCount();
+}
+
+static int CompareU64(const void *A, const void *B) {
+  u64 X = *(const u64 *)A;
+  u64 Y = *(const u64 *)B;
+  return (X > Y) - (X < Y);
+}
+
+// NOTE(Lucas): Sorts the CPU timer of the stored samples into
+// Context->Sorted and returns how many there are.
+static u64 SortSampleCycles(test_context *Context) {
+  u64 Count = Min(Context->SampleCount, (u64)TEST_SAMPLE_RING_SIZE);
+
+  for (u64 Index = 0; Index < Count; ++Index) {
+    Context->Sorted[Index] = Context->Samples[Index].M[Metric_CPUTimer];
+  }
+  qsort(Context->Sorted, Count, sizeof(u64), CompareU64);
+
+  return Count;
+}
+
+// NOTE(Lucas): Distribution free 95% confidence interval of the median: the
+// order statistics n/2 -+ 1.96 * sqrt(n) / 2.
+static bool MedianHasConverged(u64 *Sorted, u64 Count, f64 Tolerance) {
+  f64 HalfWidth = 0.98 * sqrt((f64)Count);
+  s64 Low = (s64)floor(0.5 * (f64)Count - HalfWidth);
+  s64 High = (s64)ceil(0.5 * (f64)Count + HalfWidth);
+  Low = Max(Low, 0);
+  High = Min(High, (s64)Count - 1);
+
+  f64 Median = (f64)Sorted[Count / 2];
+  return (f64)(Sorted[High] - Sorted[Low]) <= 2.0 * Tolerance * Median;
+}
+
+static bool IsTesting(test_context *Context) {
+  u64 CurrentTime = ReadCPUTimer();
+
+  if (Context->Mode == TestMode_Uninitialized) {
+    Context->Mode = TestMode_Running;
+    test_results *R = &Context->Results;
+    R->Min.M[Metric_CPUTimer] = ~0;
+    Context->TestsStartTime = CurrentTime;
+    Context->FirstTestTime = CurrentTime;
+  } else if (Context->Mode == TestMode_Running) {
+    test_results *R = &Context->Results;
+    R->Total.M[Metric_TestCount] += 1;
+
+    test_metrics Accum = Context->AccumulatedOnThisTest;
+
+    for (u32 Metric = 0; Metric < Metric_COUNT; ++Metric) {
+      R->Total.M[Metric] += Accum.M[Metric];
+    }
+
+    if (R->Max.M[Metric_CPUTimer] < Accum.M[Metric_CPUTimer]) {
+      R->Max = Accum;
+    }
+
+    // NOTE(Lucas): Only a clear improvement counts as the minimum still
+    // moving for the convergence rule.
+    f64 SettledMin =
+        (1.0 - TEST_CONVERGENCE_TOLERANCE) * (f64)R->Min.M[Metric_CPUTimer];
+    if ((f64)Accum.M[Metric_CPUTimer] < SettledMin) {
+      Context->MinSettledSince = Context->SampleCount;
+    }
+
+    if (R->Min.M[Metric_CPUTimer] > Accum.M[Metric_CPUTimer]) {
+      R->Min = Accum;
+      Context->TestsStartTime = CurrentTime;
+    }
+
+    Context->Samples[Context->SampleCount % TEST_SAMPLE_RING_SIZE] = Accum;
+    Context->SampleCount++;
+
+    Context->AccumulatedOnThisTest = {};
+
+    if (Context->StopRule == StopRule_Converged) {
+      if (Context->SampleCount >= TEST_CONVERGENCE_MIN_SAMPLES &&
+          Context->SampleCount % TEST_CONVERGENCE_CHECK_INTERVAL == 0 &&
+          Context->SampleCount - Context->MinSettledSince >=
+              TEST_CONVERGENCE_MIN_SAMPLES) {
+        u64 Count = SortSampleCycles(Context);
+        if (MedianHasConverged(Context->Sorted, Count,
+                               TEST_CONVERGENCE_TOLERANCE)) {
+          Context->HasConverged = true;
+          Context->Mode = TestMode_Completed;
+        }
+      }
+
+      if (CurrentTime - Context->FirstTestTime > Context->TargetTime) {
+        Context->Mode = TestMode_Completed;
+      }
+    } else if (CurrentTime - Context->TestsStartTime > Context->TargetTime) {
+      Context->Mode = TestMode_Completed;
+    }
+  }
+
+  return (Context->Mode == TestMode_Running);
+}
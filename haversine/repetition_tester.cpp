@@ -1,54 +1,40 @@
+#include <cassert>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <zlib.h>
 
 #include "common.hpp"
+#include "haversine_formula.cpp"
+#include "summation.h"
 #include "os.cpp"
 
+// NOTE(Lucas): Only for the layout tests, which parse the file themselves.
+#include "profiler.h"
+#include "string.cpp"
+#include "json.cpp"
+#include "json_tape.cpp"
+#include "json_stream.cpp"
+#include "pairs.cpp"
+#include "haversine_f32.cpp"
+#include "pair_layouts.cpp"
+
 struct buffer {
   u8 *Data;
   size_t Size;
 };
 
-enum metric {
-  Metric_TestCount = 0,
-  Metric_ByteCount,
-  Metric_CPUTimer,
-  Metric_MemPageFaults,
-
-  Metric_COUNT
-};
+#include "repetition_test.cpp"
 
-struct test_metrics {
-  u64 M[Metric_COUNT];
-};
-
-struct test_results {
-  test_metrics Min;
-  test_metrics Max;
-  test_metrics Total;
-};
-
-enum test_mode {
-  TestMode_Uninitialized = 0,
-  TestMode_Running,
-  TestMode_Completed
-};
-struct test_context {
-  test_mode Mode;
-
-  u64 TargetTime;
-
-  u64 TotalBytesProcessed;
-  u64 TestsStartTime;
-
-  test_metrics AccumulatedOnThisTest;
-  test_results Results;
-};
+#include "cache_control.cpp"
 
 enum allocation_type { AllocType_none = 0, AllocType_malloc, AllocType_COUNT };
 
@@ -56,6 +42,15 @@ struct read_parameters {
   allocation_type AllocType;
   buffer Dest;
   const char *Filepath;
+  // NOTE(Lucas): gzip compressed copy of the file, for the inflate test.
+  buffer Compressed;
+  cache_mode CacheMode;
+
+  // NOTE(Lucas): For the write tests, an aligned copy of the file and where
+  // to write it. ChunkSize is the stdio buffer or per call size.
+  buffer Source;
+  const char *OutputPath;
+  size_t ChunkSize;
 };
 
 typedef void read_file_fn(test_context *, read_parameters *);
@@ -64,26 +59,11 @@ struct test_case {
   const char *Name;
   read_file_fn *Func;
   allocation_type AllocType;
+  bool ReadsFile;
+  size_t ChunkSize;
 };
 
-static void CountBytes(test_context *Context, u64 Count) {
-  test_metrics *Accum = &Context->AccumulatedOnThisTest;
-  Accum->M[Metric_ByteCount] += Count;
-}
-
-static void BeginTime(test_context *Context) {
-  test_metrics *Accum = &Context->AccumulatedOnThisTest;
-
-  Accum->M[Metric_CPUTimer] -= ReadCPUTimer();
-  Accum->M[Metric_MemPageFaults] -= ReadOSPageFaultCount();
-}
-
-static void EndTime(test_context *Context) {
-  test_metrics *Accum = &Context->AccumulatedOnThisTest;
-
-  Accum->M[Metric_CPUTimer] += ReadCPUTimer();
-  Accum->M[Metric_MemPageFaults] += ReadOSPageFaultCount();
-}
+#include "test_environment.cpp"
 
 static buffer AllocateBuffer(size_t Size) {
   return (buffer){.Data = (u8 *)malloc(Size), .Size = Size};
@@ -107,6 +87,25 @@ static void HandleAllocation(read_parameters *Params, buffer *Buffer) {
   }
 }
 
+// NOTE(Lucas): Called right before BeginTime. Freshly allocated buffers are
+// not in any cache yet, only the fixed buffer needs flushing.
+static void PrepareCaches(read_parameters *Params, buffer *Buffer) {
+  switch (Params->CacheMode) {
+  case CacheMode_Warm:
+    break;
+  case CacheMode_ColdFile:
+    EvictFileFromPageCache(Params->Filepath);
+    break;
+  case CacheMode_ColdCPU:
+    if (Params->AllocType == AllocType_none) {
+      FlushFromCPUCaches(*Buffer);
+    }
+    break;
+  default:
+    abort();
+  }
+}
+
 static void HandleDeallocation(read_parameters *Params, buffer *Buffer) {
   switch (Params->AllocType) {
   case AllocType_none:
@@ -119,43 +118,6 @@ static void HandleDeallocation(read_parameters *Params, buffer *Buffer) {
   }
 }
 
-static bool IsTesting(test_context *Context) {
-  u64 CurrentTime = ReadCPUTimer();
-
-  if (Context->Mode == TestMode_Uninitialized) {
-    Context->Mode = TestMode_Running;
-    test_results *R = &Context->Results;
-    R->Min.M[Metric_CPUTimer] = ~0;
-    Context->TestsStartTime = CurrentTime;
-  } else if (Context->Mode == TestMode_Running) {
-    test_results *R = &Context->Results;
-    R->Total.M[Metric_TestCount] += 1;
-
-    test_metrics Accum = Context->AccumulatedOnThisTest;
-
-    for (u32 Metric = 0; Metric < Metric_COUNT; ++Metric) {
-      R->Total.M[Metric] += Accum.M[Metric];
-    }
-
-    if (R->Max.M[Metric_CPUTimer] < Accum.M[Metric_CPUTimer]) {
-      R->Max = Accum;
-    }
-
-    if (R->Min.M[Metric_CPUTimer] > Accum.M[Metric_CPUTimer]) {
-      R->Min = Accum;
-      Context->TestsStartTime = CurrentTime;
-    }
-
-    Context->AccumulatedOnThisTest = {};
-
-    if (CurrentTime - Context->TestsStartTime > Context->TargetTime) {
-      Context->Mode = TestMode_Completed;
-    }
-  }
-
-  return (Context->Mode == TestMode_Running);
-}
-
 void ReadEntireFile_Fread(test_context *Context, read_parameters *Params) {
   while (IsTesting(Context)) {
     FILE *File = fopen(Params->Filepath, "rb");
@@ -163,6 +125,7 @@ void ReadEntireFile_Fread(test_context *Context, read_parameters *Params) {
     if (File) {
       buffer Buffer = Params->Dest;
       HandleAllocation(Params, &Buffer);
+      PrepareCaches(Params, &Buffer);
 
       BeginTime(Context);
       int Result = fread(Buffer.Data, sizeof(u8), Buffer.Size, File);
@@ -187,6 +150,7 @@ static void ReadEntireFile_ReadSyscall(test_context *Context,
 
       buffer Buffer = Params->Dest;
       HandleAllocation(Params, &Buffer);
+      PrepareCaches(Params, &Buffer);
 
       BeginTime(Context);
       int Result = read(FileDescriptor, Buffer.Data, Buffer.Size);
@@ -207,6 +171,7 @@ static void WriteToAllBytes(test_context * Context, read_parameters *Params) {
 		buffer DestBuffer = Params->Dest;
 
 		HandleAllocation(Params, &DestBuffer);
+		PrepareCaches(Params, &DestBuffer);
 		BeginTime(Context);
 		for (u64 Index = 0; Index < DestBuffer.Size; ++Index) {
 			DestBuffer.Data[Index] = Index;
@@ -218,6 +183,69 @@ static void WriteToAllBytes(test_context * Context, read_parameters *Params) {
 	}
 }
 
+static void InflateGzip(test_context *Context, read_parameters *Params) {
+  while (IsTesting(Context)) {
+    buffer Buffer = Params->Dest;
+    HandleAllocation(Params, &Buffer);
+
+    z_stream Stream = {};
+    inflateInit2(&Stream, 16 + MAX_WBITS);
+    Stream.next_in = Params->Compressed.Data;
+    Stream.avail_in = (uInt)Params->Compressed.Size;
+    Stream.next_out = Buffer.Data;
+    Stream.avail_out = (uInt)Buffer.Size;
+
+    PrepareCaches(Params, &Buffer);
+    BeginTime(Context);
+    int Result = inflate(&Stream, Z_FINISH);
+    EndTime(Context);
+
+    if (Result == Z_STREAM_END && Stream.total_out == Buffer.Size) {
+      CountBytes(Context, Buffer.Size);
+    }
+
+    inflateEnd(&Stream);
+    HandleDeallocation(Params, &Buffer);
+  }
+}
+
+#include "write_tests.cpp"
+
+static buffer CompressFile(const char *Filepath, u64 FileSize) {
+  buffer Result = {};
+
+  buffer Source = AllocateBuffer(FileSize);
+  int FileDescriptor = open(Filepath, O_RDONLY);
+
+  if (FileDescriptor >= 0 &&
+      read(FileDescriptor, Source.Data, Source.Size) == (ssize_t)Source.Size) {
+    z_stream Stream = {};
+    deflateInit2(&Stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                 Z_DEFAULT_STRATEGY);
+
+    Result = AllocateBuffer(deflateBound(&Stream, Source.Size));
+    Stream.next_in = Source.Data;
+    Stream.avail_in = (uInt)Source.Size;
+    Stream.next_out = Result.Data;
+    Stream.avail_out = (uInt)Result.Size;
+
+    if (deflate(&Stream, Z_FINISH) == Z_STREAM_END) {
+      Result.Size = Stream.total_out;
+    } else {
+      FreeBuffer(&Result);
+    }
+
+    deflateEnd(&Stream);
+  }
+
+  if (FileDescriptor >= 0) {
+    close(FileDescriptor);
+  }
+  FreeBuffer(&Source);
+
+  return Result;
+}
+
 static const char *DescribeAllocationType(allocation_type AllocType) {
   switch (AllocType) {
   case AllocType_none:
@@ -270,49 +298,333 @@ static void PrintTestResults(test_results Results, u64 CPUTimerFrequency) {
   printf("\n");
 }
 
+static u64 SortedPercentile(u64 *Sorted, u64 Count, f64 Fraction) {
+  u64 Index = (u64)(Fraction * (f64)(Count - 1) + 0.5);
+  return Sorted[Index];
+}
+
+static void PrintSampleStatistics(test_context *Context,
+                                  u64 CPUTimerFrequency) {
+  u64 Count = SortSampleCycles(Context);
+  if (!Count) {
+    return;
+  }
+
+  u64 *Sorted = Context->Sorted;
+  f64 Milliseconds = 1000.0 / (f64)CPUTimerFrequency;
+
+  u64 Minimum = Sorted[0];
+  u64 P10 = SortedPercentile(Sorted, Count, 0.10);
+  u64 Median = SortedPercentile(Sorted, Count, 0.50);
+  u64 P90 = SortedPercentile(Sorted, Count, 0.90);
+  u64 P99 = SortedPercentile(Sorted, Count, 0.99);
+  u64 Maximum = Sorted[Count - 1];
+
+  // NOTE(Lucas): Bin the samples before Sorted is reused for the MAD.
+  u64 Bins[TEST_HISTOGRAM_BIN_COUNT + 1] = {};
+  f64 BinWidth = (f64)(P99 - Minimum) / TEST_HISTOGRAM_BIN_COUNT;
+  for (u64 Index = 0; Index < Count; ++Index) {
+    u64 Bin = TEST_HISTOGRAM_BIN_COUNT;
+    if (Sorted[Index] <= P99) {
+      Bin = BinWidth > 0 ? (u64)((f64)(Sorted[Index] - Minimum) / BinWidth) : 0;
+      Bin = Min(Bin, (u64)TEST_HISTOGRAM_BIN_COUNT - 1);
+    }
+    Bins[Bin]++;
+  }
+
+  for (u64 Index = 0; Index < Count; ++Index) {
+    Sorted[Index] = (Sorted[Index] > Median) ? Sorted[Index] - Median
+                                             : Median - Sorted[Index];
+  }
+  qsort(Sorted, Count, sizeof(u64), CompareU64);
+  u64 MAD = SortedPercentile(Sorted, Count, 0.50);
+  f64 RelativeMAD = (f64)MAD / (f64)Median;
+
+  printf("Samples: last %llu of %llu iterations, stopped %s\n", Count,
+         Context->SampleCount,
+         Context->HasConverged ? "after converging"
+         : Context->StopRule == StopRule_Converged
+             ? "at the time cap"
+             : "after no new minimum for the target time");
+  printf("Percentiles (ms): min %f, p10 %f, p50 %f, p90 %f, p99 %f, max %f\n",
+         Minimum * Milliseconds, P10 * Milliseconds, Median * Milliseconds,
+         P90 * Milliseconds, P99 * Milliseconds, Maximum * Milliseconds);
+  printf("MAD: %fms (%.2f%% of the median)\n", MAD * Milliseconds,
+         100.0 * RelativeMAD);
+
+  // NOTE(Lucas): A spread over 1% of the median usually means something else
+  // was running, a long p99 tail points at faults or interrupts.
+  bool IsNoisy = RelativeMAD > 0.01;
+  bool HasTail = (f64)P99 > 1.5 * (f64)Median;
+  printf("Stability: %s%s%s\n", (IsNoisy || HasTail) ? "" : "stable",
+         IsNoisy ? "NOISY (MAD over 1% of the median) " : "",
+         HasTail ? "TAIL (p99 over 1.5x the median)" : "");
+
+  u64 Largest = 1;
+  for (u32 Bin = 0; Bin <= TEST_HISTOGRAM_BIN_COUNT; ++Bin) {
+    Largest = Max(Largest, Bins[Bin]);
+  }
+
+  for (u32 Bin = 0; Bin <= TEST_HISTOGRAM_BIN_COUNT; ++Bin) {
+    char Bar[41];
+    u32 Width = (u32)(40 * Bins[Bin] / Largest);
+    memset(Bar, '#', Width);
+    Bar[Width] = 0;
+
+    if (Bin < TEST_HISTOGRAM_BIN_COUNT) {
+      f64 Low = (f64)Minimum + Bin * BinWidth;
+      printf("  %10f-%10f |%-40s %llu\n", Low * Milliseconds,
+             (Low + BinWidth) * Milliseconds, Bar, Bins[Bin]);
+    } else if (Bins[Bin]) {
+      printf("  %10s>%10f |%-40s %llu\n", "", P99 * Milliseconds, Bar,
+             Bins[Bin]);
+    }
+  }
+}
+
+#include "bandwidth_scaling.cpp"
+#include "microarchitecture_probes.cpp"
+#include "layout_tests.cpp"
+
 int main(int ArgCount, char *Args[]) {
   u64 RunCounter = 0;
 
+  stop_rule StopRule = StopRule_NoNewMin;
+  test_environment_options EnvOptions = {};
+  EnvOptions.PinCore = -1;
+  u32 ScalingThreadCount = 0;
+  u32 CacheModes = 1 << CacheMode_Warm;
+  bool RunProbes = false;
+  bool RunLayouts = false;
+  const char *Filepath = 0;
+
+  bool IsValid = true;
+  for (int Index = 1; IsValid && Index < ArgCount; ++Index) {
+    if (Args[Index][0] != '-') {
+      IsValid = !Filepath;
+      Filepath = Args[Index];
+    } else if (strcmp(Args[Index], "--converge") == 0) {
+      StopRule = StopRule_Converged;
+    } else if (strcmp(Args[Index], "--pin") == 0 && Index + 1 < ArgCount) {
+      EnvOptions.PinCore = atoi(Args[++Index]);
+      // NOTE(Lucas): -1 is the default, not pinned.
+      IsValid = (EnvOptions.PinCore >= -1);
+    } else if (strcmp(Args[Index], "--priority") == 0) {
+      EnvOptions.RaisePriority = true;
+    } else if (strcmp(Args[Index], "--mlock") == 0) {
+      EnvOptions.LockBuffers = true;
+    } else if (strcmp(Args[Index], "--warmup") == 0) {
+      EnvOptions.Warmup = true;
+    } else if (strcmp(Args[Index], "--scaling") == 0 && Index + 1 < ArgCount) {
+      ScalingThreadCount = atoi(Args[++Index]);
+      IsValid = (ScalingThreadCount > 0);
+    } else if (strcmp(Args[Index], "--cache") == 0 && Index + 1 < ArgCount) {
+      const char *Mode = Args[++Index];
+      if (strcmp(Mode, "warm") == 0) {
+        CacheModes = 1 << CacheMode_Warm;
+      } else if (strcmp(Mode, "cold-file") == 0) {
+        CacheModes = 1 << CacheMode_ColdFile;
+      } else if (strcmp(Mode, "cold-cpu") == 0) {
+        CacheModes = 1 << CacheMode_ColdCPU;
+      } else if (strcmp(Mode, "all") == 0) {
+        CacheModes = (1 << CacheMode_COUNT) - 1;
+      } else {
+        IsValid = false;
+      }
+    } else if (strcmp(Args[Index], "--probes") == 0) {
+      RunProbes = true;
+    } else if (strcmp(Args[Index], "--layouts") == 0) {
+      RunLayouts = true;
+    } else {
+      IsValid = false;
+    }
+  }
+
+  // NOTE(Lucas): The probes don't read anything, FILE is only needed for the
+  // file tests.
+  if ((!Filepath && !RunProbes) || (RunProbes && RunLayouts)) {
+    IsValid = false;
+  }
+
+  if (!IsValid) {
+    fprintf(stderr,
+            "Usage: %s FILE [--converge] [--pin CORE] [--priority] [--mlock] "
+            "[--warmup] [--scaling N] [--cache MODE]\n"
+            "       %s --probes [--converge] [--pin CORE] [--priority] "
+            "[--warmup]\n"
+            "       %s DATA.json --layouts [--converge] [--pin CORE] "
+            "[--priority] [--warmup]\n\n",
+            Args[0], Args[0], Args[0]);
+    fprintf(stderr, "--converge\tStop each test once its minimum and median "
+                    "have settled instead of after ten seconds without a new "
+                    "minimum.\n");
+    fprintf(stderr, "--pin CORE\tRun on CORE only (linux).\n");
+    fprintf(stderr, "--priority\tRaise the scheduling priority to nice -20.\n");
+    fprintf(stderr, "--mlock\t\tLock the file and gzip buffers in memory.\n");
+    fprintf(stderr, "--warmup\tSpin until the core clock stopped ramping "
+                    "before the first test.\n");
+    fprintf(stderr, "--scaling N\tRun the write, touch and read tests on "
+                    "1..N threads instead of the single threaded tests. With "
+                    "--pin, thread I runs on core CORE + I.\n");
+    fprintf(stderr, "--cache MODE\twarm (default) repeats on whatever the "
+                    "last repetition left in the caches, cold-file drops the "
+                    "file from the page cache before every read, cold-cpu "
+                    "flushes the destination buffer from the CPU caches, all "
+                    "runs every test in each mode that applies.\n");
+    fprintf(stderr, "--probes\tRun the x86-64 load/store, dependency chain, "
+                    "branch and loop alignment probes instead of the file "
+                    "tests.\n");
+    fprintf(stderr, "--layouts\tCompare the AoS, SoA and AoSoA pair layouts "
+                    "on a generated data file: parsing into each, summing "
+                    "each and converting between them.\n");
+    return 1;
+  }
+
   u64 CPUTimerFrequency = EstimateCPUFrequency();
 
-  const char *Filepath = Args[1];
+  if (RunProbes) {
+    test_environment Env =
+        PrepareTestEnvironment(&EnvOptions, 0, 0, CPUTimerFrequency);
+    PrintTestEnvironment(&Env, CPUTimerFrequency);
+
+    for (;;) {
+      RunCounter++;
+      printf("=====> Run #%llu\n", RunCounter);
+      RunMicroarchitectureProbes(StopRule, CPUTimerFrequency);
+    }
+  }
 
   struct stat FileStat;
   stat(Filepath, &FileStat);
 
   u64 FileSize = FileStat.st_size;
 
+  if (RunLayouts) {
+    test_environment Env =
+        PrepareTestEnvironment(&EnvOptions, 0, 0, CPUTimerFrequency);
+    PrintTestEnvironment(&Env, CPUTimerFrequency);
+
+    layout_test_data Data;
+    if (!PrepareLayoutTests(&Data, Filepath, FileSize)) {
+      return 1;
+    }
+
+    for (;;) {
+      RunCounter++;
+      printf("=====> Run #%llu\n", RunCounter);
+      RunLayoutTests(&Data, StopRule, CPUTimerFrequency);
+      printf("\n");
+    }
+  }
+
   buffer FixedBuffer = AllocateBuffer(1024 * 1024 * 1024);
 
+  // NOTE(Lucas): The inflate test reports uncompressed bytes per second,
+  // divide by the ratio to compare against the read tests.
+  buffer Compressed = CompressFile(Filepath, FileSize);
+
+  buffer WriteSource = LoadAlignedCopy(Filepath, FileSize);
+  char OutputPath[4096];
+  snprintf(OutputPath, sizeof(OutputPath), "%s.write_test", Filepath);
+
+  // NOTE(Lucas): Only the part of the fixed buffer the tests touch gets
+  // locked, the whole gigabyte is usually over RLIMIT_MEMLOCK.
+  buffer LockedBuffers[] = {{FixedBuffer.Data, FileSize}, Compressed};
+  test_environment Env =
+      PrepareTestEnvironment(&EnvOptions, LockedBuffers,
+                             ArrayCount(LockedBuffers), CPUTimerFrequency);
+  PrintTestEnvironment(&Env, CPUTimerFrequency);
+
+  printf("gzip: %llu -> %llu bytes (%.2fx)\n", FileSize,
+         (u64)Compressed.Size,
+         Compressed.Size ? (f64)FileSize / (f64)Compressed.Size : 0.0);
+
+  // NOTE(Lucas): Eviction silently does nothing on some file systems (tmpfs,
+  // some network and overlay mounts), so check it once up front.
+  if (CacheModes & (1 << CacheMode_ColdFile)) {
+    bool Evicted = EvictFileFromPageCache(Filepath);
+    f64 Resident = FileResidentFraction(Filepath);
+    if (Resident < 0) {
+      printf("Cold file: evict %s, residency unknown\n",
+             Evicted ? "ok" : "FAILED");
+    } else {
+      printf("Cold file: evict %s, %.1f%% of the file still cached\n",
+             Evicted ? "ok" : "FAILED", 100.0 * Resident);
+    }
+  }
+
   for (;;) {
     RunCounter++;
-    test_case Tests[6] = {
-        {"WriteToAllBytes", &WriteToAllBytes, AllocType_none},
-        {"WriteToAllBytes", &WriteToAllBytes, AllocType_malloc},
-        {"read", &ReadEntireFile_ReadSyscall, AllocType_none},
-        {"read", &ReadEntireFile_ReadSyscall, AllocType_malloc},
-        {"fread", &ReadEntireFile_Fread, AllocType_none},
-        {"fread", &ReadEntireFile_Fread, AllocType_malloc}};
+    test_case Tests[] = {
+        {"WriteToAllBytes", &WriteToAllBytes, AllocType_none, false},
+        {"WriteToAllBytes", &WriteToAllBytes, AllocType_malloc, false},
+        {"read", &ReadEntireFile_ReadSyscall, AllocType_none, true},
+        {"read", &ReadEntireFile_ReadSyscall, AllocType_malloc, true},
+        {"fread", &ReadEntireFile_Fread, AllocType_none, true},
+        {"fread", &ReadEntireFile_Fread, AllocType_malloc, true},
+        {"inflate", &InflateGzip, AllocType_none, false},
+        {"inflate", &InflateGzip, AllocType_malloc, false},
+        {"fwrite, 4kb stdio buffer", &WriteFile_Fwrite, AllocType_none, false,
+         4 * 1024},
+        {"fwrite, 64kb stdio buffer", &WriteFile_Fwrite, AllocType_none,
+         false, 64 * 1024},
+        {"fwrite, 1mb stdio buffer", &WriteFile_Fwrite, AllocType_none, false,
+         1024 * 1024},
+        {"write, 64kb chunks", &WriteFile_WriteSyscall, AllocType_none, false,
+         64 * 1024},
+        {"write, 1mb chunks", &WriteFile_WriteSyscall, AllocType_none, false,
+         1024 * 1024},
+        {"pwritev, 16 x 64kb", &WriteFile_Pwritev, AllocType_none, false,
+         64 * 1024},
+        {"ftruncate + mmap", &WriteFile_Mmap, AllocType_none, false},
+        {"O_DIRECT, 1mb chunks", &WriteFile_Direct, AllocType_none, false,
+         1024 * 1024}};
 
     printf("=====> Run #%llu\n", RunCounter);
-    for (off_t Index = 0; Index < ArrayCount(Tests); ++Index) {
-
-      test_case *Test = &Tests[Index];
-
-      read_parameters Params = {};
-      Params.AllocType = Test->AllocType;
-      Params.Filepath = Filepath;
-      Params.Dest = FixedBuffer;
-      Params.Dest.Size = FileSize;
 
-      test_context Context = {};
-      Context.TargetTime = 10 * CPUTimerFrequency; // Try for ten seconds
-
-      Test->Func(&Context, &Params);
+    if (ScalingThreadCount) {
+      RunScalingTests(Filepath, {FixedBuffer.Data, FileSize},
+                      ScalingThreadCount, EnvOptions.PinCore, StopRule,
+                      CPUTimerFrequency);
+      printf("\n");
+      continue;
+    }
 
-      printf("\n--- %s%s%s ---\n", DescribeAllocationType(Params.AllocType),
-             Params.AllocType ? " + " : "", Test->Name);
-      PrintTestResults(Context.Results, CPUTimerFrequency);
+    for (u64 Index = 0; Index < ArrayCount(Tests); ++Index) {
+      for (u32 Mode = 0; Mode < CacheMode_COUNT; ++Mode) {
+        test_case *Test = &Tests[Index];
+
+        if (!(CacheModes & (1 << Mode)) ||
+            (Mode == CacheMode_ColdFile && !Test->ReadsFile)) {
+          continue;
+        }
+
+        read_parameters Params = {};
+        Params.AllocType = Test->AllocType;
+        Params.Filepath = Filepath;
+        Params.Dest = FixedBuffer;
+        Params.Dest.Size = FileSize;
+        Params.Compressed = Compressed;
+        Params.CacheMode = (cache_mode)Mode;
+        Params.Source = WriteSource;
+        Params.OutputPath = OutputPath;
+        Params.ChunkSize = Test->ChunkSize;
+
+        // NOTE(Lucas): Too big for the stack with the sample ring.
+        static test_context Context;
+        Context = {};
+        Context.StopRule = StopRule;
+        Context.TargetTime = 10 * CPUTimerFrequency; // Try for ten seconds
+
+        Test->Func(&Context, &Params);
+
+        printf("\n--- %s%s%s (%s) ---\n",
+               DescribeAllocationType(Params.AllocType),
+               Params.AllocType ? " + " : "", Test->Name,
+               DescribeCacheMode(Params.CacheMode));
+        PrintTestResults(Context.Results, CPUTimerFrequency);
+        PrintSampleStatistics(&Context, CPUTimerFrequency);
+      }
     }
     printf("\n");
   }
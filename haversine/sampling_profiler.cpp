@@ -0,0 +1,622 @@
+// NOTE(Lucas): Statistical profiler for the code TimeFunction can't afford to
+// wrap (Peek, the number parsers, the haversine kernel). A SIGPROF timer
+// interrupts whatever thread is burning CPU, the handler records the
+// interrupted instruction and a short frame pointer backtrace into a
+// preallocated buffer. Everything else (symbols, aggregation, printing)
+// happens in EndProfileAndPrint.
+//
+// The backtrace needs frame pointers, build with -fno-omit-frame-pointer.
+// Without them the stacks are just the leaf. The first caller is lost when
+// the sample lands in a prologue or a leaf that doesn't set up a frame.
+
+#include <cerrno>
+#include <dlfcn.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#if __linux__
+#include <elf.h>
+#include <link.h>
+#endif
+
+#define SAMPLER_MAX_DEPTH 16
+#define SAMPLER_CAPACITY (64 * 1024)
+#define SAMPLER_MAX_FRAME_SIZE (8 * 1024 * 1024)
+#define SAMPLER_MAX_CODE_RANGES 256
+
+struct profiler_sample {
+  u32 Depth;
+  // NOTE(Lucas): Frames[0] is the interrupted instruction, the rest are
+  // return addresses, innermost first.
+  uintptr_t Frames[SAMPLER_MAX_DEPTH];
+};
+
+// NOTE(Lucas): An executable segment of a loaded module.
+struct sampler_code_range {
+  uintptr_t Low;
+  uintptr_t High;
+};
+
+struct sampler {
+  profiler_sample *Samples;
+  u64 SampleCount;
+  u64 DroppedCount;
+  u32 Frequency;
+  bool IsRunning;
+  struct sigaction PreviousAction;
+
+  // NOTE(Lucas): Collected before the timer starts, the handler can't call
+  // dladdr. With no ranges (not linux) return addresses aren't checked.
+  u32 CodeRangeCount;
+  sampler_code_range CodeRanges[SAMPLER_MAX_CODE_RANGES];
+};
+static sampler GlobalSampler;
+
+#if __linux__
+static int AddCodeRanges(struct dl_phdr_info *Module, size_t Size,
+                         void *UserData) {
+  sampler *Sampler = (sampler *)UserData;
+
+  for (u32 Index = 0; Index < Module->dlpi_phnum; ++Index) {
+    const ElfW(Phdr) *Header = Module->dlpi_phdr + Index;
+    if (Header->p_type == PT_LOAD && (Header->p_flags & PF_X) &&
+        Sampler->CodeRangeCount < SAMPLER_MAX_CODE_RANGES) {
+      uintptr_t Low = Module->dlpi_addr + Header->p_vaddr;
+      Sampler->CodeRanges[Sampler->CodeRangeCount++] = {Low,
+                                                        Low + Header->p_memsz};
+    }
+  }
+
+  return 0;
+}
+#endif
+
+static void CollectCodeRanges(sampler *Sampler) {
+  Sampler->CodeRangeCount = 0;
+#if __linux__
+  dl_iterate_phdr(AddCodeRanges, Sampler);
+#endif
+}
+
+static bool IsCodeAddress(sampler *Sampler, uintptr_t Address) {
+  if (!Sampler->CodeRangeCount) {
+    return true;
+  }
+
+  for (u32 Index = 0; Index < Sampler->CodeRangeCount; ++Index) {
+    if (Address >= Sampler->CodeRanges[Index].Low &&
+        Address < Sampler->CodeRanges[Index].High) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool ReadInterruptedState(void *Context, uintptr_t *PC,
+                                 uintptr_t *FramePointer,
+                                 uintptr_t *StackPointer) {
+  ucontext_t *State = (ucontext_t *)Context;
+
+#if __APPLE__ && __x86_64__
+  *PC = State->uc_mcontext->__ss.__rip;
+  *FramePointer = State->uc_mcontext->__ss.__rbp;
+  *StackPointer = State->uc_mcontext->__ss.__rsp;
+#elif __APPLE__ && __aarch64__
+  *PC = State->uc_mcontext->__ss.__pc;
+  *FramePointer = State->uc_mcontext->__ss.__fp;
+  *StackPointer = State->uc_mcontext->__ss.__sp;
+#elif __linux__ && __x86_64__
+  *PC = State->uc_mcontext.gregs[REG_RIP];
+  *FramePointer = State->uc_mcontext.gregs[REG_RBP];
+  *StackPointer = State->uc_mcontext.gregs[REG_RSP];
+#elif __linux__ && __aarch64__
+  *PC = State->uc_mcontext.pc;
+  *FramePointer = State->uc_mcontext.regs[29];
+  *StackPointer = State->uc_mcontext.sp;
+#else
+  return false;
+#endif
+
+  return true;
+}
+
+// NOTE(Lucas): Runs in the signal handler, so no allocations, no locks and no
+// libc beyond what is async signal safe. The slot is claimed atomically
+// because the signal can land on any of the summing threads.
+static void RecordSample(int Signal, siginfo_t *Info, void *Context) {
+  int SavedErrno = errno;
+
+  uintptr_t PC, FramePointer, StackPointer;
+  if (ReadInterruptedState(Context, &PC, &FramePointer, &StackPointer)) {
+    u64 Index = __atomic_fetch_add(&GlobalSampler.SampleCount, 1,
+                                   __ATOMIC_RELAXED);
+    if (Index < SAMPLER_CAPACITY) {
+      profiler_sample *Sample = GlobalSampler.Samples + Index;
+      Sample->Frames[0] = PC;
+      u32 Depth = 1;
+
+      // NOTE(Lucas): Each frame record is {previous frame pointer, return
+      // address} on both x86-64 and aarch64. Only walk frames that are
+      // aligned, above the stack pointer and moving up the stack, so a
+      // register that isn't a frame pointer can't send us into the weeds.
+      // Code built without frame pointers can still leave a stack address
+      // in rbp, so the walk also stops at the first return address that
+      // isn't in a loaded module's code.
+      uintptr_t Low = StackPointer;
+      uintptr_t High = StackPointer + SAMPLER_MAX_FRAME_SIZE;
+      while (Depth < SAMPLER_MAX_DEPTH && FramePointer >= Low &&
+             FramePointer < High && (FramePointer & 7) == 0) {
+        uintptr_t *Record = (uintptr_t *)FramePointer;
+        uintptr_t ReturnAddress = Record[1];
+        if (!ReturnAddress || !IsCodeAddress(&GlobalSampler, ReturnAddress)) {
+          break;
+        }
+        Sample->Frames[Depth++] = ReturnAddress;
+        Low = FramePointer + 2 * sizeof(uintptr_t);
+        FramePointer = Record[0];
+      }
+
+      Sample->Depth = Depth;
+    } else {
+      __atomic_fetch_add(&GlobalSampler.DroppedCount, 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  errno = SavedErrno;
+}
+
+static bool StartSampling(u32 Frequency) {
+  if (!GlobalSampler.Samples) {
+    GlobalSampler.Samples =
+        (profiler_sample *)calloc(SAMPLER_CAPACITY, sizeof(profiler_sample));
+    if (!GlobalSampler.Samples) {
+      return false;
+    }
+  }
+
+  GlobalSampler.SampleCount = 0;
+  GlobalSampler.DroppedCount = 0;
+  GlobalSampler.Frequency = Frequency;
+  CollectCodeRanges(&GlobalSampler);
+
+  struct sigaction Action = {};
+  Action.sa_sigaction = RecordSample;
+  Action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&Action.sa_mask);
+  if (sigaction(SIGPROF, &Action, &GlobalSampler.PreviousAction) != 0) {
+    return false;
+  }
+
+  // NOTE(Lucas): ITIMER_PROF counts the CPU time of the whole process, user
+  // and system, so time blocked in read() is not sampled but time copying in
+  // the kernel is.
+  u32 Interval = 1000000 / Max(Frequency, 1);
+  struct itimerval Timer = {};
+  Timer.it_interval.tv_sec = Interval / 1000000;
+  Timer.it_interval.tv_usec = Max(Interval % 1000000, 1);
+  Timer.it_value = Timer.it_interval;
+  if (setitimer(ITIMER_PROF, &Timer, 0) != 0) {
+    sigaction(SIGPROF, &GlobalSampler.PreviousAction, 0);
+    return false;
+  }
+
+  GlobalSampler.IsRunning = true;
+  return true;
+}
+
+static void StopSampling() {
+  if (GlobalSampler.IsRunning) {
+    struct itimerval Timer = {};
+    setitimer(ITIMER_PROF, &Timer, 0);
+    sigaction(SIGPROF, &GlobalSampler.PreviousAction, 0);
+    GlobalSampler.IsRunning = false;
+  }
+}
+
+struct sampled_address {
+  uintptr_t Address;
+  u32 FunctionIndex;
+};
+
+struct sampled_function {
+  char *Name;
+  u64 SelfCount;
+  u64 TotalCount;
+  // NOTE(Lucas): So recursion counts a sample once towards TotalCount.
+  u64 LastSample;
+};
+
+struct sample_symbols {
+  sampled_address *Addresses;
+  u64 AddressCount;
+  sampled_function *Functions;
+  u32 FunctionCount;
+};
+
+static int CompareSampledAddresses(const void *A, const void *B) {
+  uintptr_t Left = ((sampled_address *)A)->Address;
+  uintptr_t Right = ((sampled_address *)B)->Address;
+  return (Left > Right) - (Left < Right);
+}
+
+// NOTE(Lucas): Return addresses point after the call, which can already be
+// the next function. Look up the call instruction instead.
+static uintptr_t LookupAddress(profiler_sample *Sample, u32 Frame) {
+  return Frame ? Sample->Frames[Frame] - 1 : Sample->Frames[Frame];
+}
+
+static u32 FindFunctionIndex(sample_symbols *Symbols, uintptr_t Address) {
+  u64 Low = 0;
+  u64 High = Symbols->AddressCount;
+  while (Low < High) {
+    u64 Middle = Low + (High - Low) / 2;
+    if (Symbols->Addresses[Middle].Address < Address) {
+      Low = Middle + 1;
+    } else {
+      High = Middle;
+    }
+  }
+  return Symbols->Addresses[Low].FunctionIndex;
+}
+
+static u32 InternFunctionName(sample_symbols *Symbols, const char *Name) {
+  for (u32 Index = 0; Index < Symbols->FunctionCount; ++Index) {
+    if (strcmp(Symbols->Functions[Index].Name, Name) == 0) {
+      return Index;
+    }
+  }
+
+  sampled_function *Function = Symbols->Functions + Symbols->FunctionCount;
+  Function->Name = strdup(Name);
+  Function->LastSample = ~0ull;
+  return Symbols->FunctionCount++;
+}
+
+// NOTE(Lucas): dladdr answers with the closest exported symbol below the
+// address, for code in a library's internal functions that is some unrelated
+// export. On glibc the symbol's size tells them apart.
+static const char *ExportedSymbolName(uintptr_t Address) {
+  Dl_info Info;
+#if __linux__
+  ElfW(Sym) *Symbol = 0;
+  if (dladdr1((void *)Address, &Info, (void **)&Symbol, RTLD_DL_SYMENT) &&
+      Info.dli_sname && Symbol &&
+      Address - (uintptr_t)Info.dli_saddr < Symbol->st_size) {
+    return Info.dli_sname;
+  }
+#else
+  if (dladdr((void *)Address, &Info) && Info.dli_sname) {
+    return Info.dli_sname;
+  }
+#endif
+  return 0;
+}
+
+// NOTE(Lucas): addr2line on a module without debug info falls back to the
+// nearest dynamic symbol below the address, the same wrong answer the st_size
+// check in ExportedSymbolName throws away. So it only runs on the program
+// itself and on modules with a .debug_info section.
+#if __linux__
+static bool ModuleHasDebugInfo(const char *Path) {
+  bool Result = false;
+
+  FILE *File = fopen(Path, "rb");
+  if (!File) {
+    return false;
+  }
+
+  ElfW(Ehdr) Header;
+  if (fread(&Header, sizeof(Header), 1, File) == 1 &&
+      memcmp(Header.e_ident, ELFMAG, SELFMAG) == 0 &&
+      Header.e_shentsize == sizeof(ElfW(Shdr)) &&
+      Header.e_shstrndx < Header.e_shnum) {
+    ElfW(Shdr) *Sections =
+        (ElfW(Shdr) *)malloc(Header.e_shnum * sizeof(ElfW(Shdr)));
+    if (fseek(File, Header.e_shoff, SEEK_SET) == 0 &&
+        fread(Sections, sizeof(ElfW(Shdr)), Header.e_shnum, File) ==
+            Header.e_shnum) {
+      ElfW(Shdr) *Names = Sections + Header.e_shstrndx;
+      char *Strings = (char *)malloc(Names->sh_size + 1);
+      if (fseek(File, Names->sh_offset, SEEK_SET) == 0 &&
+          fread(Strings, 1, Names->sh_size, File) == Names->sh_size) {
+        Strings[Names->sh_size] = 0;
+        for (u32 Index = 0; Index < Header.e_shnum && !Result; ++Index) {
+          Result = Sections[Index].sh_name < Names->sh_size &&
+                   strcmp(Strings + Sections[Index].sh_name,
+                          ".debug_info") == 0;
+        }
+      }
+      free(Strings);
+    }
+    free(Sections);
+  }
+
+  fclose(File);
+  return Result;
+}
+#else
+static bool ModuleHasDebugInfo(const char *Path) { return false; }
+#endif
+
+static bool ShouldRunAddr2line(const Dl_info *Module) {
+  Dl_info Program;
+  if (dladdr((void *)&ShouldRunAddr2line, &Program) &&
+      Program.dli_fbase == Module->dli_fbase) {
+    return true;
+  }
+  return ModuleHasDebugInfo(Module->dli_fname);
+}
+
+// NOTE(Lucas): Everything the program defines is static, so it is not in the
+// dynamic symbol table and dladdr only names libc and friends. The rest goes
+// through one addr2line run per module, reading the module relative
+// addresses from a temporary file. If that fails too, or the module has no
+// debug info, the frame is counted under its module, so self and total time
+// of a stripped library add up on one line.
+static void SymbolizeWithAddr2line(sample_symbols *Symbols, char **Names,
+                                   const char *Module, uintptr_t Base) {
+  char AddressPath[] = "/tmp/haversine_samples_XXXXXX";
+  int AddressFile = mkstemp(AddressPath);
+  if (AddressFile < 0) {
+    return;
+  }
+
+  FILE *Addresses = fdopen(AddressFile, "w");
+  for (u64 Index = 0; Index < Symbols->AddressCount; ++Index) {
+    if (!Names[Index]) {
+      Dl_info Info;
+      if (dladdr((void *)Symbols->Addresses[Index].Address, &Info) &&
+          Info.dli_fname && strcmp(Info.dli_fname, Module) == 0) {
+        fprintf(Addresses, "%llx\n",
+                (u64)(Symbols->Addresses[Index].Address - Base));
+      }
+    }
+  }
+  fclose(Addresses);
+
+  char Command[8192];
+  snprintf(Command, sizeof(Command), "addr2line -f -C -e '%s' < %s", Module,
+           AddressPath);
+  FILE *Output = popen(Command, "r");
+
+  if (Output) {
+    char Line[4096];
+    char Location[4096];
+    for (u64 Index = 0; Index < Symbols->AddressCount; ++Index) {
+      if (!Names[Index]) {
+        Dl_info Info;
+        if (dladdr((void *)Symbols->Addresses[Index].Address, &Info) &&
+            Info.dli_fname && strcmp(Info.dli_fname, Module) == 0) {
+          if (!fgets(Line, sizeof(Line), Output) ||
+              !fgets(Location, sizeof(Location), Output)) {
+            break;
+          }
+          Line[strcspn(Line, "\n")] = 0;
+          if (strcmp(Line, "??") != 0) {
+            Names[Index] = strdup(Line);
+          }
+        }
+      }
+    }
+    pclose(Output);
+  }
+
+  unlink(AddressPath);
+}
+
+static sample_symbols SymbolizeSamples(profiler_sample *Samples,
+                                       u64 SampleCount) {
+  sample_symbols Symbols = {};
+
+  u64 FrameCount = 0;
+  for (u64 Index = 0; Index < SampleCount; ++Index) {
+    FrameCount += Samples[Index].Depth;
+  }
+
+  Symbols.Addresses =
+      (sampled_address *)malloc(Max(FrameCount, 1) * sizeof(sampled_address));
+  for (u64 Index = 0; Index < SampleCount; ++Index) {
+    for (u32 Frame = 0; Frame < Samples[Index].Depth; ++Frame) {
+      Symbols.Addresses[Symbols.AddressCount++].Address =
+          LookupAddress(Samples + Index, Frame);
+    }
+  }
+
+  qsort(Symbols.Addresses, Symbols.AddressCount, sizeof(sampled_address),
+        CompareSampledAddresses);
+  u64 UniqueCount = 0;
+  for (u64 Index = 0; Index < Symbols.AddressCount; ++Index) {
+    if (!UniqueCount || Symbols.Addresses[UniqueCount - 1].Address !=
+                            Symbols.Addresses[Index].Address) {
+      Symbols.Addresses[UniqueCount++] = Symbols.Addresses[Index];
+    }
+  }
+  Symbols.AddressCount = UniqueCount;
+
+  char **Names = (char **)calloc(Max(UniqueCount, 1), sizeof(char *));
+
+  for (u64 Index = 0; Index < UniqueCount; ++Index) {
+    const char *Name = ExportedSymbolName(Symbols.Addresses[Index].Address);
+    if (Name) {
+      Names[Index] = strdup(Name);
+    }
+  }
+
+  for (u64 Index = 0; Index < UniqueCount; ++Index) {
+    Dl_info Info;
+    if (!Names[Index] &&
+        dladdr((void *)Symbols.Addresses[Index].Address, &Info) &&
+        Info.dli_fname) {
+      if (ShouldRunAddr2line(&Info)) {
+        SymbolizeWithAddr2line(&Symbols, Names, Info.dli_fname,
+                               (uintptr_t)Info.dli_fbase);
+      }
+      // NOTE(Lucas): Mark what addr2line could not name, so the module is
+      // not run again for every one of them.
+      char Name[512];
+      const char *Slash = strrchr(Info.dli_fname, '/');
+      snprintf(Name, sizeof(Name), "[%s]", Slash ? Slash + 1 : Info.dli_fname);
+      for (u64 Other = Index; Other < UniqueCount; ++Other) {
+        Dl_info OtherInfo;
+        if (!Names[Other] &&
+            dladdr((void *)Symbols.Addresses[Other].Address, &OtherInfo) &&
+            OtherInfo.dli_fname &&
+            strcmp(OtherInfo.dli_fname, Info.dli_fname) == 0) {
+          Names[Other] = strdup(Name);
+        }
+      }
+    }
+  }
+
+  Symbols.Functions = (sampled_function *)calloc(Max(UniqueCount, 1),
+                                                 sizeof(sampled_function));
+  for (u64 Index = 0; Index < UniqueCount; ++Index) {
+    Symbols.Addresses[Index].FunctionIndex =
+        InternFunctionName(&Symbols, Names[Index] ? Names[Index] : "[unknown]");
+    free(Names[Index]);
+  }
+  free(Names);
+
+  return Symbols;
+}
+
+static void FreeSampleSymbols(sample_symbols *Symbols) {
+  for (u32 Index = 0; Index < Symbols->FunctionCount; ++Index) {
+    free(Symbols->Functions[Index].Name);
+  }
+  free(Symbols->Functions);
+  free(Symbols->Addresses);
+  *Symbols = {};
+}
+
+static int CompareFunctionsBySelf(const void *A, const void *B) {
+  sampled_function *Left = (sampled_function *)A;
+  sampled_function *Right = (sampled_function *)B;
+  if (Left->SelfCount != Right->SelfCount) {
+    return (Left->SelfCount < Right->SelfCount) ? 1 : -1;
+  }
+  return (Left->TotalCount < Right->TotalCount) -
+         (Left->TotalCount > Right->TotalCount);
+}
+
+// NOTE(Lucas): Stacks as function indices, outermost first, for sorting and
+// for the collapsed output.
+struct collapsed_stack {
+  u32 Depth;
+  u32 Functions[SAMPLER_MAX_DEPTH];
+};
+
+static int CompareCollapsedStacks(const void *A, const void *B) {
+  collapsed_stack *Left = (collapsed_stack *)A;
+  collapsed_stack *Right = (collapsed_stack *)B;
+
+  u32 Depth = Min(Left->Depth, Right->Depth);
+  for (u32 Index = 0; Index < Depth; ++Index) {
+    if (Left->Functions[Index] != Right->Functions[Index]) {
+      return (Left->Functions[Index] > Right->Functions[Index]) -
+             (Left->Functions[Index] < Right->Functions[Index]);
+    }
+  }
+  return (Left->Depth > Right->Depth) - (Left->Depth < Right->Depth);
+}
+
+// NOTE(Lucas): The format flamegraph.pl and speedscope read: the frames
+// joined by ';' from the root, a space and the sample count.
+static bool WriteCollapsedStacks(const char *Path, sample_symbols *Symbols,
+                                 profiler_sample *Samples, u64 SampleCount) {
+  FILE *File = fopen(Path, "w");
+  if (!File) {
+    return false;
+  }
+
+  collapsed_stack *Stacks = (collapsed_stack *)malloc(
+      Max(SampleCount, 1) * sizeof(collapsed_stack));
+  for (u64 Index = 0; Index < SampleCount; ++Index) {
+    profiler_sample *Sample = Samples + Index;
+    Stacks[Index].Depth = Sample->Depth;
+    for (u32 Frame = 0; Frame < Sample->Depth; ++Frame) {
+      Stacks[Index].Functions[Sample->Depth - 1 - Frame] =
+          FindFunctionIndex(Symbols, LookupAddress(Sample, Frame));
+    }
+  }
+  qsort(Stacks, SampleCount, sizeof(collapsed_stack), CompareCollapsedStacks);
+
+  u64 Index = 0;
+  while (Index < SampleCount) {
+    u64 RunEnd = Index + 1;
+    while (RunEnd < SampleCount &&
+           CompareCollapsedStacks(Stacks + Index, Stacks + RunEnd) == 0) {
+      RunEnd++;
+    }
+
+    for (u32 Frame = 0; Frame < Stacks[Index].Depth; ++Frame) {
+      fprintf(File, "%s%s", Frame ? ";" : "",
+              Symbols->Functions[Stacks[Index].Functions[Frame]].Name);
+    }
+    fprintf(File, " %llu\n", RunEnd - Index);
+
+    Index = RunEnd;
+  }
+
+  free(Stacks);
+  return fclose(File) == 0;
+}
+
+static void PrintSamplingReport(u32 TopCount, const char *CollapsedPath) {
+  u64 SampleCount = Min(GlobalSampler.SampleCount, (u64)SAMPLER_CAPACITY);
+  profiler_sample *Samples = GlobalSampler.Samples;
+
+  printf("== Sampling results (%llu samples at %uhz", SampleCount,
+         GlobalSampler.Frequency);
+  if (GlobalSampler.DroppedCount) {
+    printf(", %llu dropped, buffer full", GlobalSampler.DroppedCount);
+  }
+  printf(")\n");
+
+  if (!SampleCount) {
+    return;
+  }
+
+  sample_symbols Symbols = SymbolizeSamples(Samples, SampleCount);
+
+  for (u64 Index = 0; Index < SampleCount; ++Index) {
+    profiler_sample *Sample = Samples + Index;
+    for (u32 Frame = 0; Frame < Sample->Depth; ++Frame) {
+      sampled_function *Function =
+          Symbols.Functions +
+          FindFunctionIndex(&Symbols, LookupAddress(Sample, Frame));
+      if (Frame == 0) {
+        Function->SelfCount++;
+      }
+      if (Function->LastSample != Index) {
+        Function->TotalCount++;
+        Function->LastSample = Index;
+      }
+    }
+  }
+
+  // NOTE(Lucas): Written before sorting, the stacks refer to functions by
+  // index.
+  if (CollapsedPath) {
+    if (WriteCollapsedStacks(CollapsedPath, &Symbols, Samples, SampleCount)) {
+      printf("\tcollapsed stacks written to %s\n", CollapsedPath);
+    } else {
+      printf("\tcould not write collapsed stacks to %s\n", CollapsedPath);
+    }
+  }
+
+  qsort(Symbols.Functions, Symbols.FunctionCount, sizeof(sampled_function),
+        CompareFunctionsBySelf);
+
+  printf("\t%8s %8s  %s\n", "self", "total", "function");
+  u32 Count = Min(TopCount, Symbols.FunctionCount);
+  for (u32 Index = 0; Index < Count; ++Index) {
+    sampled_function *Function = Symbols.Functions + Index;
+    printf("\t%7.2f%% %7.2f%%  %s\n",
+           100.0 * (f64)Function->SelfCount / (f64)SampleCount,
+           100.0 * (f64)Function->TotalCount / (f64)SampleCount,
+           Function->Name);
+  }
+
+  FreeSampleSymbols(&Symbols);
+}
@@ -0,0 +1,370 @@
+// NOTE(Lucas): --shards N. The coordinator cuts the pairs array of the input
+// into N byte ranges that start on a pair, forks one worker process per range
+// and merges what they leave in a shared results block. Each worker maps the
+// file itself and runs the stream parser over its range only, so workers
+// share nothing but the page cache.
+//
+// The average has to match the single process one bit for bit, which needs
+// every distance in the same summation block and lane as there (global pair
+// index / SUMMATION_BLOCK_SIZE). That takes two rounds of workers:
+//
+//   1. Count: every worker counts the pairs in its range (one '{' each, the
+//      generator's format has no nested objects in a pair).
+//   2. Sum: with the counts known, every worker knows the global index of its
+//      first pair. It sums the blocks that are entirely inside its range and
+//      hands back the distances of the blocks it shares with its neighbours,
+//      which the coordinator sums.
+//
+// Only the results block crosses process boundaries, the same data would go
+// over the network with one host per shard.
+
+#include <cctype>
+#include <sys/wait.h>
+
+#define SHARD_MAX_COUNT 256
+#define SHARD_MAX_SECTIONS 64
+
+enum shard_phase { ShardPhase_Count = 0, ShardPhase_Sum };
+
+struct shard_result {
+  // NOTE(Lucas): Filled in by the coordinator.
+  u64 Begin;
+  u64 End;
+  u64 FirstPairIndex;
+  u64 BlockCapacity;
+  f64 *BlockSums;
+
+  // NOTE(Lucas): Filled in by the worker. Head holds the distances before the
+  // range's first block boundary, Tail the ones after its last, the blocks in
+  // between are summed into BlockSums.
+  bool IsValid;
+  u64 PairCount;
+  u64 ParsedPairCount;
+  u32 HeadCount;
+  u32 TailCount;
+  u64 BlockCount;
+  f64 Head[SUMMATION_BLOCK_SIZE];
+  f64 Tail[SUMMATION_BLOCK_SIZE];
+
+  u64 Elapsed[2];
+  u32 SectionCount;
+  profiler_section Sections[SHARD_MAX_SECTIONS];
+};
+
+struct shard_accumulator {
+  shard_result *Shard;
+  bool IsCompensated;
+  u64 NextPairIndex;
+  u64 FirstBoundary;
+  u32 BlockFill;
+  f64 Block[SUMMATION_BLOCK_SIZE];
+};
+
+static void AccumulateShardPair(void *UserData, haversine_pair *Pair) {
+  shard_accumulator *Accumulator = (shard_accumulator *)UserData;
+  shard_result *Shard = Accumulator->Shard;
+
+  f64 Distance = ReferenceHaversine(Pair->X0, Pair->Y0, Pair->X1, Pair->Y1,
+                                    EARTH_RADIUS);
+  u64 PairIndex = Accumulator->NextPairIndex++;
+  Shard->ParsedPairCount++;
+
+  if (PairIndex < Accumulator->FirstBoundary) {
+    Shard->Head[Shard->HeadCount++] = Distance;
+  } else {
+    Accumulator->Block[Accumulator->BlockFill++] = Distance;
+    if (Accumulator->BlockFill == SUMMATION_BLOCK_SIZE) {
+      if (Shard->BlockCount < Shard->BlockCapacity) {
+        Shard->BlockSums[Shard->BlockCount] =
+            SumBlock(Accumulator->Block, SUMMATION_BLOCK_SIZE,
+                     Accumulator->IsCompensated);
+      }
+      Shard->BlockCount++;
+      Accumulator->BlockFill = 0;
+    }
+  }
+}
+
+// NOTE(Lucas): The range is fed to the stream parser between a made up
+// '{"pairs": [' and ']}', without the comma that separated it from the next
+// range.
+static bool SumShard(shard_result *Shard, buffer File, bool IsCompensated) {
+  TimeBandwidth("SumShard", Shard->End - Shard->Begin);
+
+  shard_accumulator *Accumulator =
+      (shard_accumulator *)calloc(1, sizeof(shard_accumulator));
+  Accumulator->Shard = Shard;
+  Accumulator->IsCompensated = IsCompensated;
+  Accumulator->NextPairIndex = Shard->FirstPairIndex;
+  Accumulator->FirstBoundary =
+      (Shard->FirstPairIndex + SUMMATION_BLOCK_SIZE - 1) /
+      SUMMATION_BLOCK_SIZE * SUMMATION_BLOCK_SIZE;
+
+  u64 End = Shard->End;
+  while (End > Shard->Begin &&
+         (File.Data[End - 1] == ',' || isspace(File.Data[End - 1]))) {
+    End--;
+  }
+
+  pair_stream_decoder Decoder = {.Callback = AccumulateShardPair,
+                                 .UserData = Accumulator};
+  json_stream_parser Parser;
+  InitJSONStream(&Parser, DecodePairStreamEvent, &Decoder);
+
+  const char Prefix[] = "{\"pairs\": [";
+  const char Suffix[] = "]}";
+  bool IsValid =
+      FeedJSONStream(&Parser, Prefix, sizeof(Prefix) - 1) &&
+      FeedJSONStream(&Parser, (char *)File.Data + Shard->Begin,
+                     End - Shard->Begin) &&
+      FeedJSONStream(&Parser, Suffix, sizeof(Suffix) - 1) &&
+      FinishJSONStream(&Parser) && !Decoder.IsMissingField;
+
+  Shard->TailCount = Accumulator->BlockFill;
+  memcpy(Shard->Tail, Accumulator->Block,
+         Accumulator->BlockFill * sizeof(f64));
+
+  free(Accumulator);
+
+  return IsValid && Shard->ParsedPairCount == Shard->PairCount &&
+         Shard->BlockCount <= Shard->BlockCapacity;
+}
+
+static u64 CountShardPairs(shard_result *Shard, buffer File) {
+  TimeBandwidth("CountShardPairs", Shard->End - Shard->Begin);
+
+  u64 Count = 0;
+  u8 *At = File.Data + Shard->Begin;
+  u8 *End = File.Data + Shard->End;
+  while ((At = (u8 *)memchr(At, '{', End - At))) {
+    Count++;
+    At++;
+  }
+
+  return Count;
+}
+
+static void RunShardWorker(shard_result *Shard, const char *InputPath,
+                           shard_phase Phase, bool IsCompensated) {
+  ResetProfilerSections();
+  u64 Start = ReadCPUTimer();
+
+  memory_mapped_file File = OpenMemoryMappedFile(InputPath);
+  if (File.IsValid) {
+    if (Phase == ShardPhase_Count) {
+      Shard->PairCount = CountShardPairs(Shard, File.Contents);
+      Shard->IsValid = true;
+    } else {
+      Shard->IsValid = SumShard(Shard, File.Contents, IsCompensated);
+    }
+    CloseMemoryMappedFile(&File);
+  }
+
+  Shard->Elapsed[Phase] = ReadCPUTimer() - Start;
+  Shard->SectionCount =
+      CollectProfilerSections(Shard->Sections, SHARD_MAX_SECTIONS);
+}
+
+// NOTE(Lucas): One process per shard, all running at once. Returns false if
+// any of them could not be started or did not finish cleanly.
+static bool RunShardPhase(shard_result *Shards, u32 ShardCount,
+                          const char *InputPath, shard_phase Phase,
+                          bool IsCompensated) {
+  pid_t Workers[SHARD_MAX_COUNT];
+  bool Result = true;
+
+  // NOTE(Lucas): Otherwise whatever is still buffered gets printed once more
+  // by every worker.
+  fflush(stdout);
+  fflush(stderr);
+
+  u32 StartedCount = 0;
+  for (; StartedCount < ShardCount; ++StartedCount) {
+    pid_t Worker = fork();
+    if (Worker == 0) {
+      RunShardWorker(Shards + StartedCount, InputPath, Phase, IsCompensated);
+      _exit(Shards[StartedCount].IsValid ? 0 : 1);
+    } else if (Worker < 0) {
+      fprintf(stderr, "Could not start shard %u: %s\n", StartedCount,
+              strerror(errno));
+      Result = false;
+      break;
+    }
+    Workers[StartedCount] = Worker;
+  }
+
+  for (u32 Index = 0; Index < StartedCount; ++Index) {
+    int Status = 0;
+    if (waitpid(Workers[Index], &Status, 0) != Workers[Index] ||
+        !WIFEXITED(Status) || WEXITSTATUS(Status) != 0) {
+      fprintf(stderr, "Shard %u failed\n", Index);
+      Result = false;
+    } else {
+      MergeProfilerSections(Shards[Index].Sections,
+                            Shards[Index].SectionCount);
+    }
+  }
+
+  return Result;
+}
+
+static void *MapSharedMemory(size_t Size) {
+  void *Result = mmap(0, Max(Size, 1), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  return (Result == MAP_FAILED) ? 0 : Result;
+}
+
+// NOTE(Lucas): Only looks at the bytes around the cut points, the workers
+// read the rest.
+static bool SplitIntoShards(const char *InputPath, shard_result *Shards,
+                            u32 ShardCount) {
+  memory_mapped_file File = OpenMemoryMappedFile(InputPath);
+  if (!File.IsValid) {
+    return false;
+  }
+
+  u8 *Data = File.Contents.Data;
+  u64 Size = File.Contents.Size;
+
+  u8 *Open = (u8 *)memchr(Data, '[', Size);
+  u64 ArrayEnd = Size;
+  while (ArrayEnd > 0 && Data[ArrayEnd - 1] != ']') {
+    ArrayEnd--;
+  }
+
+  bool Result = false;
+  if (Open && ArrayEnd > 0) {
+    u64 ArrayBegin = (Open - Data) + 1;
+    ArrayEnd--;
+
+    if (ArrayBegin <= ArrayEnd) {
+      u64 Begin = ArrayBegin;
+      for (u32 Index = 0; Index < ShardCount; ++Index) {
+        u64 End = ArrayEnd;
+        if (Index + 1 < ShardCount) {
+          End = ArrayBegin + (ArrayEnd - ArrayBegin) * (Index + 1) / ShardCount;
+          End = Max(End, Begin);
+          u8 *NextPair = (u8 *)memchr(Data + End, '{', ArrayEnd - End);
+          End = NextPair ? (u64)(NextPair - Data) : ArrayEnd;
+        }
+
+        Shards[Index].Begin = Begin;
+        Shards[Index].End = End;
+        Begin = End;
+      }
+      Result = true;
+    }
+  }
+
+  CloseMemoryMappedFile(&File);
+  return Result;
+}
+
+static haversine_result ProcessShards(const char *InputPath, u32 ShardCount,
+                                      bool IsCompensated) {
+  haversine_result Result = {};
+
+  size_t ResultsSize = ShardCount * sizeof(shard_result);
+  shard_result *Shards = (shard_result *)MapSharedMemory(ResultsSize);
+  if (!Shards) {
+    return Result;
+  }
+
+  bool IsValid = SplitIntoShards(InputPath, Shards, ShardCount);
+
+  {
+    TimeBlock("CountShards");
+    IsValid = IsValid && RunShardPhase(Shards, ShardCount, InputPath,
+                                       ShardPhase_Count, IsCompensated);
+  }
+
+  // NOTE(Lucas): One more block per shard than it could fill on its own, in
+  // case its range doesn't start on a block boundary.
+  u64 TotalBlockCapacity = 0;
+  u64 PairCount = 0;
+  for (u32 Index = 0; IsValid && Index < ShardCount; ++Index) {
+    Shards[Index].FirstPairIndex = PairCount;
+    Shards[Index].BlockCapacity =
+        Shards[Index].PairCount / SUMMATION_BLOCK_SIZE + 1;
+    PairCount += Shards[Index].PairCount;
+    TotalBlockCapacity += Shards[Index].BlockCapacity;
+  }
+
+  f64 *BlockSums = 0;
+  if (IsValid) {
+    BlockSums = (f64 *)MapSharedMemory(TotalBlockCapacity * sizeof(f64));
+    IsValid = (BlockSums != 0);
+  }
+
+  if (IsValid) {
+    u64 Offset = 0;
+    for (u32 Index = 0; Index < ShardCount; ++Index) {
+      Shards[Index].BlockSums = BlockSums + Offset;
+      Offset += Shards[Index].BlockCapacity;
+    }
+
+    TimeBlock("SumShards");
+    IsValid = RunShardPhase(Shards, ShardCount, InputPath, ShardPhase_Sum,
+                            IsCompensated);
+  }
+
+  if (IsValid) {
+    TimeBlock("MergeShards");
+
+    // NOTE(Lucas): In shard order, the blocks shared between neighbours are
+    // put back together in Pending.
+    f64 Pending[SUMMATION_BLOCK_SIZE];
+    u32 PendingCount = 0;
+
+    InitSummation(&Result.Summation, IsCompensated);
+    for (u32 Index = 0; Index < ShardCount; ++Index) {
+      shard_result *Shard = Shards + Index;
+
+      for (u32 Value = 0; Value < Shard->HeadCount; ++Value) {
+        Pending[PendingCount++] = Shard->Head[Value];
+        if (PendingCount == SUMMATION_BLOCK_SIZE) {
+          AddBlockSum(&Result.Summation,
+                      SumBlock(Pending, PendingCount, IsCompensated));
+          PendingCount = 0;
+        }
+      }
+
+      for (u64 Block = 0; Block < Shard->BlockCount; ++Block) {
+        AddBlockSum(&Result.Summation, Shard->BlockSums[Block]);
+      }
+
+      for (u32 Value = 0; Value < Shard->TailCount; ++Value) {
+        Pending[PendingCount++] = Shard->Tail[Value];
+      }
+    }
+    if (PendingCount) {
+      AddBlockSum(&Result.Summation,
+                  SumBlock(Pending, PendingCount, IsCompensated));
+    }
+
+    Result.Count = PairCount;
+    Result.Sum = SummationResult(&Result.Summation);
+    Result.IsValid = true;
+  }
+
+  if (IsValid) {
+    f64 Milliseconds = 1000.0 / (f64)GlobalProfiler.CPUFrequency;
+    for (u32 Index = 0; Index < ShardCount; ++Index) {
+      shard_result *Shard = Shards + Index;
+      printf("Shard %u: %llu pairs, %.3fmb, count %.3fms, sum %.3fms\n",
+             Index, Shard->PairCount,
+             (f64)(Shard->End - Shard->Begin) / (1024.0 * 1024.0),
+             Shard->Elapsed[ShardPhase_Count] * Milliseconds,
+             Shard->Elapsed[ShardPhase_Sum] * Milliseconds);
+    }
+    printf("Shard sections in the profile are summed over the %u workers.\n",
+           ShardCount);
+  }
+
+  if (BlockSums) {
+    munmap(BlockSums, TotalBlockCapacity * sizeof(f64));
+  }
+  munmap(Shards, ResultsSize);
+
+  return Result;
+}
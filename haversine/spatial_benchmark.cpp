@@ -0,0 +1,325 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "haversine_formula.cpp"
+#include "os.cpp"
+
+#define PROFILER_ENABLED 1
+#include "profiler.cpp"
+
+#include "string.cpp"
+#include "json.cpp"
+#include "json_tape.cpp"
+#include "json_stream.cpp"
+
+#include "file.cpp"
+#include "pairs.cpp"
+#include "spatial_index.cpp"
+
+struct options {
+  const char *InputPath;
+  u64 QueryCount;
+  f64 Radius;
+  u32 K;
+  bool IsValid;
+};
+
+static void PrintUsage(const char *ProgramName) {
+  fprintf(stderr, "Usage: %s INPUT [QUERIES [RADIUS [K]]]\n\n", ProgramName);
+  fprintf(stderr, "INPUT\tA data_*.json file produced by "
+                  "GenerateRandomHaversineData (uniform or cluster).\n");
+  fprintf(stderr, "QUERIES\tNumber of query points (default 200).\n");
+  fprintf(stderr, "RADIUS\tRadius of the radius queries in km (default 500).\n");
+  fprintf(stderr, "K\tNeighbors per nearest neighbor query (default 16).\n");
+}
+
+static options ParseCommandLineOptions(int ArgCount, char *Args[]) {
+  options Result = {.QueryCount = 200, .Radius = 500.0, .K = 16};
+
+  if (ArgCount >= 2 && ArgCount <= 5) {
+    Result.InputPath = Args[1];
+
+    if (ArgCount > 2) {
+      sscanf(Args[2], "%llu", &Result.QueryCount);
+    }
+    if (ArgCount > 3) {
+      sscanf(Args[3], "%lf", &Result.Radius);
+    }
+    if (ArgCount > 4) {
+      sscanf(Args[4], "%u", &Result.K);
+    }
+
+    Result.IsValid = Result.QueryCount && Result.Radius > 0 && Result.K;
+  }
+
+  return Result;
+}
+
+static bool LoadPairs(const char *InputPath, haversine_pairs *Pairs) {
+  TimeFunction;
+  bool Result = false;
+
+  buffer File = ReadEntireFile(InputPath);
+  json_tape *Tape = NULL;
+
+  if (File.Data) {
+    TimeBandwidth("ParseJSON", File.Size);
+    Tape = ParseJSONTape((char *)File.Data, File.Size);
+  }
+
+  if (Tape) {
+    json_tape_value PairsData = GetKey(JSONTapeRoot(Tape), STRING("pairs"));
+
+    if (PairsData) {
+      ForEachPair(PairsData, AppendPair, Pairs);
+      Result = true;
+    }
+
+    FreeJSONTape(Tape);
+  }
+
+  free(File.Data);
+
+  return Result;
+}
+
+static void PointFromId(haversine_pairs *Pairs, u64 PointId, f64 *Lon,
+                        f64 *Lat) {
+  u64 PairIndex = PointId / 2;
+  *Lon = (PointId & 1) ? Pairs->X1[PairIndex] : Pairs->X0[PairIndex];
+  *Lat = (PointId & 1) ? Pairs->Y1[PairIndex] : Pairs->Y0[PairIndex];
+}
+
+static spatial_results BruteForceRadius(haversine_pairs *Pairs, f64 *Lon,
+                                        f64 *Lat, u64 QueryCount,
+                                        f64 Radius) {
+  TimeFunction;
+  spatial_results Results = {};
+  Results.Starts = (u64 *)malloc((QueryCount + 1) * sizeof(u64));
+
+  u64 PointCount = 2 * Pairs->Count;
+
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    Results.Starts[Query] = Results.Count;
+
+    for (u64 PointId = 0; PointId < PointCount; ++PointId) {
+      f64 PointLon, PointLat;
+      PointFromId(Pairs, PointId, &PointLon, &PointLat);
+
+      if (ReferenceHaversine(Lon[Query], Lat[Query], PointLon, PointLat,
+                             EARTH_RADIUS) <= Radius) {
+        if (Results.Count == Results.Capacity) {
+          Results.Capacity = Results.Capacity ? 2 * Results.Capacity : 4096;
+          Results.Ids =
+              (u64 *)realloc(Results.Ids, Results.Capacity * sizeof(u64));
+        }
+        Results.Ids[Results.Count++] = PointId;
+      }
+    }
+  }
+
+  Results.Starts[QueryCount] = Results.Count;
+
+  return Results;
+}
+
+static int CompareNeighbors(const void *A, const void *B) {
+  f64 DistanceA = ((const spatial_neighbor *)A)->Distance;
+  f64 DistanceB = ((const spatial_neighbor *)B)->Distance;
+  return (DistanceA > DistanceB) - (DistanceA < DistanceB);
+}
+
+// NOTE(Lucas): Keeps the K best in a sorted array, inserting by shifting.
+// K is small, this is not what is being measured.
+static void BruteForceNearest(haversine_pairs *Pairs, f64 *Lon, f64 *Lat,
+                              u64 QueryCount, u32 K, spatial_neighbor *Out) {
+  TimeFunction;
+  u64 PointCount = 2 * Pairs->Count;
+
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    spatial_neighbor *Best = Out + Query * K;
+    u32 BestCount = 0;
+
+    for (u64 PointId = 0; PointId < PointCount; ++PointId) {
+      f64 PointLon, PointLat;
+      PointFromId(Pairs, PointId, &PointLon, &PointLat);
+
+      f64 Distance = ReferenceHaversine(Lon[Query], Lat[Query], PointLon,
+                                        PointLat, EARTH_RADIUS);
+
+      if (BestCount < K || Distance < Best[BestCount - 1].Distance) {
+        u32 Slot = (BestCount < K) ? BestCount++ : K - 1;
+        while (Slot > 0 && Best[Slot - 1].Distance > Distance) {
+          Best[Slot] = Best[Slot - 1];
+          Slot--;
+        }
+        Best[Slot] = {PointId, Distance};
+      }
+    }
+
+    qsort(Best, BestCount, sizeof(spatial_neighbor), CompareNeighbors);
+  }
+}
+
+static int CompareU64(const void *A, const void *B) {
+  u64 X = *(const u64 *)A;
+  u64 Y = *(const u64 *)B;
+  return (X > Y) - (X < Y);
+}
+
+// NOTE(Lucas): Number of queries whose set of hits differs between the two.
+static u64 CountRadiusMismatches(spatial_results *Expected,
+                                 spatial_results *Actual, u64 QueryCount) {
+  u64 Result = 0;
+
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    u64 ExpectedCount = Expected->Starts[Query + 1] - Expected->Starts[Query];
+    u64 ActualCount = Actual->Starts[Query + 1] - Actual->Starts[Query];
+    u64 *ExpectedIds = Expected->Ids + Expected->Starts[Query];
+    u64 *ActualIds = Actual->Ids + Actual->Starts[Query];
+
+    qsort(ExpectedIds, ExpectedCount, sizeof(u64), CompareU64);
+    qsort(ActualIds, ActualCount, sizeof(u64), CompareU64);
+
+    Result += (ExpectedCount != ActualCount) ||
+              memcmp(ExpectedIds, ActualIds, ExpectedCount * sizeof(u64)) != 0;
+  }
+
+  return Result;
+}
+
+// NOTE(Lucas): Compares distances rather than ids, equidistant points may
+// legitimately come back in either order.
+static u64 CountNearestMismatches(spatial_neighbor *Expected,
+                                  spatial_neighbor *Actual, u64 QueryCount,
+                                  u32 K) {
+  u64 Result = 0;
+
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    for (u32 Neighbor = 0; Neighbor < K; ++Neighbor) {
+      f64 Difference = fabs(Expected[Query * K + Neighbor].Distance -
+                            Actual[Query * K + Neighbor].Distance);
+      if (Difference > 1e-6) {
+        Result++;
+        break;
+      }
+    }
+  }
+
+  return Result;
+}
+
+static f64 SecondsFrom(u64 Elapsed) {
+  return (f64)Elapsed / (f64)GlobalProfiler.CPUFrequency;
+}
+
+int main(int ArgCount, char *Args[]) {
+  options Options = ParseCommandLineOptions(ArgCount, Args);
+
+  if (!Options.IsValid) {
+    PrintUsage(Args[0]);
+    return 1;
+  }
+
+  BeginProfile();
+
+  haversine_pairs Pairs = {};
+  if (!LoadPairs(Options.InputPath, &Pairs) || Pairs.Count == 0) {
+    fprintf(stderr, "Could not load pairs from %s\n", Options.InputPath);
+    return 1;
+  }
+
+  u64 PointCount = 2 * Pairs.Count;
+
+  // NOTE(Lucas): Queries sit on (jittered) data points, so they follow the
+  // distribution of the data set, uniform or clustered, and have hits.
+  srand(1234);
+  f64 *QueryLon = (f64 *)malloc(Options.QueryCount * sizeof(f64));
+  f64 *QueryLat = (f64 *)malloc(Options.QueryCount * sizeof(f64));
+  for (u64 Query = 0; Query < Options.QueryCount; ++Query) {
+    u64 PointId = ((u64)rand() * RAND_MAX + rand()) % PointCount;
+    PointFromId(&Pairs, PointId, QueryLon + Query, QueryLat + Query);
+    QueryLon[Query] += ((f64)rand() / RAND_MAX - 0.5);
+    QueryLat[Query] += ((f64)rand() / RAND_MAX - 0.5);
+  }
+
+  u64 StartCounter = ReadCPUTimer();
+  spatial_grid Grid = BuildSpatialGrid(&Pairs, EARTH_RADIUS);
+  f64 BuildSeconds = SecondsFrom(ReadCPUTimer() - StartCounter);
+
+  StartCounter = ReadCPUTimer();
+  spatial_results GridRadius = RadiusQueryBatch(
+      &Grid, QueryLon, QueryLat, Options.QueryCount, Options.Radius);
+  f64 GridRadiusSeconds = SecondsFrom(ReadCPUTimer() - StartCounter);
+
+  StartCounter = ReadCPUTimer();
+  spatial_results BruteRadius = BruteForceRadius(
+      &Pairs, QueryLon, QueryLat, Options.QueryCount, Options.Radius);
+  f64 BruteRadiusSeconds = SecondsFrom(ReadCPUTimer() - StartCounter);
+
+  spatial_neighbor *GridNearest = (spatial_neighbor *)malloc(
+      Options.QueryCount * Options.K * sizeof(spatial_neighbor));
+  spatial_neighbor *BruteNearest = (spatial_neighbor *)malloc(
+      Options.QueryCount * Options.K * sizeof(spatial_neighbor));
+
+  StartCounter = ReadCPUTimer();
+  u32 FoundCount = NearestQueryBatch(&Grid, QueryLon, QueryLat,
+                                     Options.QueryCount, Options.K, GridNearest);
+  f64 GridNearestSeconds = SecondsFrom(ReadCPUTimer() - StartCounter);
+
+  StartCounter = ReadCPUTimer();
+  BruteForceNearest(&Pairs, QueryLon, QueryLat, Options.QueryCount, FoundCount,
+                    BruteNearest);
+  f64 BruteNearestSeconds = SecondsFrom(ReadCPUTimer() - StartCounter);
+
+  // NOTE(Lucas): The brute force wrote with a stride of FoundCount.
+  u64 NearestMismatches = 0;
+  for (u64 Query = 0; Query < Options.QueryCount; ++Query) {
+    NearestMismatches += CountNearestMismatches(
+        BruteNearest + Query * FoundCount, GridNearest + Query * Options.K, 1,
+        FoundCount);
+  }
+
+  u64 RadiusMismatches =
+      CountRadiusMismatches(&BruteRadius, &GridRadius, Options.QueryCount);
+
+  printf("Points: %llu, grid %ux%u cells of %.3f degrees, built in %.3fs\n",
+         PointCount, Grid.LonCellCount, Grid.LatCellCount, Grid.CellDegrees,
+         BuildSeconds);
+  printf("Radius %.1fkm, %llu queries: %.1f hits/query\n", Options.Radius,
+         Options.QueryCount, (f64)GridRadius.Count / Options.QueryCount);
+  printf("  grid  %.6fs (%.0f queries/s)\n", GridRadiusSeconds,
+         Options.QueryCount / GridRadiusSeconds);
+  printf("  brute %.6fs (%.0f queries/s), grid is %.1fx faster, %llu "
+         "mismatches\n",
+         BruteRadiusSeconds, Options.QueryCount / BruteRadiusSeconds,
+         BruteRadiusSeconds / GridRadiusSeconds, RadiusMismatches);
+  printf("%u nearest, %llu queries:\n", FoundCount, Options.QueryCount);
+  printf("  grid  %.6fs (%.0f queries/s)\n", GridNearestSeconds,
+         Options.QueryCount / GridNearestSeconds);
+  printf("  brute %.6fs (%.0f queries/s), grid is %.1fx faster, %llu "
+         "mismatches\n",
+         BruteNearestSeconds, Options.QueryCount / BruteNearestSeconds,
+         BruteNearestSeconds / GridNearestSeconds, NearestMismatches);
+
+  free(GridNearest);
+  free(BruteNearest);
+  FreeSpatialResults(&GridRadius);
+  FreeSpatialResults(&BruteRadius);
+  FreeSpatialGrid(&Grid);
+  free(QueryLon);
+  free(QueryLat);
+  FreePairs(&Pairs);
+
+  EndProfileAndPrint();
+
+  return (RadiusMismatches || NearestMismatches) ? 1 : 0;
+}
@@ -0,0 +1,414 @@
+// NOTE(Lucas): A uniform longitude/latitude cell grid over the pair end
+// points, for "all points within R of P" and "k points nearest to P".
+//
+// Every pair contributes two points, point 2 * N is (X0, Y0) of pair N and
+// 2 * N + 1 is (X1, Y1). Points are stored sorted by cell, with the start of
+// every cell in CellStarts.
+//
+// Candidates from the cells overlapping a query cap are filtered with the dot
+// product of unit vectors: great circle distance <= R exactly when
+// dot(P, Q) >= cos(R / EarthRadius). That needs no trigonometry per point;
+// ReferenceHaversine is only used for the distances that get reported.
+
+struct spatial_grid {
+  f64 EarthRadius;
+  f64 CellDegrees;
+  u32 LonCellCount;
+  u32 LatCellCount;
+
+  u64 *CellStarts;
+
+  u64 PointCount;
+  f64 *X;
+  f64 *Y;
+  f64 *Z;
+  f64 *Lon;
+  f64 *Lat;
+  u64 *PointIds;
+};
+
+struct spatial_neighbor {
+  u64 PointId;
+  f64 Distance;
+};
+
+// NOTE(Lucas): Results of a batch of queries, the hits of query N are
+// Ids[Starts[N]] up to Ids[Starts[N + 1]].
+struct spatial_results {
+  u64 *Starts;
+  u64 *Ids;
+  u64 Count;
+  u64 Capacity;
+};
+
+struct spatial_candidates {
+  u64 *Indices;
+  f64 *Dots;
+  u64 Count;
+  u64 Capacity;
+};
+
+// NOTE(Lucas): The cluster generator can produce latitudes past the poles and
+// longitudes past +-180. Those still describe points on the sphere (the
+// haversine formula does not care), fold them back into range.
+static void NormalizeLonLat(f64 *Lon, f64 *Lat) {
+  f64 FromSouthPole = fmod(*Lat + 90.0, 360.0);
+  if (FromSouthPole < 0) {
+    FromSouthPole += 360.0;
+  }
+
+  f64 Longitude = *Lon;
+  if (FromSouthPole > 180.0) {
+    FromSouthPole = 360.0 - FromSouthPole;
+    Longitude += 180.0;
+  }
+
+  Longitude = fmod(Longitude + 180.0, 360.0);
+  if (Longitude < 0) {
+    Longitude += 360.0;
+  }
+
+  *Lon = Longitude - 180.0;
+  *Lat = FromSouthPole - 90.0;
+}
+
+static void UnitVectorFromLonLat(f64 Lon, f64 Lat, f64 *X, f64 *Y, f64 *Z) {
+  f64 Phi = RadiansFromDegrees(Lat);
+  f64 Lambda = RadiansFromDegrees(Lon);
+
+  *X = cos(Phi) * cos(Lambda);
+  *Y = cos(Phi) * sin(Lambda);
+  *Z = sin(Phi);
+}
+
+static inline u32 LonCellFor(spatial_grid *Grid, f64 Lon) {
+  s64 Cell = (s64)floor((Lon + 180.0) / Grid->CellDegrees);
+  Cell %= (s64)Grid->LonCellCount;
+  if (Cell < 0) {
+    Cell += Grid->LonCellCount;
+  }
+  return (u32)Cell;
+}
+
+static inline u32 LatCellFor(spatial_grid *Grid, f64 Lat) {
+  s64 Cell = (s64)floor((Lat + 90.0) / Grid->CellDegrees);
+  Cell = Max(Cell, 0);
+  Cell = Min(Cell, (s64)Grid->LatCellCount - 1);
+  return (u32)Cell;
+}
+
+static spatial_grid BuildSpatialGrid(haversine_pairs *Pairs, f64 EarthRadius) {
+  TimeFunction;
+  spatial_grid Grid = {.EarthRadius = EarthRadius};
+
+  u64 PointCount = 2 * Pairs->Count;
+
+  // NOTE(Lucas): Aim for about 8 points per cell on uniform data.
+  f64 CellDegrees = sqrt(360.0 * 180.0 * 8.0 / (f64)Max(PointCount, 1));
+  CellDegrees = Min(Max(CellDegrees, 0.01), 10.0);
+
+  Grid.LonCellCount = (u32)ceil(360.0 / CellDegrees);
+  Grid.CellDegrees = 360.0 / Grid.LonCellCount;
+  Grid.LatCellCount = (u32)ceil(180.0 / Grid.CellDegrees);
+
+  u64 CellCount = (u64)Grid.LonCellCount * Grid.LatCellCount;
+  Grid.CellStarts = (u64 *)calloc(CellCount + 1, sizeof(u64));
+
+  Grid.PointCount = PointCount;
+  Grid.X = (f64 *)malloc(PointCount * sizeof(f64));
+  Grid.Y = (f64 *)malloc(PointCount * sizeof(f64));
+  Grid.Z = (f64 *)malloc(PointCount * sizeof(f64));
+  Grid.Lon = (f64 *)malloc(PointCount * sizeof(f64));
+  Grid.Lat = (f64 *)malloc(PointCount * sizeof(f64));
+  Grid.PointIds = (u64 *)malloc(PointCount * sizeof(u64));
+
+  u64 *PointCells = (u64 *)malloc(PointCount * sizeof(u64));
+
+  // NOTE(Lucas): Counting sort by cell: count, prefix sum, scatter.
+  for (u64 PointId = 0; PointId < PointCount; ++PointId) {
+    u64 PairIndex = PointId / 2;
+    f64 Lon = (PointId & 1) ? Pairs->X1[PairIndex] : Pairs->X0[PairIndex];
+    f64 Lat = (PointId & 1) ? Pairs->Y1[PairIndex] : Pairs->Y0[PairIndex];
+    NormalizeLonLat(&Lon, &Lat);
+
+    u64 Cell = (u64)LatCellFor(&Grid, Lat) * Grid.LonCellCount +
+               LonCellFor(&Grid, Lon);
+    PointCells[PointId] = Cell;
+    Grid.CellStarts[Cell + 1]++;
+  }
+
+  for (u64 Cell = 0; Cell < CellCount; ++Cell) {
+    Grid.CellStarts[Cell + 1] += Grid.CellStarts[Cell];
+  }
+
+  u64 *Cursor = (u64 *)malloc(CellCount * sizeof(u64));
+  memcpy(Cursor, Grid.CellStarts, CellCount * sizeof(u64));
+
+  for (u64 PointId = 0; PointId < PointCount; ++PointId) {
+    u64 PairIndex = PointId / 2;
+    f64 Lon = (PointId & 1) ? Pairs->X1[PairIndex] : Pairs->X0[PairIndex];
+    f64 Lat = (PointId & 1) ? Pairs->Y1[PairIndex] : Pairs->Y0[PairIndex];
+    NormalizeLonLat(&Lon, &Lat);
+
+    u64 Slot = Cursor[PointCells[PointId]]++;
+    Grid.Lon[Slot] = Lon;
+    Grid.Lat[Slot] = Lat;
+    Grid.PointIds[Slot] = PointId;
+    UnitVectorFromLonLat(Lon, Lat, Grid.X + Slot, Grid.Y + Slot, Grid.Z + Slot);
+  }
+
+  free(Cursor);
+  free(PointCells);
+
+  return Grid;
+}
+
+static void FreeSpatialGrid(spatial_grid *Grid) {
+  free(Grid->CellStarts);
+  free(Grid->X);
+  free(Grid->Y);
+  free(Grid->Z);
+  free(Grid->Lon);
+  free(Grid->Lat);
+  free(Grid->PointIds);
+  *Grid = {};
+}
+
+static void AppendCandidate(spatial_candidates *Candidates, u64 Index,
+                            f64 Dot) {
+  if (Candidates->Count == Candidates->Capacity) {
+    Candidates->Capacity = Candidates->Capacity ? 2 * Candidates->Capacity : 256;
+    Candidates->Indices = (u64 *)realloc(Candidates->Indices,
+                                         Candidates->Capacity * sizeof(u64));
+    Candidates->Dots =
+        (f64 *)realloc(Candidates->Dots, Candidates->Capacity * sizeof(f64));
+  }
+
+  Candidates->Indices[Candidates->Count] = Index;
+  Candidates->Dots[Candidates->Count] = Dot;
+  Candidates->Count++;
+}
+
+static void FreeSpatialCandidates(spatial_candidates *Candidates) {
+  free(Candidates->Indices);
+  free(Candidates->Dots);
+  *Candidates = {};
+}
+
+// NOTE(Lucas): Appends the storage index of every point within Radius of
+// (Lon, Lat), along with its dot product with the query point.
+static void CollectWithinRadius(spatial_grid *Grid, f64 Lon, f64 Lat,
+                                f64 Radius, spatial_candidates *Candidates) {
+  NormalizeLonLat(&Lon, &Lat);
+
+  f64 QX, QY, QZ;
+  UnitVectorFromLonLat(Lon, Lat, &QX, &QY, &QZ);
+
+  f64 Angle = Radius / Grid->EarthRadius;
+  f64 MinDot = cos(Min(Angle, M_PI));
+  f64 AngleDegrees = Angle * 57.295779513082320876798;
+
+  f64 LatMin = Lat - AngleDegrees;
+  f64 LatMax = Lat + AngleDegrees;
+
+  // NOTE(Lucas): The widest longitude span of a cap that does not contain a
+  // pole is asin(sin(r) / cos(lat)), a cap over a pole spans every
+  // longitude.
+  u32 LonSpan = Grid->LonCellCount;
+  u32 FirstLonCell = 0;
+  if (LatMin > -90.0 && LatMax < 90.0) {
+    f64 SinRatio = sin(Angle) / cos(RadiansFromDegrees(Lat));
+    if (SinRatio < 1.0) {
+      f64 LonDelta = asin(SinRatio) * 57.295779513082320876798;
+      s64 FirstCell = (s64)floor((Lon - LonDelta + 180.0) / Grid->CellDegrees);
+      s64 LastCell = (s64)floor((Lon + LonDelta + 180.0) / Grid->CellDegrees);
+      if (LastCell - FirstCell + 1 < (s64)Grid->LonCellCount) {
+        LonSpan = (u32)(LastCell - FirstCell + 1);
+        FirstLonCell = LonCellFor(Grid, Lon - LonDelta);
+      }
+    }
+  }
+
+  u32 FirstLatCell = LatCellFor(Grid, LatMin);
+  u32 LastLatCell = LatCellFor(Grid, LatMax);
+
+  for (u32 LatCell = FirstLatCell; LatCell <= LastLatCell; ++LatCell) {
+    for (u32 Step = 0; Step < LonSpan; ++Step) {
+      u32 LonCell = (FirstLonCell + Step) % Grid->LonCellCount;
+      u64 Cell = (u64)LatCell * Grid->LonCellCount + LonCell;
+
+      for (u64 Index = Grid->CellStarts[Cell];
+           Index < Grid->CellStarts[Cell + 1]; ++Index) {
+        f64 Dot = QX * Grid->X[Index] + QY * Grid->Y[Index] +
+                  QZ * Grid->Z[Index];
+        if (Dot >= MinDot) {
+          AppendCandidate(Candidates, Index, Dot);
+        }
+      }
+    }
+  }
+}
+
+static u64 CellOfQuery(spatial_grid *Grid, f64 Lon, f64 Lat) {
+  NormalizeLonLat(&Lon, &Lat);
+  return (u64)LatCellFor(Grid, Lat) * Grid->LonCellCount +
+         LonCellFor(Grid, Lon);
+}
+
+static spatial_grid *GlobalSortGrid;
+static f64 *GlobalSortLon;
+static f64 *GlobalSortLat;
+
+static int CompareQueriesByCell(const void *A, const void *B) {
+  u64 QueryA = *(const u64 *)A;
+  u64 QueryB = *(const u64 *)B;
+  u64 CellA = CellOfQuery(GlobalSortGrid, GlobalSortLon[QueryA],
+                          GlobalSortLat[QueryA]);
+  u64 CellB = CellOfQuery(GlobalSortGrid, GlobalSortLon[QueryB],
+                          GlobalSortLat[QueryB]);
+  return (CellA > CellB) - (CellA < CellB);
+}
+
+// NOTE(Lucas): Queries are answered in cell order so neighbouring queries
+// reuse the cells they pull into the cache, results are still reported in
+// the order of the queries.
+static u64 *OrderQueriesByCell(spatial_grid *Grid, f64 *Lon, f64 *Lat,
+                               u64 QueryCount) {
+  u64 *Order = (u64 *)malloc(QueryCount * sizeof(u64));
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    Order[Query] = Query;
+  }
+
+  GlobalSortGrid = Grid;
+  GlobalSortLon = Lon;
+  GlobalSortLat = Lat;
+  qsort(Order, QueryCount, sizeof(u64), CompareQueriesByCell);
+
+  return Order;
+}
+
+static void FreeSpatialResults(spatial_results *Results) {
+  free(Results->Starts);
+  free(Results->Ids);
+  *Results = {};
+}
+
+// NOTE(Lucas): Point ids within Radius of every (Lon[N], Lat[N]), unordered
+// within a query.
+static spatial_results RadiusQueryBatch(spatial_grid *Grid, f64 *Lon,
+                                        f64 *Lat, u64 QueryCount,
+                                        f64 Radius) {
+  TimeFunction;
+  spatial_results Results = {};
+
+  u64 *Order = OrderQueriesByCell(Grid, Lon, Lat, QueryCount);
+  u64 *Counts = (u64 *)calloc(QueryCount, sizeof(u64));
+
+  // NOTE(Lucas): Collect per query in cell order, then lay the ids out in
+  // query order.
+  spatial_candidates *PerQuery =
+      (spatial_candidates *)calloc(QueryCount, sizeof(spatial_candidates));
+
+  for (u64 OrderIndex = 0; OrderIndex < QueryCount; ++OrderIndex) {
+    u64 Query = Order[OrderIndex];
+    CollectWithinRadius(Grid, Lon[Query], Lat[Query], Radius,
+                        PerQuery + Query);
+    Counts[Query] = PerQuery[Query].Count;
+  }
+
+  Results.Starts = (u64 *)malloc((QueryCount + 1) * sizeof(u64));
+  Results.Starts[0] = 0;
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    Results.Starts[Query + 1] = Results.Starts[Query] + Counts[Query];
+  }
+
+  Results.Count = Results.Starts[QueryCount];
+  Results.Capacity = Results.Count;
+  Results.Ids = (u64 *)malloc(Max(Results.Count, 1) * sizeof(u64));
+
+  for (u64 Query = 0; Query < QueryCount; ++Query) {
+    spatial_candidates *Candidates = PerQuery + Query;
+    u64 *Ids = Results.Ids + Results.Starts[Query];
+    for (u64 Index = 0; Index < Candidates->Count; ++Index) {
+      Ids[Index] = Grid->PointIds[Candidates->Indices[Index]];
+    }
+    FreeSpatialCandidates(Candidates);
+  }
+
+  free(PerQuery);
+  free(Counts);
+  free(Order);
+
+  return Results;
+}
+
+static spatial_candidates *GlobalSortCandidates;
+
+static int CompareCandidatesByDot(const void *A, const void *B) {
+  f64 DotA = GlobalSortCandidates->Dots[*(const u64 *)A];
+  f64 DotB = GlobalSortCandidates->Dots[*(const u64 *)B];
+  // NOTE(Lucas): Larger dot product means closer.
+  return (DotA < DotB) - (DotA > DotB);
+}
+
+// NOTE(Lucas): Writes the K nearest points of every query to Out[N * K],
+// nearest first. Returns how many neighbors were found per query (less than
+// K only if the grid has fewer than K points).
+static u32 NearestQueryBatch(spatial_grid *Grid, f64 *Lon, f64 *Lat,
+                             u64 QueryCount, u32 K, spatial_neighbor *Out) {
+  TimeFunction;
+  u32 Result = (u32)Min((u64)K, Grid->PointCount);
+
+  u64 *Order = OrderQueriesByCell(Grid, Lon, Lat, QueryCount);
+
+  // NOTE(Lucas): Start with the radius that holds about 2K points on a
+  // uniform sphere and double it until there are enough candidates.
+  f64 SphereArea = 4.0 * M_PI * Grid->EarthRadius * Grid->EarthRadius;
+  f64 StartRadius =
+      sqrt(2.0 * K * SphereArea / (M_PI * (f64)Max(Grid->PointCount, 1)));
+  f64 MaxRadius = M_PI * Grid->EarthRadius;
+
+  spatial_candidates Candidates = {};
+  u64 *Ranking = NULL;
+  u64 RankingCapacity = 0;
+
+  for (u64 OrderIndex = 0; OrderIndex < QueryCount; ++OrderIndex) {
+    u64 Query = Order[OrderIndex];
+
+    f64 Radius = StartRadius;
+    for (;;) {
+      Candidates.Count = 0;
+      CollectWithinRadius(Grid, Lon[Query], Lat[Query], Radius, &Candidates);
+      if (Candidates.Count >= Result || Radius >= MaxRadius) {
+        break;
+      }
+      Radius *= 2.0;
+    }
+
+    if (RankingCapacity < Candidates.Count) {
+      RankingCapacity = Candidates.Count;
+      Ranking = (u64 *)realloc(Ranking, RankingCapacity * sizeof(u64));
+    }
+    for (u64 Index = 0; Index < Candidates.Count; ++Index) {
+      Ranking[Index] = Index;
+    }
+
+    GlobalSortCandidates = &Candidates;
+    qsort(Ranking, Candidates.Count, sizeof(u64), CompareCandidatesByDot);
+
+    for (u32 Neighbor = 0; Neighbor < Result; ++Neighbor) {
+      u64 Index = Candidates.Indices[Ranking[Neighbor]];
+      spatial_neighbor *Slot = Out + Query * K + Neighbor;
+      Slot->PointId = Grid->PointIds[Index];
+      Slot->Distance = ReferenceHaversine(Lon[Query], Lat[Query],
+                                          Grid->Lon[Index], Grid->Lat[Index],
+                                          Grid->EarthRadius);
+    }
+  }
+
+  free(Ranking);
+  FreeSpatialCandidates(&Candidates);
+  free(Order);
+
+  return Result;
+}
@@ -4,7 +4,7 @@ struct string {
 };
 
 string CopyString(const char *String, off_t StartOffset, size_t Count) {
-  char *Data = (char *)malloc(sizeof(char) * (Count + 1));
+  char *Data = (char *)ProfiledMalloc(sizeof(char) * (Count + 1));
   memcpy(Data, String + StartOffset, Count);
   Data[Count] = 0;
 
@@ -0,0 +1,159 @@
+// NOTE(Lucas): Summation with a result that only depends on the values and
+// their order, not on how the work was split between threads or how wide the
+// vector units are. Shared by the generator (C) and the processor (C++), so
+// the generator's reference answer can be compared bit for bit.
+//
+// The sequence is cut into blocks of SUMMATION_BLOCK_SIZE values, starting at
+// the first value. Inside a block, value N goes to lane N %
+// SUMMATION_LANE_COUNT and the lanes are combined with a fixed tree. Block
+// sums are then combined pairwise, like the carries of a binary counter.
+//
+// Anything that sums whole blocks independently (SumBlock) and hands the
+// block sums to AddBlockSum in order gets exactly the same result as adding
+// the values one at a time with AddToSummation.
+//
+// The compensated mode keeps a Neumaier correction per lane. It is written
+// without branches so the lane loop still vectorizes.
+//
+// Expects the f64/u64/u32 typedefs and <math.h>.
+
+#define SUMMATION_LANE_COUNT 8
+#define SUMMATION_BLOCK_SIZE 4096
+#define SUMMATION_MAX_LEVELS 64
+
+typedef struct {
+  bool IsCompensated;
+  u32 BlockFill;
+  f64 Lanes[SUMMATION_LANE_COUNT];
+  f64 Compensations[SUMMATION_LANE_COUNT];
+
+  // NOTE(Lucas): Levels[L] holds the sum of 2^L blocks whenever bit L of
+  // BlockCount is set.
+  u64 BlockCount;
+  f64 Levels[SUMMATION_MAX_LEVELS];
+} summation;
+
+static inline void InitSummation(summation *Summation, bool IsCompensated) {
+  memset(Summation, 0, sizeof(*Summation));
+  Summation->IsCompensated = IsCompensated;
+}
+
+static inline void NeumaierAdd(f64 *Sum, f64 *Compensation, f64 Value) {
+  f64 Total = *Sum + Value;
+  f64 SumIsLarger = (*Sum - Total) + Value;
+  f64 ValueIsLarger = (Value - Total) + *Sum;
+  *Compensation += (fabs(*Sum) >= fabs(Value)) ? SumIsLarger : ValueIsLarger;
+  *Sum = Total;
+}
+
+// NOTE(Lucas): Halves the number of live lanes every step, lane L is added to
+// lane L + Width. That is the usual horizontal reduction of a vector
+// register, so a SIMD implementation can do the same.
+static inline f64 ReduceLanes(f64 *Lanes, f64 *Compensations,
+                              bool IsCompensated) {
+  if (IsCompensated) {
+    for (u32 Lane = 0; Lane < SUMMATION_LANE_COUNT; ++Lane) {
+      Lanes[Lane] += Compensations[Lane];
+    }
+  }
+
+  for (u32 Width = SUMMATION_LANE_COUNT / 2; Width > 0; Width /= 2) {
+    for (u32 Lane = 0; Lane < Width; ++Lane) {
+      Lanes[Lane] = Lanes[Lane] + Lanes[Lane + Width];
+    }
+  }
+
+  return Lanes[0];
+}
+
+// NOTE(Lucas): Sums one block, Count is at most SUMMATION_BLOCK_SIZE and is
+// only smaller for the last block of the sequence.
+static inline f64 SumBlock(const f64 *Values, u32 Count,
+                           bool IsCompensated) {
+  f64 Lanes[SUMMATION_LANE_COUNT] = {0};
+  f64 Compensations[SUMMATION_LANE_COUNT] = {0};
+
+  u32 Index = 0;
+
+  if (IsCompensated) {
+    for (; Index + SUMMATION_LANE_COUNT <= Count;
+         Index += SUMMATION_LANE_COUNT) {
+      for (u32 Lane = 0; Lane < SUMMATION_LANE_COUNT; ++Lane) {
+        NeumaierAdd(Lanes + Lane, Compensations + Lane, Values[Index + Lane]);
+      }
+    }
+    for (; Index < Count; ++Index) {
+      u32 Lane = Index % SUMMATION_LANE_COUNT;
+      NeumaierAdd(Lanes + Lane, Compensations + Lane, Values[Index]);
+    }
+  } else {
+    for (; Index + SUMMATION_LANE_COUNT <= Count;
+         Index += SUMMATION_LANE_COUNT) {
+      for (u32 Lane = 0; Lane < SUMMATION_LANE_COUNT; ++Lane) {
+        Lanes[Lane] += Values[Index + Lane];
+      }
+    }
+    for (; Index < Count; ++Index) {
+      Lanes[Index % SUMMATION_LANE_COUNT] += Values[Index];
+    }
+  }
+
+  return ReduceLanes(Lanes, Compensations, IsCompensated);
+}
+
+static inline void AddBlockSum(summation *Summation, f64 BlockSum) {
+  f64 Carry = BlockSum;
+  u64 Count = Summation->BlockCount;
+  u32 Level = 0;
+
+  while (Count & 1) {
+    Carry = Summation->Levels[Level] + Carry;
+    Count >>= 1;
+    Level++;
+  }
+
+  Summation->Levels[Level] = Carry;
+  Summation->BlockCount++;
+}
+
+static inline void FlushSummationBlock(summation *Summation) {
+  AddBlockSum(Summation, ReduceLanes(Summation->Lanes, Summation->Compensations,
+                                     Summation->IsCompensated));
+
+  memset(Summation->Lanes, 0, sizeof(Summation->Lanes));
+  memset(Summation->Compensations, 0, sizeof(Summation->Compensations));
+  Summation->BlockFill = 0;
+}
+
+static inline void AddToSummation(summation *Summation, f64 Value) {
+  u32 Lane = Summation->BlockFill % SUMMATION_LANE_COUNT;
+
+  if (Summation->IsCompensated) {
+    NeumaierAdd(Summation->Lanes + Lane, Summation->Compensations + Lane,
+                Value);
+  } else {
+    Summation->Lanes[Lane] += Value;
+  }
+
+  if (++Summation->BlockFill == SUMMATION_BLOCK_SIZE) {
+    FlushSummationBlock(Summation);
+  }
+}
+
+// NOTE(Lucas): Does not change Summation, more values can still be added.
+static inline f64 SummationResult(const summation *Summation) {
+  summation Final = *Summation;
+
+  if (Final.BlockFill) {
+    FlushSummationBlock(&Final);
+  }
+
+  f64 Result = 0;
+  for (u32 Level = 0; Level < SUMMATION_MAX_LEVELS; ++Level) {
+    if ((Final.BlockCount >> Level) & 1) {
+      Result = Final.Levels[Level] + Result;
+    }
+  }
+
+  return Result;
+}
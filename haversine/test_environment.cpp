@@ -0,0 +1,310 @@
+// NOTE(Lucas): Sets up what the repetition tester can control about the
+// machine (core, priority, locked buffers, clock warmup) and records the rest
+// in a header, so numbers from different machines and days can be compared.
+//
+// Pinning, the governor, SMT and THP are linux only. Elsewhere they are
+// reported as unavailable instead of failing the run.
+
+#include <cerrno>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#if __linux__
+#include <sched.h>
+#endif
+
+#define WARMUP_CHAIN_LENGTH (1024 * 1024)
+#define WARMUP_STABLE_ROUNDS 8
+#define WARMUP_TOLERANCE 0.01
+#define WARMUP_MIN_MILLISECONDS 200
+#define WARMUP_MAX_MILLISECONDS 5000
+
+struct test_environment_options {
+  // NOTE(Lucas): -1 leaves the thread wherever the scheduler puts it.
+  int PinCore;
+  bool RaisePriority;
+  bool LockBuffers;
+  bool Warmup;
+};
+
+struct test_environment {
+  char PinStatus[64];
+  char PriorityStatus[64];
+  char LockStatus[64];
+
+  int Core;
+  char Governor[32];
+  char CurrentFrequency[32];
+  char SMT[64];
+  char THP[32];
+
+  bool HasWarmedUp;
+  bool WarmupSettled;
+  u64 WarmupRounds;
+  f64 WarmupMilliseconds;
+  f64 TicksPerChainStep;
+};
+
+// NOTE(Lucas): Reads the first line of a small sysfs/procfs file, Out is left
+// empty if it can't be read.
+static void ReadFirstLine(const char *Path, char *Out, size_t OutSize) {
+  Out[0] = 0;
+
+  FILE *File = fopen(Path, "r");
+  if (File) {
+    if (fgets(Out, (int)OutSize, File)) {
+      Out[strcspn(Out, "\n")] = 0;
+    }
+    fclose(File);
+  }
+}
+
+static int CurrentCore() {
+#if __linux__
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+static int OnlineCoreCount() { return (int)sysconf(_SC_NPROCESSORS_ONLN); }
+
+// NOTE(Lucas): Pins the calling thread only, threads it creates afterwards
+// start with the same mask.
+static bool PinCurrentThread(int Core) {
+#if __linux__
+  // NOTE(Lucas): CPU_SET does not check its argument, past CPU_SETSIZE it
+  // writes outside the set.
+  if (Core < 0 || Core >= CPU_SETSIZE) {
+    errno = EINVAL;
+    return false;
+  }
+
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  CPU_SET(Core, &Set);
+  return sched_setaffinity(0, sizeof(Set), &Set) == 0;
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
+
+static void PinToCore(test_environment *Env, int Core) {
+  if (PinCurrentThread(Core)) {
+    snprintf(Env->PinStatus, sizeof(Env->PinStatus), "pinned to core %d",
+             Core);
+  } else {
+    snprintf(Env->PinStatus, sizeof(Env->PinStatus),
+             "pin to core %d failed: %s", Core, strerror(errno));
+  }
+}
+
+// NOTE(Lucas): Only nice -20, a realtime policy on a thread that spins for
+// minutes can starve the rest of the core.
+static void RaisePriority(test_environment *Env) {
+  if (setpriority(PRIO_PROCESS, 0, -20) == 0) {
+    snprintf(Env->PriorityStatus, sizeof(Env->PriorityStatus), "nice -20");
+  } else {
+    snprintf(Env->PriorityStatus, sizeof(Env->PriorityStatus),
+             "nice %d (raising failed: %s)", getpriority(PRIO_PROCESS, 0),
+             strerror(errno));
+  }
+}
+
+// NOTE(Lucas): Also faults the pages in, so the tests using these buffers see
+// no page faults at all.
+static void LockBuffers(test_environment *Env, buffer *Buffers,
+                        u32 BufferCount) {
+  u64 LockedBytes = 0;
+
+  for (u32 Index = 0; Index < BufferCount; ++Index) {
+    if (mlock(Buffers[Index].Data, Buffers[Index].Size) != 0) {
+      snprintf(Env->LockStatus, sizeof(Env->LockStatus), "mlock failed: %s",
+               strerror(errno));
+      return;
+    }
+    LockedBytes += Buffers[Index].Size;
+  }
+
+  snprintf(Env->LockStatus, sizeof(Env->LockStatus), "%.3fmb locked",
+           (f64)LockedBytes / (1024.0 * 1024.0));
+}
+
+// NOTE(Lucas): A chain of dependent adds runs at about one step per core
+// cycle, so timer ticks per step is the timer to core clock ratio. It is
+// stable once the core stopped ramping its frequency.
+static u64 TimeDependentChain() {
+  u64 Value = 0;
+
+  u64 Start = ReadCPUTimer();
+  for (u64 Step = 0; Step < WARMUP_CHAIN_LENGTH; ++Step) {
+    Value += Step;
+    asm volatile("" : "+r"(Value));
+  }
+  u64 End = ReadCPUTimer();
+
+  return End - Start;
+}
+
+static void WarmUp(test_environment *Env, u64 CPUTimerFrequency) {
+  u64 Rounds[WARMUP_STABLE_ROUNDS] = {};
+  u64 MinTicks = WARMUP_MIN_MILLISECONDS * CPUTimerFrequency / 1000;
+  u64 MaxTicks = WARMUP_MAX_MILLISECONDS * CPUTimerFrequency / 1000;
+
+  u64 Start = ReadCPUTimer();
+  u64 Elapsed = 0;
+  u64 RoundCount = 0;
+  bool IsSettled = false;
+
+  while (!IsSettled && Elapsed < MaxTicks) {
+    Rounds[RoundCount % WARMUP_STABLE_ROUNDS] = TimeDependentChain();
+    RoundCount++;
+    Elapsed = ReadCPUTimer() - Start;
+
+    if (RoundCount >= WARMUP_STABLE_ROUNDS && Elapsed >= MinTicks) {
+      u64 Fastest = ~0ull;
+      u64 Slowest = 0;
+      for (u32 Index = 0; Index < WARMUP_STABLE_ROUNDS; ++Index) {
+        Fastest = Min(Fastest, Rounds[Index]);
+        Slowest = Max(Slowest, Rounds[Index]);
+      }
+      IsSettled = (f64)(Slowest - Fastest) <= WARMUP_TOLERANCE * (f64)Fastest;
+    }
+  }
+
+  u64 LastRound = Rounds[(RoundCount - 1) % WARMUP_STABLE_ROUNDS];
+
+  Env->HasWarmedUp = true;
+  Env->WarmupSettled = IsSettled;
+  Env->WarmupRounds = RoundCount;
+  Env->WarmupMilliseconds = 1000.0 * (f64)Elapsed / (f64)CPUTimerFrequency;
+  Env->TicksPerChainStep = (f64)LastRound / WARMUP_CHAIN_LENGTH;
+}
+
+static void ReadMachineState(test_environment *Env) {
+  Env->Core = CurrentCore();
+
+  strcpy(Env->Governor, "unavailable");
+  strcpy(Env->CurrentFrequency, "unavailable");
+  strcpy(Env->SMT, "unavailable");
+  strcpy(Env->THP, "unavailable");
+
+#if __linux__
+  char Path[128];
+  char Line[128];
+
+  if (Env->Core >= 0) {
+    snprintf(Path, sizeof(Path),
+             "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+             Env->Core);
+    ReadFirstLine(Path, Line, sizeof(Line));
+    if (Line[0]) {
+      snprintf(Env->Governor, sizeof(Env->Governor), "%.*s",
+               (int)sizeof(Env->Governor) - 1, Line);
+    }
+
+    snprintf(Path, sizeof(Path),
+             "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq",
+             Env->Core);
+    ReadFirstLine(Path, Line, sizeof(Line));
+    if (Line[0]) {
+      snprintf(Env->CurrentFrequency, sizeof(Env->CurrentFrequency),
+               "%.3fghz", atof(Line) / 1000000.0);
+    }
+  }
+
+  char Active[16];
+  ReadFirstLine("/sys/devices/system/cpu/smt/active", Active, sizeof(Active));
+  if (Active[0] && Env->Core >= 0) {
+    snprintf(Path, sizeof(Path),
+             "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+             Env->Core);
+    ReadFirstLine(Path, Line, sizeof(Line));
+    // NOTE(Lucas): The sibling list is cut to what fits after the prefix.
+    snprintf(Env->SMT, sizeof(Env->SMT), "%s, siblings %.*s",
+             (Active[0] == '1') ? "on" : "off", (int)sizeof(Env->SMT) - 16,
+             Line[0] ? Line : "?");
+  }
+
+  // NOTE(Lucas): The file reads like "always [madvise] never", keep the
+  // selected mode.
+  ReadFirstLine("/sys/kernel/mm/transparent_hugepage/enabled", Line,
+                sizeof(Line));
+  char *Selected = strchr(Line, '[');
+  char *SelectedEnd = Selected ? strchr(Selected, ']') : 0;
+  if (SelectedEnd) {
+    *SelectedEnd = 0;
+    snprintf(Env->THP, sizeof(Env->THP), "%s", Selected + 1);
+  }
+#endif
+}
+
+static test_environment
+PrepareTestEnvironment(test_environment_options *Options, buffer *Buffers,
+                       u32 BufferCount, u64 CPUTimerFrequency) {
+  test_environment Env = {};
+  strcpy(Env.PinStatus, "not pinned");
+  strcpy(Env.PriorityStatus, "default");
+  strcpy(Env.LockStatus, "not locked");
+
+  if (Options->PinCore >= 0) {
+    PinToCore(&Env, Options->PinCore);
+  }
+  if (Options->RaisePriority) {
+    RaisePriority(&Env);
+  }
+  if (Options->LockBuffers) {
+    LockBuffers(&Env, Buffers, BufferCount);
+  }
+  if (Options->Warmup) {
+    WarmUp(&Env, CPUTimerFrequency);
+  }
+
+  // NOTE(Lucas): After the warmup, so the frequency is the one the tests see.
+  ReadMachineState(&Env);
+
+  return Env;
+}
+
+static void PrintTestEnvironment(test_environment *Env,
+                                 u64 CPUTimerFrequency) {
+  char Date[64];
+  time_t Now = time(0);
+  strftime(Date, sizeof(Date), "%Y-%m-%d %H:%M:%S", localtime(&Now));
+
+  struct utsname Name;
+  if (uname(&Name) != 0) {
+    strcpy(Name.nodename, "?");
+    strcpy(Name.sysname, "?");
+    strcpy(Name.release, "?");
+    strcpy(Name.machine, "?");
+  }
+
+  printf("Date: %s\n", Date);
+  printf("Host: %s (%s %s %s)\n", Name.nodename, Name.sysname, Name.release,
+         Name.machine);
+  printf("CPU timer: %.3fmhz\n", (f64)CPUTimerFrequency / 1000000.0);
+
+  if (Env->Core >= 0) {
+    printf("Core: %d (%s)\n", Env->Core, Env->PinStatus);
+  } else {
+    printf("Core: unknown (%s)\n", Env->PinStatus);
+  }
+  printf("Priority: %s\n", Env->PriorityStatus);
+  printf("Buffers: %s\n", Env->LockStatus);
+  printf("Governor: %s, current frequency %s\n", Env->Governor,
+         Env->CurrentFrequency);
+  printf("SMT: %s\n", Env->SMT);
+  printf("THP: %s\n", Env->THP);
+
+  if (Env->HasWarmedUp) {
+    printf("Warmup: %s after %llu rounds (%.1fms), %.4f timer ticks per "
+           "dependent add\n",
+           Env->WarmupSettled ? "settled" : "NOT SETTLED", Env->WarmupRounds,
+           Env->WarmupMilliseconds, Env->TicksPerChainStep);
+  } else {
+    printf("Warmup: none\n");
+  }
+}
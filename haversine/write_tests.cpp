@@ -0,0 +1,226 @@
+// NOTE(Lucas): The write side of the repetition tests. Every repetition
+// creates Params->OutputPath from scratch and writes Params->Source into it.
+// Opening and closing are inside the timed region, for the mmap test the
+// ftruncate and the mapping are part of the cost. The file is deleted after
+// each repetition, outside of it.
+//
+// Everything but O_DIRECT ends in the page cache, O_DIRECT goes to the disk
+// and is there to show what the page cache is buying.
+
+#include <sys/uio.h>
+
+// NOTE(Lucas): About the size of one line of the generator's JSON, fwrite is
+// called per record like fprintf is.
+#define WRITE_TEST_RECORD_SIZE 64
+#define WRITE_TEST_IOVEC_COUNT 16
+#define WRITE_TEST_DIRECT_ALIGNMENT 4096
+
+// NOTE(Lucas): Page aligned and padded to WRITE_TEST_DIRECT_ALIGNMENT, so
+// O_DIRECT can write it as is.
+static buffer LoadAlignedCopy(const char *Filepath, u64 FileSize) {
+  buffer Result = {};
+
+  size_t Capacity = (FileSize + WRITE_TEST_DIRECT_ALIGNMENT - 1) &
+                    ~(size_t)(WRITE_TEST_DIRECT_ALIGNMENT - 1);
+  void *Data = NULL;
+  if (posix_memalign(&Data, WRITE_TEST_DIRECT_ALIGNMENT, Max(Capacity, 1)) ==
+      0) {
+    memset(Data, 0, Capacity);
+
+    FILE *File = fopen(Filepath, "rb");
+    if (File) {
+      if (fread(Data, sizeof(u8), FileSize, File) == FileSize) {
+        Result.Data = (u8 *)Data;
+        Result.Size = FileSize;
+      }
+      fclose(File);
+    }
+
+    if (!Result.Data) {
+      free(Data);
+    }
+  }
+
+  return Result;
+}
+
+static void WriteFile_Fwrite(test_context *Context, read_parameters *Params) {
+  char *StdioBuffer = (char *)malloc(Params->ChunkSize);
+
+  while (IsTesting(Context)) {
+    buffer Source = Params->Source;
+    PrepareCaches(Params, &Source);
+
+    BeginTime(Context);
+    u64 Written = 0;
+    bool Closed = false;
+    FILE *File = fopen(Params->OutputPath, "wb");
+    if (File) {
+      setvbuf(File, StdioBuffer, _IOFBF, Params->ChunkSize);
+      for (u64 Offset = 0; Offset < Source.Size;
+           Offset += WRITE_TEST_RECORD_SIZE) {
+        size_t Size = Min(Source.Size - Offset, (u64)WRITE_TEST_RECORD_SIZE);
+        Written += fwrite(Source.Data + Offset, sizeof(u8), Size, File);
+      }
+      Closed = (fclose(File) == 0);
+    }
+    EndTime(Context);
+
+    if (Written == Source.Size && Closed) {
+      CountBytes(Context, Source.Size);
+    }
+    unlink(Params->OutputPath);
+  }
+
+  free(StdioBuffer);
+}
+
+static void WriteFile_WriteSyscall(test_context *Context,
+                                   read_parameters *Params) {
+  while (IsTesting(Context)) {
+    buffer Source = Params->Source;
+    PrepareCaches(Params, &Source);
+
+    BeginTime(Context);
+    u64 Written = 0;
+    int FileDescriptor =
+        open(Params->OutputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (FileDescriptor >= 0) {
+      while (Written < Source.Size) {
+        size_t Size = Min(Source.Size - Written, (u64)Params->ChunkSize);
+        ssize_t Result = write(FileDescriptor, Source.Data + Written, Size);
+        if (Result <= 0) {
+          break;
+        }
+        Written += Result;
+      }
+      close(FileDescriptor);
+    }
+    EndTime(Context);
+
+    if (Written == Source.Size) {
+      CountBytes(Context, Source.Size);
+    }
+    unlink(Params->OutputPath);
+  }
+}
+
+static void WriteFile_Pwritev(test_context *Context, read_parameters *Params) {
+  while (IsTesting(Context)) {
+    buffer Source = Params->Source;
+    PrepareCaches(Params, &Source);
+
+    BeginTime(Context);
+    u64 Written = 0;
+    int FileDescriptor =
+        open(Params->OutputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (FileDescriptor >= 0) {
+      while (Written < Source.Size) {
+        struct iovec Vectors[WRITE_TEST_IOVEC_COUNT];
+        int VectorCount = 0;
+        u64 Offset = Written;
+        while (VectorCount < WRITE_TEST_IOVEC_COUNT && Offset < Source.Size) {
+          size_t Size = Min(Source.Size - Offset, (u64)Params->ChunkSize);
+          Vectors[VectorCount].iov_base = Source.Data + Offset;
+          Vectors[VectorCount].iov_len = Size;
+          VectorCount++;
+          Offset += Size;
+        }
+
+        ssize_t Result =
+            pwritev(FileDescriptor, Vectors, VectorCount, (off_t)Written);
+        if (Result <= 0) {
+          break;
+        }
+        Written += Result;
+      }
+      close(FileDescriptor);
+    }
+    EndTime(Context);
+
+    if (Written == Source.Size) {
+      CountBytes(Context, Source.Size);
+    }
+    unlink(Params->OutputPath);
+  }
+}
+
+static void WriteFile_Mmap(test_context *Context, read_parameters *Params) {
+  while (IsTesting(Context)) {
+    buffer Source = Params->Source;
+    PrepareCaches(Params, &Source);
+
+    BeginTime(Context);
+    bool IsWritten = false;
+    int FileDescriptor =
+        open(Params->OutputPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (FileDescriptor >= 0) {
+      if (Source.Size && ftruncate(FileDescriptor, Source.Size) == 0) {
+        void *Mapping = mmap(0, Source.Size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, FileDescriptor, 0);
+        if (Mapping != MAP_FAILED) {
+          memcpy(Mapping, Source.Data, Source.Size);
+          IsWritten = (munmap(Mapping, Source.Size) == 0);
+        }
+      }
+      close(FileDescriptor);
+    }
+    EndTime(Context);
+
+    if (IsWritten) {
+      CountBytes(Context, Source.Size);
+    }
+    unlink(Params->OutputPath);
+  }
+}
+
+// NOTE(Lucas): F_NOCACHE is the closest macos has. The last chunk is padded
+// to the alignment and the file truncated back afterwards.
+static void WriteFile_Direct(test_context *Context, read_parameters *Params) {
+  static bool HasWarned;
+
+  while (IsTesting(Context)) {
+    buffer Source = Params->Source;
+    PrepareCaches(Params, &Source);
+
+    BeginTime(Context);
+    u64 Written = 0;
+#if __APPLE__
+    int FileDescriptor =
+        open(Params->OutputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (FileDescriptor >= 0 && fcntl(FileDescriptor, F_NOCACHE, 1) != 0) {
+      close(FileDescriptor);
+      FileDescriptor = -1;
+    }
+#else
+    int FileDescriptor =
+        open(Params->OutputPath, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+    if (FileDescriptor >= 0) {
+      while (Written < Source.Size) {
+        size_t Size = Min(Source.Size - Written, (u64)Params->ChunkSize);
+        size_t Padded = (Size + WRITE_TEST_DIRECT_ALIGNMENT - 1) &
+                        ~(size_t)(WRITE_TEST_DIRECT_ALIGNMENT - 1);
+        ssize_t Result = write(FileDescriptor, Source.Data + Written, Padded);
+        if (Result <= 0) {
+          break;
+        }
+        Written += Min((u64)Result, (u64)Size);
+      }
+      if (ftruncate(FileDescriptor, Source.Size) != 0) {
+        Written = 0;
+      }
+      close(FileDescriptor);
+    }
+    EndTime(Context);
+
+    if (Written == Source.Size) {
+      CountBytes(Context, Source.Size);
+    } else if (!HasWarned) {
+      fprintf(stderr, "Direct writes are not supported for %s (%s)\n",
+              Params->OutputPath, strerror(errno));
+      HasWarned = true;
+    }
+    unlink(Params->OutputPath);
+  }
+}